@@ -118,9 +118,11 @@ void raw_merkle(const unsigned char *coinbase, unsigned int len, unsigned char *
   memcpy(merkle, coinbase, len);
 }
 
-#define CL_SET_BLKARG(blkvar) status |= clSetKernelArg(*kernel, num++, sizeof(uint), (void *)&blk->blkvar)
-#define CL_SET_VARG(args, var) status |= clSetKernelArg(*kernel, num++, args * sizeof(uint), (void *)var)
-#define CL_SET_ARG_N(n, var) do { status |= clSetKernelArg(*kernel, n, sizeof(var), (void *)&var); } while (0)
+/* Through set_kernel_arg(): arguments that kept their value since the last
+ * pass are not set again */
+#define CL_SET_BLKARG(blkvar) status |= set_kernel_arg(clState, kernel, num++, sizeof(uint), (void *)&blk->blkvar)
+#define CL_SET_VARG(args, var) status |= set_kernel_arg(clState, kernel, num++, args * sizeof(uint), (void *)var)
+#define CL_SET_ARG_N(n, var) do { status |= set_kernel_arg(clState, kernel, n, sizeof(var), (void *)&var); } while (0)
 #define CL_SET_ARG_0(var) CL_SET_ARG_N(0, var)
 #define CL_SET_ARG(var) CL_SET_ARG_N(num++, var)
 #define CL_NEXTKERNEL_SET_ARG_N(n, var) do { kernel++; CL_SET_ARG_N(n, var); } while (0)
@@ -224,6 +226,33 @@ static void append_x13_compiler_options(struct _build_kernel_data *data, struct
   strcat(data->binary_filename, buf);
 }
 
+/* Uploads the work data unless CLbuffer0 already holds it, which is the
+ * case on every pass but the first of a work item.  The upload is from
+ * clState->cldata_sent, so on an in order queue it need not block: nothing
+ * changes that copy before the pass ends with clFinish().  With
+ * --mapped-buffers the data is copied straight into the mapped CLbuffer0,
+ * no kernel of the state runs while it is queued. */
+static cl_int write_clbuffer0(struct __clState *clState, const void *data, size_t size)
+{
+  cl_int status;
+
+  if (size == clState->cldata_sent_size && !memcmp(clState->cldata_sent, data, size))
+    return CL_SUCCESS;
+  if (size > sizeof(clState->cldata_sent))
+    return CL_INVALID_VALUE;
+
+  memcpy(clState->cldata_sent, data, size);
+  if (clState->input_map) {
+    memcpy(clState->input_map, data, size);
+    status = CL_SUCCESS;
+  }
+  else
+    status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, !clState->in_order, 0, size,
+      clState->cldata_sent, 0, NULL, NULL);
+  clState->cldata_sent_size = status == CL_SUCCESS ? size : 0;
+  return status;
+}
+
 static cl_int queue_scrypt_kernel(struct __clState *clState, struct _dev_blk_ctx *blk, __maybe_unused cl_uint threads)
 {
   unsigned char *midstate = blk->work->midstate;
@@ -234,7 +263,7 @@ static cl_int queue_scrypt_kernel(struct __clState *clState, struct _dev_blk_ctx
 
   le_target = *(cl_uint *)(blk->work->device_target + 28);
   memcpy(clState->cldata, blk->work->data, 80);
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 80, clState->cldata, 0, NULL, NULL);
+  status = write_clbuffer0(clState, clState->cldata, 80);
 
   CL_SET_ARG(clState->CLbuffer0);
   CL_SET_ARG(clState->outputBuffer);
@@ -259,7 +288,7 @@ static cl_int queue_neoscrypt_kernel(_clState *clState, dev_blk_ctx *blk, __mayb
    * The compiler will get rid of it anyway. */
   le_target = (cl_uint)le32toh(((uint32_t *)blk->work->/*device_*/target)[7]);
   memcpy(clState->cldata, blk->work->data, 80);
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 80, clState->cldata, 0, NULL, NULL);
+  status = write_clbuffer0(clState, clState->cldata, 80);
 
   CL_SET_ARG(clState->CLbuffer0);
   CL_SET_ARG(clState->outputBuffer);
@@ -284,7 +313,7 @@ static cl_int queue_credits_kernel(_clState *clState, dev_blk_ctx *blk, __maybe_
 
   memcpy(clState->cldata, blk->work->data, 168);
 //  flip168(clState->cldata, blk->work->data);
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 168, clState->cldata, 0, NULL, NULL);
+  status = write_clbuffer0(clState, clState->cldata, 168);
 
   CL_SET_ARG(clState->CLbuffer0);
   CL_SET_ARG(clState->outputBuffer);
@@ -309,7 +338,7 @@ static cl_int queue_yescrypt_kernel(_clState *clState, dev_blk_ctx *blk, __maybe
 
 //  memcpy(clState->cldata, blk->work->data, 80);
   flip80(clState->cldata, blk->work->data);
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 80, clState->cldata, 0, NULL, NULL);
+  status = write_clbuffer0(clState, clState->cldata, 80);
 
   CL_SET_ARG(clState->CLbuffer0);
   CL_SET_ARG(clState->outputBuffer);
@@ -334,7 +363,7 @@ static cl_int queue_yescrypt_multikernel(_clState *clState, dev_blk_ctx *blk, __
   le_target = (cl_uint)le32toh(((uint32_t *)blk->work->/*device_*/target)[7]);
   memcpy(clState->cldata, blk->work->data, 80);
 //  flip80(clState->cldata, blk->work->data);
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 80, clState->cldata, 0, NULL, NULL);
+  status = write_clbuffer0(clState, clState->cldata, 80);
 //pbkdf and initial sha
   kernel = &clState->kernel;
 
@@ -395,7 +424,7 @@ static cl_int queue_maxcoin_kernel(struct __clState *clState, struct _dev_blk_ct
   cl_int status = 0;
 
   flip80(clState->cldata, blk->work->data);
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 80, clState->cldata, 0, NULL, NULL);
+  status = write_clbuffer0(clState, clState->cldata, 80);
 
   CL_SET_ARG(clState->CLbuffer0);
   CL_SET_ARG(clState->outputBuffer);
@@ -412,7 +441,7 @@ static cl_int queue_sph_kernel(struct __clState *clState, struct _dev_blk_ctx *b
 
   le_target = *(cl_ulong *)(blk->work->device_target + 24);
   flip80(clState->cldata, blk->work->data);
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 80, clState->cldata, 0, NULL, NULL);
+  status = write_clbuffer0(clState, clState->cldata, 80);
 
   CL_SET_ARG(clState->CLbuffer0);
   CL_SET_ARG(clState->outputBuffer);
@@ -430,7 +459,7 @@ static cl_int queue_darkcoin_mod_kernel(struct __clState *clState, struct _dev_b
 
   le_target = *(cl_ulong *)(blk->work->device_target + 24);
   flip80(clState->cldata, blk->work->data);
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 80, clState->cldata, 0, NULL, NULL);
+  status = write_clbuffer0(clState, clState->cldata, 80);
 
   // blake - search
   kernel = &clState->kernel;
@@ -474,7 +503,7 @@ static cl_int queue_sibcoin_kernel(struct __clState *clState, struct _dev_blk_ct
 
   le_target = *(cl_ulong *)(blk->work->device_target + 24);
   flip80(clState->cldata, blk->work->data);
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 80, clState->cldata, 0, NULL, NULL);
+  status = write_clbuffer0(clState, clState->cldata, 80);
 
   // blake - search
   kernel = &clState->kernel;
@@ -525,7 +554,7 @@ static cl_int queue_tribus_kernel(struct __clState *clState, struct _dev_blk_ctx
   for (int i = 0; i < 3; i++)
     ((uint32_t*)clState->cldata)[32 + i] = swab32(data_end[i]);
 
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 128+16, clState->cldata, 0, NULL, NULL);
+  status = write_clbuffer0(clState, clState->cldata, 128+16);
 
   // jh80 + keccak - search()
   kernel = &clState->kernel;
@@ -551,7 +580,7 @@ static cl_int queue_veltor_kernel(struct __clState *clState, struct _dev_blk_ctx
 
   le_target = *(cl_ulong *)(blk->work->device_target + 24);
   flip80(clState->cldata, blk->work->data);
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 80, clState->cldata, 0, NULL, NULL);
+  status = write_clbuffer0(clState, clState->cldata, 80);
   // skein80 search()
   kernel = &clState->kernel;
   num = 0;
@@ -580,7 +609,7 @@ static cl_int queue_skein2_kernel(struct __clState *clState, struct _dev_blk_ctx
 
   le_target = *(cl_ulong *)(blk->work->device_target + 24);
   flip80(clState->cldata, blk->work->data);
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 80, clState->cldata, 0, NULL, NULL);
+  status = write_clbuffer0(clState, clState->cldata, 80);
   // skein80 search()
   kernel = &clState->kernel;
   num = 0;
@@ -605,7 +634,7 @@ static cl_int queue_skunk_kernel(struct __clState *clState, struct _dev_blk_ctx
 
   le_target = *(cl_ulong *)(blk->work->device_target + 24);
   flip80(clState->cldata, blk->work->data);
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 80, clState->cldata, 0, NULL, NULL);
+  status = write_clbuffer0(clState, clState->cldata, 80);
   // skein search()
   kernel = &clState->kernel;
   num = 0;
@@ -634,7 +663,7 @@ static cl_int queue_bitblock_kernel(struct __clState *clState, struct _dev_blk_c
 
   le_target = *(cl_ulong *)(blk->work->device_target + 24);
   flip80(clState->cldata, blk->work->data);
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 80, clState->cldata, 0, NULL, NULL);
+  status = write_clbuffer0(clState, clState->cldata, 80);
 
   // blake - search
   kernel = &clState->kernel;
@@ -686,7 +715,7 @@ static cl_int queue_bitblockold_kernel(struct __clState *clState, struct _dev_bl
 
   le_target = *(cl_ulong *)(blk->work->device_target + 24);
   flip80(clState->cldata, blk->work->data);
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 80, clState->cldata, 0, NULL, NULL);
+  status = write_clbuffer0(clState, clState->cldata, 80);
 
   // blake - search
   kernel = &clState->kernel;
@@ -731,7 +760,7 @@ static cl_int queue_marucoin_mod_kernel(struct __clState *clState, struct _dev_b
 
   le_target = *(cl_ulong *)(blk->work->device_target + 24);
   flip80(clState->cldata, blk->work->data);
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 80, clState->cldata, 0, NULL, NULL);
+  status = write_clbuffer0(clState, clState->cldata, 80);
 
   // blake - search
   kernel = &clState->kernel;
@@ -779,7 +808,7 @@ static cl_int queue_marucoin_mod_old_kernel(struct __clState *clState, struct _d
 
   le_target = *(cl_ulong *)(blk->work->device_target + 24);
   flip80(clState->cldata, blk->work->data);
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 80, clState->cldata, 0, NULL, NULL);
+  status = write_clbuffer0(clState, clState->cldata, 80);
 
   // blake - search
   kernel = &clState->kernel;
@@ -823,7 +852,7 @@ static cl_int queue_talkcoin_mod_kernel(struct __clState *clState, struct _dev_b
 
   le_target = *(cl_ulong *)(blk->work->device_target + 24);
   flip80(clState->cldata, blk->work->data);
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 80, clState->cldata, 0, NULL, NULL);
+  status = write_clbuffer0(clState, clState->cldata, 80);
 
   // blake - search
   kernel = &clState->kernel;
@@ -855,7 +884,7 @@ static cl_int queue_x14_kernel(struct __clState *clState, struct _dev_blk_ctx *b
 
   le_target = *(cl_ulong *)(blk->work->device_target + 24);
   flip80(clState->cldata, blk->work->data);
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 80, clState->cldata, 0, NULL, NULL);
+  status = write_clbuffer0(clState, clState->cldata, 80);
 
   // blake - search
   kernel = &clState->kernel;
@@ -905,7 +934,7 @@ static cl_int queue_x14_old_kernel(struct __clState *clState, struct _dev_blk_ct
 
   le_target = *(cl_ulong *)(blk->work->device_target + 24);
   flip80(clState->cldata, blk->work->data);
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 80, clState->cldata, 0, NULL, NULL);
+  status = write_clbuffer0(clState, clState->cldata, 80);
 
   // blake - search
   kernel = &clState->kernel;
@@ -949,7 +978,7 @@ static cl_int queue_fresh_kernel(struct __clState *clState, struct _dev_blk_ctx
 
   le_target = *(cl_ulong *)(blk->work->device_target + 24);
   flip80(clState->cldata, blk->work->data);
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 80, clState->cldata, 0, NULL, NULL);
+  status = write_clbuffer0(clState, clState->cldata, 80);
 
   // shavite 1 - search
   kernel = &clState->kernel;
@@ -980,7 +1009,7 @@ static cl_int queue_whirlcoin_kernel(struct __clState *clState, struct _dev_blk_
 
   le_target = *(cl_ulong *)(blk->work->device_target + 24);
   flip80(clState->cldata, blk->work->data);
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 80, clState->cldata, 0, NULL, NULL);
+  status = write_clbuffer0(clState, clState->cldata, 80);
 
   //clbuffer, hashes
   kernel = &clState->kernel;
@@ -1027,11 +1056,11 @@ static cl_int queue_whirlpoolx_kernel(struct __clState *clState, struct _dev_blk
     midblock[i] ^= ((uint64_t *)(clState->cldata))[i];
   }
 
-  status = clSetKernelArg(clState->kernel, 0, sizeof(cl_ulong8), (cl_ulong8 *)&midblock);
-  status |= clSetKernelArg(clState->kernel, 1, sizeof(cl_ulong), (void *)(((uint64_t *)clState->cldata) + 8));
-  status |= clSetKernelArg(clState->kernel, 2, sizeof(cl_ulong), (void *)(((uint64_t *)clState->cldata) + 9));
-  status |= clSetKernelArg(clState->kernel, 3, sizeof(cl_mem), (void *)&clState->outputBuffer);
-  status |= clSetKernelArg(clState->kernel, 4, sizeof(cl_ulong), (void *)&le_target);
+  status = set_kernel_arg(clState, &clState->kernel, 0, sizeof(cl_ulong8), (cl_ulong8 *)&midblock);
+  status |= set_kernel_arg(clState, &clState->kernel, 1, sizeof(cl_ulong), (void *)(((uint64_t *)clState->cldata) + 8));
+  status |= set_kernel_arg(clState, &clState->kernel, 2, sizeof(cl_ulong), (void *)(((uint64_t *)clState->cldata) + 9));
+  status |= set_kernel_arg(clState, &clState->kernel, 3, sizeof(cl_mem), (void *)&clState->outputBuffer);
+  status |= set_kernel_arg(clState, &clState->kernel, 4, sizeof(cl_ulong), (void *)&le_target);
 
   return status;
 }
@@ -1045,7 +1074,7 @@ static cl_int queue_lyra2re_kernel(struct __clState *clState, struct _dev_blk_ct
 
   le_target = *(cl_ulong *)(blk->work->device_target + 24);
   flip80(clState->cldata, blk->work->data);
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 80, clState->cldata, 0, NULL, NULL);
+  status = write_clbuffer0(clState, clState->cldata, 80);
 
   // blake - search
   kernel = &clState->kernel;
@@ -1090,7 +1119,7 @@ static cl_int queue_lyra2rev2_kernel(struct __clState *clState, struct _dev_blk_
   //  le_target = *(cl_uint *)(blk->work->device_target + 28);
   le_target = *(cl_ulong *)(blk->work->device_target + 24);
   flip80(clState->cldata, blk->work->data);
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 80, clState->cldata, 0, NULL, NULL);
+  status = write_clbuffer0(clState, clState->cldata, 80);
 
   // blake - search
   kernel = &clState->kernel;
@@ -1143,7 +1172,7 @@ static cl_int queue_pluck_kernel(_clState *clState, dev_blk_ctx *blk, __maybe_un
 
   le_target = (cl_uint)le32toh(((uint32_t *)blk->work->/*device_*/target)[7]);
   flip80(clState->cldata, blk->work->data);
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 80, clState->cldata, 0, NULL, NULL);
+  status = write_clbuffer0(clState, clState->cldata, 80);
 
   CL_SET_ARG(clState->CLbuffer0);
   CL_SET_ARG(clState->outputBuffer);
@@ -1162,7 +1191,7 @@ static cl_int queue_blake_kernel(_clState *clState, dev_blk_ctx *blk, __maybe_un
 
   le_target = *(cl_ulong *)(blk->work->device_target + 24);
   flip80(clState->cldata, blk->work->data);
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 80, clState->cldata, 0, NULL, NULL);
+  status = write_clbuffer0(clState, clState->cldata, 80);
 
   CL_SET_ARG(clState->outputBuffer);
   CL_SET_ARG(blk->work->blk.ctx_a);
@@ -1178,6 +1207,15 @@ static cl_int queue_blake_kernel(_clState *clState, dev_blk_ctx *blk, __maybe_un
   CL_SET_ARG(blk->work->blk.cty_b);
   CL_SET_ARG(blk->work->blk.cty_c);
 
+  if (clState->payload) {
+    uint32_t target[8];
+    int i;
+
+    for (i = 0; i < 8; i++)
+      target[i] = le32toh(((uint32_t *)blk->work->device_target)[i]);
+    CL_SET_VARG(8, target);
+  }
+
   return status;
 }
 
@@ -1235,7 +1273,7 @@ static cl_int queue_ethash_kernel(_clState *clState, dev_blk_ctx *blk, __maybe_u
   le_target = *(cl_ulong *)(blk->work->device_target + 24);
 
   // DO NOT flip80.
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 32, blk->work->data, 0, NULL, NULL);
+  status = write_clbuffer0(clState, blk->work->data, 32);
   if (clState->EpochNumber != blk->work->EpochNumber)
   {
     clState->EpochNumber = blk->work->EpochNumber;
@@ -1243,6 +1281,7 @@ static cl_int queue_ethash_kernel(_clState *clState, dev_blk_ctx *blk, __maybe_u
     cl_event DAGGenEvent;
 
     applog(LOG_INFO, "DAG being regenerated on %s", cgpu->name);
+    api_push_dag(cgpu, clState->EpochNumber, 0);
     if (clState->EthCache)
       clReleaseMemObject(clState->EthCache);
     if (clState->DAG)
@@ -1255,6 +1294,7 @@ static cl_int queue_ethash_kernel(_clState *clState, dev_blk_ctx *blk, __maybe_u
     }
 
     clState->EthCache = clCreateBuffer(clState->context, CL_MEM_READ_ONLY, CacheSize, NULL, &status);
+    forget_kernel_args(clState);
 
     int idx = blk->work->EpochNumber % 2;
     cg_ilock(&EthCacheLock[idx]);
@@ -1301,6 +1341,7 @@ static cl_int queue_ethash_kernel(_clState *clState, dev_blk_ctx *blk, __maybe_u
       status |= clEnqueueNDRangeKernel(clState->commandQueue, clState->GenerateDAG, 1, NULL, &items, NULL, 0, NULL, &DAGGenEvent);
       status |= clWaitForEvents(1, &DAGGenEvent);
       applog(LOG_INFO, "Generating DAG %s %2.0f%%", cgpu->name, ((double)(zero+items) / DAGItems) * 100);
+      api_push_dag(cgpu, clState->EpochNumber, ((double)(zero+items) / DAGItems) * 100);
     }
 
     // Last items..
@@ -1324,6 +1365,7 @@ static cl_int queue_ethash_kernel(_clState *clState, dev_blk_ctx *blk, __maybe_u
       return(status);
     }
     applog(LOG_NOTICE, "DAG ready on %s (%u MB)", cgpu->name, (unsigned) (DAGSize >> 20));
+    api_push_dag(cgpu, clState->EpochNumber, 100);
   }
 
   mutex_lock(&eth_nonce_lock);
@@ -1385,6 +1427,7 @@ static cl_int nightcap_generate_dag(_clState *clState, dev_blk_ctx *blk, cl_uint
 		uint32_t idx = epoch_number % 2;
 
 		applog(LOG_INFO, "DAG being regenerated on %s", cgpu->name);
+		api_push_dag(cgpu, epoch_number, 0);
 		if (clState->EthCache)
 			clReleaseMemObject(clState->EthCache);
 		if (clState->DAG)
@@ -1397,6 +1440,7 @@ static cl_int nightcap_generate_dag(_clState *clState, dev_blk_ctx *blk, cl_uint
 		}
 
 		clState->EthCache = clCreateBuffer(clState->context, CL_MEM_READ_ONLY, CacheSize, NULL, &status);
+		forget_kernel_args(clState);
 
 		// calc seed hash here
 		memset(seedhash, '\0', sizeof(seedhash));
@@ -1480,6 +1524,7 @@ static cl_int nightcap_generate_dag(_clState *clState, dev_blk_ctx *blk, cl_uint
 #endif
 
 			applog(LOG_INFO, "Generating DAG %s %2.0f%%", cgpu->name, ((double)(zero + items) / DAGItems) * 100);
+			api_push_dag(cgpu, epoch_number, ((double)(zero + items) / DAGItems) * 100);
 		}
 
 #ifdef DEBUG_NIGHTCAP_DAG
@@ -1551,6 +1596,7 @@ static cl_int nightcap_generate_dag(_clState *clState, dev_blk_ctx *blk, cl_uint
 				return(status);
 			}
 			applog(LOG_NOTICE, "DAG ready on %s (%u MB)", cgpu->name, (unsigned)(DAGSize >> 20));
+			api_push_dag(cgpu, epoch_number, 100);
 			//exit(0); // DEBUG
 		}
 	}
@@ -1621,7 +1667,7 @@ static cl_int queue_nightcap_kernel(_clState *clState, dev_blk_ctx *blk, __maybe
   }
 
   // Submit block header data
-  status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 80, work_data, 0, NULL, NULL);
+  status = write_clbuffer0(clState, work_data, 80);
 
   // Regenerate the dag if neccesary
   nightcap_generate_dag(clState, blk, height_number, epoch_number);
@@ -1807,7 +1853,7 @@ static cl_int queue_nightcap_split_kernel(_clState *clState, dev_blk_ctx *blk, _
 	}
 
 	// Submit block header data
-	status = clEnqueueWriteBuffer(clState->commandQueue, clState->CLbuffer0, true, 0, 80, work_data, 0, NULL, NULL);
+	status = write_clbuffer0(clState, work_data, 80);
 
 	// Regenerate the dag if neccesary
 	nightcap_generate_dag(clState, blk, height_number, epoch_number);
@@ -1886,7 +1932,7 @@ static cl_int queue_nightcap_split_kernel(_clState *clState, dev_blk_ctx *blk, _
 static algorithm_settings_t algos[] = {
   // kernels starting from this will have difficulty calculated by using litecoin algorithm
 #define A_SCRYPT(a) \
-  { a, ALGO_SCRYPT, "", 1, 65536, 65536, 0, 0, 0xFF, 0xFFFFFFFFULL, 0x0000ffffUL, 0, -1, CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, scrypt_regenhash, NULL, queue_scrypt_kernel, gen_hash, append_scrypt_compiler_options }
+  { a, ALGO_SCRYPT, "", 1, 65536, 65536, 0, 0, 0xFF, 0xFFFFFFFFULL, 0x0000ffffUL, 0, -1, CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, scrypt_regenhash, NULL, queue_scrypt_kernel, gen_hash, append_scrypt_compiler_options, scrypt_regenhash_batch }
   A_SCRYPT("ckolivas"),
   A_SCRYPT("alexkarnew"),
   A_SCRYPT("alexkarnold"),
@@ -1897,7 +1943,7 @@ static algorithm_settings_t algos[] = {
 #undef A_SCRYPT
 
 #define A_NEOSCRYPT(a) \
-  { a, ALGO_NEOSCRYPT, "", 1, 65536, 65536, 0, 0, 0xFF, 0xFFFF000000000000ULL, 0x0000ffffUL, 0, -1, CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, neoscrypt_regenhash, NULL, queue_neoscrypt_kernel, gen_hash, append_neoscrypt_compiler_options }
+  { a, ALGO_NEOSCRYPT, "", 1, 65536, 65536, 0, 0, 0xFF, 0xFFFF000000000000ULL, 0x0000ffffUL, 0, -1, CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, neoscrypt_regenhash, NULL, queue_neoscrypt_kernel, gen_hash, append_neoscrypt_compiler_options, neoscrypt_regenhash_batch }
   A_NEOSCRYPT("neoscrypt"),
 #undef A_NEOSCRYPT
 
@@ -1950,7 +1996,7 @@ static algorithm_settings_t algos[] = {
 
   { "darkcoin-mod", ALGO_X11, "", 1, 1, 1, 0, 0, 0xFF, 0xFFFFULL, 0x0000ffffUL, 10, 8 * 16 * 4194304, 0, darkcoin_regenhash, NULL, queue_darkcoin_mod_kernel, gen_hash, append_x11_compiler_options },
 
-  { "sibcoin-mod", ALGO_SIBCOIN, "", 1, 1, 1, 0, 0, 0xFF, 0xFFFFULL, 0x0000ffffUL, 11, 8 * 16 * 4194304, 0, sibcoin_regenhash, NULL, queue_sibcoin_kernel, gen_hash, append_x11_compiler_options },
+  { "sibcoin-mod", ALGO_SIBCOIN, "sibcoin", 1, 1, 1, 0, 0, 0xFF, 0xFFFFULL, 0x0000ffffUL, 11, 8 * 16 * 4194304, 0, sibcoin_regenhash, NULL, queue_sibcoin_kernel, gen_hash, append_x11_compiler_options },
 
   { "skein2", ALGO_SKEIN2, "", 1, 1, 1, 0, 0, 0xFF, 0xFFFFULL, 0x0000ffffUL, 1, 8 * 16 * 4194304, 0, skein2_regenhash, NULL, queue_skein2_kernel, gen_hash, append_x11_compiler_options },
 
@@ -1974,8 +2020,8 @@ static algorithm_settings_t algos[] = {
 
   { "fresh", ALGO_FRESH, "", 1, 256, 256, 0, 0, 0xFF, 0xFFFFULL, 0x0000ffffUL, 4, 4 * 16 * 4194304, 0, fresh_regenhash, NULL, queue_fresh_kernel, gen_hash, NULL },
 
-  { "lyra2re", ALGO_LYRA2RE, "", 1, 128, 128, 0, 0, 0xFF, 0xFFFFULL, 0x0000ffffUL, 4, 2 * 8 * 4194304, 0, lyra2re_regenhash, precalc_hash_blake256, queue_lyra2re_kernel, gen_hash, NULL },
-  { "lyra2rev2", ALGO_LYRA2REV2, "", 1, 256, 256, 0, 0, 0xFF, 0xFFFFULL, 0x0000ffffUL, 6, -1, CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, lyra2rev2_regenhash, precalc_hash_blake256, queue_lyra2rev2_kernel, gen_hash, append_neoscrypt_compiler_options },
+  { "lyra2re", ALGO_LYRA2RE, "", 1, 128, 128, 0, 0, 0xFF, 0xFFFFULL, 0x0000ffffUL, 4, 2 * 8 * 4194304, 0, lyra2re_regenhash, precalc_hash_blake256, queue_lyra2re_kernel, gen_hash, NULL, lyra2re_regenhash_batch },
+  { "lyra2rev2", ALGO_LYRA2REV2, "", 1, 256, 256, 0, 0, 0xFF, 0xFFFFULL, 0x0000ffffUL, 6, -1, CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, lyra2rev2_regenhash, precalc_hash_blake256, queue_lyra2rev2_kernel, gen_hash, append_neoscrypt_compiler_options, lyra2rev2_regenhash_batch },
 
   // kernels starting from this will have difficulty calculated by using fuguecoin algorithm
 #define A_FUGUE(a, b, c) \
@@ -2004,6 +2050,11 @@ static algorithm_settings_t algos[] = {
   { NULL, ALGO_UNK, "", 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL }
 };
 
+const char *get_algorithm_name(unsigned int index)
+{
+  return (index < sizeof(algos) / sizeof(algos[0])) ? algos[index].name : NULL;
+}
+
 void copy_algorithm_settings(algorithm_t* dest, const char* algo)
 {
   algorithm_settings_t* src;
@@ -2015,6 +2066,7 @@ void copy_algorithm_settings(algorithm_t* dest, const char* algo)
     {
       strcpy(dest->name, src->name);
       dest->kernelfile = src->kernelfile;
+      dest->variant = NULL;
       dest->type = src->type;
 
       dest->diff_multiplier1 = src->diff_multiplier1;
@@ -2033,6 +2085,7 @@ void copy_algorithm_settings(algorithm_t* dest, const char* algo)
       dest->queue_kernel = src->queue_kernel;
       dest->gen_hash = src->gen_hash;
       dest->set_compile_options = src->set_compile_options;
+      dest->regenhash_batch = src->regenhash_batch;
       break;
     }
   }
@@ -2045,6 +2098,116 @@ void copy_algorithm_settings(algorithm_t* dest, const char* algo)
   }
 }
 
+static const algorithm_settings_t *find_algorithm_settings(const char *name)
+{
+  algorithm_settings_t *src;
+
+  for (src = algos; src->name; src++)
+    if (strcasecmp(src->name, name) == 0)
+      return src;
+  return NULL;
+}
+
+static const char *settings_kernel(const algorithm_settings_t *src)
+{
+  return empty_string(src->kernelfile) ? src->name : src->kernelfile;
+}
+
+static bool same_cpu_hash(const algorithm_settings_t *a, const algorithm_settings_t *b)
+{
+  return a->type == b->type && a->regenhash == b->regenhash &&
+    a->precalc_hash == b->precalc_hash && a->gen_hash == b->gen_hash;
+}
+
+const char *get_algorithm_variant(const char *name, unsigned int index)
+{
+  const algorithm_settings_t *base = find_algorithm_settings(name), *src, *prev;
+
+  if (!base)
+    return NULL;
+
+  for (src = algos; src->name; src++) {
+    if (!same_cpu_hash(src, base))
+      continue;
+
+    // skip entries building the same kernel as an earlier one (e.g. cloverhash)
+    for (prev = algos; prev < src; prev++)
+      if (same_cpu_hash(prev, base) && !strcmp(settings_kernel(prev), settings_kernel(src)))
+        break;
+    if (prev < src)
+      continue;
+
+    if (!index--)
+      return src->name;
+  }
+
+  return NULL;
+}
+
+bool set_algorithm_variant(algorithm_t *algo, const char *variant)
+{
+  const algorithm_settings_t *src = find_algorithm_settings(variant);
+
+  if (!src)
+    return false;
+
+  algo->variant = src->name;
+  algo->xintensity_shift = src->xintensity_shift;
+  algo->intensity_shift = src->intensity_shift;
+  algo->found_idx = src->found_idx;
+  algo->n_extra_kernels = src->n_extra_kernels;
+  algo->rw_buffer_size = src->rw_buffer_size;
+  algo->cq_properties = src->cq_properties;
+  algo->queue_kernel = src->queue_kernel;
+  algo->set_compile_options = src->set_compile_options;
+  return true;
+}
+
+const char *get_algorithm_kernel(const algorithm_t *algo)
+{
+  const algorithm_settings_t *src;
+
+  if (!empty_string(algo->kernelfile))
+    return algo->kernelfile;
+  if (algo->variant && (src = find_algorithm_settings(algo->variant)))
+    return settings_kernel(src);
+  return algo->name;
+}
+
+/* Single kernel sources that loop over nonces when built with -D PERSISTENT,
+ * see kernel/persistent.cl */
+static const char *persistent_kernels[] = {
+  "blake256r14", "blake256r8", "vanilla", "decred", "maxcoin", "groestlcoin", NULL
+};
+
+bool has_persistent_kernel(const algorithm_t *algo)
+{
+  const char *kernel = get_algorithm_kernel(algo);
+  unsigned int i;
+
+  if (algo->n_extra_kernels)
+    return false;
+  for (i = 0; persistent_kernels[i]; i++)
+    if (!strcmp(kernel, persistent_kernels[i]))
+      return true;
+  return false;
+}
+
+static const char *payload_kernels[] = {
+  "blake256r14", "blake256r8", "vanilla", NULL
+};
+
+bool has_payload_kernel(const algorithm_t *algo)
+{
+  const char *kernel = get_algorithm_kernel(algo);
+  unsigned int i;
+
+  for (i = 0; payload_kernels[i]; i++)
+    if (!strcmp(kernel, payload_kernels[i]))
+      return true;
+  return false;
+}
+
 static const char *lookup_algorithm_alias(const char *lookup_alias, uint8_t *nfactor)
 {
 #define ALGO_ALIAS_NF(alias, name, nf) \
@@ -2076,8 +2239,8 @@ static const char *lookup_algorithm_alias(const char *lookup_alias, uint8_t *nfa
   ALGO_ALIAS("lyra2v2", "lyra2rev2");
   ALGO_ALIAS("blakecoin", "blake256r8");
   ALGO_ALIAS("blake", "blake256r14");
-  ALGO_ALIAS("sibcoin-mod", "sibcoin");
-  ALGO_ALIAS("sib", "sibcoin");
+  ALGO_ALIAS("sibcoin", "sibcoin-mod");
+  ALGO_ALIAS("sib", "sibcoin-mod");
   ALGO_ALIAS("doubleskein", "skein2");
   ALGO_ALIAS("woodcoin", "skein2");
   ALGO_ALIAS("skunkhash", "skunk");
@@ -68,6 +68,7 @@ typedef struct _algorithm_t {
   char     name[20]; /* Human-readable identifier */
   algorithm_type_t type; //algorithm type
   const char *kernelfile; /* alternate kernel file */
+  const char *variant; /* kernel variant picked by --kernel-autotune, NULL for the default */
   uint32_t n;        /* N (CPU/Memory tradeoff parameter) */
   uint8_t  nfactor;  /* Factor of N above (n = 2^nfactor) */
   double   diff_multiplier1;
@@ -86,6 +87,7 @@ typedef struct _algorithm_t {
   cl_int(*queue_kernel)(struct __clState *, struct _dev_blk_ctx *, cl_uint);
   void(*gen_hash)(const unsigned char *, unsigned int, unsigned char *);
   void(*set_compile_options)(struct _build_kernel_data *, struct cgpu_info *, struct _algorithm_t *);
+  void(*regenhash_batch)(struct work *, unsigned int); /* optional, hashes several works at once */
 } algorithm_t;
 
 typedef struct _algorithm_settings_t
@@ -109,11 +111,43 @@ typedef struct _algorithm_settings_t
 	cl_int   (*queue_kernel)(struct __clState *, struct _dev_blk_ctx *, cl_uint);
 	void     (*gen_hash)(const unsigned char *, unsigned int, unsigned char *);
 	void     (*set_compile_options)(build_kernel_data *, struct cgpu_info *, algorithm_t *);
+	void     (*regenhash_batch)(struct work *, unsigned int);
 } algorithm_settings_t;
 
+/* One CPU implementation of an algorithm's hash. Algorithms with vectorised
+ * code export a table of these, reference path first, so the CPU benchmark
+ * can time and cross-check every path the running CPU supports.
+ */
+typedef struct _cpu_hash_path_t {
+  const char *name;
+  unsigned int lanes; /* works hashed per call of the core */
+  bool(*available)(void);
+  void(*hash)(struct work *, unsigned int);
+} cpu_hash_path_t;
+
+/* Name of the index-th registered algorithm, NULL past the last one. */
+const char *get_algorithm_name(unsigned int index);
+
 /* Set default parameters based on name. */
 void set_algorithm(algorithm_t* algo, const char* name);
 
+/* Name of the index-th kernel variant that can mine algorithm name (itself
+ * included): the registered algorithms hashing the same way on the CPU with
+ * a different kernel, e.g. darkcoin and darkcoin-mod. NULL past the last one. */
+const char *get_algorithm_variant(const char *name, unsigned int index);
+
+/* Run algo with the kernel and kernel settings of variant, keeping its
+ * name, difficulty and CPU hash. Returns false if variant does not exist. */
+bool set_algorithm_variant(algorithm_t *algo, const char *variant);
+
+/* Kernel source file (without .cl) that algo builds. */
+const char *get_algorithm_kernel(const algorithm_t *algo);
+
+/* Whether the kernel of algo can be built for --persistent-kernel. */
+bool has_persistent_kernel(const algorithm_t *algo);
+/* Whether the kernel of algo can be built for --hash-payload. */
+bool has_payload_kernel(const algorithm_t *algo);
+
 /* Set to specific N factor. */
 void set_algorithm_nfactor(algorithm_t* algo, const uint8_t nfactor);
 
@@ -131,9 +131,11 @@ void ethash_regenhash(struct work *work)
 	LightEthash(work->hash, work->mixhash, work->data, (Node*) (EthCache[idx] + 64), work->EpochNumber, work->Nonce);
 	cg_runlock(&EthCacheLock[idx]);
 
-	char *DbgHash = bin2hex(work->hash, 32);
+	if (applog_enabled(LOG_DEBUG)) {
+		char *DbgHash = bin2hex(work->hash, 32);
 
-	applog(LOG_DEBUG, "Regenhash result: %s.", DbgHash);
-	applog(LOG_DEBUG, "Last ulong: 0x%016llX.", bswap_64(*((uint64_t *)(work->hash + 0))));
-	free(DbgHash);
+		applog(LOG_DEBUG, "Regenhash result: %s.", DbgHash);
+		applog(LOG_DEBUG, "Last ulong: 0x%016llX.", bswap_64(*((uint64_t *)(work->hash + 0))));
+		free(DbgHash);
+	}
 }
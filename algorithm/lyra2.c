@@ -24,6 +24,10 @@
 #include "lyra2.h"
 #include "sponge.h"
 
+//Largest matrix kept on the stack: Lyra2RE uses 8 x 8 blocks (6 KiB)
+#define LYRA2_STACK_BYTES 8192
+#define LYRA2_MATRIX_ALIGN 64
+
 /**
  * Executes Lyra2 based on the G function from Blake2b. This version supports salts and passwords
  * whose combined length is smaller than the size of the memory matrix, (i.e., (nRows x nCols x b) bits,
@@ -57,31 +61,34 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
     //==========================================================================/
 
     //========== Initializing the Memory Matrix and pointers to it =============//
-    //Tries to allocate enough space for the whole memory matrix
+    //The matrices used by Lyra2RE/Lyra2REv2 fit on the stack, larger ones are
+    //allocated.  Either way the matrix starts on a cache line.
 
     const int64_t ROW_LEN_INT64 = BLOCK_LEN_INT64 * nCols;
     const int64_t ROW_LEN_BYTES = ROW_LEN_INT64 * 8;
     // for Lyra2REv2, nCols = 4, v1 was using 8
     const int64_t BLOCK_LEN = (nCols == 4) ? BLOCK_LEN_BLAKE2_SAFE_INT64 : BLOCK_LEN_BLAKE2_SAFE_BYTES;
 
+    uint64_t stackMatrix[(LYRA2_STACK_BYTES + LYRA2_MATRIX_ALIGN) / 8];
+    void *allocated = NULL;
+    uint64_t *wholeMatrix;
+
     i = (int64_t) ((int64_t) nRows * (int64_t) ROW_LEN_BYTES);
-	uint64_t *wholeMatrix = (uint64_t*)malloc(i);
-    if (wholeMatrix == NULL) {
-      return -1;
+    if (i <= LYRA2_STACK_BYTES) {
+      wholeMatrix = stackMatrix;
+    } else {
+      allocated = malloc(i + LYRA2_MATRIX_ALIGN);
+      if (allocated == NULL) {
+        return -1;
+      }
+      wholeMatrix = (uint64_t*)allocated;
     }
+    wholeMatrix = (uint64_t*)(((uintptr_t)wholeMatrix + LYRA2_MATRIX_ALIGN - 1) & ~(uintptr_t)(LYRA2_MATRIX_ALIGN - 1));
 	memset(wholeMatrix, 0, i);
 
-    //Allocates pointers to each row of the matrix
-	uint64_t **memMatrix = (uint64_t**)malloc(nRows * sizeof (uint64_t*));
-    if (memMatrix == NULL) {
-      return -1;
-    }
-    //Places the pointers in the correct positions
-    uint64_t *ptrWord = wholeMatrix;
-    for (i = 0; i < nRows; i++) {
-      memMatrix[i] = ptrWord;
-      ptrWord += ROW_LEN_INT64;
-    }
+    //Row r of the matrix
+#define memMatrix(r) (wholeMatrix + (r) * ROW_LEN_INT64)
+    uint64_t *ptrWord;
     //==========================================================================/
 
     //============= Getting the password + salt + basil padded with 10*1 ===============//
@@ -124,10 +131,7 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
 
     //======================= Initializing the Sponge State ====================//
     //Sponge state: 16 uint64_t, BLOCK_LEN_INT64 words of them for the bitrate (b) and the remainder for the capacity (c)
-	uint64_t *state = (uint64_t*)malloc(16 * sizeof (uint64_t));
-    if (state == NULL) {
-      return -1;
-    }
+    uint64_t state[16];
     initState(state);
     //==========================================================================/
 
@@ -140,12 +144,12 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
     }
 
     //Initializes M[0] and M[1]
-    reducedSqueezeRow0(state, memMatrix[0], nCols); //The locally copied password is most likely overwritten here
-    reducedDuplexRow1(state, memMatrix[0], memMatrix[1], nCols);
+    reducedSqueezeRow0(state, memMatrix(0), nCols); //The locally copied password is most likely overwritten here
+    reducedDuplexRow1(state, memMatrix(0), memMatrix(1), nCols);
 
     do {
       //M[row] = rand; //M[row*] = M[row*] XOR rotW(rand)
-      reducedDuplexRowSetup(state, memMatrix[prev], memMatrix[rowa], memMatrix[row], nCols);
+      reducedDuplexRowSetup(state, memMatrix(prev), memMatrix(rowa), memMatrix(row), nCols);
 
 
       //updates the value of row* (deterministically picked during Setup))
@@ -178,7 +182,7 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
   	    //------------------------------------------------------------------------------------------
 
   	    //Performs a reduced-round duplexing operation over M[row*] XOR M[prev], updating both M[row*] and M[row]
-  	    reducedDuplexRow(state, memMatrix[prev], memMatrix[rowa], memMatrix[row], nCols);
+  	    reducedDuplexRow(state, memMatrix(prev), memMatrix(rowa), memMatrix(row), nCols);
 
   	    //update prev: it now points to the last row ever computed
   	    prev = row;
@@ -195,20 +199,180 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
 
     //============================ Wrap-up Phase ===============================//
     //Absorbs the last block of the memory matrix
-    absorbBlock(state, memMatrix[rowa]);
+    absorbBlock(state, memMatrix(rowa));
 
     //Squeezes the key
     squeeze(state, (unsigned char*)K, kLen);
     //==========================================================================/
 
     //========================= Freeing the memory =============================//
-    free(memMatrix);
-    free(wholeMatrix);
+#undef memMatrix
+    free(allocated);
 
-    //Wiping out the sponge's internal state before freeing it
+    //Wiping out the sponge's internal state
     memset(state, 0, 16 * sizeof (uint64_t));
-    free(state);
     //==========================================================================/
 
     return 0;
 }
+
+#ifdef USE_SIMD_X86
+/**
+ * Executes Lyra2 for four passwords and salts of the same lengths and with the
+ * same parameters, one per 64-bit lane of the AVX2 sponge (see sponge.c).  The
+ * output is the same as four calls to LYRA2().  Only the rows picked during the
+ * Wandering phase differ between the lanes; the memory matrix is interleaved
+ * word by word so everything else is plain vector loads and stores.
+ *
+ * The CPU must support AVX2, check with simd_have(SIMD_AVX2) first.
+ *
+ * @param K The four derived keys to be output by the algorithm
+ * @param pwd The four passwords
+ * @param salt The four salts
+ *
+ * @return 0 if the keys are generated correctly; -1 if there is an error (usually due to lack of memory for allocation)
+ */
+SIMD_TARGET("avx2")
+int LYRA2_4way(void *const K[4], uint64_t kLen, const void *const pwd[4], uint64_t pwdlen, const void *const salt[4], uint64_t saltlen, uint64_t timeCost, uint64_t nRows, uint64_t nCols) {
+
+    //============================= Basic variables ============================//
+    int64_t row = 2; //index of row to be processed
+    int64_t prev = 1; //index of prev (last row ever computed/modified)
+    int64_t rowa = 0; //index of row* (deterministically picked during Setup, so the same for all lanes)
+    int64_t tau; //Time Loop iterator
+    int64_t step = 1; //Visitation step (used during Setup and Wandering phases)
+    int64_t window = 2; //Visitation window (used to define which rows can be revisited during Setup)
+    int64_t gap = 1; //Modifier to the step, assuming the values 1 or -1
+    int64_t i; //auxiliary iteration counter
+    int l; //lane
+    uint64_t *rowaLanes[4]; //per-lane M[row*] (randomly picked while Wandering)
+    //==========================================================================/
+
+    //========== Initializing the Memory Matrix and pointers to it =============//
+    const int64_t ROW_LEN_INT64 = BLOCK_LEN_INT64 * nCols; //in vectors of four words
+    const int64_t ROW_LEN_BYTES = ROW_LEN_INT64 * 8;       //per lane
+    // for Lyra2REv2, nCols = 4, v1 was using 8
+    const int64_t BLOCK_LEN = (nCols == 4) ? BLOCK_LEN_BLAKE2_SAFE_INT64 : BLOCK_LEN_BLAKE2_SAFE_BYTES;
+
+    uint64_t stackMatrix[(4 * LYRA2_STACK_BYTES + LYRA2_MATRIX_ALIGN) / 8];
+    void *allocated = NULL;
+    __m256i *wholeMatrix;
+
+    i = (int64_t) ((int64_t) nRows * (int64_t) ROW_LEN_BYTES);
+    if (i <= LYRA2_STACK_BYTES) {
+      wholeMatrix = (__m256i*)stackMatrix;
+    } else {
+      allocated = malloc(4 * i + LYRA2_MATRIX_ALIGN);
+      if (allocated == NULL) {
+        return -1;
+      }
+      wholeMatrix = (__m256i*)allocated;
+    }
+    wholeMatrix = (__m256i*)(((uintptr_t)wholeMatrix + LYRA2_MATRIX_ALIGN - 1) & ~(uintptr_t)(LYRA2_MATRIX_ALIGN - 1));
+    memset(wholeMatrix, 0, 4 * i);
+
+    //Row r of the matrix
+#define memMatrix(r) (wholeMatrix + (r) * ROW_LEN_INT64)
+    //==========================================================================/
+
+    //============= Getting the password + salt + basil padded with 10*1 ===============//
+    //Each lane builds its input exactly as LYRA2() does, in its own quarter of the matrix
+    uint64_t nBlocksInput = ((saltlen + pwdlen + 6 * sizeof (uint64_t)) / BLOCK_LEN_BLAKE2_SAFE_BYTES) + 1;
+    for (l = 0; l < 4; l++) {
+      byte *ptrByte = (byte*) wholeMatrix + l * i;
+
+      memcpy(ptrByte, pwd[l], pwdlen);
+      ptrByte += pwdlen;
+      memcpy(ptrByte, salt[l], saltlen);
+      ptrByte += saltlen;
+      memcpy(ptrByte, &kLen, sizeof (uint64_t));
+      ptrByte += sizeof (uint64_t);
+      memcpy(ptrByte, &pwdlen, sizeof (uint64_t));
+      ptrByte += sizeof (uint64_t);
+      memcpy(ptrByte, &saltlen, sizeof (uint64_t));
+      ptrByte += sizeof (uint64_t);
+      memcpy(ptrByte, &timeCost, sizeof (uint64_t));
+      ptrByte += sizeof (uint64_t);
+      memcpy(ptrByte, &nRows, sizeof (uint64_t));
+      ptrByte += sizeof (uint64_t);
+      memcpy(ptrByte, &nCols, sizeof (uint64_t));
+      ptrByte += sizeof (uint64_t);
+
+      *ptrByte = 0x80;
+      ptrByte = (byte*) wholeMatrix + l * i + nBlocksInput * BLOCK_LEN_BLAKE2_SAFE_BYTES - 1;
+      *ptrByte ^= 0x01;
+    }
+    //==========================================================================/
+
+    //======================= Initializing the Sponge State ====================//
+    __m256i state[16];
+    initState_4way(state);
+    //==========================================================================/
+
+    //================================ Setup Phase =============================//
+    for (i = 0; i < nBlocksInput; i++) {
+      const uint64_t *lane = (const uint64_t*) wholeMatrix + i * BLOCK_LEN;
+      const int64_t quarter = nRows * ROW_LEN_INT64;
+      __m256i block[BLOCK_LEN_BLAKE2_SAFE_INT64];
+      int k;
+
+      for (k = 0; k < BLOCK_LEN_BLAKE2_SAFE_INT64; k++)
+        block[k] = _mm256_set_epi64x(lane[3 * quarter + k], lane[2 * quarter + k], lane[quarter + k], lane[k]);
+      absorbBlockBlake2Safe_4way(state, block);
+    }
+
+    //Initializes M[0] and M[1]
+    reducedSqueezeRow0_4way(state, memMatrix(0), nCols);
+    reducedDuplexRow1_4way(state, memMatrix(0), memMatrix(1), nCols);
+
+    do {
+      //M[row] = rand; //M[row*] = M[row*] XOR rotW(rand)
+      reducedDuplexRowSetup_4way(state, memMatrix(prev), memMatrix(rowa), memMatrix(row), nCols);
+
+      rowa = (rowa + step) & (window - 1);
+      prev = row;
+      row++;
+
+      if (rowa == 0) {
+        step = window + gap;
+        window *= 2;
+        gap = -gap;
+      }
+    } while (row < nRows);
+
+    for (l = 0; l < 4; l++)
+      rowaLanes[l] = (uint64_t*) memMatrix(rowa) + l;
+    //==========================================================================/
+
+    //============================ Wandering Phase =============================//
+    row = 0;
+    for (tau = 1; tau <= timeCost; tau++) {
+      step = (tau % 2 == 0) ? -1 : nRows / 2 - 1;
+      do {
+        ALIGN uint64_t word0[4];
+
+        //Selects a pseudorandom index row* for every lane
+        _mm256_store_si256((__m256i*)word0, state[0]);
+        for (l = 0; l < 4; l++)
+          rowaLanes[l] = (uint64_t*) memMatrix(word0[l] % nRows) + l;
+
+        reducedDuplexRow_4way(state, memMatrix(prev), rowaLanes, memMatrix(row), nCols);
+
+        prev = row;
+        row = (row + step) % nRows;
+      } while (row != 0);
+    }
+    //==========================================================================/
+
+    //============================ Wrap-up Phase ===============================//
+    absorbBlock_4way(state, rowaLanes);
+    squeeze_4way(state, K, kLen);
+    //==========================================================================/
+
+#undef memMatrix
+    free(allocated);
+    memset(state, 0, sizeof (state));
+
+    return 0;
+}
+#endif
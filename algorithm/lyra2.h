@@ -21,6 +21,7 @@
 #define LYRA2_H_
 
 #include <stdint.h>
+#include "algorithm/simd.h"
 
 typedef unsigned char byte;
 
@@ -38,5 +39,8 @@ typedef unsigned char byte;
 #endif
 
 int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *salt, uint64_t saltlen, uint64_t timeCost, uint64_t nRows, uint64_t nCols);
+#ifdef USE_SIMD_X86
+int LYRA2_4way(void *const K[4], uint64_t kLen, const void *const pwd[4], uint64_t pwdlen, const void *const salt[4], uint64_t saltlen, uint64_t timeCost, uint64_t nRows, uint64_t nCols);
+#endif
 
 #endif /* LYRA2_H_ */
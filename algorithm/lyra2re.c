@@ -37,6 +37,7 @@
 #include "sph/sph_skein.h"
 #include "sph/sph_keccak.h" 
 #include "lyra2.h"
+#include "algorithm/simd.h"
 
 /*
  * Encode a length len/4 vector of (uint32_t) into a length len vector of
@@ -52,14 +53,12 @@ be32enc_vect(uint32_t *dst, const uint32_t *src, uint32_t len)
 }
 
 
-void lyra2rehash(void *state, const void *input)
+/* Blake and Keccak: the password and salt passed to Lyra2 */
+static void lyra2rehash_pre(uint32_t hashB[8], const void *input)
 {
 	sph_blake256_context     ctx_blake;
-	sph_groestl256_context   ctx_groestl;
 	sph_keccak256_context    ctx_keccak;
-	sph_skein256_context     ctx_skein;
-
-	uint32_t hashA[8], hashB[8];
+	uint32_t hashA[8];
 
 	sph_blake256_set_rounds(14);
 
@@ -70,8 +69,14 @@ void lyra2rehash(void *state, const void *input)
 	sph_keccak256_init(&ctx_keccak);
 	sph_keccak256 (&ctx_keccak,hashA, 32);
 	sph_keccak256_close(&ctx_keccak, hashB);
+}
 
-	LYRA2(hashA, 32, hashB, 32, hashB, 32, 1, 8, 8);
+/* Skein and Groestl of the Lyra2 output */
+static void lyra2rehash_post(void *state, const uint32_t hashA[8])
+{
+	sph_groestl256_context   ctx_groestl;
+	sph_skein256_context     ctx_skein;
+	uint32_t hashB[8], hashC[8];
 
 	sph_skein256_init(&ctx_skein);
 	sph_skein256 (&ctx_skein, hashA, 32);
@@ -79,11 +84,40 @@ void lyra2rehash(void *state, const void *input)
 
 	sph_groestl256_init(&ctx_groestl);
 	sph_groestl256 (&ctx_groestl, hashB, 32);
-	sph_groestl256_close(&ctx_groestl, hashA);
+	sph_groestl256_close(&ctx_groestl, hashC);
 
-	memcpy(state, hashA, 32);
+	memcpy(state, hashC, 32);
 }
 
+void lyra2rehash(void *state, const void *input)
+{
+	uint32_t hashA[8], hashB[8];
+
+	lyra2rehash_pre(hashB, input);
+	LYRA2(hashA, 32, hashB, 32, hashB, 32, 1, 8, 8);
+	lyra2rehash_post(state, hashA);
+}
+
+#ifdef USE_SIMD_X86
+/* Four hashes at once, Lyra2 on the AVX2 4-way sponge */
+static void lyra2rehash_4way(void *const state[4], const void *const input[4])
+{
+	uint32_t hashA[4][8], hashB[4][8];
+	const void *pwd[4];
+	void *key[4];
+	int l;
+
+	for (l = 0; l < 4; l++) {
+		lyra2rehash_pre(hashB[l], input[l]);
+		pwd[l] = hashB[l];
+		key[l] = hashA[l];
+	}
+	LYRA2_4way(key, 32, pwd, 32, pwd, 32, 1, 8, 8);
+	for (l = 0; l < 4; l++)
+		lyra2rehash_post(state[l], hashA[l]);
+}
+#endif
+
 static const uint32_t diff1targ = 0x0000ffff;
 
 
@@ -109,15 +143,80 @@ int lyra2re_test(unsigned char *pdata, const unsigned char *ptarget, uint32_t no
 	return 1;
 }
 
-void lyra2re_regenhash(struct work *work)
+static void lyra2re_hash_c(struct work *works, unsigned int count)
 {
-        uint32_t data[20];
-        uint32_t *nonce = (uint32_t *)(work->data + 76);
-        uint32_t *ohash = (uint32_t *)(work->hash);
+	uint32_t data[20];
+	unsigned int i;
 
-        be32enc_vect(data, (const uint32_t *)work->data, 19);
-        data[19] = htobe32(*nonce);
-        lyra2rehash(ohash, data);
+	for (i = 0; i < count; i++) {
+		uint32_t *nonce = (uint32_t *)(works[i].data + 76);
+		uint32_t *ohash = (uint32_t *)(works[i].hash);
+
+		be32enc_vect(data, (const uint32_t *)works[i].data, 19);
+		data[19] = htobe32(*nonce);
+		lyra2rehash(ohash, data);
+	}
+}
+
+static bool lyra2re_have_c(void)
+{
+	return true;
+}
+
+#ifdef USE_SIMD_X86
+/* Groups of four works, the last one padded by repeating its final work */
+static void lyra2re_hash_4way(struct work *works, unsigned int count)
+{
+	uint32_t data[4][20];
+	const void *input[4];
+	void *ohash[4];
+	unsigned int base, l;
+
+	for (base = 0; base < count; base += 4) {
+		for (l = 0; l < 4; l++) {
+			struct work *work = &works[base + l < count ? base + l : count - 1];
+
+			be32enc_vect(data[l], (const uint32_t *)work->data, 19);
+			data[l][19] = htobe32(*(uint32_t *)(work->data + 76));
+			input[l] = data[l];
+			ohash[l] = work->hash;
+		}
+		lyra2rehash_4way(ohash, input);
+	}
+}
+
+static bool lyra2re_have_avx2(void)
+{
+	return simd_have(SIMD_AVX2);
+}
+#endif
+
+const cpu_hash_path_t lyra2re_hash_paths[] = {
+	{ "c", 1, lyra2re_have_c, lyra2re_hash_c },
+#ifdef USE_SIMD_X86
+	{ "avx2-4way", 4, lyra2re_have_avx2, lyra2re_hash_4way },
+#endif
+	{ NULL, 0, NULL, NULL }
+};
+
+void lyra2re_regenhash_batch(struct work *works, unsigned int count)
+{
+#ifdef USE_SIMD_X86
+	/* A padded group of four still beats three works one by one */
+	if (count >= 3 && lyra2re_have_avx2()) {
+		unsigned int n = count % 4 == 3 ? count : count & ~3U;
+
+		lyra2re_hash_4way(works, n);
+		works += n;
+		count -= n;
+	}
+#endif
+	lyra2re_hash_c(works, count);
+}
+
+void lyra2re_regenhash(struct work *work)
+{
+	lyra2re_hash_c(work, 1);
 }
 
 bool scanhash_lyra2re(struct thr_info *thr, const unsigned char __maybe_unused *pmidstate,
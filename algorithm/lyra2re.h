@@ -6,5 +6,9 @@
 extern int lyra2re_test(unsigned char *pdata, const unsigned char *ptarget,
 			uint32_t nonce);
 extern void lyra2re_regenhash(struct work *work);
+extern void lyra2re_regenhash_batch(struct work *works, unsigned int count);
+
+/* CPU implementations of lyra2re_regenhash(), reference first */
+extern const cpu_hash_path_t lyra2re_hash_paths[];
 
 #endif /* LYRA2RE_H */
@@ -39,6 +39,7 @@
 #include "sph/sph_bmw.h"
 #include "sph/sph_cubehash.h"
 #include "lyra2.h"
+#include "algorithm/simd.h"
 
 /*
  * Encode a length len/4 vector of (uint32_t) into a length len vector of
@@ -54,14 +55,13 @@ be32enc_vect(uint32_t *dst, const uint32_t *src, uint32_t len)
 }
 
 
-void lyra2rev2hash(void *state, const void *input)
+/* Blake, Keccak and CubeHash: the password and salt passed to Lyra2 */
+static void lyra2rev2hash_pre(uint32_t hashA[8], const void *input)
 {
 	sph_blake256_context     ctx_blake;
-	sph_bmw256_context       ctx_bmw;
 	sph_keccak256_context    ctx_keccak;
-	sph_skein256_context     ctx_skein;
 	sph_cubehash256_context  ctx_cube;
-	uint32_t hashA[8], hashB[8];
+	uint32_t hashB[8];
 
 	sph_blake256_set_rounds(14);
 
@@ -76,8 +76,15 @@ void lyra2rev2hash(void *state, const void *input)
 	sph_cubehash256_init(&ctx_cube);
 	sph_cubehash256(&ctx_cube, hashB, 32);
 	sph_cubehash256_close(&ctx_cube, hashA);
+}
 
-	LYRA2(hashB, 32, hashA, 32, hashA, 32, 1, 4, 4);
+/* Skein, CubeHash and BMW of the Lyra2 output */
+static void lyra2rev2hash_post(void *state, const uint32_t hashB[8])
+{
+	sph_bmw256_context       ctx_bmw;
+	sph_skein256_context     ctx_skein;
+	sph_cubehash256_context  ctx_cube;
+	uint32_t hashA[8], hashC[8];
 
 	sph_skein256_init(&ctx_skein);
 	sph_skein256 (&ctx_skein, hashB, 32);
@@ -85,10 +92,10 @@ void lyra2rev2hash(void *state, const void *input)
 
 	sph_cubehash256_init(&ctx_cube);
 	sph_cubehash256(&ctx_cube, hashA, 32);
-	sph_cubehash256_close(&ctx_cube, hashB);
+	sph_cubehash256_close(&ctx_cube, hashC);
 
 	sph_bmw256_init(&ctx_bmw);
-	sph_bmw256 (&ctx_bmw, hashB, 32);
+	sph_bmw256 (&ctx_bmw, hashC, 32);
 	sph_bmw256_close(&ctx_bmw, hashA);
 
 //printf("cpu hash %08x %08x %08x %08x\n",hashA[0],hashA[1],hashA[2],hashA[3]);
@@ -96,6 +103,35 @@ void lyra2rev2hash(void *state, const void *input)
 	memcpy(state, hashA, 32);
 }
 
+void lyra2rev2hash(void *state, const void *input)
+{
+	uint32_t hashA[8], hashB[8];
+
+	lyra2rev2hash_pre(hashA, input);
+	LYRA2(hashB, 32, hashA, 32, hashA, 32, 1, 4, 4);
+	lyra2rev2hash_post(state, hashB);
+}
+
+#ifdef USE_SIMD_X86
+/* Four hashes at once, Lyra2 on the AVX2 4-way sponge */
+static void lyra2rev2hash_4way(void *const state[4], const void *const input[4])
+{
+	uint32_t hashA[4][8], hashB[4][8];
+	const void *pwd[4];
+	void *key[4];
+	int l;
+
+	for (l = 0; l < 4; l++) {
+		lyra2rev2hash_pre(hashA[l], input[l]);
+		pwd[l] = hashA[l];
+		key[l] = hashB[l];
+	}
+	LYRA2_4way(key, 32, pwd, 32, pwd, 32, 1, 4, 4);
+	for (l = 0; l < 4; l++)
+		lyra2rev2hash_post(state[l], hashB[l]);
+}
+#endif
+
 static const uint32_t diff1targ = 0x0000ffff;
 
 
@@ -121,15 +157,80 @@ int lyra2rev2_test(unsigned char *pdata, const unsigned char *ptarget, uint32_t
 	return 1;
 }
 
-void lyra2rev2_regenhash(struct work *work)
+static void lyra2rev2_hash_c(struct work *works, unsigned int count)
 {
-        uint32_t data[20];
-        uint32_t *nonce = (uint32_t *)(work->data + 76);
-        uint32_t *ohash = (uint32_t *)(work->hash);
+	uint32_t data[20];
+	unsigned int i;
 
-        be32enc_vect(data, (const uint32_t *)work->data, 19);
-        data[19] = htobe32(*nonce);
-        lyra2rev2hash(ohash, data);
+	for (i = 0; i < count; i++) {
+		uint32_t *nonce = (uint32_t *)(works[i].data + 76);
+		uint32_t *ohash = (uint32_t *)(works[i].hash);
+
+		be32enc_vect(data, (const uint32_t *)works[i].data, 19);
+		data[19] = htobe32(*nonce);
+		lyra2rev2hash(ohash, data);
+	}
+}
+
+static bool lyra2rev2_have_c(void)
+{
+	return true;
+}
+
+#ifdef USE_SIMD_X86
+/* Groups of four works, the last one padded by repeating its final work */
+static void lyra2rev2_hash_4way(struct work *works, unsigned int count)
+{
+	uint32_t data[4][20];
+	const void *input[4];
+	void *ohash[4];
+	unsigned int base, l;
+
+	for (base = 0; base < count; base += 4) {
+		for (l = 0; l < 4; l++) {
+			struct work *work = &works[base + l < count ? base + l : count - 1];
+
+			be32enc_vect(data[l], (const uint32_t *)work->data, 19);
+			data[l][19] = htobe32(*(uint32_t *)(work->data + 76));
+			input[l] = data[l];
+			ohash[l] = work->hash;
+		}
+		lyra2rev2hash_4way(ohash, input);
+	}
+}
+
+static bool lyra2rev2_have_avx2(void)
+{
+	return simd_have(SIMD_AVX2);
+}
+#endif
+
+const cpu_hash_path_t lyra2rev2_hash_paths[] = {
+	{ "c", 1, lyra2rev2_have_c, lyra2rev2_hash_c },
+#ifdef USE_SIMD_X86
+	{ "avx2-4way", 4, lyra2rev2_have_avx2, lyra2rev2_hash_4way },
+#endif
+	{ NULL, 0, NULL, NULL }
+};
+
+void lyra2rev2_regenhash_batch(struct work *works, unsigned int count)
+{
+#ifdef USE_SIMD_X86
+	/* A padded group of four still beats three works one by one */
+	if (count >= 3 && lyra2rev2_have_avx2()) {
+		unsigned int n = count % 4 == 3 ? count : count & ~3U;
+
+		lyra2rev2_hash_4way(works, n);
+		works += n;
+		count -= n;
+	}
+#endif
+	lyra2rev2_hash_c(works, count);
+}
+
+void lyra2rev2_regenhash(struct work *work)
+{
+	lyra2rev2_hash_c(work, 1);
 }
 
 bool scanhash_lyra2rev2(struct thr_info *thr, const unsigned char __maybe_unused *pmidstate,
@@ -7,5 +7,9 @@
 extern int lyra2rev2_test(unsigned char *pdata, const unsigned char *ptarget,
 			uint32_t nonce);
 extern void lyra2rev2_regenhash(struct work *work);
+extern void lyra2rev2_regenhash_batch(struct work *works, unsigned int count);
+
+/* CPU implementations of lyra2rev2_regenhash(), reference first */
+extern const cpu_hash_path_t lyra2rev2_hash_paths[];
 
 #endif /* LYRA2REV2_H */
@@ -35,6 +35,7 @@
 #include <string.h>
 
 #include "neoscrypt.h"
+#include "algorithm/simd.h"
 
 #define SCRYPT_BLOCK_SIZE 64
 #define SCRYPT_HASH_BLOCK_SIZE 64
@@ -1288,122 +1289,820 @@ void neoscrypt(const uchar *password, uchar *output, uint profile) {
     free(stack);
 }
 
-void neoscrypt_regenhash(struct work *work)
-{
-	neoscrypt(work->data, work->hash, 0x80000620);
+/* Vectorised NeoScrypt for share verification.
+ *
+ * Only the profile used for mining (0x80000620: FastKDF-BLAKE2s,
+ * N = 128, r = 2, ChaCha20/20 and Salsa20/20) is covered; neoscrypt()
+ * above stays the reference for every profile.  The single lane path
+ * runs the ChaCha and Salsa SMix side by side, the interleaved paths
+ * compute 4 or 8 hashes at once with word k of every lane in vector k. */
+
+#define NEOSCRYPT_N      128
+#define NEOSCRYPT_WORDS  64    /* r * 2 * SCRYPT_BLOCK_SIZE / 4 */
+#define NEOSCRYPT_ROUNDS 20
+#define NEOSCRYPT_MAX_LANES 8
+
+#ifdef USE_SIMD_X86
+
+/* BLAKE2s parameter block word 0: 32 byte digest, 32 byte key,
+ * fanout 1, depth 1 */
+#define FASTKDF_PRF_PARAM 0x01012020U
+
+/* The FastKDF PRF of lanes lanes: BLAKE2s(in[l], key = key[l]), i.e. the
+ * zero padded key block followed by the 64 byte input as the last block */
+typedef void (*fastkdf_prf_t)(uint lanes, uchar *const in[], uchar *const key[], uint out[][8]);
+
+/* FastKDF of the mining profile (80 byte password, 32 iterations) for
+ * lanes independent inputs, the PRF being evaluated for all lanes at
+ * once; the bookkeeping is neoscrypt_fastkdf() per lane */
+static void neoscrypt_fastkdf_lanes(uint lanes, fastkdf_prf_t prf,
+  const uchar *const password[], const uchar *const salt[], uint salt_len,
+  uchar *const output[], uint output_len) {
+    const uint kdf_buf_size = FASTKDF_BUFFER_SIZE, password_len = 80, N = 32,
+      prf_input_size = BLAKE2S_BLOCK_SIZE, prf_key_size = BLAKE2S_KEY_SIZE,
+      prf_output_size = BLAKE2S_OUT_SIZE;
+    uchar buf[NEOSCRYPT_MAX_LANES][2 * FASTKDF_BUFFER_SIZE + BLAKE2S_BLOCK_SIZE + BLAKE2S_KEY_SIZE];
+    uchar *A[NEOSCRYPT_MAX_LANES], *B[NEOSCRYPT_MAX_LANES];
+    uint prf_output[NEOSCRYPT_MAX_LANES][8] __attribute__((aligned(32)));
+    uchar *prf_input[NEOSCRYPT_MAX_LANES], *prf_key[NEOSCRYPT_MAX_LANES];
+    uint bufptr[NEOSCRYPT_MAX_LANES];
+    uint a, b, i, j, l;
+
+    for(l = 0; l < lanes; l++) {
+        A[l] = buf[l];
+        B[l] = &A[l][kdf_buf_size + prf_input_size];
+
+        /* Initialise the password buffer */
+        a = kdf_buf_size / password_len;
+        for(i = 0; i < a; i++)
+          neoscrypt_copy(&A[l][i * password_len], password[l], password_len);
+        b = kdf_buf_size - a * password_len;
+        if(b)
+          neoscrypt_copy(&A[l][a * password_len], password[l], b);
+        neoscrypt_copy(&A[l][kdf_buf_size], password[l], prf_input_size);
+
+        /* Initialise the salt buffer */
+        a = kdf_buf_size / salt_len;
+        for(i = 0; i < a; i++)
+          neoscrypt_copy(&B[l][i * salt_len], salt[l], salt_len);
+        b = kdf_buf_size - a * salt_len;
+        if(b)
+          neoscrypt_copy(&B[l][a * salt_len], salt[l], b);
+        neoscrypt_copy(&B[l][kdf_buf_size], salt[l], prf_key_size);
+
+        bufptr[l] = 0;
+    }
+
+    /* The primary iteration */
+    for(i = 0; i < N; i++) {
+        for(l = 0; l < lanes; l++) {
+            prf_input[l] = &A[l][bufptr[l]];
+            prf_key[l] = &B[l][bufptr[l]];
+        }
+
+        prf(lanes, prf_input, prf_key, prf_output);
+
+        for(l = 0; l < lanes; l++) {
+            uchar *out = (uchar *) prf_output[l];
+            uint ptr;
+
+            for(j = 0, ptr = 0; j < prf_output_size; j++)
+              ptr += out[j];
+            ptr &= (kdf_buf_size - 1);
+            bufptr[l] = ptr;
+
+            neoscrypt_xor(&B[l][ptr], out, prf_output_size);
+
+            if(ptr < prf_key_size)
+              neoscrypt_copy(&B[l][kdf_buf_size + ptr], &B[l][ptr], MIN(prf_output_size, prf_key_size - ptr));
+
+            if((kdf_buf_size - ptr) < prf_output_size)
+              neoscrypt_copy(&B[l][0], &B[l][kdf_buf_size], prf_output_size - (kdf_buf_size - ptr));
+        }
+    }
+
+    /* Modify and copy into the output buffer */
+    for(l = 0; l < lanes; l++) {
+        a = kdf_buf_size - bufptr[l];
+        if(a >= output_len) {
+            neoscrypt_xor(&B[l][bufptr[l]], &A[l][0], output_len);
+            neoscrypt_copy(output[l], &B[l][bufptr[l]], output_len);
+        } else {
+            neoscrypt_xor(&B[l][bufptr[l]], &A[l][0], a);
+            neoscrypt_xor(&B[l][0], &A[l][a], output_len - a);
+            neoscrypt_copy(output[l], &B[l][bufptr[l]], a);
+            neoscrypt_copy(output[l] + a, &B[l][0], output_len - a);
+        }
+    }
 }
 
-#if (NEOSCRYPT_TEST)
+#define ROTR_SSE2(v, c) SIMD_ROTL_SSE2(v, 32 - (c))
+#define ROTR16_SSE2(v) _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xB1), 0xB1)
+
+/* BLAKE2s compression with the state held in rows */
+SIMD_TARGET("sse2")
+static void blake2s_compress_sse2(uint *h, const uint *m, uint t, uint f) {
+    __m128i row1, row2, row3, row4, buf;
+    const uint8_t *s;
+    uint r;
+
+    row1 = _mm_loadu_si128((const __m128i *) &h[0]);
+    row2 = _mm_loadu_si128((const __m128i *) &h[4]);
+    row3 = _mm_loadu_si128((const __m128i *) &blake2s_IV[0]);
+    row4 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) &blake2s_IV[4]), _mm_set_epi32(0, f, 0, t));
+
+#define G1_SSE2(b) \
+    row1 = _mm_add_epi32(_mm_add_epi32(row1, b), row2); \
+    row4 = ROTR16_SSE2(_mm_xor_si128(row4, row1)); \
+    row3 = _mm_add_epi32(row3, row4); \
+    row2 = ROTR_SSE2(_mm_xor_si128(row2, row3), 12)
+#define G2_SSE2(b) \
+    row1 = _mm_add_epi32(_mm_add_epi32(row1, b), row2); \
+    row4 = ROTR_SSE2(_mm_xor_si128(row4, row1), 8); \
+    row3 = _mm_add_epi32(row3, row4); \
+    row2 = ROTR_SSE2(_mm_xor_si128(row2, row3), 7)
+
+    for(r = 0; r < 10; r++) {
+        s = blake2s_sigma[r];
+
+        buf = _mm_set_epi32(m[s[6]], m[s[4]], m[s[2]], m[s[0]]);
+        G1_SSE2(buf);
+        buf = _mm_set_epi32(m[s[7]], m[s[5]], m[s[3]], m[s[1]]);
+        G2_SSE2(buf);
+
+        row2 = _mm_shuffle_epi32(row2, 0x39);
+        row3 = _mm_shuffle_epi32(row3, 0x4E);
+        row4 = _mm_shuffle_epi32(row4, 0x93);
+
+        buf = _mm_set_epi32(m[s[14]], m[s[12]], m[s[10]], m[s[8]]);
+        G1_SSE2(buf);
+        buf = _mm_set_epi32(m[s[15]], m[s[13]], m[s[11]], m[s[9]]);
+        G2_SSE2(buf);
+
+        row2 = _mm_shuffle_epi32(row2, 0x93);
+        row3 = _mm_shuffle_epi32(row3, 0x4E);
+        row4 = _mm_shuffle_epi32(row4, 0x39);
+    }
+#undef G1_SSE2
+#undef G2_SSE2
+
+    _mm_storeu_si128((__m128i *) &h[0], _mm_xor_si128(_mm_loadu_si128((const __m128i *) &h[0]), _mm_xor_si128(row1, row3)));
+    _mm_storeu_si128((__m128i *) &h[4], _mm_xor_si128(_mm_loadu_si128((const __m128i *) &h[4]), _mm_xor_si128(row2, row4)));
+}
 
-#include <stdio.h>
+static void neoscrypt_fastkdf_prf_sse2(uint lanes, uchar *const in[], uchar *const key[], uint out[][8]) {
+    uint m[16];
+    uint l, i;
 
-int main() {
-    uint prf_input_len = 64, prf_key_len = 32, prf_output_len = 32;
-    uint kdf_input_len = 80, kdf_output_len = 256, N = 32;
-    uint neoscrypt_output_len = 32;
-    uchar input[kdf_input_len], output[kdf_output_len];
+    for(l = 0; l < lanes; l++) {
+        for(i = 0; i < 8; i++)
+          out[l][i] = blake2s_IV[i];
+        out[l][0] ^= FASTKDF_PRF_PARAM;
+
+        neoscrypt_copy(m, key[l], BLAKE2S_KEY_SIZE);
+        neoscrypt_erase(&m[8], BLAKE2S_BLOCK_SIZE - BLAKE2S_KEY_SIZE);
+        blake2s_compress_sse2(out[l], m, BLAKE2S_BLOCK_SIZE, 0);
+        neoscrypt_copy(m, in[l], BLAKE2S_BLOCK_SIZE);
+        blake2s_compress_sse2(out[l], m, 2 * BLAKE2S_BLOCK_SIZE, ~0U);
+    }
+}
+
+/* Interleaved BLAKE2s: the message schedule is plain indexing of m[] */
+#define BLAKE2S_G_VEC(ADD, XOR, ROTR, r, i, a, b, c, d) \
+    a = ADD(ADD(a, b), m[blake2s_sigma[r][2*i+0]]); \
+    d = ROTR(XOR(d, a), 16); \
+    c = ADD(c, d); \
+    b = ROTR(XOR(b, c), 12); \
+    a = ADD(ADD(a, b), m[blake2s_sigma[r][2*i+1]]); \
+    d = ROTR(XOR(d, a), 8); \
+    c = ADD(c, d); \
+    b = ROTR(XOR(b, c), 7)
+
+#define BLAKE2S_ROUND_VEC(ADD, XOR, ROTR, r) \
+    BLAKE2S_G_VEC(ADD, XOR, ROTR, r, 0, v[ 0], v[ 4], v[ 8], v[12]); \
+    BLAKE2S_G_VEC(ADD, XOR, ROTR, r, 1, v[ 1], v[ 5], v[ 9], v[13]); \
+    BLAKE2S_G_VEC(ADD, XOR, ROTR, r, 2, v[ 2], v[ 6], v[10], v[14]); \
+    BLAKE2S_G_VEC(ADD, XOR, ROTR, r, 3, v[ 3], v[ 7], v[11], v[15]); \
+    BLAKE2S_G_VEC(ADD, XOR, ROTR, r, 4, v[ 0], v[ 5], v[10], v[15]); \
+    BLAKE2S_G_VEC(ADD, XOR, ROTR, r, 5, v[ 1], v[ 6], v[11], v[12]); \
+    BLAKE2S_G_VEC(ADD, XOR, ROTR, r, 6, v[ 2], v[ 7], v[ 8], v[13]); \
+    BLAKE2S_G_VEC(ADD, XOR, ROTR, r, 7, v[ 3], v[ 4], v[ 9], v[14])
+
+#define ROTR_4WAY(v, c) ((c) == 16 ? ROTR16_SSE2(v) : ROTR_SSE2(v, c))
+
+SIMD_TARGET("sse2")
+static void blake2s_compress_4way(__m128i *h, const __m128i *m, uint t, uint f) {
+    __m128i v[16];
     uint i;
-    ubool fail;
 
-    for(i = 0; i < kdf_input_len; i++) {
-        input[i] = i;
+    for(i = 0; i < 8; i++) {
+        v[i] = h[i];
+        v[i + 8] = _mm_set1_epi32(blake2s_IV[i]);
     }
+    v[12] = _mm_set1_epi32(blake2s_IV[4] ^ t);
+    v[14] = _mm_set1_epi32(blake2s_IV[6] ^ f);
 
-    neoscrypt_blake2s(input, prf_input_len, input, prf_key_len, output, prf_output_len);
+    for(i = 0; i < 10; i++) {
+        BLAKE2S_ROUND_VEC(_mm_add_epi32, _mm_xor_si128, ROTR_4WAY, i);
+    }
 
-    uchar blake2s_ref[32] = {
-        0x89, 0x75, 0xB0, 0x57, 0x7F, 0xD3, 0x55, 0x66,
-        0xD7, 0x50, 0xB3, 0x62, 0xB0, 0x89, 0x7A, 0x26,
-        0xC3, 0x99, 0x13, 0x6D, 0xF0, 0x7B, 0xAB, 0xAB,
-        0xBD, 0xE6, 0x20, 0x3F, 0xF2, 0x95, 0x4E, 0xD4 };
+    for(i = 0; i < 8; i++)
+      h[i] = _mm_xor_si128(h[i], _mm_xor_si128(v[i], v[i + 8]));
+}
 
-    for(i = 0, fail = 0; i < prf_output_len; i++) {
-        if(output[i] != blake2s_ref[i]) {
-            fail = 1;
-            break;
+SIMD_TARGET("sse2")
+static void neoscrypt_fastkdf_prf_4way(uint lanes, uchar *const in[], uchar *const key[], uint out[][8]) {
+    uint buf[4][16] __attribute__((aligned(16)));
+    __m128i h[8], m[16];
+    uint g, i, l;
+
+    for(i = 0; i < 8; i++)
+      h[i] = _mm_set1_epi32(blake2s_IV[i] ^ (i ? 0 : FASTKDF_PRF_PARAM));
+
+    for(l = 0; l < 4; l++) {
+        neoscrypt_copy(buf[l], key[l < lanes ? l : 0], BLAKE2S_KEY_SIZE);
+        neoscrypt_erase(&buf[l][8], BLAKE2S_BLOCK_SIZE - BLAKE2S_KEY_SIZE);
+    }
+    for(g = 0; g < 4; g++)
+      simd_load_4x4(&m[g * 4], &buf[0][g * 4], &buf[1][g * 4], &buf[2][g * 4], &buf[3][g * 4]);
+    blake2s_compress_4way(h, m, BLAKE2S_BLOCK_SIZE, 0);
+
+    for(l = 0; l < 4; l++)
+      neoscrypt_copy(buf[l], in[l < lanes ? l : 0], BLAKE2S_BLOCK_SIZE);
+    for(g = 0; g < 4; g++)
+      simd_load_4x4(&m[g * 4], &buf[0][g * 4], &buf[1][g * 4], &buf[2][g * 4], &buf[3][g * 4]);
+    blake2s_compress_4way(h, m, 2 * BLAKE2S_BLOCK_SIZE, ~0U);
+
+    for(g = 0; g < 2; g++)
+      simd_store_4x4(&h[g * 4], &buf[0][g * 4], &buf[1][g * 4], &buf[2][g * 4], &buf[3][g * 4]);
+    for(l = 0; l < lanes; l++)
+      neoscrypt_copy(out[l], buf[l], BLAKE2S_OUT_SIZE);
+}
+
+#define ROTR_AVX2(v, c) SIMD_ROTL_AVX2(v, 32 - (c))
+
+SIMD_TARGET("avx2")
+static void blake2s_compress_8way(__m256i *h, const __m256i *m, uint t, uint f) {
+    __m256i v[16];
+    uint i;
+
+    for(i = 0; i < 8; i++) {
+        v[i] = h[i];
+        v[i + 8] = _mm256_set1_epi32(blake2s_IV[i]);
+    }
+    v[12] = _mm256_set1_epi32(blake2s_IV[4] ^ t);
+    v[14] = _mm256_set1_epi32(blake2s_IV[6] ^ f);
+
+    for(i = 0; i < 10; i++) {
+        BLAKE2S_ROUND_VEC(_mm256_add_epi32, _mm256_xor_si256, ROTR_AVX2, i);
+    }
+
+    for(i = 0; i < 8; i++)
+      h[i] = _mm256_xor_si256(h[i], _mm256_xor_si256(v[i], v[i + 8]));
+}
+
+SIMD_TARGET("avx2")
+static void neoscrypt_fastkdf_prf_8way(uint lanes, uchar *const in[], uchar *const key[], uint out[][8]) {
+    uint buf[8][16] __attribute__((aligned(16)));
+    __m256i h[8], m[16];
+    void *p[8];
+    uint g, i, l;
+
+    for(i = 0; i < 8; i++)
+      h[i] = _mm256_set1_epi32(blake2s_IV[i] ^ (i ? 0 : FASTKDF_PRF_PARAM));
+
+    for(l = 0; l < 8; l++) {
+        neoscrypt_copy(buf[l], key[l < lanes ? l : 0], BLAKE2S_KEY_SIZE);
+        neoscrypt_erase(&buf[l][8], BLAKE2S_BLOCK_SIZE - BLAKE2S_KEY_SIZE);
+    }
+    for(g = 0; g < 4; g++) {
+        for(l = 0; l < 8; l++)
+          p[l] = &buf[l][g * 4];
+        simd_load_8x4(&m[g * 4], p);
+    }
+    blake2s_compress_8way(h, m, BLAKE2S_BLOCK_SIZE, 0);
+
+    for(l = 0; l < 8; l++)
+      neoscrypt_copy(buf[l], in[l < lanes ? l : 0], BLAKE2S_BLOCK_SIZE);
+    for(g = 0; g < 4; g++) {
+        for(l = 0; l < 8; l++)
+          p[l] = &buf[l][g * 4];
+        simd_load_8x4(&m[g * 4], p);
+    }
+    blake2s_compress_8way(h, m, 2 * BLAKE2S_BLOCK_SIZE, ~0U);
+
+    for(g = 0; g < 2; g++) {
+        for(l = 0; l < 8; l++)
+          p[l] = &buf[l][g * 4];
+        simd_store_8x4(&h[g * 4], p);
+    }
+    for(l = 0; l < lanes; l++)
+      neoscrypt_copy(out[l], buf[l], BLAKE2S_OUT_SIZE);
+}
+
+/* Single lane Salsa20 in the shuffled order of scrypt-sse (position i of a
+ * block holds word i * 5 % 16); X is converted once around the Salsa SMix
+ * by neoscrypt_tangle().  Word 0, used by integerify, stays in place. */
+static void neoscrypt_tangle(uint *X, uint blocks, ubool inverse) {
+    uint T[16];
+    uint b, i;
+
+    for(b = 0; b < blocks; b++, X += 16) {
+        neoscrypt_copy(T, X, SCRYPT_BLOCK_SIZE);
+        for(i = 0; i < 16; i++) {
+            if(inverse)
+              X[i * 5 % 16] = T[i];
+            else
+              X[i] = T[i * 5 % 16];
         }
     }
+}
 
-    if(fail) {
-        printf("BLAKE2s integrity test failed!\n");
-        return(1);
-    } else {
-        printf("BLAKE2s integrity test passed.\n");
+/* Single lane ChaCha20 double round on rows in natural order */
+#define CHACHA_COLUMNS_SSE2(X0, X1, X2, X3) \
+    X0 = _mm_add_epi32(X0, X1); X3 = ROTR16_SSE2(_mm_xor_si128(X3, X0)); \
+    X2 = _mm_add_epi32(X2, X3); X1 = SIMD_ROTL_SSE2(_mm_xor_si128(X1, X2), 12); \
+    X0 = _mm_add_epi32(X0, X1); X3 = SIMD_ROTL_SSE2(_mm_xor_si128(X3, X0), 8); \
+    X2 = _mm_add_epi32(X2, X3); X1 = SIMD_ROTL_SSE2(_mm_xor_si128(X1, X2), 7)
+
+#define CHACHA_DOUBLEROUND_SSE2(X0, X1, X2, X3) \
+    CHACHA_COLUMNS_SSE2(X0, X1, X2, X3); \
+    X1 = _mm_shuffle_epi32(X1, 0x39); \
+    X2 = _mm_shuffle_epi32(X2, 0x4E); \
+    X3 = _mm_shuffle_epi32(X3, 0x93); \
+    CHACHA_COLUMNS_SSE2(X0, X1, X2, X3); \
+    X1 = _mm_shuffle_epi32(X1, 0x93); \
+    X2 = _mm_shuffle_epi32(X2, 0x4E); \
+    X3 = _mm_shuffle_epi32(X3, 0x39)
+
+/* A single vectorised Salsa or ChaCha chain has too little parallelism to
+ * beat the scalar code, but the ChaCha SMix of Z and the Salsa SMix of X
+ * are independent: the block mixer runs both at once.  Block k of Z is
+ * Z[k * 4 .. k * 4 + 3], the same for X (r = 2). */
+SIMD_TARGET("sse2")
+static inline void neoscrypt_blkmix2_sse2(__m128i *Z, __m128i *X) {
+    __m128i Z0, Z1, Z2, Z3, X0, X1, X2, X3, T;
+    uint b, i, rounds;
+
+    for(b = 0; b < 4; b++) {
+        __m128i *BZ = &Z[b * 4], *BX = &X[b * 4];
+        const uint p = ((b + 3) & 3) * 4;
+
+        Z0 = BZ[0] = _mm_xor_si128(BZ[0], Z[p + 0]);
+        Z1 = BZ[1] = _mm_xor_si128(BZ[1], Z[p + 1]);
+        Z2 = BZ[2] = _mm_xor_si128(BZ[2], Z[p + 2]);
+        Z3 = BZ[3] = _mm_xor_si128(BZ[3], Z[p + 3]);
+        X0 = BX[0] = _mm_xor_si128(BX[0], X[p + 0]);
+        X1 = BX[1] = _mm_xor_si128(BX[1], X[p + 1]);
+        X2 = BX[2] = _mm_xor_si128(BX[2], X[p + 2]);
+        X3 = BX[3] = _mm_xor_si128(BX[3], X[p + 3]);
+
+        for(rounds = NEOSCRYPT_ROUNDS; rounds; rounds -= 2) {
+            CHACHA_DOUBLEROUND_SSE2(Z0, Z1, Z2, Z3);
+            SIMD_SALSA_DOUBLEROUND_SSE2(X0, X1, X2, X3);
+        }
+
+        BZ[0] = _mm_add_epi32(BZ[0], Z0);
+        BZ[1] = _mm_add_epi32(BZ[1], Z1);
+        BZ[2] = _mm_add_epi32(BZ[2], Z2);
+        BZ[3] = _mm_add_epi32(BZ[3], Z3);
+        BX[0] = _mm_add_epi32(BX[0], X0);
+        BX[1] = _mm_add_epi32(BX[1], X1);
+        BX[2] = _mm_add_epi32(BX[2], X2);
+        BX[3] = _mm_add_epi32(BX[3], X3);
     }
+    for(i = 0; i < 4; i++) {
+        T = Z[4 + i];
+        Z[4 + i] = Z[8 + i];
+        Z[8 + i] = T;
+        T = X[4 + i];
+        X[4 + i] = X[8 + i];
+        X[8 + i] = T;
+    }
+}
 
-    neoscrypt_fastkdf(input, kdf_input_len, input, kdf_input_len, N, output, kdf_output_len);
+/* Both SMix at once; V holds the Z rows followed by the X rows */
+SIMD_TARGET("sse2")
+static void neoscrypt_core_sse2(uint X[][NEOSCRYPT_WORDS], uint *scratch) {
+    __m128i *VZ = (__m128i *) scratch, *VX = VZ + NEOSCRYPT_N * 16;
+    __m128i Xv[16], Zv[16];
+    uint i, j, k;
+
+    for(k = 0; k < 16; k++)
+      Zv[k] = _mm_load_si128((const __m128i *) &X[0][k * 4]);
+    neoscrypt_tangle(X[0], 4, 0);
+    for(k = 0; k < 16; k++)
+      Xv[k] = _mm_load_si128((const __m128i *) &X[0][k * 4]);
+
+    for(i = 0; i < NEOSCRYPT_N; i++) {
+        for(k = 0; k < 16; k++) {
+            VZ[i * 16 + k] = Zv[k];
+            VX[i * 16 + k] = Xv[k];
+        }
+        neoscrypt_blkmix2_sse2(Zv, Xv);
+    }
+    for(i = 0; i < NEOSCRYPT_N; i++) {
+        j = (_mm_cvtsi128_si32(Zv[12]) & (NEOSCRYPT_N - 1)) * 16;
+        for(k = 0; k < 16; k++)
+          Zv[k] = _mm_xor_si128(Zv[k], VZ[j + k]);
+        j = (_mm_cvtsi128_si32(Xv[12]) & (NEOSCRYPT_N - 1)) * 16;
+        for(k = 0; k < 16; k++)
+          Xv[k] = _mm_xor_si128(Xv[k], VX[j + k]);
+        neoscrypt_blkmix2_sse2(Zv, Xv);
+    }
 
-    uchar fastkdf_ref[256] = {
-        0xCC, 0xBC, 0x19, 0x71, 0xEC, 0x44, 0xE3, 0x17,
-        0xB3, 0xC9, 0xDE, 0x16, 0x76, 0x02, 0x60, 0xB8,
-        0xE2, 0xD4, 0x79, 0xB6, 0x88, 0xCA, 0xB5, 0x4A,
-        0xCF, 0x6E, 0x0E, 0x9A, 0xAE, 0x48, 0x78, 0x12,
-        0xA1, 0x95, 0x1E, 0xE1, 0xD1, 0x0A, 0xC2, 0x94,
-        0x1F, 0x0A, 0x39, 0x73, 0xFE, 0xA4, 0xCD, 0x87,
-        0x4B, 0x38, 0x54, 0x72, 0xB5, 0x53, 0xC3, 0xEA,
-        0xC1, 0x26, 0x8D, 0xA7, 0xFF, 0x3F, 0xC1, 0x79,
-        0xA6, 0xFF, 0x96, 0x54, 0x29, 0x05, 0xC0, 0x22,
-        0x90, 0xDB, 0x53, 0x87, 0x2D, 0x29, 0x00, 0xA6,
-        0x14, 0x16, 0x38, 0x63, 0xDA, 0xBC, 0x0E, 0x99,
-        0x68, 0xB3, 0x98, 0x92, 0x42, 0xE3, 0xF6, 0xB4,
-        0x19, 0xE3, 0xE3, 0xF6, 0x8E, 0x67, 0x47, 0x7B,
-        0xB6, 0xFB, 0xEA, 0xCE, 0x6D, 0x0F, 0xAF, 0xF6,
-        0x19, 0x43, 0x8D, 0xF7, 0x3E, 0xB5, 0xFB, 0xA3,
-        0x64, 0x5E, 0xD2, 0x72, 0x80, 0x6B, 0x39, 0x93,
-        0xB7, 0x80, 0x04, 0xCB, 0xF5, 0xC2, 0x61, 0xB1,
-        0x90, 0x4E, 0x2B, 0x02, 0x57, 0x53, 0x77, 0x16,
-        0x6A, 0x52, 0xBD, 0xD1, 0x62, 0xEC, 0xA1, 0xCB,
-        0x89, 0x03, 0x29, 0xA2, 0x02, 0x5C, 0x9A, 0x62,
-        0x99, 0x44, 0x54, 0xEA, 0x44, 0x91, 0x27, 0x3A,
-        0x50, 0x82, 0x62, 0x03, 0x99, 0xB3, 0xFA, 0xF7,
-        0xD4, 0x13, 0x47, 0x61, 0xFB, 0x0A, 0xE7, 0x81,
-        0x61, 0x57, 0x58, 0x4C, 0x69, 0x4E, 0x67, 0x0A,
-        0xC1, 0x21, 0xA7, 0xD2, 0xF6, 0x6D, 0x2F, 0x10,
-        0x01, 0xFB, 0xA5, 0x47, 0x2C, 0xE5, 0x15, 0xD7,
-        0x6A, 0xEF, 0xC9, 0xE2, 0xC2, 0x88, 0xA2, 0x3B,
-        0x6C, 0x8D, 0xBB, 0x26, 0xE7, 0xC4, 0x15, 0xEC,
-        0x5E, 0x5D, 0x74, 0x79, 0xBD, 0x81, 0x35, 0xA1,
-        0x42, 0x27, 0xEB, 0x57, 0xCF, 0xF6, 0x2E, 0x51,
-        0x90, 0xFD, 0xD9, 0xE4, 0x53, 0x6E, 0x12, 0xA1,
-        0x99, 0x79, 0x4D, 0x29, 0x6F, 0x5B, 0x4D, 0x9A };
-
-    for(i = 0, fail = 0; i < kdf_output_len; i++) {
-        if(output[i] != fastkdf_ref[i]) {
-            fail = 1;
-            break;
+    for(k = 0; k < 16; k++)
+      _mm_store_si128((__m128i *) &X[0][k * 4], Xv[k]);
+    neoscrypt_tangle(X[0], 4, 1);
+    for(k = 0; k < 16; k++)
+      _mm_store_si128((__m128i *) &X[0][k * 4], _mm_xor_si128(_mm_load_si128((const __m128i *) &X[0][k * 4]), Zv[k]));
+}
+
+/* Interleaved mixers: B[k] holds word k of every lane */
+SIMD_TARGET("sse2")
+static inline void neoscrypt_blkmix_4way(__m128i *X, ubool chacha) {
+    __m128i x[16], T;
+    uint b, i, rounds;
+
+    for(b = 0; b < 4; b++) {
+        __m128i *B = &X[b * 16];
+        const __m128i *P = &X[((b + 3) & 3) * 16];
+
+        for(i = 0; i < 16; i++)
+          x[i] = B[i] = _mm_xor_si128(B[i], P[i]);
+        for(rounds = NEOSCRYPT_ROUNDS; rounds; rounds -= 2) {
+            if(chacha) {
+                SIMD_CHACHA_DOUBLEROUND(_mm_add_epi32, _mm_xor_si128, SIMD_ROTL_SSE2, x);
+            } else {
+                SIMD_SALSA_DOUBLEROUND(_mm_add_epi32, _mm_xor_si128, SIMD_ROTL_SSE2, x);
+            }
         }
+        for(i = 0; i < 16; i++)
+          B[i] = _mm_add_epi32(B[i], x[i]);
+    }
+    for(i = 0; i < 16; i++) {
+        T = X[16 + i];
+        X[16 + i] = X[32 + i];
+        X[32 + i] = T;
     }
+}
 
-    if(fail) {
-        printf("FastKDF integrity test failed!\n");
-        return(1);
-    } else {
-        printf("FastKDF integrity test passed.\n");
+/* V holds NEOSCRYPT_N rows of 16 vectors per lane, lane l at row l * N */
+SIMD_TARGET("sse2")
+static void neoscrypt_smix_4way(__m128i *X, __m128i *V, ubool chacha) {
+    __m128i T[4];
+    uint i, g, k, l;
+    uint j[4];
+
+    for(i = 0; i < NEOSCRYPT_N; i++) {
+        for(g = 0; g < 16; g++)
+          simd_store_4x4(&X[g * 4], &V[(0 * NEOSCRYPT_N + i) * 16 + g], &V[(1 * NEOSCRYPT_N + i) * 16 + g],
+            &V[(2 * NEOSCRYPT_N + i) * 16 + g], &V[(3 * NEOSCRYPT_N + i) * 16 + g]);
+        neoscrypt_blkmix_4way(X, chacha);
+    }
+    for(i = 0; i < NEOSCRYPT_N; i++) {
+        _mm_storeu_si128((__m128i *) j, X[48]);
+        for(l = 0; l < 4; l++)
+          j[l] = (l * NEOSCRYPT_N + (j[l] & (NEOSCRYPT_N - 1))) * 16;
+        for(g = 0; g < 16; g++) {
+            simd_load_4x4(T, &V[j[0] + g], &V[j[1] + g], &V[j[2] + g], &V[j[3] + g]);
+            for(k = 0; k < 4; k++)
+              X[g * 4 + k] = _mm_xor_si128(X[g * 4 + k], T[k]);
+        }
+        neoscrypt_blkmix_4way(X, chacha);
     }
+}
 
-    neoscrypt(input, output, 0x80000620);
+SIMD_TARGET("sse2")
+static void neoscrypt_core_4way(uint X[][NEOSCRYPT_WORDS], uint *scratch) {
+    __m128i *V = (__m128i *) scratch;
+    __m128i Xv[64], Zv[64];
+    uint g, k;
 
-    uchar neoscrypt_ref[32] = {
-        0x72, 0x58, 0x96, 0x1A, 0xFB, 0x33, 0xFD, 0x12,
-        0xD0, 0x0C, 0xAC, 0xB8, 0xD6, 0x3F, 0x4F, 0x4F,
-        0x52, 0xBB, 0x69, 0x17, 0x04, 0x38, 0x65, 0xDD,
-        0x24, 0xA0, 0x8F, 0x57, 0x88, 0x53, 0x12, 0x2D };
+    for(g = 0; g < 16; g++)
+      simd_load_4x4(&Xv[g * 4], &X[0][g * 4], &X[1][g * 4], &X[2][g * 4], &X[3][g * 4]);
+    for(k = 0; k < 64; k++)
+      Zv[k] = Xv[k];
 
-    for(i = 0, fail = 0; i < neoscrypt_output_len; i++) {
-        if(output[i] != neoscrypt_ref[i]) {
-            fail = 1;
-            break;
+    neoscrypt_smix_4way(Zv, V, 1);
+    neoscrypt_smix_4way(Xv, V, 0);
+
+    for(k = 0; k < 64; k++)
+      Xv[k] = _mm_xor_si128(Xv[k], Zv[k]);
+    for(g = 0; g < 16; g++)
+      simd_store_4x4(&Xv[g * 4], &X[0][g * 4], &X[1][g * 4], &X[2][g * 4], &X[3][g * 4]);
+}
+
+SIMD_TARGET("avx2")
+static inline void neoscrypt_blkmix_8way(__m256i *X, ubool chacha) {
+    __m256i x[16], T;
+    uint b, i, rounds;
+
+    for(b = 0; b < 4; b++) {
+        __m256i *B = &X[b * 16];
+        const __m256i *P = &X[((b + 3) & 3) * 16];
+
+        for(i = 0; i < 16; i++)
+          x[i] = B[i] = _mm256_xor_si256(B[i], P[i]);
+        for(rounds = NEOSCRYPT_ROUNDS; rounds; rounds -= 2) {
+            if(chacha) {
+                SIMD_CHACHA_DOUBLEROUND(_mm256_add_epi32, _mm256_xor_si256, SIMD_ROTL_AVX2, x);
+            } else {
+                SIMD_SALSA_DOUBLEROUND(_mm256_add_epi32, _mm256_xor_si256, SIMD_ROTL_AVX2, x);
+            }
         }
+        for(i = 0; i < 16; i++)
+          B[i] = _mm256_add_epi32(B[i], x[i]);
+    }
+    for(i = 0; i < 16; i++) {
+        T = X[16 + i];
+        X[16 + i] = X[32 + i];
+        X[32 + i] = T;
     }
+}
 
-    if(fail) {
-        printf("NeoScrypt integrity test failed!\n");
-        return(1);
-    } else {
-        printf("NeoScrypt integrity test passed.\n");
+SIMD_TARGET("avx2")
+static void neoscrypt_smix_8way(__m256i *X, __m128i *V, ubool chacha) {
+    __m256i T[4];
+    void *p[8];
+    uint i, g, k, l;
+    uint j[8];
+
+    for(i = 0; i < NEOSCRYPT_N; i++) {
+        for(g = 0; g < 16; g++) {
+            for(l = 0; l < 8; l++)
+              p[l] = &V[(l * NEOSCRYPT_N + i) * 16 + g];
+            simd_store_8x4(&X[g * 4], p);
+        }
+        neoscrypt_blkmix_8way(X, chacha);
+    }
+    for(i = 0; i < NEOSCRYPT_N; i++) {
+        _mm256_storeu_si256((__m256i *) j, X[48]);
+        for(l = 0; l < 8; l++)
+          j[l] = (l * NEOSCRYPT_N + (j[l] & (NEOSCRYPT_N - 1))) * 16;
+        for(g = 0; g < 16; g++) {
+            for(l = 0; l < 8; l++)
+              p[l] = &V[j[l] + g];
+            simd_load_8x4(T, p);
+            for(k = 0; k < 4; k++)
+              X[g * 4 + k] = _mm256_xor_si256(X[g * 4 + k], T[k]);
+        }
+        neoscrypt_blkmix_8way(X, chacha);
+    }
+}
+
+SIMD_TARGET("avx2")
+static void neoscrypt_core_8way(uint X[][NEOSCRYPT_WORDS], uint *scratch) {
+    __m128i *V = (__m128i *) scratch;
+    __m256i Xv[64], Zv[64];
+    void *p[8];
+    uint g, k, l;
+
+    for(g = 0; g < 16; g++) {
+        for(l = 0; l < 8; l++)
+          p[l] = &X[l][g * 4];
+        simd_load_8x4(&Xv[g * 4], p);
+    }
+    for(k = 0; k < 64; k++)
+      Zv[k] = Xv[k];
+
+    neoscrypt_smix_8way(Zv, V, 1);
+    neoscrypt_smix_8way(Xv, V, 0);
+
+    for(k = 0; k < 64; k++)
+      Xv[k] = _mm256_xor_si256(Xv[k], Zv[k]);
+    for(g = 0; g < 16; g++) {
+        for(l = 0; l < 8; l++)
+          p[l] = &X[l][g * 4];
+        simd_store_8x4(&Xv[g * 4], p);
+    }
+}
+
+static bool neoscrypt_have_sse2(void) {
+    return simd_have(SIMD_SSE2);
+}
+
+static bool neoscrypt_have_avx2(void) {
+    return simd_have(SIMD_AVX2);
+}
+
+typedef void (*neoscrypt_core_t)(uint X[][NEOSCRYPT_WORDS], uint *scratch);
+
+/* Hashes count works, lanes at a time; a short final group repeats its
+ * last work.  V needs max(lanes, 2) * N * 256 bytes, 64 byte aligned. */
+static void neoscrypt_hash_lanes(struct work *works, uint count, uint lanes,
+  neoscrypt_core_t core, fastkdf_prf_t prf, uint *V) {
+    uint X[NEOSCRYPT_MAX_LANES][NEOSCRYPT_WORDS] __attribute__((aligned(32)));
+    const uchar *password[NEOSCRYPT_MAX_LANES], *salt[NEOSCRYPT_MAX_LANES];
+    uchar *output[NEOSCRYPT_MAX_LANES];
+    uint base, l;
+
+    for(base = 0; base < count; base += lanes) {
+        for(l = 0; l < lanes; l++) {
+            uint w = base + l < count ? base + l : count - 1;
+
+            password[l] = works[w].data;
+            output[l] = (uchar *) X[l];
+        }
+        neoscrypt_fastkdf_lanes(lanes, prf, password, password, 80, output, NEOSCRYPT_WORDS * 4);
+
+        core(X, V);
+
+        for(l = 0; l < lanes; l++) {
+            salt[l] = (uchar *) X[l];
+            output[l] = works[base + l < count ? base + l : count - 1].hash;
+        }
+        /* Padding lanes write the hash of the repeated work again */
+        neoscrypt_fastkdf_lanes(lanes, prf, password, salt, NEOSCRYPT_WORDS * 4, output, 32);
     }
+}
+
+/* Scratchpad of rows * N blocks of 256 bytes */
+static void *neoscrypt_alloc_scratch(uint rows, uint **V) {
+    uchar *mem = (uchar *) malloc(rows * NEOSCRYPT_N * NEOSCRYPT_WORDS * 4 + 63);
+
+    if(unlikely(!mem))
+      return NULL;
+    *V = (uint *) (((uintptr_t) mem + 63) & ~(uintptr_t) 63);
+    return mem;
+}
+
+static void neoscrypt_hash_ref(struct work *works, unsigned int count);
+
+static void neoscrypt_hash_path(struct work *works, uint count, uint lanes, uint scratch_rows,
+  neoscrypt_core_t core, fastkdf_prf_t prf) {
+    uint *V;
+    void *mem = neoscrypt_alloc_scratch(scratch_rows, &V);
 
-    return(0);
+    if(unlikely(!mem)) {
+        neoscrypt_hash_ref(works, count);
+        return;
+    }
+    neoscrypt_hash_lanes(works, count, lanes, core, prf, V);
+    free(mem);
 }
 
-#endif
\ No newline at end of file
+static void neoscrypt_hash_sse2(struct work *works, unsigned int count) {
+    neoscrypt_hash_path(works, count, 1, 2, neoscrypt_core_sse2, neoscrypt_fastkdf_prf_sse2);
+}
+
+static void neoscrypt_hash_4way(struct work *works, unsigned int count) {
+    neoscrypt_hash_path(works, count, 4, 4, neoscrypt_core_4way, neoscrypt_fastkdf_prf_4way);
+}
+
+static void neoscrypt_hash_8way(struct work *works, unsigned int count) {
+    neoscrypt_hash_path(works, count, 8, 8, neoscrypt_core_8way, neoscrypt_fastkdf_prf_8way);
+}
+
+#endif /* USE_SIMD_X86 */
+
+static void neoscrypt_hash_ref(struct work *works, unsigned int count) {
+    uint i;
+
+    for(i = 0; i < count; i++)
+      neoscrypt(works[i].data, works[i].hash, 0x80000620);
+}
+
+static bool neoscrypt_have_c(void) {
+    return true;
+}
+
+const cpu_hash_path_t neoscrypt_hash_paths[] = {
+    { "c", 1, neoscrypt_have_c, neoscrypt_hash_ref },
+#ifdef USE_SIMD_X86
+    { "sse2", 1, neoscrypt_have_sse2, neoscrypt_hash_sse2 },
+    { "sse2-4way", 4, neoscrypt_have_sse2, neoscrypt_hash_4way },
+    { "avx2-8way", 8, neoscrypt_have_avx2, neoscrypt_hash_8way },
+#endif
+    { NULL, 0, NULL, NULL }
+};
+
+/* Hashes several nonces at once, as scrypt_regenhash_batch().  A group is
+ * only worth its padding from 5 works for 8 lanes and 4 works for 4 lanes,
+ * the side by side single lane core covers the rest. */
+void neoscrypt_regenhash_batch(struct work *works, unsigned int count) {
+#ifdef USE_SIMD_X86
+    uint *V;
+    void *mem;
+    ubool avx2;
+
+    if(neoscrypt_have_sse2()) {
+        avx2 = neoscrypt_have_avx2() && count > 4;
+        mem = neoscrypt_alloc_scratch(avx2 ? 8 : count >= 4 ? 4 : 2, &V);
+        if(likely(mem)) {
+            while(count) {
+                uint chunk;
+
+                if(avx2 && count > 4) {
+                    chunk = MIN(count, 8);
+                    neoscrypt_hash_lanes(works, chunk, 8, neoscrypt_core_8way, neoscrypt_fastkdf_prf_8way, V);
+                } else if(count >= 4) {
+                    chunk = 4;
+                    neoscrypt_hash_lanes(works, chunk, 4, neoscrypt_core_4way, neoscrypt_fastkdf_prf_4way, V);
+                } else {
+                    chunk = 1;
+                    neoscrypt_hash_lanes(works, chunk, 1, neoscrypt_core_sse2, neoscrypt_fastkdf_prf_sse2, V);
+                }
+                works += chunk;
+                count -= chunk;
+            }
+            free(mem);
+            return;
+        }
+    }
+#endif
+    neoscrypt_hash_ref(works, count);
+}
+
+void neoscrypt_regenhash(struct work *work)
+{
+    neoscrypt_regenhash_batch(work, 1);
+}
+
+/* Known answers for the input bytes 0, 1, ..., 79 */
+static const uchar blake2s_ref[32] = {
+    0x89, 0x75, 0xB0, 0x57, 0x7F, 0xD3, 0x55, 0x66,
+    0xD7, 0x50, 0xB3, 0x62, 0xB0, 0x89, 0x7A, 0x26,
+    0xC3, 0x99, 0x13, 0x6D, 0xF0, 0x7B, 0xAB, 0xAB,
+    0xBD, 0xE6, 0x20, 0x3F, 0xF2, 0x95, 0x4E, 0xD4 };
+
+static const uchar fastkdf_ref[256] = {
+    0xCC, 0xBC, 0x19, 0x71, 0xEC, 0x44, 0xE3, 0x17,
+    0xB3, 0xC9, 0xDE, 0x16, 0x76, 0x02, 0x60, 0xB8,
+    0xE2, 0xD4, 0x79, 0xB6, 0x88, 0xCA, 0xB5, 0x4A,
+    0xCF, 0x6E, 0x0E, 0x9A, 0xAE, 0x48, 0x78, 0x12,
+    0xA1, 0x95, 0x1E, 0xE1, 0xD1, 0x0A, 0xC2, 0x94,
+    0x1F, 0x0A, 0x39, 0x73, 0xFE, 0xA4, 0xCD, 0x87,
+    0x4B, 0x38, 0x54, 0x72, 0xB5, 0x53, 0xC3, 0xEA,
+    0xC1, 0x26, 0x8D, 0xA7, 0xFF, 0x3F, 0xC1, 0x79,
+    0xA6, 0xFF, 0x96, 0x54, 0x29, 0x05, 0xC0, 0x22,
+    0x90, 0xDB, 0x53, 0x87, 0x2D, 0x29, 0x00, 0xA6,
+    0x14, 0x16, 0x38, 0x63, 0xDA, 0xBC, 0x0E, 0x99,
+    0x68, 0xB3, 0x98, 0x92, 0x42, 0xE3, 0xF6, 0xB4,
+    0x19, 0xE3, 0xE3, 0xF6, 0x8E, 0x67, 0x47, 0x7B,
+    0xB6, 0xFB, 0xEA, 0xCE, 0x6D, 0x0F, 0xAF, 0xF6,
+    0x19, 0x43, 0x8D, 0xF7, 0x3E, 0xB5, 0xFB, 0xA3,
+    0x64, 0x5E, 0xD2, 0x72, 0x80, 0x6B, 0x39, 0x93,
+    0xB7, 0x80, 0x04, 0xCB, 0xF5, 0xC2, 0x61, 0xB1,
+    0x90, 0x4E, 0x2B, 0x02, 0x57, 0x53, 0x77, 0x16,
+    0x6A, 0x52, 0xBD, 0xD1, 0x62, 0xEC, 0xA1, 0xCB,
+    0x89, 0x03, 0x29, 0xA2, 0x02, 0x5C, 0x9A, 0x62,
+    0x99, 0x44, 0x54, 0xEA, 0x44, 0x91, 0x27, 0x3A,
+    0x50, 0x82, 0x62, 0x03, 0x99, 0xB3, 0xFA, 0xF7,
+    0xD4, 0x13, 0x47, 0x61, 0xFB, 0x0A, 0xE7, 0x81,
+    0x61, 0x57, 0x58, 0x4C, 0x69, 0x4E, 0x67, 0x0A,
+    0xC1, 0x21, 0xA7, 0xD2, 0xF6, 0x6D, 0x2F, 0x10,
+    0x01, 0xFB, 0xA5, 0x47, 0x2C, 0xE5, 0x15, 0xD7,
+    0x6A, 0xEF, 0xC9, 0xE2, 0xC2, 0x88, 0xA2, 0x3B,
+    0x6C, 0x8D, 0xBB, 0x26, 0xE7, 0xC4, 0x15, 0xEC,
+    0x5E, 0x5D, 0x74, 0x79, 0xBD, 0x81, 0x35, 0xA1,
+    0x42, 0x27, 0xEB, 0x57, 0xCF, 0xF6, 0x2E, 0x51,
+    0x90, 0xFD, 0xD9, 0xE4, 0x53, 0x6E, 0x12, 0xA1,
+    0x99, 0x79, 0x4D, 0x29, 0x6F, 0x5B, 0x4D, 0x9A };
+
+static const uchar neoscrypt_ref[32] = {
+    0x72, 0x58, 0x96, 0x1A, 0xFB, 0x33, 0xFD, 0x12,
+    0xD0, 0x0C, 0xAC, 0xB8, 0xD6, 0x3F, 0x4F, 0x4F,
+    0x52, 0xBB, 0x69, 0x17, 0x04, 0x38, 0x65, 0xDD,
+    0x24, 0xA0, 0x8F, 0x57, 0x88, 0x53, 0x12, 0x2D };
+
+/* The former NEOSCRYPT_TEST integrity tests: BLAKE2s, FastKDF and the
+ * mining profile through every hash path this CPU supports */
+bool neoscrypt_selftest(void) {
+    const uint prf_input_len = 64, prf_key_len = 32, prf_output_len = 32;
+    const uint kdf_input_len = 80, kdf_output_len = 256, N = 32;
+    uchar input[80], output[256];
+    const cpu_hash_path_t *path;
+    struct work work;
+    uint i;
+
+    for(i = 0; i < kdf_input_len; i++) {
+        input[i] = i;
+    }
+
+    neoscrypt_blake2s(input, prf_input_len, input, prf_key_len, output, prf_output_len);
+    if(memcmp(output, blake2s_ref, prf_output_len)) {
+        applog(LOG_ERR, "BLAKE2s integrity test failed!");
+        return(false);
+    }
+
+    neoscrypt_fastkdf(input, kdf_input_len, input, kdf_input_len, N, output, kdf_output_len);
+    if(memcmp(output, fastkdf_ref, kdf_output_len)) {
+        applog(LOG_ERR, "FastKDF integrity test failed!");
+        return(false);
+    }
+
+    for(path = neoscrypt_hash_paths; path->name; path++) {
+        if(!path->available())
+          continue;
+        memset(&work, 0, sizeof(work));
+        memcpy(work.data, input, kdf_input_len);
+        path->hash(&work, 1);
+        if(memcmp(work.hash, neoscrypt_ref, sizeof(neoscrypt_ref))) {
+            applog(LOG_ERR, "NeoScrypt integrity test failed for the %s path!", path->name);
+            return(false);
+        }
+    }
+
+    return(true);
+}
@@ -8,5 +8,10 @@
 /* These routines are always available. */
 extern void neoscrypt_regenhash(struct work *work);
 extern void neoscrypt(const unsigned char *input, unsigned char *output, unsigned int profile);
+extern void neoscrypt_regenhash_batch(struct work *works, unsigned int count);
+extern bool neoscrypt_selftest(void);
+
+/* CPU implementations of the mining profile, reference first */
+extern const cpu_hash_path_t neoscrypt_hash_paths[];
 
 #endif /* NEOSCRYPT_H */
\ No newline at end of file
@@ -274,8 +274,10 @@ void nightcap_regenhash(struct work *work)
 
 	memcpy(work->hash, res.result, 32);
 
-	char *DbgHash = bin2hex(work->hash, 32);
-	applog(LOG_DEBUG, "Regenhash result: %s.", DbgHash);
-	free(DbgHash);
+	if (applog_enabled(LOG_DEBUG)) {
+		char *DbgHash = bin2hex(work->hash, 32);
+		applog(LOG_DEBUG, "Regenhash result: %s.", DbgHash);
+		free(DbgHash);
+	}
 }
 
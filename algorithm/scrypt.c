@@ -29,6 +29,8 @@
 
 #include "config.h"
 #include "miner.h"
+#include "algorithm/scrypt.h"
+#include "algorithm/simd.h"
 
 #include <stdlib.h>
 #include <stdint.h>
@@ -196,8 +198,21 @@ static const uint32_t outerpad[8] = {0x80000000, 0, 0, 0, 0, 0, 0, 0x00000300};
  * Compute PBKDF2(passwd, salt, c, dkLen) using HMAC-SHA256 as the PRF, and
  * write the output to buf.  The value dkLen must be at most 32 * (2^32 - 1).
  */
+/*
+ * The 80 byte password is longer than the HMAC block, so the key is
+ * SHA256(passwd).  Its first 64 bytes do not contain the nonce and are the
+ * same for every nonce of a work item, so the state after that block is
+ * computed once by the caller and passed in as kstate.
+ */
+static inline void
+PBKDF2_SHA256_key_midstate(const uint32_t * passwd, uint32_t * kstate)
+{
+	SHA256_InitState(kstate);
+	SHA256_Transform(kstate, passwd, 1);
+}
+
 static inline void
-PBKDF2_SHA256_80_128(const uint32_t * passwd, uint32_t * buf)
+PBKDF2_SHA256_80_128(const uint32_t * passwd, const uint32_t * kstate, uint32_t * buf)
 {
 	SHA256_CTX PShictx, PShoctx;
 	uint32_t tstate[8];
@@ -208,8 +223,7 @@ PBKDF2_SHA256_80_128(const uint32_t * passwd, uint32_t * buf)
 	static const uint32_t innerpad[11] = {0x00000080, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xa0040000};
 
 	/* If Klen > 64, the key is really SHA256(K). */
-	SHA256_InitState(tstate);
-	SHA256_Transform(tstate, passwd, 1);
+	memcpy(tstate, kstate, 32);
 	memcpy(pad, passwd+16, 16);
 	memcpy(pad+4, passwdpad, 48);
 	SHA256_Transform(tstate, pad, 1);
@@ -251,7 +265,7 @@ PBKDF2_SHA256_80_128(const uint32_t * passwd, uint32_t * buf)
 
 
 static inline void
-PBKDF2_SHA256_80_128_32(const uint32_t * passwd, const uint32_t * salt, uint32_t *ostate)
+PBKDF2_SHA256_80_128_32(const uint32_t * passwd, const uint32_t * kstate, const uint32_t * salt, uint32_t *ostate)
 {
 	uint32_t tstate[8];
 	uint32_t ihash[8];
@@ -263,8 +277,7 @@ PBKDF2_SHA256_80_128_32(const uint32_t * passwd, const uint32_t * salt, uint32_t
 	static const uint32_t ihash_finalblk[16] = {0x00000001,0x80000000,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0x00000620};
 
 	/* If Klen > 64, the key is really SHA256(K). */
-	SHA256_InitState(tstate);
-	SHA256_Transform(tstate, passwd, 1);
+	memcpy(tstate, kstate, 32);
 	memcpy(pad, passwd+16, 16);
 	memcpy(pad+4, passwdpad, 48);
 	SHA256_Transform(tstate, pad, 1);
@@ -353,24 +366,17 @@ salsa20_8(uint32_t B[16], const uint32_t Bx[16])
 	B[15] += x15;
 }
 
-/* cpu and memory intensive function to transform a 80 byte buffer into
- * a 32 byte output.
- * scratchpad size needs to be at least (bytes):
- * 63 + (128 * r * p) + (256 * r + 64) + (128 * r * N)
- */
-static void scrypt_n_1_1_256_sp(const uint32_t* input, char* scratchpad, uint32_t *ostate, uint32_t n)
+
+/* The sequential memory-hard part of scrypt (ROMix with r = 1) on one
+ * 128 byte block X, using V as its n * 128 byte scratchpad. */
+static void scrypt_core(uint32_t X[32], uint32_t *V, uint32_t n)
 {
-	uint32_t * V;
-	uint32_t X[32];
 	uint32_t i;
 	uint32_t j;
 	uint32_t k;
 	uint64_t *p1, *p2;
 
 	p1 = (uint64_t *)X;
-	V = (uint32_t *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
-
-	PBKDF2_SHA256_80_128(input, X);
 
 	for (i = 0; i < n; i += 2) {
 		memcpy(&V[i * 32], X, 128);
@@ -400,21 +406,415 @@ static void scrypt_n_1_1_256_sp(const uint32_t* input, char* scratchpad, uint32_
 		salsa20_8(&X[0], &X[16]);
 		salsa20_8(&X[16], &X[0]);
 	}
+}
 
-	PBKDF2_SHA256_80_128_32(input, X, ostate);
+/* cpu and memory intensive function to transform a 80 byte buffer into
+ * a 32 byte output.
+ * scratchpad size needs to be at least (bytes):
+ * 63 + (128 * r * p) + (256 * r + 64) + (128 * r * N)
+ */
+static void scrypt_n_1_1_256_sp(const uint32_t* input, char* scratchpad, uint32_t *ostate, uint32_t n)
+{
+	uint32_t * V;
+	uint32_t X[32];
+	uint32_t kstate[8];
+
+	V = (uint32_t *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+
+	PBKDF2_SHA256_key_midstate(input, kstate);
+	PBKDF2_SHA256_80_128(input, kstate, X);
+	scrypt_core(X, V, n);
+	PBKDF2_SHA256_80_128_32(input, kstate, X, ostate);
 }
 
-void scrypt_regenhash(struct work *work)
+#ifdef USE_SIMD_X86
+/*
+ * SSE2 salsa20/8 on a single block, in the shuffled word order used by
+ * Colin Percival's scrypt-sse: position i of each 16 word block holds word
+ * i * 5 % 16, which turns the column and row steps into whole-register
+ * operations.  Word 0 stays in place so the index j is still X[16].
+ */
+static inline void scrypt_shuffle(uint32_t dst[32], const uint32_t src[32])
 {
-	uint32_t data[20];
-	char *scratchbuf;
-	uint32_t *nonce = (uint32_t *)(work->data + 76);
-	uint32_t *ohash = (uint32_t *)(work->hash);
+	int i, k;
+
+	for (k = 0; k < 32; k += 16)
+		for (i = 0; i < 16; i++)
+			dst[k + i] = src[k + i * 5 % 16];
+}
+
+static inline void scrypt_unshuffle(uint32_t dst[32], const uint32_t src[32])
+{
+	int i, k;
+
+	for (k = 0; k < 32; k += 16)
+		for (i = 0; i < 16; i++)
+			dst[k + i * 5 % 16] = src[k + i];
+}
+
+SIMD_TARGET("sse2")
+static inline void salsa20_8_sse2(__m128i B[4], const __m128i Bx[4])
+{
+	__m128i X0, X1, X2, X3;
+	int i;
+
+	X0 = B[0] = _mm_xor_si128(B[0], Bx[0]);
+	X1 = B[1] = _mm_xor_si128(B[1], Bx[1]);
+	X2 = B[2] = _mm_xor_si128(B[2], Bx[2]);
+	X3 = B[3] = _mm_xor_si128(B[3], Bx[3]);
+
+	for (i = 0; i < 8; i += 2)
+		SIMD_SALSA_DOUBLEROUND_SSE2(X0, X1, X2, X3);
+
+	B[0] = _mm_add_epi32(B[0], X0);
+	B[1] = _mm_add_epi32(B[1], X1);
+	B[2] = _mm_add_epi32(B[2], X2);
+	B[3] = _mm_add_epi32(B[3], X3);
+}
+
+SIMD_TARGET("sse2")
+static void scrypt_core_sse2(uint32_t X[][32], uint32_t *scratch, uint32_t n)
+{
+	__m128i *V = (__m128i *)scratch;
+	__m128i B[8];
+	uint32_t tmp[32];
+	uint32_t i, j, k;
+
+	scrypt_shuffle(tmp, X[0]);
+	for (k = 0; k < 8; k++)
+		B[k] = _mm_loadu_si128((const __m128i *)&tmp[k * 4]);
+
+	for (i = 0; i < n; i++) {
+		for (k = 0; k < 8; k++)
+			V[i * 8 + k] = B[k];
+
+		salsa20_8_sse2(&B[0], &B[4]);
+		salsa20_8_sse2(&B[4], &B[0]);
+	}
+	for (i = 0; i < n; i++) {
+		j = _mm_cvtsi128_si32(B[4]) & (n - 1);
+		for (k = 0; k < 8; k++)
+			B[k] = _mm_xor_si128(B[k], V[j * 8 + k]);
+
+		salsa20_8_sse2(&B[0], &B[4]);
+		salsa20_8_sse2(&B[4], &B[0]);
+	}
+
+	for (k = 0; k < 8; k++)
+		_mm_storeu_si128((__m128i *)&tmp[k * 4], B[k]);
+	scrypt_unshuffle(X[0], tmp);
+}
+
+/*
+ * Interleaved cores: vector element l carries nonce l, so register k holds
+ * word k of every lane and salsa20/8 is the scalar code on vectors.  Each
+ * lane keeps its own scratchpad (lane l at block offset l * n) because the
+ * lookup index differs per lane.
+ */
+SIMD_TARGET("sse2")
+static inline void salsa20_8_4way(__m128i B[16], const __m128i Bx[16])
+{
+	__m128i x[16];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		x[i] = B[i] = _mm_xor_si128(B[i], Bx[i]);
+	for (i = 0; i < 8; i += 2) {
+		SIMD_SALSA_DOUBLEROUND(_mm_add_epi32, _mm_xor_si128, SIMD_ROTL_SSE2, x);
+	}
+	for (i = 0; i < 16; i++)
+		B[i] = _mm_add_epi32(B[i], x[i]);
+}
+
+SIMD_TARGET("sse2")
+static void scrypt_core_4way(uint32_t X[][32], uint32_t *scratch, uint32_t n)
+{
+	__m128i *V = (__m128i *)scratch;
+	__m128i B[32], T[4];
+	uint32_t i, g, k, l;
+	uint32_t j[4];
+
+	for (g = 0; g < 8; g++)
+		simd_load_4x4(&B[g * 4], &X[0][g * 4], &X[1][g * 4], &X[2][g * 4], &X[3][g * 4]);
+
+	for (i = 0; i < n; i++) {
+		for (g = 0; g < 8; g++)
+			simd_store_4x4(&B[g * 4], &V[(0 * n + i) * 8 + g], &V[(1 * n + i) * 8 + g],
+				       &V[(2 * n + i) * 8 + g], &V[(3 * n + i) * 8 + g]);
+
+		salsa20_8_4way(&B[0], &B[16]);
+		salsa20_8_4way(&B[16], &B[0]);
+	}
+	for (i = 0; i < n; i++) {
+		_mm_storeu_si128((__m128i *)j, B[16]);
+		for (l = 0; l < 4; l++)
+			j[l] = (l * n + (j[l] & (n - 1))) * 8;
+		for (g = 0; g < 8; g++) {
+			simd_load_4x4(T, &V[j[0] + g], &V[j[1] + g], &V[j[2] + g], &V[j[3] + g]);
+			for (k = 0; k < 4; k++)
+				B[g * 4 + k] = _mm_xor_si128(B[g * 4 + k], T[k]);
+		}
+
+		salsa20_8_4way(&B[0], &B[16]);
+		salsa20_8_4way(&B[16], &B[0]);
+	}
+
+	for (g = 0; g < 8; g++)
+		simd_store_4x4(&B[g * 4], &X[0][g * 4], &X[1][g * 4], &X[2][g * 4], &X[3][g * 4]);
+}
+
+SIMD_TARGET("avx2")
+static inline void salsa20_8_8way(__m256i B[16], const __m256i Bx[16])
+{
+	__m256i x[16];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		x[i] = B[i] = _mm256_xor_si256(B[i], Bx[i]);
+	for (i = 0; i < 8; i += 2) {
+		SIMD_SALSA_DOUBLEROUND(_mm256_add_epi32, _mm256_xor_si256, SIMD_ROTL_AVX2, x);
+	}
+	for (i = 0; i < 16; i++)
+		B[i] = _mm256_add_epi32(B[i], x[i]);
+}
+
+SIMD_TARGET("avx2")
+static void scrypt_core_8way(uint32_t X[][32], uint32_t *scratch, uint32_t n)
+{
+	__m128i *V = (__m128i *)scratch;
+	__m256i B[32], T[4];
+	void *p[8];
+	uint32_t i, g, k, l;
+	uint32_t j[8];
+
+	for (g = 0; g < 8; g++) {
+		for (l = 0; l < 8; l++)
+			p[l] = &X[l][g * 4];
+		simd_load_8x4(&B[g * 4], p);
+	}
+
+	for (i = 0; i < n; i++) {
+		for (g = 0; g < 8; g++) {
+			for (l = 0; l < 8; l++)
+				p[l] = &V[(l * n + i) * 8 + g];
+			simd_store_8x4(&B[g * 4], p);
+		}
+
+		salsa20_8_8way(&B[0], &B[16]);
+		salsa20_8_8way(&B[16], &B[0]);
+	}
+	for (i = 0; i < n; i++) {
+		_mm256_storeu_si256((__m256i *)j, B[16]);
+		for (l = 0; l < 8; l++)
+			j[l] = (l * n + (j[l] & (n - 1))) * 8;
+		for (g = 0; g < 8; g++) {
+			for (l = 0; l < 8; l++)
+				p[l] = &V[j[l] + g];
+			simd_load_8x4(T, p);
+			for (k = 0; k < 4; k++)
+				B[g * 4 + k] = _mm256_xor_si256(B[g * 4 + k], T[k]);
+		}
+
+		salsa20_8_8way(&B[0], &B[16]);
+		salsa20_8_8way(&B[16], &B[0]);
+	}
+
+	for (g = 0; g < 8; g++) {
+		for (l = 0; l < 8; l++)
+			p[l] = &X[l][g * 4];
+		simd_store_8x4(&B[g * 4], p);
+	}
+}
+
+#define SCRYPT_MAX_LANES 8
+
+/* Big-endian password for one work item with its nonce in place */
+static inline void scrypt_input(const struct work *work, uint32_t data[20])
+{
+	const uint32_t *nonce = (const uint32_t *)(work->data + 76);
 
 	be32enc_vect(data, (const uint32_t *)work->data, 19);
 	data[19] = htobe32(*nonce);
+}
+
+/*
+ * Hashes count works with a core of the given width.  Works are expected to
+ * share the scrypt N of works[0]; a short final group is padded by
+ * repeating its last work.  V is the scratchpad for all lanes
+ * (lanes * n * 128 bytes, 64 byte aligned).
+ */
+static void scrypt_hash_lanes(struct work *works, unsigned int count, unsigned int lanes,
+			      void (*core)(uint32_t X[][32], uint32_t *V, uint32_t n), uint32_t *V)
+{
+	uint32_t data[SCRYPT_MAX_LANES][20];
+	uint32_t X[SCRYPT_MAX_LANES][32] __attribute__((aligned(32)));
+	uint32_t kstate[SCRYPT_MAX_LANES][8];
+	uint32_t n = works[0].pool->algorithm.n;
+	unsigned int base, l;
+
+	for (base = 0; base < count; base += lanes) {
+		for (l = 0; l < lanes; l++) {
+			unsigned int w = base + l < count ? base + l : count - 1;
+
+			scrypt_input(&works[w], data[l]);
+			/* Nonces of one work share the key midstate */
+			if (l && !memcmp(data[l], data[0], 64))
+				memcpy(kstate[l], kstate[0], 32);
+			else
+				PBKDF2_SHA256_key_midstate(data[l], kstate[l]);
+			PBKDF2_SHA256_80_128(data[l], kstate[l], X[l]);
+		}
+
+		core(X, V, n);
+
+		for (l = 0; l < lanes && base + l < count; l++) {
+			uint32_t *ohash = (uint32_t *)(works[base + l].hash);
+
+			PBKDF2_SHA256_80_128_32(data[l], kstate[l], X[l], ohash);
+			flip32(ohash, ohash);
+		}
+	}
+}
+
+static void *scrypt_alloc_scratch(uint32_t n, unsigned int lanes, uint32_t **V)
+{
+	void *mem = malloc((size_t)n * 128 * lanes + 63);
+
+	if (unlikely(!mem))
+		return NULL;
+	*V = (uint32_t *)(((uintptr_t)(mem) + 63) & ~ (uintptr_t)(63));
+	return mem;
+}
+
+static bool scrypt_hash_path(struct work *works, unsigned int count, unsigned int lanes,
+			     void (*core)(uint32_t X[][32], uint32_t *V, uint32_t n))
+{
+	uint32_t *V;
+	void *mem = scrypt_alloc_scratch(works[0].pool->algorithm.n, lanes, &V);
+
+	if (unlikely(!mem))
+		return false;
+	scrypt_hash_lanes(works, count, lanes, core, V);
+	free(mem);
+	return true;
+}
 
-	scratchbuf = (char *)alloca(work->pool->algorithm.n * 128 + 512);
-	scrypt_n_1_1_256_sp(data, scratchbuf, ohash, work->pool->algorithm.n);
-	flip32(ohash, ohash);
+static bool scrypt_have_sse2(void)
+{
+	return simd_have(SIMD_SSE2);
+}
+
+static bool scrypt_have_avx2(void)
+{
+	return simd_have(SIMD_AVX2);
+}
+#endif /* USE_SIMD_X86 */
+
+static void scrypt_hash_ref(struct work *works, unsigned int count)
+{
+	unsigned int i;
+	char *scratchbuf;
+
+	if (!count)
+		return;
+	/* one scratchpad for all works, alloca in the loop would pile them up */
+	scratchbuf = (char *)alloca(works[0].pool->algorithm.n * 128 + 512);
+	for (i = 0; i < count; i++) {
+		uint32_t data[20];
+		uint32_t *nonce = (uint32_t *)(works[i].data + 76);
+		uint32_t *ohash = (uint32_t *)(works[i].hash);
+
+		be32enc_vect(data, (const uint32_t *)works[i].data, 19);
+		data[19] = htobe32(*nonce);
+
+		scrypt_n_1_1_256_sp(data, scratchbuf, ohash, works[i].pool->algorithm.n);
+		flip32(ohash, ohash);
+	}
+}
+
+static bool scrypt_have_c(void)
+{
+	return true;
+}
+
+#ifdef USE_SIMD_X86
+static void scrypt_hash_sse2(struct work *works, unsigned int count)
+{
+	if (!scrypt_hash_path(works, count, 1, scrypt_core_sse2))
+		scrypt_hash_ref(works, count);
+}
+
+static void scrypt_hash_4way(struct work *works, unsigned int count)
+{
+	if (!scrypt_hash_path(works, count, 4, scrypt_core_4way))
+		scrypt_hash_ref(works, count);
+}
+
+static void scrypt_hash_8way(struct work *works, unsigned int count)
+{
+	if (!scrypt_hash_path(works, count, 8, scrypt_core_8way))
+		scrypt_hash_ref(works, count);
+}
+#endif
+
+const cpu_hash_path_t scrypt_hash_paths[] = {
+	{ "c", 1, scrypt_have_c, scrypt_hash_ref },
+#ifdef USE_SIMD_X86
+	{ "sse2", 1, scrypt_have_sse2, scrypt_hash_sse2 },
+	{ "sse2-4way", 4, scrypt_have_sse2, scrypt_hash_4way },
+	{ "avx2-8way", 8, scrypt_have_avx2, scrypt_hash_8way },
+#endif
+	{ NULL, 0, NULL, NULL }
+};
+
+/*
+ * Hashes several nonces of the same work, e.g. all results of one kernel
+ * run.  Each group goes to the widest core the CPU supports that it fills
+ * at least half way, leftovers to the single lane SSE2 code.
+ */
+void scrypt_regenhash_batch(struct work *works, unsigned int count)
+{
+#ifdef USE_SIMD_X86
+	uint32_t *V;
+	void *mem;
+	bool avx2;
+
+	if (scrypt_have_sse2() && count == 1) {
+		char *scratchbuf = (char *)alloca(works[0].pool->algorithm.n * 128 + 63);
+
+		V = (uint32_t *)(((uintptr_t)(scratchbuf) + 63) & ~ (uintptr_t)(63));
+		scrypt_hash_lanes(works, 1, 1, scrypt_core_sse2, V);
+		return;
+	}
+	if (scrypt_have_sse2()) {
+		avx2 = scrypt_have_avx2() && count > 4;
+		mem = scrypt_alloc_scratch(works[0].pool->algorithm.n, avx2 ? 8 : 4, &V);
+		if (likely(mem)) {
+			while (count) {
+				unsigned int chunk;
+
+				if (avx2 && count > 4) {
+					chunk = count < 8 ? count : 8;
+					scrypt_hash_lanes(works, chunk, 8, scrypt_core_8way, V);
+				} else if (count > 1) {
+					chunk = count < 4 ? count : 4;
+					scrypt_hash_lanes(works, chunk, 4, scrypt_core_4way, V);
+				} else {
+					chunk = 1;
+					scrypt_hash_lanes(works, chunk, 1, scrypt_core_sse2, V);
+				}
+				works += chunk;
+				count -= chunk;
+			}
+			free(mem);
+			return;
+		}
+	}
+#endif
+	scrypt_hash_ref(works, count);
+}
+
+void scrypt_regenhash(struct work *work)
+{
+	scrypt_regenhash_batch(work, 1);
 }
@@ -6,5 +6,8 @@
 /* extern int scrypt_test(unsigned char *pdata, const unsigned char *ptarget, */
 /* 			uint32_t nonce); */
 extern void scrypt_regenhash(struct work *work);
+extern void scrypt_regenhash_batch(struct work *works, unsigned int count);
+
+extern const cpu_hash_path_t scrypt_hash_paths[];
 
 #endif /* SCRYPT_H */
@@ -0,0 +1,174 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+/*
+ * Helpers for the vectorised CPU hash paths.
+ *
+ * The vector code is compiled with per-function target attributes so the
+ * binary still runs on any CPU of the base architecture; the path to use is
+ * picked at runtime with simd_have().  Compilers without target attribute
+ * support (and MSVC) only get the portable C implementations.
+ */
+
+#include <stdbool.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define USE_SIMD_X86 1
+/* target("vaes") needs a newer compiler than the rest */
+#if defined(__clang__) || __GNUC__ >= 8
+#define USE_SIMD_VAES 1
+#endif
+#endif
+
+#ifdef USE_SIMD_X86
+#include <immintrin.h>
+
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+
+/* Feature names as understood by __builtin_cpu_supports() */
+#define SIMD_SSE2   "sse2"
+#define SIMD_SSSE3  "ssse3"
+#define SIMD_SSE41  "sse4.1"
+#define SIMD_AVX2   "avx2"
+#define SIMD_AES    "aes"
+#define SIMD_VAES   "vaes"
+
+#define simd_have(feature) (__builtin_cpu_init(), __builtin_cpu_supports(feature))
+
+#define SIMD_ROTL_SSE2(v, c) _mm_or_si128(_mm_slli_epi32(v, c), _mm_srli_epi32(v, 32 - (c)))
+#define SIMD_ROTL_AVX2(v, c) _mm256_or_si256(_mm256_slli_epi32(v, c), _mm256_srli_epi32(v, 32 - (c)))
+
+#define SIMD_TRANSPOSE4_SSE2(a, b, c, d) do { \
+  __m128i t0 = _mm_unpacklo_epi32(a, b), t1 = _mm_unpacklo_epi32(c, d); \
+  __m128i t2 = _mm_unpackhi_epi32(a, b), t3 = _mm_unpackhi_epi32(c, d); \
+  a = _mm_unpacklo_epi64(t0, t1); \
+  b = _mm_unpackhi_epi64(t0, t1); \
+  c = _mm_unpacklo_epi64(t2, t3); \
+  d = _mm_unpackhi_epi64(t2, t3); \
+} while (0)
+
+/*
+ * Interleaved lanes: several independent hashes are computed at once with
+ * 32-bit word k of every lane in vector k.  The helpers below move four
+ * consecutive words between the per-lane memory at p[l] (16 byte aligned)
+ * and four interleaved vectors.
+ */
+SIMD_TARGET("sse2")
+static inline void simd_load_4x4(__m128i B[4], const void *p0, const void *p1, const void *p2, const void *p3)
+{
+  B[0] = _mm_load_si128((const __m128i *)p0);
+  B[1] = _mm_load_si128((const __m128i *)p1);
+  B[2] = _mm_load_si128((const __m128i *)p2);
+  B[3] = _mm_load_si128((const __m128i *)p3);
+  SIMD_TRANSPOSE4_SSE2(B[0], B[1], B[2], B[3]);
+}
+
+SIMD_TARGET("sse2")
+static inline void simd_store_4x4(const __m128i B[4], void *p0, void *p1, void *p2, void *p3)
+{
+  __m128i a = B[0], b = B[1], c = B[2], d = B[3];
+
+  SIMD_TRANSPOSE4_SSE2(a, b, c, d);
+  _mm_store_si128((__m128i *)p0, a);
+  _mm_store_si128((__m128i *)p1, b);
+  _mm_store_si128((__m128i *)p2, c);
+  _mm_store_si128((__m128i *)p3, d);
+}
+
+/* Eight lanes: lanes 0-3 in the low, lanes 4-7 in the high 128 bits */
+SIMD_TARGET("avx2")
+static inline void simd_load_8x4(__m256i B[4], void *const p[8])
+{
+  __m128i lo[4], hi[4];
+  int k;
+
+  simd_load_4x4(lo, p[0], p[1], p[2], p[3]);
+  simd_load_4x4(hi, p[4], p[5], p[6], p[7]);
+  for (k = 0; k < 4; k++)
+    B[k] = _mm256_inserti128_si256(_mm256_castsi128_si256(lo[k]), hi[k], 1);
+}
+
+SIMD_TARGET("avx2")
+static inline void simd_store_8x4(const __m256i B[4], void *const p[8])
+{
+  __m128i lo[4], hi[4];
+  int k;
+
+  for (k = 0; k < 4; k++) {
+    lo[k] = _mm256_castsi256_si128(B[k]);
+    hi[k] = _mm256_extracti128_si256(B[k], 1);
+  }
+  simd_store_4x4(lo, p[0], p[1], p[2], p[3]);
+  simd_store_4x4(hi, p[4], p[5], p[6], p[7]);
+}
+
+/*
+ * Salsa20 double round of one block kept in the shuffled order of
+ * scrypt-sse: X0..X3 hold words (0,5,10,15), (4,9,14,3), (8,13,2,7) and
+ * (12,1,6,11), so the rows become columns after a rotation of X1..X3.
+ */
+#define SIMD_SALSA_ARX_SSE2(out, a, b, c) do { \
+  __m128i t_ = _mm_add_epi32(a, b); \
+  out = _mm_xor_si128(out, _mm_slli_epi32(t_, c)); \
+  out = _mm_xor_si128(out, _mm_srli_epi32(t_, 32 - (c))); \
+} while (0)
+
+#define SIMD_SALSA_DOUBLEROUND_SSE2(X0, X1, X2, X3) do { \
+  SIMD_SALSA_ARX_SSE2(X1, X0, X3, 7); \
+  SIMD_SALSA_ARX_SSE2(X2, X1, X0, 9); \
+  SIMD_SALSA_ARX_SSE2(X3, X2, X1, 13); \
+  SIMD_SALSA_ARX_SSE2(X0, X3, X2, 18); \
+  X1 = _mm_shuffle_epi32(X1, 0x93); \
+  X2 = _mm_shuffle_epi32(X2, 0x4E); \
+  X3 = _mm_shuffle_epi32(X3, 0x39); \
+  SIMD_SALSA_ARX_SSE2(X3, X0, X1, 7); \
+  SIMD_SALSA_ARX_SSE2(X2, X3, X0, 9); \
+  SIMD_SALSA_ARX_SSE2(X1, X2, X3, 13); \
+  SIMD_SALSA_ARX_SSE2(X0, X1, X2, 18); \
+  X1 = _mm_shuffle_epi32(X1, 0x39); \
+  X2 = _mm_shuffle_epi32(X2, 0x4E); \
+  X3 = _mm_shuffle_epi32(X3, 0x93); \
+} while (0)
+#else
+#define simd_have(feature) (false)
+#endif
+
+/*
+ * Salsa20 and ChaCha20 double rounds over x[0..15], written with the
+ * operations ADD, XOR and ROTL so the same code serves scalar words and
+ * interleaved vectors.
+ */
+#define SIMD_SALSA_QR(ADD, XOR, ROTL, a, b, c, d) \
+  b = XOR(b, ROTL(ADD(a, d), 7)); \
+  c = XOR(c, ROTL(ADD(b, a), 9)); \
+  d = XOR(d, ROTL(ADD(c, b), 13)); \
+  a = XOR(a, ROTL(ADD(d, c), 18))
+
+#define SIMD_SALSA_DOUBLEROUND(ADD, XOR, ROTL, x) \
+  SIMD_SALSA_QR(ADD, XOR, ROTL, x[ 0], x[ 4], x[ 8], x[12]); \
+  SIMD_SALSA_QR(ADD, XOR, ROTL, x[ 5], x[ 9], x[13], x[ 1]); \
+  SIMD_SALSA_QR(ADD, XOR, ROTL, x[10], x[14], x[ 2], x[ 6]); \
+  SIMD_SALSA_QR(ADD, XOR, ROTL, x[15], x[ 3], x[ 7], x[11]); \
+  SIMD_SALSA_QR(ADD, XOR, ROTL, x[ 0], x[ 1], x[ 2], x[ 3]); \
+  SIMD_SALSA_QR(ADD, XOR, ROTL, x[ 5], x[ 6], x[ 7], x[ 4]); \
+  SIMD_SALSA_QR(ADD, XOR, ROTL, x[10], x[11], x[ 8], x[ 9]); \
+  SIMD_SALSA_QR(ADD, XOR, ROTL, x[15], x[12], x[13], x[14])
+
+#define SIMD_CHACHA_QR(ADD, XOR, ROTL, a, b, c, d) \
+  a = ADD(a, b); d = ROTL(XOR(d, a), 16); \
+  c = ADD(c, d); b = ROTL(XOR(b, c), 12); \
+  a = ADD(a, b); d = ROTL(XOR(d, a), 8); \
+  c = ADD(c, d); b = ROTL(XOR(b, c), 7)
+
+#define SIMD_CHACHA_DOUBLEROUND(ADD, XOR, ROTL, x) \
+  SIMD_CHACHA_QR(ADD, XOR, ROTL, x[ 0], x[ 4], x[ 8], x[12]); \
+  SIMD_CHACHA_QR(ADD, XOR, ROTL, x[ 1], x[ 5], x[ 9], x[13]); \
+  SIMD_CHACHA_QR(ADD, XOR, ROTL, x[ 2], x[ 6], x[10], x[14]); \
+  SIMD_CHACHA_QR(ADD, XOR, ROTL, x[ 3], x[ 7], x[11], x[15]); \
+  SIMD_CHACHA_QR(ADD, XOR, ROTL, x[ 0], x[ 5], x[10], x[15]); \
+  SIMD_CHACHA_QR(ADD, XOR, ROTL, x[ 1], x[ 6], x[11], x[12]); \
+  SIMD_CHACHA_QR(ADD, XOR, ROTL, x[ 2], x[ 7], x[ 8], x[13]); \
+  SIMD_CHACHA_QR(ADD, XOR, ROTL, x[ 3], x[ 4], x[ 9], x[14])
+
+#endif /* SIMD_H */
@@ -387,6 +387,294 @@ void reducedDuplexRow(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint
 }
 
 
+#ifdef USE_SIMD_X86
+/*
+ * Four independent sponges, one per 64-bit lane of the AVX2 registers.
+ * state[k] holds word k of every sponge and the memory matrix is laid out
+ * the same way, so a block is BLOCK_LEN_INT64 vectors (six cache lines) and
+ * every G works on the four sponges at once without any shuffling between
+ * words.  A single sponge does not gain from AVX2: the four G of a round are
+ * one dependency chain there and scalar code already runs them in parallel.
+ */
+SIMD_TARGET("avx2")
+static inline __m256i rotr24_4way(__m256i x) {
+    return _mm256_shuffle_epi8(x, _mm256_setr_epi8(
+	3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10,
+	3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10));
+}
+
+SIMD_TARGET("avx2")
+static inline __m256i rotr16_4way(__m256i x) {
+    return _mm256_shuffle_epi8(x, _mm256_setr_epi8(
+	2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,
+	2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9));
+}
+
+#define G_4WAY(a,b,c,d) \
+  do { \
+    a = _mm256_add_epi64(a, b); \
+    d = _mm256_shuffle_epi32(_mm256_xor_si256(d, a), 0xB1); \
+    c = _mm256_add_epi64(c, d); \
+    b = rotr24_4way(_mm256_xor_si256(b, c)); \
+    a = _mm256_add_epi64(a, b); \
+    d = rotr16_4way(_mm256_xor_si256(d, a)); \
+    c = _mm256_add_epi64(c, d); \
+    b = _mm256_xor_si256(b, c); \
+    b = _mm256_or_si256(_mm256_srli_epi64(b, 63), _mm256_add_epi64(b, b)); \
+  } while(0)
+
+#define ROUND_LYRA_4WAY(v) \
+    G_4WAY(v[ 0],v[ 4],v[ 8],v[12]); \
+    G_4WAY(v[ 1],v[ 5],v[ 9],v[13]); \
+    G_4WAY(v[ 2],v[ 6],v[10],v[14]); \
+    G_4WAY(v[ 3],v[ 7],v[11],v[15]); \
+    G_4WAY(v[ 0],v[ 5],v[10],v[15]); \
+    G_4WAY(v[ 1],v[ 6],v[11],v[12]); \
+    G_4WAY(v[ 2],v[ 7],v[ 8],v[13]); \
+    G_4WAY(v[ 3],v[ 4],v[ 9],v[14]);
+
+SIMD_TARGET("avx2")
+static inline void blake2bLyra_4way(__m256i *v) {
+    int i;
+    for (i = 0; i < 12; i++) {
+	ROUND_LYRA_4WAY(v);
+    }
+}
+
+/*
+ * Rows picked per sponge during the Wandering phase are given as one
+ * pointer per lane, to the lane's first word of the block; words of a lane
+ * are four uint64_t apart.  When all four sponges picked the same row the
+ * pointers are consecutive and the row is accessed as vectors.
+ */
+static inline int sameRow_4way(uint64_t *const p[4]) {
+    return p[1] == p[0] + 1 && p[2] == p[0] + 2 && p[3] == p[0] + 3;
+}
+
+SIMD_TARGET("avx2")
+static inline __m256i loadLanes_4way(uint64_t *const p[4], int same, int word) {
+    if (same)
+	return _mm256_load_si256((const __m256i *)p[0] + word);
+    return _mm256_set_epi64x(p[3][4 * word], p[2][4 * word], p[1][4 * word], p[0][4 * word]);
+}
+
+SIMD_TARGET("avx2")
+static inline void storeLanes_4way(uint64_t *const p[4], int same, int word, __m256i x) {
+    ALIGN uint64_t t[4];
+
+    if (same) {
+	_mm256_store_si256((__m256i *)p[0] + word, x);
+	return;
+    }
+    _mm256_store_si256((__m256i *)t, x);
+    p[0][4 * word] = t[0];
+    p[1][4 * word] = t[1];
+    p[2][4 * word] = t[2];
+    p[3][4 * word] = t[3];
+}
+
+/**
+ * Initializes four sponge states, as initState() does for one.
+ *
+ * @param state         The four interleaved states to be initialized
+ */
+SIMD_TARGET("avx2")
+void initState_4way(__m256i state[16]) {
+    int i;
+    for (i = 0; i < 8; i++) {
+	state[i] = _mm256_setzero_si256();
+	state[8 + i] = _mm256_set1_epi64x(blake2b_IV[i]);
+    }
+}
+
+/**
+ * Absorbs one BLOCK_LEN_BLAKE2_SAFE_INT64 block into each of four sponges.
+ *
+ * @param state The four interleaved states
+ * @param in    The interleaved blocks to be absorbed
+ */
+SIMD_TARGET("avx2")
+void absorbBlockBlake2Safe_4way(__m256i state[16], const __m256i *in) {
+    __m256i v[16];
+    int i;
+
+    for (i = 0; i < 16; i++)
+	v[i] = state[i];
+    for (i = 0; i < BLOCK_LEN_BLAKE2_SAFE_INT64; i++)
+	v[i] = _mm256_xor_si256(v[i], in[i]);
+    blake2bLyra_4way(v);
+    for (i = 0; i < 16; i++)
+	state[i] = v[i];
+}
+
+/**
+ * Absorbs one BLOCK_LEN_INT64 block into each of four sponges, lane l
+ * reading its block from in[l].
+ *
+ * @param state The four interleaved states
+ * @param in    Per-lane pointers to the blocks to be absorbed
+ */
+SIMD_TARGET("avx2")
+void absorbBlock_4way(__m256i state[16], uint64_t *const in[4]) {
+    int same = sameRow_4way(in);
+    __m256i v[16];
+    int i;
+
+    for (i = 0; i < 16; i++)
+	v[i] = state[i];
+    for (i = 0; i < BLOCK_LEN_INT64; i++)
+	v[i] = _mm256_xor_si256(v[i], loadLanes_4way(in, same, i));
+    blake2bLyra_4way(v);
+    for (i = 0; i < 16; i++)
+	state[i] = v[i];
+}
+
+/**
+ * Squeezes len bytes out of each of four sponges into out[0..3].
+ *
+ * @param state      The four interleaved states
+ * @param out        Arrays that will receive the data squeezed
+ * @param len        The number of bytes to be squeezed into each array
+ */
+SIMD_TARGET("avx2")
+void squeeze_4way(__m256i state[16], void *const out[4], unsigned int len) {
+    ALIGN uint64_t words[BLOCK_LEN_INT64 * 4];
+    unsigned int done, n, i, l;
+
+    for (done = 0; done < len; done += n) {
+	n = len - done < BLOCK_LEN_BYTES ? len - done : BLOCK_LEN_BYTES;
+	for (i = 0; i < BLOCK_LEN_INT64; i++)
+	    _mm256_store_si256((__m256i *)words + i, state[i]);
+	for (l = 0; l < 4; l++) {
+	    for (i = 0; i * 8 < n; i++)
+		memcpy((byte *)out[l] + done + i * 8, &words[i * 4 + l], n - i * 8 < 8 ? n - i * 8 : 8);
+	}
+	if (n == BLOCK_LEN_BYTES)
+	    blake2bLyra_4way(state);
+    }
+}
+
+/**
+ * reducedSqueezeRow0() for four sponges and an interleaved row.
+ */
+SIMD_TARGET("avx2")
+void reducedSqueezeRow0_4way(__m256i state[16], __m256i *rowOut, uint64_t nCols) {
+    __m256i *ptrWord = rowOut + (nCols-1)*BLOCK_LEN_INT64;
+    __m256i v[16];
+    uint64_t c;
+    int i;
+
+    for (i = 0; i < 16; i++)
+	v[i] = state[i];
+    for (c = 0; c < nCols; c++) {
+	for (i = 0; i < BLOCK_LEN_INT64; i++)
+	    ptrWord[i] = v[i];
+	ptrWord -= BLOCK_LEN_INT64;
+	ROUND_LYRA_4WAY(v);
+    }
+    for (i = 0; i < 16; i++)
+	state[i] = v[i];
+}
+
+/**
+ * reducedDuplexRow1() for four sponges and interleaved rows.
+ */
+SIMD_TARGET("avx2")
+void reducedDuplexRow1_4way(__m256i state[16], __m256i *rowIn, __m256i *rowOut, uint64_t nCols) {
+    __m256i* ptrWordIn = rowIn;
+    __m256i* ptrWordOut = rowOut + (nCols-1)*BLOCK_LEN_INT64;
+    __m256i v[16];
+    uint64_t c;
+    int i;
+
+    for (i = 0; i < 16; i++)
+	v[i] = state[i];
+    for (c = 0; c < nCols; c++) {
+	for (i = 0; i < BLOCK_LEN_INT64; i++)
+	    v[i] = _mm256_xor_si256(v[i], ptrWordIn[i]);
+	ROUND_LYRA_4WAY(v);
+	for (i = 0; i < BLOCK_LEN_INT64; i++)
+	    ptrWordOut[i] = _mm256_xor_si256(ptrWordIn[i], v[i]);
+
+	ptrWordIn += BLOCK_LEN_INT64;
+	ptrWordOut -= BLOCK_LEN_INT64;
+    }
+    for (i = 0; i < 16; i++)
+	state[i] = v[i];
+}
+
+/**
+ * reducedDuplexRowSetup() for four sponges and interleaved rows.  rotW is
+ * a renaming of the words here, so M[row*] costs no shuffles.
+ */
+SIMD_TARGET("avx2")
+void reducedDuplexRowSetup_4way(__m256i state[16], __m256i *rowIn, __m256i *rowInOut, __m256i *rowOut, uint64_t nCols) {
+    __m256i* ptrWordIn = rowIn;
+    __m256i* ptrWordInOut = rowInOut;
+    __m256i* ptrWordOut = rowOut + (nCols-1)*BLOCK_LEN_INT64;
+    __m256i v[16];
+    uint64_t c;
+    int i;
+
+    for (i = 0; i < 16; i++)
+	v[i] = state[i];
+    for (c = 0; c < nCols; c++) {
+	for (i = 0; i < BLOCK_LEN_INT64; i++)
+	    v[i] = _mm256_xor_si256(v[i], _mm256_add_epi64(ptrWordIn[i], ptrWordInOut[i]));
+	ROUND_LYRA_4WAY(v);
+	for (i = 0; i < BLOCK_LEN_INT64; i++)
+	    ptrWordOut[i] = _mm256_xor_si256(ptrWordIn[i], v[i]);
+	ptrWordInOut[0] = _mm256_xor_si256(ptrWordInOut[0], v[BLOCK_LEN_INT64 - 1]);
+	for (i = 1; i < BLOCK_LEN_INT64; i++)
+	    ptrWordInOut[i] = _mm256_xor_si256(ptrWordInOut[i], v[i - 1]);
+
+	ptrWordInOut += BLOCK_LEN_INT64;
+	ptrWordIn += BLOCK_LEN_INT64;
+	ptrWordOut -= BLOCK_LEN_INT64;
+    }
+    for (i = 0; i < 16; i++)
+	state[i] = v[i];
+}
+
+/**
+ * reducedDuplexRow() for four sponges and interleaved rows, where lane l
+ * uses the row starting at rowInOut[l] as M[row*].  That row may be rowOut
+ * for some lanes, so M[rowOut] is fully updated before M[row*] is read back.
+ */
+SIMD_TARGET("avx2")
+void reducedDuplexRow_4way(__m256i state[16], __m256i *rowIn, uint64_t *const rowInOut[4], __m256i *rowOut, uint64_t nCols) {
+    int same = sameRow_4way(rowInOut);
+    uint64_t *ptrWordInOut[4];
+    __m256i* ptrWordIn = rowIn;
+    __m256i* ptrWordOut = rowOut;
+    __m256i v[16];
+    uint64_t c;
+    int i, l;
+
+    for (l = 0; l < 4; l++)
+	ptrWordInOut[l] = rowInOut[l];
+    for (i = 0; i < 16; i++)
+	v[i] = state[i];
+    for (c = 0; c < nCols; c++) {
+	for (i = 0; i < BLOCK_LEN_INT64; i++)
+	    v[i] = _mm256_xor_si256(v[i], _mm256_add_epi64(ptrWordIn[i], loadLanes_4way(ptrWordInOut, same, i)));
+	ROUND_LYRA_4WAY(v);
+	for (i = 0; i < BLOCK_LEN_INT64; i++)
+	    ptrWordOut[i] = _mm256_xor_si256(ptrWordOut[i], v[i]);
+	for (i = 0; i < BLOCK_LEN_INT64; i++)
+	    storeLanes_4way(ptrWordInOut, same, i, _mm256_xor_si256(loadLanes_4way(ptrWordInOut, same, i),
+		v[i == 0 ? BLOCK_LEN_INT64 - 1 : i - 1]));
+
+	ptrWordIn += BLOCK_LEN_INT64;
+	ptrWordOut += BLOCK_LEN_INT64;
+	for (l = 0; l < 4; l++)
+	    ptrWordInOut[l] += BLOCK_LEN_INT64 * 4;
+    }
+    for (i = 0; i < 16; i++)
+	state[i] = v[i];
+}
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 /**
@@ -23,6 +23,7 @@
 #define SPONGE_H_
 
 #include <stdint.h>
+#include "algorithm/simd.h"
 
 #if defined(__GNUC__)
 #define ALIGN __attribute__ ((aligned(32)))
@@ -89,6 +90,18 @@ void reducedDuplexRow1(uint64_t *state, uint64_t *rowIn, uint64_t *rowOut, uint6
 void reducedDuplexRowSetup(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols);
 void reducedDuplexRow(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols);
 
+//---- Four sponges at once, one per 64-bit lane (AVX2 only, check simd_have(SIMD_AVX2))
+#ifdef USE_SIMD_X86
+void initState_4way(__m256i state[16]);
+void absorbBlockBlake2Safe_4way(__m256i state[16], const __m256i *in);
+void absorbBlock_4way(__m256i state[16], uint64_t *const in[4]);
+void squeeze_4way(__m256i state[16], void *const out[4], unsigned int len);
+void reducedSqueezeRow0_4way(__m256i state[16], __m256i *rowOut, uint64_t nCols);
+void reducedDuplexRow1_4way(__m256i state[16], __m256i *rowIn, __m256i *rowOut, uint64_t nCols);
+void reducedDuplexRowSetup_4way(__m256i state[16], __m256i *rowIn, __m256i *rowInOut, __m256i *rowOut, uint64_t nCols);
+void reducedDuplexRow_4way(__m256i state[16], __m256i *rowIn, uint64_t *const rowInOut[4], __m256i *rowOut, uint64_t nCols);
+#endif
+
 //---- Misc
 void printArray(unsigned char *array, unsigned int size, char *name);
 
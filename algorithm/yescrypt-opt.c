@@ -28,18 +28,13 @@
  * online backup system.
  */
 
-#ifdef __i386__
-#warning "This implementation does not use SIMD, and thus it runs a lot slower than the SIMD-enabled implementation. Enable at least SSE2 in the C compiler and use yescrypt-best.c instead unless you're building this SIMD-less implementation on purpose (portability to older CPUs or testing)."
-#elif defined(__x86_64__)
-#warning "This implementation does not use SIMD, and thus it runs a lot slower than the SIMD-enabled implementation. Use yescrypt-best.c instead unless you're building this SIMD-less implementation on purpose (for testing only)."
-#endif
-
 #include <errno.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include "algorithm/yescrypt_core.h"
 #include "sph/sha256_Y.h"
 #include "algorithm/sysendian.h"
+#include "algorithm/simd.h"
 
 // #include "sph/yescrypt-platform.c"
 #define HUGEPAGE_THRESHOLD		(12 * 1024 * 1024)
@@ -488,6 +483,212 @@ blockmix_pwxform(const uint64_t * Bin, uint64_t * Bout, uint64_t * S, size_t r)
 }
 
 
+#ifdef USE_SIMD_X86
+/*
+ * SSE2 versions of the block mixers.  They keep the SIMD-shuffled block
+ * layout of the C code above, so V, S and the VROM are shared with it and
+ * integerify() still applies.  All blocks are at least 16 byte aligned.
+ */
+
+/* salsa20/8 of the block held in X0..X3 */
+#define SALSA20_8_SSE2(X0, X1, X2, X3) \
+	do { \
+		__m128i Y0 = X0, Y1 = X1, Y2 = X2, Y3 = X3; \
+		int k_; \
+		for (k_ = 0; k_ < 4; k_++) \
+			SIMD_SALSA_DOUBLEROUND_SSE2(Y0, Y1, Y2, Y3); \
+		X0 = _mm_add_epi32(X0, Y0); \
+		X1 = _mm_add_epi32(X1, Y1); \
+		X2 = _mm_add_epi32(X2, Y2); \
+		X3 = _mm_add_epi32(X3, Y3); \
+	} while (0)
+
+#define XOR4(X0, X1, X2, X3, in) \
+	X0 = _mm_xor_si128(X0, (in)[0]); \
+	X1 = _mm_xor_si128(X1, (in)[1]); \
+	X2 = _mm_xor_si128(X2, (in)[2]); \
+	X3 = _mm_xor_si128(X3, (in)[3])
+
+#define OUT4(out, X0, X1, X2, X3) \
+	(out)[0] = X0; (out)[1] = X1; (out)[2] = X2; (out)[3] = X3
+
+SIMD_TARGET("sse2")
+static void
+blockmix_salsa8_sse2(const uint64_t * Bin, uint64_t * Bout, uint64_t * X, size_t r)
+{
+	const __m128i *in = (const __m128i *)Bin;
+	__m128i *out = (__m128i *)Bout;
+	__m128i X0, X1, X2, X3;
+	size_t i;
+
+	(void)X;
+
+	/* 1: X <-- B_{2r - 1} */
+	X0 = in[(2 * r - 1) * 4 + 0];
+	X1 = in[(2 * r - 1) * 4 + 1];
+	X2 = in[(2 * r - 1) * 4 + 2];
+	X3 = in[(2 * r - 1) * 4 + 3];
+
+	/* 2: for i = 0 to 2r - 1 do */
+	for (i = 0; i < 2 * r; i += 2) {
+		/* 3: X <-- H(X \xor B_i) */
+		XOR4(X0, X1, X2, X3, &in[i * 4]);
+		SALSA20_8_SSE2(X0, X1, X2, X3);
+		/* 4: Y_i <-- X */
+		/* 6: B' <-- (Y_0, Y_2 ... Y_{2r-2}, Y_1, Y_3 ... Y_{2r-1}) */
+		OUT4(&out[i * 2], X0, X1, X2, X3);
+
+		XOR4(X0, X1, X2, X3, &in[i * 4 + 4]);
+		SALSA20_8_SSE2(X0, X1, X2, X3);
+		OUT4(&out[i * 2 + r * 4], X0, X1, X2, X3);
+	}
+}
+
+/*
+ * One pwxform round of both 64-bit lanes of X: the S-box indices come
+ * from the low lane, the multiply is hi32 * lo32 of each lane.
+ */
+#ifdef __x86_64__
+#define PWXFORM_SIMD(X) \
+	do { \
+		uint64_t x = (uint64_t)_mm_cvtsi128_si64(X) & S_MASK2; \
+		__m128i s0 = *(const __m128i *)(S0 + (uint32_t)x); \
+		__m128i s1 = *(const __m128i *)(S1 + (x >> 32)); \
+		X = _mm_mul_epu32(_mm_srli_epi64(X, 32), X); \
+		X = _mm_add_epi64(X, s0); \
+		X = _mm_xor_si128(X, s1); \
+	} while (0)
+#else
+#define PWXFORM_SIMD(X) \
+	do { \
+		uint32_t lo = (uint32_t)_mm_cvtsi128_si32(X) & S_MASK; \
+		uint32_t hi = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(X, 4)) & S_MASK; \
+		__m128i s0 = *(const __m128i *)(S0 + lo); \
+		__m128i s1 = *(const __m128i *)(S1 + hi); \
+		X = _mm_mul_epu32(_mm_srli_epi64(X, 32), X); \
+		X = _mm_add_epi64(X, s0); \
+		X = _mm_xor_si128(X, s1); \
+	} while (0)
+#endif
+
+/* The S_P = 4 lanes of a pwxform block are independent; interleave them */
+#define PWXFORM_ROUND_SSE2(X0, X1, X2, X3) \
+	PWXFORM_SIMD(X0); PWXFORM_SIMD(X1); PWXFORM_SIMD(X2); PWXFORM_SIMD(X3)
+
+SIMD_TARGET("sse2")
+static void
+blockmix_pwxform_sse2(const uint64_t * Bin, uint64_t * Bout, uint64_t * S, size_t r)
+{
+	const __m128i *in = (const __m128i *)Bin;
+	__m128i *out = (__m128i *)Bout;
+	const uint8_t *S0 = (const uint8_t *)S;
+	const uint8_t *S1 = (const uint8_t *)(S + S_SIZE1 * S_SIMD);
+	__m128i X0, X1, X2, X3;
+	size_t r1, i, k;
+
+	/* Convert 128-byte blocks to 64-byte pwxform blocks (S_P_SIZE = 8),
+	 * so there are no partial blocks and the last one is B'_{2r-1} */
+	r1 = r * 128 / (S_P_SIZE * 8);
+
+	/* X <-- B_{r1 - 1} */
+	X0 = in[(r1 - 1) * 4 + 0];
+	X1 = in[(r1 - 1) * 4 + 1];
+	X2 = in[(r1 - 1) * 4 + 2];
+	X3 = in[(r1 - 1) * 4 + 3];
+
+	/* for i = 0 to r1 - 1 do */
+	for (i = 0; i < r1; i++) {
+		/* X <-- X \xor B_i */
+		XOR4(X0, X1, X2, X3, &in[i * 4]);
+
+		/* X <-- H'(X) */
+		for (k = 0; k < S_ROUNDS; k++) {
+			PWXFORM_ROUND_SSE2(X0, X1, X2, X3);
+		}
+
+		/* B'_i <-- X */
+		if (i < r1 - 1) {
+			OUT4(&out[i * 4], X0, X1, X2, X3);
+		}
+	}
+
+	/* B'_{2r-1} <-- H(B'_{2r-1}) */
+	SALSA20_8_SSE2(X0, X1, X2, X3);
+	OUT4(&out[(r1 - 1) * 4], X0, X1, X2, X3);
+}
+
+#undef XOR4
+#undef OUT4
+
+/* blkcpy() and blkxor() of whole 128r byte blocks for smix1() and smix2() */
+SIMD_TARGET("sse2")
+static void
+blkcpy_sse2(uint64_t * dest, const uint64_t * src, size_t count)
+{
+	__m128i *d = (__m128i *)dest;
+	const __m128i *s = (const __m128i *)src;
+	size_t i;
+
+	for (i = 0; i < count / 2; i += 4) {
+		d[i] = s[i]; d[i + 1] = s[i + 1];
+		d[i + 2] = s[i + 2]; d[i + 3] = s[i + 3];
+	}
+}
+
+SIMD_TARGET("sse2")
+static void
+blkxor_sse2(uint64_t * dest, const uint64_t * src, size_t count)
+{
+	__m128i *d = (__m128i *)dest;
+	const __m128i *s = (const __m128i *)src;
+	size_t i;
+
+	for (i = 0; i < count / 2; i += 4) {
+		d[i] = _mm_xor_si128(d[i], s[i]);
+		d[i + 1] = _mm_xor_si128(d[i + 1], s[i + 1]);
+		d[i + 2] = _mm_xor_si128(d[i + 2], s[i + 2]);
+		d[i + 3] = _mm_xor_si128(d[i + 3], s[i + 3]);
+	}
+}
+#endif /* USE_SIMD_X86 */
+
+/*
+ * The block mixers used by smix1() and smix2(), picked once per
+ * yescrypt_kdf() call by yescrypt_mixer().
+ */
+typedef void (*blockmix_t)(const uint64_t *, uint64_t *, uint64_t *, size_t);
+
+typedef struct {
+	blockmix_t salsa8;
+	blockmix_t pwxform;
+	void (*blkcpy)(uint64_t *, const uint64_t *, size_t);
+	void (*blkxor)(uint64_t *, const uint64_t *, size_t);
+} yescrypt_mixer_t;
+
+static const yescrypt_mixer_t mixer_c = {
+	blockmix_salsa8, blockmix_pwxform, blkcpy, blkxor
+};
+#ifdef USE_SIMD_X86
+static const yescrypt_mixer_t mixer_sse2 = {
+	blockmix_salsa8_sse2, blockmix_pwxform_sse2, blkcpy_sse2, blkxor_sse2
+};
+#endif
+
+static const yescrypt_mixer_t *
+yescrypt_mixer(yescrypt_path_t path)
+{
+#ifdef USE_SIMD_X86
+	if (path == YESCRYPT_PATH_AUTO)
+		path = simd_have(SIMD_SSE2) ? YESCRYPT_PATH_SSE2 : YESCRYPT_PATH_C;
+	if (path == YESCRYPT_PATH_SSE2)
+		return &mixer_sse2;
+#else
+	(void)path;
+#endif
+	return &mixer_c;
+}
+
+
 
 /**
  * integerify(B, r):
@@ -508,7 +709,7 @@ integerify(const uint64_t * B, size_t r)
 }
 
 /**
- * smix1(B, r, N, flags, V, NROM, shared, XY, S):
+ * smix1(B, r, N, flags, V, NROM, shared, XY, S, mix):
  * Compute first loop of B = SMix_r(B, N).  The input B must be 128r bytes in
  * length; the temporary storage V must be 128rN bytes in length; the temporary
  * storage XY must be 256r + 64 bytes in length.  The value N must be even and
@@ -517,9 +718,9 @@ integerify(const uint64_t * B, size_t r)
 static void
 smix1(uint64_t * B, size_t r, uint64_t N, yescrypt_flags_t flags,
 	uint64_t * V, uint64_t NROM, const yescrypt_shared_t * shared,
-	uint64_t * XY, uint64_t * S)
+	uint64_t * XY, uint64_t * S, const yescrypt_mixer_t * mix)
 {
-	void (*blockmix)(const uint64_t *, uint64_t *, uint64_t *, size_t) = (S ? blockmix_pwxform : blockmix_salsa8);
+	blockmix_t blockmix = (S ? mix->pwxform : mix->salsa8);
 	const uint64_t * VROM = (uint64_t *)shared->shared1.aligned;
 	uint32_t VROM_mask = shared->mask1;
 	size_t s = 16 * r;
@@ -545,7 +746,7 @@ smix1(uint64_t * B, size_t r, uint64_t N, yescrypt_flags_t flags,
 	/* 3: V_i <-- X */
 
 	blockmix(X, Y, Z, r);
-	blkcpy(&V[s], Y, s);
+	mix->blkcpy(&V[s], Y, s);
 	X = XY;
 
 	if (NROM && (VROM_mask & 1)) {
@@ -554,7 +755,7 @@ smix1(uint64_t * B, size_t r, uint64_t N, yescrypt_flags_t flags,
 			j = integerify(Y, r) & (NROM - 1);
 
 			/* X <-- H(X \xor VROM_j) */
-			blkxor(Y, &VROM[j * s], s);
+			mix->blkxor(Y, &VROM[j * s], s);
 		}
 	
 		blockmix(Y, X, Z, r);
@@ -563,7 +764,7 @@ smix1(uint64_t * B, size_t r, uint64_t N, yescrypt_flags_t flags,
 		/* 2: for i = 0 to N - 1 do */
 		for (n = 1, i = 2; i < N; i += 2) {
 			/* 3: V_i <-- X */
-			blkcpy(&V[i * s], X, s);
+			mix->blkcpy(&V[i * s], X, s);
 
 			if ((i & (i - 1)) == 0)
 				n <<= 1;
@@ -573,13 +774,13 @@ smix1(uint64_t * B, size_t r, uint64_t N, yescrypt_flags_t flags,
 			j += i - n;
 
 			/* X <-- X \xor V_j */
-			blkxor(X, &V[j * s], s);
+			mix->blkxor(X, &V[j * s], s);
 
 			/* 4: X <-- H(X) */
 			blockmix(X, Y, Z, r);
 
 			/* 3: V_i <-- X */
-			blkcpy(&V[(i + 1) * s], Y, s);
+			mix->blkcpy(&V[(i + 1) * s], Y, s);
 
 			j = integerify(Y, r);
 			if (((i + 1) & VROM_mask) == 1) {
@@ -587,14 +788,14 @@ smix1(uint64_t * B, size_t r, uint64_t N, yescrypt_flags_t flags,
 				j &= NROM - 1;
 
 				/* X <-- H(X \xor VROM_j) */
-				blkxor(Y, &VROM[j * s], s);
+				mix->blkxor(Y, &VROM[j * s], s);
 			} else {
 				/* j <-- Wrap(Integerify(X), i) */
 				j &= n - 1;
 				j += i + 1 - n;
 
 				/* X <-- H(X \xor V_j) */
-				blkxor(Y, &V[j * s], s);
+				mix->blkxor(Y, &V[j * s], s);
 			}
 
 			blockmix(Y, X, Z, r);
@@ -607,7 +808,7 @@ smix1(uint64_t * B, size_t r, uint64_t N, yescrypt_flags_t flags,
 		/* 2: for i = 0 to N - 1 do */
 		for (n = 1, i = 2; i < N; i += 2) {
 			/* 3: V_i <-- X */
-			blkcpy(&V[i * s], X, s);
+			mix->blkcpy(&V[i * s], X, s);
 
 			if (rw) {
 				if ((i & (i - 1)) == 0)
@@ -618,14 +819,14 @@ smix1(uint64_t * B, size_t r, uint64_t N, yescrypt_flags_t flags,
 				j += i - n;
 				
 				/* X <-- X \xor V_j */
-				blkxor(X, &V[j * s], s);
+				mix->blkxor(X, &V[j * s], s);
 			}
 
 			/* 4: X <-- H(X) */
 			blockmix(X, Y, Z, r);
 
 			/* 3: V_i <-- X */
-			blkcpy(&V[(i + 1) * s], Y, s);
+			mix->blkcpy(&V[(i + 1) * s], Y, s);
 
 			if (rw) {
 				/* j <-- Wrap(Integerify(X), i) */
@@ -634,7 +835,7 @@ smix1(uint64_t * B, size_t r, uint64_t N, yescrypt_flags_t flags,
 				
 
 				/* X <-- X \xor V_j */
-				blkxor(Y, &V[j * s], s);
+				mix->blkxor(Y, &V[j * s], s);
 			}
 
 			/* 4: X <-- H(X) */
@@ -656,7 +857,7 @@ smix1(uint64_t * B, size_t r, uint64_t N, yescrypt_flags_t flags,
 
 
 /**
- * smix2(B, r, N, Nloop, flags, V, NROM, shared, XY, S):
+ * smix2(B, r, N, Nloop, flags, V, NROM, shared, XY, S, mix):
  * Compute second loop of B = SMix_r(B, N).  The input B must be 128r bytes in
  * length; the temporary storage V must be 128rN bytes in length; the temporary
  * storage XY must be 256r + 64 bytes in length.  The value N must be a
@@ -666,11 +867,9 @@ static void
 smix2(uint64_t * B, size_t r, uint64_t N, uint64_t Nloop,
 	yescrypt_flags_t flags,
 	uint64_t * V, uint64_t NROM, const yescrypt_shared_t * shared,
-	uint64_t * XY, uint64_t * S)
+	uint64_t * XY, uint64_t * S, const yescrypt_mixer_t * mix)
 {
-	
-	void (*blockmix)(const uint64_t *, uint64_t *, uint64_t *, size_t) =
-		(S ? blockmix_pwxform : blockmix_salsa8);
+	blockmix_t blockmix = (S ? mix->pwxform : mix->salsa8);
 	const uint64_t * VROM = (uint64_t *)shared->shared1.aligned;
 	uint32_t VROM_mask = shared->mask1 | 1;
 	size_t s = 16 * r;
@@ -701,10 +900,10 @@ smix2(uint64_t * B, size_t r, uint64_t N, uint64_t Nloop,
 			j = integerify(X, r) & (N - 1);
 
 			/* 8: X <-- H(X \xor V_j) */
-			blkxor(X, &V[j * s], s);
+			mix->blkxor(X, &V[j * s], s);
 			/* V_j <-- Xprev \xor V_j */
 			if (rw)
-				blkcpy(&V[j * s], X, s);
+				mix->blkcpy(&V[j * s], X, s);
 			blockmix(X, Y, Z, r);
 
 			j = integerify(Y, r);
@@ -713,16 +912,16 @@ smix2(uint64_t * B, size_t r, uint64_t N, uint64_t Nloop,
 				j &= NROM - 1;
 
 				/* X <-- H(X \xor VROM_j) */
-				blkxor(Y, &VROM[j * s], s);
+				mix->blkxor(Y, &VROM[j * s], s);
 			} else {
 				/* 7: j <-- Integerify(X) mod N */
 				j &= N - 1;
 
 				/* 8: X <-- H(X \xor V_j) */
-				blkxor(Y, &V[j * s], s);
+				mix->blkxor(Y, &V[j * s], s);
 				/* V_j <-- Xprev \xor V_j */
 				if (rw)
-					blkcpy(&V[j * s], Y, s);
+					mix->blkcpy(&V[j * s], Y, s);
 			}
 
 			blockmix(Y, X, Z, r);
@@ -736,20 +935,20 @@ smix2(uint64_t * B, size_t r, uint64_t N, uint64_t Nloop,
 			j = integerify(X, r) & (N - 1);
 
 			/* 8: X <-- H(X \xor V_j) */
-			blkxor(X, &V[j * s], s);
+			mix->blkxor(X, &V[j * s], s);
 			/* V_j <-- Xprev \xor V_j */
 			if (rw)
-				blkcpy(&V[j * s], X, s);
+				mix->blkcpy(&V[j * s], X, s);
 			blockmix(X, Y, Z, r);
 
 			/* 7: j <-- Integerify(X) mod N */
 			j = integerify(Y, r) & (N - 1);
 
 			/* 8: X <-- H(X \xor V_j) */
-			blkxor(Y, &V[j * s], s);
+			mix->blkxor(Y, &V[j * s], s);
 			/* V_j <-- Xprev \xor V_j */
 			if (rw)
-				blkcpy(&V[j * s], Y, s);
+				mix->blkcpy(&V[j * s], Y, s);
 			blockmix(Y, X, Z, r);
 		} while (--i);
 	}
@@ -782,7 +981,7 @@ p2floor(uint64_t x)
 }
 
 /**
- * smix(B, r, N, p, t, flags, V, NROM, shared, XY, S):
+ * smix(B, r, N, p, t, flags, V, NROM, shared, XY, S, mix):
  * Compute B = SMix_r(B, N).  The input B must be 128rp bytes in length; the
  * temporary storage V must be 128rN bytes in length; the temporary storage
  * XY must be 256r+64 or (256r+64)*p bytes in length (the larger size is
@@ -793,7 +992,7 @@ static void
 smix(uint64_t * B, size_t r, uint64_t N, uint32_t p, uint32_t t,
 	yescrypt_flags_t flags,
 	uint64_t * V, uint64_t NROM, const yescrypt_shared_t * shared,
-	uint64_t * XY, uint64_t * S)
+	uint64_t * XY, uint64_t * S, const yescrypt_mixer_t * mix)
 {
 	size_t s = 16 * r;
 	uint64_t Nchunk = N / p, Nloop_all, Nloop_rw;
@@ -835,15 +1034,15 @@ smix(uint64_t * B, size_t r, uint64_t N, uint32_t p, uint32_t t,
 		uint64_t * Sp = S ? &S[i * S_SIZE_ALL] : S;
 
 		if (Sp) 
-			smix1(Bp, 1, S_SIZE_ALL / 16, (yescrypt_flags_t)flags & ~YESCRYPT_PWXFORM,Sp, NROM, shared, XYp, NULL);
+			smix1(Bp, 1, S_SIZE_ALL / 16, (yescrypt_flags_t)flags & ~YESCRYPT_PWXFORM,Sp, NROM, shared, XYp, NULL, mix);
 
 	
 
 		if (!(flags & __YESCRYPT_INIT_SHARED_2)) 
-			smix1(Bp, r, Np, flags, Vp, NROM, shared, XYp, Sp);
+			smix1(Bp, r, Np, flags, Vp, NROM, shared, XYp, Sp, mix);
 
 
-			smix2(Bp, r, p2floor(Np), Nloop_rw, flags, Vp, NROM, shared, XYp, Sp);
+			smix2(Bp, r, p2floor(Np), Nloop_rw, flags, Vp, NROM, shared, XYp, Sp, mix);
 
 
 
@@ -856,7 +1055,7 @@ smix(uint64_t * B, size_t r, uint64_t N, uint32_t p, uint32_t t,
 			uint64_t * XYp = XY;
 
 			uint64_t * Sp = S ? &S[i * S_SIZE_ALL] : S;
-			smix2(Bp, r, N, Nloop_all - Nloop_rw,flags & ~YESCRYPT_RW, V, NROM, shared, XYp, Sp);
+			smix2(Bp, r, N, Nloop_all - Nloop_rw,flags & ~YESCRYPT_RW, V, NROM, shared, XYp, Sp, mix);
 
 		}
 	}
@@ -870,7 +1069,7 @@ static void
 smix_old(uint64_t * B, size_t r, uint64_t N, uint32_t p, uint32_t t,
 yescrypt_flags_t flags,
 uint64_t * V, uint64_t NROM, const yescrypt_shared_t * shared,
-uint64_t * XY, uint64_t * S)
+uint64_t * XY, uint64_t * S, const yescrypt_mixer_t * mix)
 {
 	size_t s = 16 * r;
 	uint64_t Nchunk = N / p, Nloop_all, Nloop_rw;
@@ -914,16 +1113,16 @@ uint64_t * XY, uint64_t * S)
 		uint64_t * Sp = S ? &S[i * S_SIZE_ALL] : S;
 
 		if (Sp) {
-			smix1(Bp, 1, S_SIZE_ALL / 16, flags & ~YESCRYPT_PWXFORM, Sp, NROM, shared, XYp, NULL);
+			smix1(Bp, 1, S_SIZE_ALL / 16, flags & ~YESCRYPT_PWXFORM, Sp, NROM, shared, XYp, NULL, mix);
 
 
 		}
 		if (!(flags & __YESCRYPT_INIT_SHARED_2)) {
-			smix1(Bp, r, Np, flags, Vp, NROM, shared, XYp, Sp);
+			smix1(Bp, r, Np, flags, Vp, NROM, shared, XYp, Sp, mix);
 		}
 
 
-		smix2(Bp, r, p2floor(Np), Nloop_rw, flags, Vp, NROM, shared, XYp, Sp);
+		smix2(Bp, r, p2floor(Np), Nloop_rw, flags, Vp, NROM, shared, XYp, Sp, mix);
 	}
 	
 	if (Nloop_all > Nloop_rw) {
@@ -934,7 +1133,7 @@ uint64_t * XY, uint64_t * S)
 			uint64_t * XYp = XY;
 
 			uint64_t * Sp = S ? &S[i * S_SIZE_ALL] : S;
-			smix2(Bp, r, N, Nloop_all - Nloop_rw, flags & ~YESCRYPT_RW, V, NROM, shared, XYp, Sp);
+			smix2(Bp, r, N, Nloop_all - Nloop_rw, flags & ~YESCRYPT_RW, V, NROM, shared, XYp, Sp, mix);
 		}
 	}
 }
@@ -962,6 +1161,23 @@ yescrypt_kdf(const yescrypt_shared_t * shared, yescrypt_local_t * local,
 	uint64_t N, uint32_t r, uint32_t p, uint32_t t, yescrypt_flags_t flags,
 	uint8_t * buf, size_t buflen)
 {
+	return yescrypt_kdf_path(shared, local, passwd, passwdlen, salt, saltlen,
+		N, r, p, t, flags, buf, buflen, YESCRYPT_PATH_AUTO);
+}
+
+/**
+ * yescrypt_kdf_path(shared, local, passwd, passwdlen, salt, saltlen,
+ *     N, r, p, t, flags, buf, buflen, path):
+ * yescrypt_kdf() with the block mixers of the given code path.
+ */
+int
+yescrypt_kdf_path(const yescrypt_shared_t * shared, yescrypt_local_t * local,
+	const uint8_t * passwd, size_t passwdlen,
+	const uint8_t * salt, size_t saltlen,
+	uint64_t N, uint32_t r, uint32_t p, uint32_t t, yescrypt_flags_t flags,
+	uint8_t * buf, size_t buflen, yescrypt_path_t path)
+{
+	const yescrypt_mixer_t * mix = yescrypt_mixer(path);
 	yescrypt_region_t tmp;
 	uint64_t NROM;
 	size_t B_size, V_size, XY_size, need;
@@ -1116,13 +1332,13 @@ yescrypt_kdf(const yescrypt_shared_t * shared, yescrypt_local_t * local,
 		blkcpy(sha256, B, sizeof(sha256) / sizeof(sha256[0]));
 	}
 	if (p == 1 || (flags & YESCRYPT_PARALLEL_SMIX)) {
-		smix(B, r, N, p, t, flags, V, NROM, shared, XY, S);
+		smix(B, r, N, p, t, flags, V, NROM, shared, XY, S, mix);
 	} else {
 		uint32_t i;
 		/* 2: for i = 0 to p - 1 do */
 		for (i = 0; i < p; i++) {
 			/* 3: B_i <-- MF(B_i, N) */
-			smix(&B[(size_t)16 * r * i], r, N, 1, t, flags, V, NROM, shared, XY, S);
+			smix(&B[(size_t)16 * r * i], r, N, 1, t, flags, V, NROM, shared, XY, S, mix);
 		}
 	}
 
@@ -1168,6 +1384,7 @@ const uint8_t * salt, size_t saltlen,
 uint64_t N, uint32_t r, uint32_t p, uint32_t t, yescrypt_flags_t flags,
 uint8_t * buf, size_t buflen)
 {
+	const yescrypt_mixer_t * mix = yescrypt_mixer(YESCRYPT_PATH_AUTO);
 	yescrypt_region_t tmp;
 	uint64_t NROM;
 	size_t B_size, V_size, XY_size, need;
@@ -1324,7 +1541,7 @@ uint8_t * buf, size_t buflen)
 	{
 		blkcpy(sha256, B, sizeof(sha256) / sizeof(sha256[0]));
 	}
-		smix(B, r, N, p, t, flags, V, NROM, shared, XY, S);
+		smix(B, r, N, p, t, flags, V, NROM, shared, XY, S, mix);
 
 
 	/* 5: DK <-- PBKDF2(P, B, 1, dkLen) */
@@ -31,7 +31,9 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "algorithm/yescrypt.h"
 #include "algorithm/yescrypt_core.h"
+#include "algorithm/simd.h"
 
 static const uint32_t diff1targ = 0x0000ffff;
 
@@ -70,18 +72,56 @@ int yescrypt_test(unsigned char *pdata, const unsigned char *ptarget, uint32_t n
 	return 1;
 }
 
+static void yescrypt_hash_works(struct work *works, unsigned int count, yescrypt_path_t path)
+{
+	uint32_t data[20];
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		uint32_t *nonce = (uint32_t *)(works[i].data + 76);
+		uint32_t *ohash = (uint32_t *)(works[i].hash);
+
+		be32enc_vect(data, (const uint32_t *)works[i].data, 19);
+		data[19] = htobe32(*nonce);
+
+		yescrypt_hash_path((unsigned char *)data, (unsigned char *)ohash, path);
+	}
+}
+
 void yescrypt_regenhash(struct work *work)
 {
-        uint32_t data[20];
-        uint32_t *nonce = (uint32_t *)(work->data + 76);
-        uint32_t *ohash = (uint32_t *)(work->hash);
+	yescrypt_hash_works(work, 1, YESCRYPT_PATH_AUTO);
+}
+
+static bool yescrypt_have_c(void)
+{
+	return true;
+}
 
-        be32enc_vect(data, (const uint32_t *)work->data, 19);
-        data[19] = htobe32(*nonce);	
+static void yescrypt_hash_c(struct work *works, unsigned int count)
+{
+	yescrypt_hash_works(works, count, YESCRYPT_PATH_C);
+}
 
-		yescrypt_hash((unsigned char*)data, (unsigned char*)ohash);
-        
+#ifdef USE_SIMD_X86
+static bool yescrypt_have_sse2(void)
+{
+	return simd_have(SIMD_SSE2);
+}
+
+static void yescrypt_hash_sse2(struct work *works, unsigned int count)
+{
+	yescrypt_hash_works(works, count, YESCRYPT_PATH_SSE2);
 }
+#endif
+
+const cpu_hash_path_t yescrypt_hash_paths[] = {
+	{ "c", 1, yescrypt_have_c, yescrypt_hash_c },
+#ifdef USE_SIMD_X86
+	{ "sse2", 1, yescrypt_have_sse2, yescrypt_hash_sse2 },
+#endif
+	{ NULL, 0, NULL, NULL }
+};
 
 
 bool scanhash_yescrypt(struct thr_info *thr, const unsigned char __maybe_unused *pmidstate,
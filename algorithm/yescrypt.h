@@ -7,4 +7,7 @@
 extern int yescrypt_test(unsigned char *pdata, const unsigned char *ptarget, uint32_t nonce);
 extern void yescrypt_regenhash(struct work *work);
 
+/* CPU implementations of yescrypt_regenhash(), reference first */
+extern const cpu_hash_path_t yescrypt_hash_paths[];
+
 #endif /* YESCRYPT_H */
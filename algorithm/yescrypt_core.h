@@ -298,6 +298,28 @@ extern int yescrypt_kdf(const yescrypt_shared_t * __shared,
 	yescrypt_flags_t __flags,
 	uint8_t * __buf, size_t __buflen);
 
+/**
+ * CPU code paths of yescrypt_kdf_path(); YESCRYPT_PATH_AUTO picks the fastest
+ * one the running CPU supports and is what yescrypt_kdf() uses.
+ */
+typedef enum {
+	YESCRYPT_PATH_AUTO = 0,
+	YESCRYPT_PATH_C,
+	YESCRYPT_PATH_SSE2
+} yescrypt_path_t;
+
+extern int yescrypt_kdf_path(const yescrypt_shared_t * __shared,
+	yescrypt_local_t * __local,
+	const uint8_t * __passwd, size_t __passwdlen,
+	const uint8_t * __salt, size_t __saltlen,
+	uint64_t __N, uint32_t __r, uint32_t __p, uint32_t __t,
+	yescrypt_flags_t __flags,
+	uint8_t * __buf, size_t __buflen, yescrypt_path_t __path);
+
+/* yescrypt_hash() computed by the given code path */
+extern void yescrypt_hash_path(const unsigned char *input, unsigned char *output,
+	yescrypt_path_t path);
+
 /**
  * yescrypt_r(shared, local, passwd, passwdlen, setting, buf, buflen):
  * Compute and encode an scrypt or enhanced scrypt hash of passwd given the
@@ -323,7 +323,7 @@ yescrypt_gensalt(uint32_t N_log2, uint32_t r, uint32_t p,
 static int
 yescrypt_bsty(const uint8_t * passwd, size_t passwdlen,
     const uint8_t * salt, size_t saltlen, uint64_t N, uint32_t r, uint32_t p,
-    uint8_t * buf, size_t buflen)
+    uint8_t * buf, size_t buflen, yescrypt_path_t path)
 {
 	static __thread int initialized = 0;
 	static __thread yescrypt_shared_t shared;
@@ -346,15 +346,20 @@ yescrypt_bsty(const uint8_t * passwd, size_t passwdlen,
 		}
 		initialized = 1;
  	}
-	retval = yescrypt_kdf(&shared, &local,
+	retval = yescrypt_kdf_path(&shared, &local,
 	    passwd, passwdlen, salt, saltlen, N, r, p, 0, YESCRYPT_FLAGS,
-	    buf, buflen);		
+	    buf, buflen, path);
 
 	return retval;
 }
 
-void yescrypt_hash(const unsigned char *input, unsigned char *output)
+void yescrypt_hash_path(const unsigned char *input, unsigned char *output,
+    yescrypt_path_t path)
 {
+   yescrypt_bsty((const uint8_t *)input, 80, (const uint8_t *) input, 80, 2048, 8, 1, (uint8_t *)output, 32, path);
+}
 
-   yescrypt_bsty((const uint8_t *)input, 80, (const uint8_t *) input, 80, 2048, 8, 1, (uint8_t *)output, 32);
+void yescrypt_hash(const unsigned char *input, unsigned char *output)
+{
+   yescrypt_hash_path(input, output, YESCRYPT_PATH_AUTO);
 }
@@ -34,6 +34,17 @@
 #include "algorithm.h"
 
 #include "config_parser.h"
+#include "driver-opencl.h"
+#include "ocl/kernel_profile.h"
+
+#if defined(__linux)
+#define HAVE_API_EPOLL 1
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdarg.h>
+#include <sys/epoll.h>
+#endif
 
 #ifdef WIN32
 static char WSAbuf[1024];
@@ -218,6 +229,17 @@ struct CODES codes[] = {
 
  { SEVERITY_SUCC,  MSG_CHPOOLPR, PARAM_BOTH, "Changed pool %d to profile '%s'" },
 
+ { SEVERITY_SUCC,  MSG_KPROFILE, PARAM_NONE, "Kernel profile" },
+ { SEVERITY_WARN,  MSG_KPROFDIS, PARAM_NONE, "Kernel profiling not enabled" },
+
+ { SEVERITY_SUCC,  MSG_KEEPALIVE, PARAM_NONE, "Keep-alive on" },
+ { SEVERITY_WARN,  MSG_KEEPDIS, PARAM_NONE, "Keep-alive not available" },
+ { SEVERITY_SUCC,  MSG_APISTATS, PARAM_NONE, "API stats" },
+ { SEVERITY_ERR,   MSG_RATELIMIT, PARAM_NONE, "Rate limit exceeded" },
+ { SEVERITY_SUCC,  MSG_SUBSCRIBE, PARAM_STR, "Subscribed to %s" },
+ { SEVERITY_WARN,  MSG_SUBDIS, PARAM_NONE, "Subscriptions not available" },
+ { SEVERITY_ERR,   MSG_INVSUB, PARAM_STR, "Invalid subscription '%s'" },
+
  { SEVERITY_SUCC,  MSG_BYE,   PARAM_STR,  "%s" },
  { SEVERITY_FAIL, 0, (enum code_parameters)0, NULL }
 };
@@ -286,6 +308,24 @@ static time_t when = 0; // when the request occurred
 static struct IP4ACCESS *ipaccess = NULL;
 static int ips = 0;
 
+// Connection and request counters, only changed by the API thread
+static unsigned int api_conns, api_requests, api_limited, api_offloaded, api_timeouts, api_refused;
+static int api_open, api_keepalives, api_subscribers;
+static unsigned int api_pushed, api_push_dropped;
+// Served by the event server, not one connection at a time
+static bool api_evented;
+#ifdef HAVE_API_EPOLL
+static pthread_t api_worker_pth;
+static bool api_worker_started;
+static struct thread_q *api_job_q;
+// Set by api_worker_end() before it queues the empty job that ends the worker
+static bool api_worker_stop;
+#endif
+// Guards the per command latency counters in cmds[]
+static pthread_mutex_t api_stats_lock;
+// Held while a request runs, the API thread and worker share pools[] and the devices
+static pthread_mutex_t api_cmd_lock;
+
 struct APIGROUPS {
   // This becomes a string like: "|cmd1|cmd2|cmd3|" so it's quick to search
   char *commands;
@@ -298,6 +338,8 @@ static void io_reinit(struct io_data *io_data)
   io_data->cur = io_data->ptr;
   *(io_data->ptr) = '\0';
   io_data->close = false;
+  io_data->keepalive = false;
+  io_data->subscribe = 0;
 }
 
 static struct io_data *_io_new(size_t initial, bool socket_buf)
@@ -1488,6 +1530,16 @@ static void gpustatus(struct io_data *io_data, int gpu, bool isjson, bool precom
     double rejp = cgpu->diff1 ?
         (double)(cgpu->diff_rejected) / (double)(cgpu->diff1) : 0;
     root = api_add_percent(root, "Device Rejected%", &rejp, false);
+    root = api_add_int(root, "Work Waits", &(cgpu->work_waits), false);
+    root = api_add_double(root, "Work Wait Secs", &(cgpu->work_wait_secs), false);
+    double work_per_sec = cgpu->work_interval > 0 ? 1 / cgpu->work_interval : 0;
+    root = api_add_double(root, "Work Rate", &work_per_sec, true);
+    root = api_add_uint64(root, "Verified", &(cgpu->verify_checked), false);
+    root = api_add_uint64(root, "Verify Skipped", &(cgpu->verify_skipped), false);
+    root = api_add_int(root, "Verify Errors", &(cgpu->verify_bad), false);
+    double verp = cgpu->verify_checked + cgpu->verify_bad ?
+        (double)(cgpu->verify_bad) / (double)(cgpu->verify_checked + cgpu->verify_bad) : 0;
+    root = api_add_percent(root, "Verify Errors%", &verp, false);
     root = api_add_elapsed(root, "Device Elapsed", &(total_secs), true); // GPUs don't hotplug
 
     root = print_data(root, buf, isjson, precom);
@@ -1554,12 +1606,61 @@ static void gpudev(struct io_data *io_data, __maybe_unused SOCKETTYPE c, char *p
     io_close(io_data);
 }
 
+struct ack_latency {
+  unsigned int count;
+  double avg, p50, p90, p99, max;   /* milliseconds */
+  char hist[SHARE_LAT_BUCKETS * 24];
+};
+
+/* Upper bound of the histogram bucket holding the pct percentile */
+static double ack_latency_pct(struct pool *pool, unsigned int pct)
+{
+  unsigned int rank = (pool->share_lat_count * pct + 99) / 100, seen = 0;
+  int i;
+
+  for (i = 0; i < SHARE_LAT_BUCKETS - 1; i++) {
+    seen += pool->share_lat[i];
+    if (seen >= rank)
+      return share_lat_bounds[i] < pool->share_lat_max ? share_lat_bounds[i] : pool->share_lat_max;
+  }
+  return pool->share_lat_max;
+}
+
+/* Summarises the submit to ack latency histogram of a stratum pool, called
+ * with its sshare_lock held */
+static void ack_latency(struct pool *pool, struct ack_latency *lat)
+{
+  size_t len = 0;
+  int i;
+
+  memset(lat, 0, sizeof(*lat));
+  lat->count = pool->share_lat_count;
+  if (lat->count) {
+    lat->avg = pool->share_lat_total / lat->count;
+    lat->p50 = ack_latency_pct(pool, 50);
+    lat->p90 = ack_latency_pct(pool, 90);
+    lat->p99 = ack_latency_pct(pool, 99);
+    lat->max = pool->share_lat_max;
+  }
+
+  /* "10=n,25=n,...,inf=n", bucket upper bounds in milliseconds */
+  for (i = 0; i < SHARE_LAT_BUCKETS; i++) {
+    if (i < SHARE_LAT_BUCKETS - 1)
+      len += snprintf(lat->hist + len, sizeof(lat->hist) - len, "%s%d=%u",
+          i ? "," : "", share_lat_bounds[i], pool->share_lat[i]);
+    else
+      len += snprintf(lat->hist + len, sizeof(lat->hist) - len, ",inf=%u",
+          pool->share_lat[i]);
+  }
+}
+
 static void poolstatus(struct io_data *io_data, __maybe_unused SOCKETTYPE c, __maybe_unused char *param, bool isjson, __maybe_unused char group)
 {
   struct api_data *root = NULL;
   char buf[TMPBUFSIZ];
   bool io_open = false;
   char *status, *lp;
+  struct ack_latency lat;
   int i;
 
   if (total_pools == 0) {
@@ -1626,6 +1727,18 @@ static void poolstatus(struct io_data *io_data, __maybe_unused SOCKETTYPE c, __m
     root = api_add_uint(root, "Stale", &(pool->stale_shares), false);
     root = api_add_uint(root, "Get Failures", &(pool->getfail_occasions), false);
     root = api_add_uint(root, "Remote Failures", &(pool->remotefail_occasions), false);
+    root = api_add_double(root, "Gen Latency", &(pool->gen_latency), false);
+    root = api_add_int(root, "Share Timeouts", &(pool->share_timeouts), false);
+    mutex_lock(&pool->sshare_lock);
+    ack_latency(pool, &lat);
+    mutex_unlock(&pool->sshare_lock);
+    root = api_add_uint(root, "Ack Count", &(lat.count), true);
+    root = api_add_double(root, "Ack Latency Avg", &(lat.avg), true);
+    root = api_add_double(root, "Ack Latency P50", &(lat.p50), true);
+    root = api_add_double(root, "Ack Latency P90", &(lat.p90), true);
+    root = api_add_double(root, "Ack Latency P99", &(lat.p99), true);
+    root = api_add_double(root, "Ack Latency Max", &(lat.max), true);
+    root = api_add_string(root, "Ack Latency Hist", lat.hist, true);
     root = api_add_escape(root, "User", pool->rpc_user, false);
     root = api_add_time(root, "Last Share Time", &(pool->last_share_time), false);
     root = api_add_double(root, "Diff1 Shares", &(pool->diff1), false);
@@ -1647,6 +1760,9 @@ static void poolstatus(struct io_data *io_data, __maybe_unused SOCKETTYPE c, __m
       root = api_add_escape(root, "Stratum URL", pool->stratum_url, false);
     else
       root = api_add_const(root, "Stratum URL", BLANK, false);
+    root = api_add_bool(root, "Standby", &(pool->standby), false);
+    root = api_add_double(root, "Connect Latency", &(pool->cnx_latency), false);
+    root = api_add_time(root, "Last Notify Time", &(pool->last_notify), false);
     root = api_add_bool(root, "Has GBT", &(pool->has_gbt), false);
     root = api_add_double(root, "Best Share", &(pool->best_diff), true);
     double rejp = (pool->diff_accepted + pool->diff_rejected + pool->diff_stale) ?
@@ -1723,6 +1839,18 @@ static void summary(struct io_data *io_data, __maybe_unused SOCKETTYPE c, __mayb
       (double)(total_diff_stale) / (double)(total_diff_accepted + total_diff_rejected + total_diff_stale) : 0;
   root = api_add_percent(root, "Pool Stale%", &stalep, false);
   root = api_add_time(root, "Last getwork", &last_getwork, false);
+  root = api_add_int(root, "Staged Target", &staged_target, true);
+  root = api_add_double(root, "Work Rate", &work_rate, true);
+  root = api_add_int(root, "Idle Events", &idle_events, true);
+  root = api_add_double(root, "Idle Secs", &idle_secs, true);
+  root = api_add_int(root, "Failover Prefetched", &failover_prefetched, true);
+  root = api_add_int(root, "Failover Prefetch Used", &failover_used, true);
+  root = api_add_int(root, "Nonce Jobs", &nonce_jobs, true);
+  root = api_add_int(root, "Nonce Ranges", &nonce_ranges, true);
+  root = api_add_uint64(root, "Work Allocs", &work_made, true);
+  root = api_add_uint64(root, "Work Recycled", &work_recycled, true);
+  root = api_add_uint64(root, "Work Jobs", &work_jobs, true);
+  root = api_add_uint64(root, "Log Dropped", &log_dropped, true);
 
   mutex_unlock(&hash_lock);
 
@@ -2622,7 +2750,7 @@ static void devdetails(struct io_data *io_data, __maybe_unused SOCKETTYPE c, __m
     root = api_add_string(root, "Name", cgpu->drv->name, false);
     root = api_add_int(root, "ID", &(cgpu->device_id), false);
     root = api_add_string(root, "Driver", cgpu->drv->dname, false);
-    root = api_add_const(root, "Kernel", cgpu->algorithm.name, false);
+    root = api_add_const(root, "Kernel", get_algorithm_kernel(&cgpu->algorithm), false);
     root = api_add_const(root, "Model", cgpu->name ? cgpu->name : BLANK, false);
     root = api_add_const(root, "Device Path", cgpu->device_path ? cgpu->device_path : BLANK, false);
 
@@ -2635,6 +2763,74 @@ static void devdetails(struct io_data *io_data, __maybe_unused SOCKETTYPE c, __m
     io_close(io_data);
 }
 
+static void kernelprofile(struct io_data *io_data, __maybe_unused SOCKETTYPE c, char *param, bool isjson, __maybe_unused char group)
+{
+  struct kernel_stage_stats st[KPROF_STAGES];
+  struct api_data *root = NULL;
+  char buf[TMPBUFSIZ], kname[16];
+  bool io_open = false;
+  unsigned int nstages, k;
+  int id, first, last, i, j;
+  double share;
+
+  if (nDevs == 0) {
+    message(io_data, MSG_GPUNON, 0, NULL, isjson);
+    return;
+  }
+
+  if (!opt_kernel_profile) {
+    message(io_data, MSG_KPROFDIS, 0, NULL, isjson);
+    return;
+  }
+
+  first = 0;
+  last = nDevs - 1;
+  if (param != NULL && *param != '\0') {
+    id = atoi(param);
+    if (id < 0 || id >= nDevs) {
+      message(io_data, MSG_INVGPU, id, NULL, isjson);
+      return;
+    }
+    first = last = id;
+  }
+
+  message(io_data, MSG_KPROFILE, 0, NULL, isjson);
+
+  if (isjson)
+    io_open = io_add(io_data, COMSTR JSON_KERNELPROFILE);
+
+  for (i = first, j = 0; i <= last; i++) {
+    struct cgpu_info *cgpu = &gpus[i];
+
+    if (!cgpu->kprofile)
+      continue;
+
+    nstages = kernel_profile_stats(cgpu->kprofile, st);
+    for (k = 0; k < nstages; k++) {
+      kernel_stage_name(kname, sizeof(kname), k);
+      root = api_add_int(root, "GPU", &i, false);
+      root = api_add_uint(root, "Stage", &k, false);
+      root = api_add_string(root, "Kernel", kname, true);
+      root = api_add_uint64(root, "Passes", &(st[k].passes), false);
+      root = api_add_uint(root, "Samples", &(st[k].samples), false);
+      root = api_add_double(root, "Average", &(st[k].avg), false);
+      root = api_add_double(root, "P50", &(st[k].p50), false);
+      root = api_add_double(root, "P90", &(st[k].p90), false);
+      root = api_add_double(root, "P99", &(st[k].p99), false);
+      root = api_add_double(root, "Max", &(st[k].max), false);
+      share = st[k].share / 100;
+      root = api_add_percent(root, "Share%", &share, false);
+
+      root = print_data(root, buf, isjson, isjson && (j > 0));
+      io_add(io_data, buf);
+      j++;
+    }
+  }
+
+  if (isjson && io_open)
+    io_close(io_data);
+}
+
 void dosave(struct io_data *io_data, __maybe_unused SOCKETTYPE c, char *param, bool isjson, __maybe_unused char group)
 {
   char filename[PATH_MAX];
@@ -2962,6 +3158,80 @@ static void dozero(struct io_data *io_data, __maybe_unused SOCKETTYPE c, char *p
     message(io_data, MSG_ZERNOSUM, 0, all ? "All" : "BestShare", isjson);
 }
 
+static void keepalive(struct io_data *io_data, __maybe_unused SOCKETTYPE c, __maybe_unused char *param, bool isjson, __maybe_unused char group)
+{
+  if (api_evented) {
+    io_data->keepalive = true;
+    message(io_data, MSG_KEEPALIVE, 0, NULL, isjson);
+  } else
+    message(io_data, MSG_KEEPDIS, 0, NULL, isjson);
+}
+
+static struct {
+  const char *name;
+  int mask;
+} push_names[] = {
+  { "share",  API_PUSH_SHARE },
+  { "device", API_PUSH_DEVICE },
+  { "pool", API_PUSH_POOL },
+  { "dag",  API_PUSH_DAG },
+  { "hashrate", API_PUSH_HASHRATE },
+  { "all",  API_PUSH_ALL },
+  { NULL, 0 }
+};
+
+/* param is a comma separated list of event names, pool=N and gpu=N,
+ * all events of all pools and GPUs without it */
+static void subscribe(struct io_data *io_data, __maybe_unused SOCKETTYPE c, char *param, bool isjson, __maybe_unused char group)
+{
+  char list[256], buf[256], *ptr, *next;
+  int mask = 0, pool = -1, gpu = -1;
+  int i;
+
+  if (!api_evented) {
+    message(io_data, MSG_SUBDIS, 0, NULL, isjson);
+    return;
+  }
+
+  if (param == NULL || *param == '\0')
+    param = "all";
+  // Short enough for the reply
+  snprintf(list, sizeof(list), "%s", param);
+  strcpy(buf, list);
+
+  for (ptr = buf; ptr; ptr = next) {
+    next = strchr(ptr, ',');
+    if (next)
+      *(next++) = '\0';
+
+    if (!strncasecmp(ptr, "pool=", 5) && isdigit((unsigned char)ptr[5]))
+      pool = atoi(ptr + 5);
+    else if (!strncasecmp(ptr, "gpu=", 4) && isdigit((unsigned char)ptr[4]))
+      gpu = atoi(ptr + 4);
+    else {
+      for (i = 0; push_names[i].name; i++) {
+        if (!strcasecmp(ptr, push_names[i].name))
+          break;
+      }
+      if (!push_names[i].name) {
+        message(io_data, MSG_INVSUB, 0, ptr, isjson);
+        return;
+      }
+      mask |= push_names[i].mask;
+    }
+  }
+
+  // Only filters, every kind of event
+  if (!mask)
+    mask = API_PUSH_ALL;
+
+  io_data->subscribe = mask;
+  io_data->sub_pool = pool;
+  io_data->sub_gpu = gpu;
+  message(io_data, MSG_SUBSCRIBE, 0, list, isjson);
+}
+
+static void apistats(struct io_data *io_data, __maybe_unused SOCKETTYPE c, __maybe_unused char *param, bool isjson, __maybe_unused char group);
 static void checkcommand(struct io_data *io_data, __maybe_unused SOCKETTYPE c, char *param, bool isjson, char group);
 
 struct CMDS {
@@ -2969,6 +3239,10 @@ struct CMDS {
   void (*func)(struct io_data *, SOCKETTYPE, char *, bool, char);
   bool iswritemode;
   bool joinable;
+  bool offload;   // may be slow, the event server runs it on the API worker
+  // Latency of the command, under api_stats_lock
+  uint64_t calls;
+  double total, max;
 } cmds[] = {
   { "version",    apiversion, false,  true },
   { "config",   minerconfig,  false,  true },
@@ -2978,32 +3252,33 @@ struct CMDS {
   { "summary",    summary,  false,  true },
   { "gpuenable",          gpuenable,      true, false },
   { "gpudisable",         gpudisable,     true, false },
-  { "gpurestart",         gpurestart,     true, false },
+  { "gpurestart",         gpurestart,     true, false, true },
   { "gpu",                gpudev,         false,  false },
   { "gpucount",           gpucount,       false,  true },
   { "switchpool",   switchpool, true, false },
   { "changestrategy",   api_pool_strategy, true, false },
-  { "addpool",    addpool,  true, false },
+  { "addpool",    addpool,  true, false, true },
   { "poolpriority", poolpriority, true, false },
   { "poolquota",    poolquota,  true, false },
   { "enablepool",   enablepool, true, false },
   { "disablepool",  disablepool,  true, false },
-  { "removepool",   removepool, true, false },
+  { "removepool",   removepool, true, false, true },
   { "changepoolprofile",   api_pool_profile, true, false },
   { "addprofile",    api_profile_add,  true, false },
   { "removeprofile",    api_profile_remove,  true, false },
   { "gpuintensity",       gpuintensity,   true, false },
   { "gpuxintensity",       gpuxintensity,   true, false },
   { "gpurawintensity",       gpurawintensity,   true, false },
-  { "gpumem",             gpumem,         true, false },
-  { "gpuengine",          gpuengine,      true, false },
-  { "gpufan",             gpufan,         true, false },
-  { "gpuvddc",            gpuvddc,        true, false },
-  { "save",   dosave,   true, false },
+  { "gpumem",             gpumem,         true, false, true },
+  { "gpuengine",          gpuengine,      true, false, true },
+  { "gpufan",             gpufan,         true, false, true },
+  { "gpuvddc",            gpuvddc,        true, false, true },
+  { "save",   dosave,   true, false, true },
   { "quit",   doquit,   true, false },
   { "privileged",   privileged, true, false },
   { "notify",   notify,   false,  true },
   { "devdetails",   devdetails, false,  true },
+  { "kernelprofile",  kernelprofile, false,  true },
   { "restart",    dorestart,  true, false },
   { "stats",    minerstats, false,  true },
   { "check",    checkcommand, false,  false },
@@ -3013,6 +3288,9 @@ struct CMDS {
   { "setconfig",    setconfig,  true, false },
   { "zero",   dozero,   true, false },
   { "lockstats",    lockstats,  true, true },
+  { "keepalive",    keepalive,  false,  true },
+  { "apistats",   apistats, false,  true },
+  { "subscribe",  subscribe,  false,  false },
   { NULL,     NULL,   false,  false }
 };
 
@@ -3056,6 +3334,59 @@ static void checkcommand(struct io_data *io_data, __maybe_unused SOCKETTYPE c, c
     io_close(io_data);
 }
 
+static void apistats(struct io_data *io_data, __maybe_unused SOCKETTYPE c, __maybe_unused char *param, bool isjson, __maybe_unused char group)
+{
+  struct api_data *root = NULL;
+  char buf[TMPBUFSIZ];
+  bool io_open = false;
+  uint64_t calls;
+  double avg, max, total;
+  int i;
+
+  message(io_data, MSG_APISTATS, 0, NULL, isjson);
+
+  if (isjson)
+    io_open = io_add(io_data, COMSTR JSON_APISTATS);
+
+  root = api_add_const(root, "Server", api_evented ? "epoll" : "blocking", false);
+  root = api_add_uint(root, "Connections", &api_conns, false);
+  root = api_add_int(root, "Open", &api_open, false);
+  root = api_add_int(root, "Keep-alive", &api_keepalives, false);
+  root = api_add_uint(root, "Requests", &api_requests, false);
+  root = api_add_uint(root, "Rate Limited", &api_limited, false);
+  root = api_add_uint(root, "Offloaded", &api_offloaded, false);
+  root = api_add_uint(root, "Timed Out", &api_timeouts, false);
+  root = api_add_uint(root, "Refused", &api_refused, false);
+  root = api_add_int(root, "Subscribers", &api_subscribers, false);
+  root = api_add_uint(root, "Pushed", &api_pushed, false);
+  root = api_add_uint(root, "Push Dropped", &api_push_dropped, false);
+  root = print_data(root, buf, isjson, false);
+  io_add(io_data, buf);
+
+  for (i = 0; cmds[i].name != NULL; i++) {
+    mutex_lock(&api_stats_lock);
+    calls = cmds[i].calls;
+    total = cmds[i].total;
+    max = cmds[i].max;
+    mutex_unlock(&api_stats_lock);
+
+    if (!calls)
+      continue;
+
+    avg = total / calls;
+    root = api_add_string(root, "Command", cmds[i].name, false);
+    root = api_add_uint64(root, "Calls", &calls, false);
+    root = api_add_double(root, "Average", &avg, false);
+    root = api_add_double(root, "Max", &max, false);
+    root = api_add_double(root, "Total", &total, false);
+    root = print_data(root, buf, isjson, isjson);
+    io_add(io_data, buf);
+  }
+
+  if (isjson && io_open)
+    io_close(io_data);
+}
+
 static void head_join(struct io_data *io_data, char *cmdptr, bool isjson, bool *firstjoin)
 {
   char *ptr;
@@ -3099,18 +3430,22 @@ static void tail_join(struct io_data *io_data, bool isjson)
   }
 }
 
-static void send_result(struct io_data *io_data, SOCKETTYPE c, bool isjson)
+// Completes the reply in io_data, it is sent with its terminating NUL
+static void end_result(struct io_data *io_data, bool isjson)
 {
-  int count, sendc, res, tosend, len, n;
-  char *buf = io_data->ptr;
-
-  strcpy(buf, io_data->ptr);
-
-  if (io_data->close)
-    strcat(buf, JSON_CLOSE);
+  if (io_data->close) {
+    io_add(io_data, JSON_CLOSE);
+    io_data->close = false;
+  }
 
   if (isjson)
-    strcat(buf, JSON_END);
+    io_add(io_data, JSON_END);
+}
+
+static void send_result(struct io_data *io_data, SOCKETTYPE c)
+{
+  int count, sendc, res, tosend, len, n;
+  char *buf = io_data->ptr;
 
   len = strlen(buf);
   tosend = len+1;
@@ -3163,6 +3498,212 @@ static void send_result(struct io_data *io_data, SOCKETTYPE c, bool isjson)
   }
 }
 
+static void cmd_latency(int i, struct timeval *tv_start, struct timeval *tv_end)
+{
+  double ms = tdiff(tv_end, tv_start) * 1000;
+
+  mutex_lock(&api_stats_lock);
+  cmds[i].calls++;
+  cmds[i].total += ms;
+  if (ms > cmds[i].max)
+    cmds[i].max = ms;
+  mutex_unlock(&api_stats_lock);
+}
+
+/* Handles the request in buf, n bytes and NUL terminated, and leaves the
+ * reply ready to send in io_data.  With defer a command marked offload, or
+ * any command while the worker is running one, is not run and false is
+ * returned, for the request to be handled again on the API worker. */
+static bool api_request(struct io_data *io_data, SOCKETTYPE c, char *buf, int n, char group, const char *connectaddr, bool defer)
+{
+  char param_buf[TMPBUFSIZ];
+  char cmdbuf[100];
+  char *cmd = NULL, *cmdptr, *cmdsbuf = NULL;
+  char *param;
+  json_error_t json_err;
+  json_t *json_config = NULL;
+  json_t *json_val;
+  struct timeval tv_start, tv_end;
+  bool isjson;
+  bool did, isjoin = false, firstjoin, deferred = false;
+  int i;
+
+  // Not cancelled holding the lock, tidyup() waits for the worker
+  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+  if (!defer)
+    mutex_lock(&api_cmd_lock);
+  else if (mutex_trylock(&api_cmd_lock)) {
+    // Never wait for the worker, queue behind it instead
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    return false;
+  }
+
+  // the time of the request in now
+  when = time(NULL);
+  io_reinit(io_data);
+
+  did = false;
+
+  if (*buf != ISJSON) {
+    isjson = false;
+
+    param = strchr(buf, SEPARATOR);
+    if (param != NULL)
+      *(param++) = '\0';
+
+    cmd = buf;
+  }
+  else {
+    isjson = true;
+
+    param = NULL;
+
+#if JANSSON_MAJOR_VERSION > 2 || (JANSSON_MAJOR_VERSION == 2 && JANSSON_MINOR_VERSION > 0)
+    json_config = json_loadb(buf, n, 0, &json_err);
+#elif JANSSON_MAJOR_VERSION > 1
+    json_config = json_loads(buf, 0, &json_err);
+#else
+    json_config = json_loads(buf, &json_err);
+#endif
+
+    if (!json_is_object(json_config)) {
+      message(io_data, MSG_INVJSON, 0, NULL, isjson);
+      end_result(io_data, isjson);
+      did = true;
+    } else {
+      json_val = json_object_get(json_config, JSON_COMMAND);
+      if (json_val == NULL) {
+        message(io_data, MSG_MISCMD, 0, NULL, isjson);
+        end_result(io_data, isjson);
+        did = true;
+      } else {
+        if (!json_is_string(json_val)) {
+          message(io_data, MSG_INVCMD, 0, NULL, isjson);
+          end_result(io_data, isjson);
+          did = true;
+        } else {
+          cmd = (char *)json_string_value(json_val);
+          json_val = json_object_get(json_config, JSON_PARAMETER);
+          if (json_is_string(json_val))
+            param = (char *)json_string_value(json_val);
+          else if (json_is_integer(json_val)) {
+            sprintf(param_buf, "%d", (int)json_integer_value(json_val));
+            param = param_buf;
+          } else if (json_is_real(json_val)) {
+            sprintf(param_buf, "%f", (double)json_real_value(json_val));
+            param = param_buf;
+          }
+        }
+      }
+    }
+  }
+
+  if (!did) {
+    if (strchr(cmd, CMDJOIN)) {
+      firstjoin = isjoin = true;
+      // cmd + leading and trailing '|' + '\0'
+      cmdsbuf = (char *)malloc(strlen(cmd) + 3);
+      if (!cmdsbuf)
+        quithere(1, "OOM cmdsbuf");
+      strcpy(cmdsbuf, "|");
+      param = NULL;
+    } else
+      firstjoin = isjoin = false;
+
+    cmdptr = cmd;
+    do {
+      did = false;
+      if (isjoin) {
+        cmd = strchr(cmdptr, CMDJOIN);
+        if (cmd)
+          *(cmd++) = '\0';
+        if (!*cmdptr)
+          goto inochi;
+      }
+
+      for (i = 0; cmds[i].name != NULL; i++) {
+        if (strcmp(cmdptr, cmds[i].name) == 0) {
+          if (defer && !isjoin && cmds[i].offload) {
+            did = deferred = true;
+            break;
+          }
+          sprintf(cmdbuf, "|%s|", cmdptr);
+          if (isjoin) {
+            if (strstr(cmdsbuf, cmdbuf)) {
+              did = true;
+              break;
+            }
+            strcat(cmdsbuf, cmdptr);
+            strcat(cmdsbuf, "|");
+            head_join(io_data, cmdptr, isjson, &firstjoin);
+            if (!cmds[i].joinable) {
+              message(io_data, MSG_ACCDENY, 0, cmds[i].name, isjson);
+              did = true;
+              tail_join(io_data, isjson);
+              break;
+            }
+          }
+          if (ISPRIVGROUP(group) || strstr(COMMANDS(group), cmdbuf)) {
+            cgtime(&tv_start);
+            (cmds[i].func)(io_data, c, param, isjson, group);
+            cgtime(&tv_end);
+            cmd_latency(i, &tv_start, &tv_end);
+          } else {
+            message(io_data, MSG_ACCDENY, 0, cmds[i].name, isjson);
+            applog(LOG_DEBUG, "API: access denied to '%s' for '%s' command", connectaddr, cmds[i].name);
+          }
+
+          did = true;
+          if (!isjoin)
+            end_result(io_data, isjson);
+          else
+            tail_join(io_data, isjson);
+          break;
+        }
+      }
+
+      if (!did) {
+        if (isjoin)
+          head_join(io_data, cmdptr, isjson, &firstjoin);
+        message(io_data, MSG_INVCMD, 0, NULL, isjson);
+        if (isjoin)
+          tail_join(io_data, isjson);
+        else
+          end_result(io_data, isjson);
+      }
+inochi:
+      if (isjoin)
+        cmdptr = cmd;
+    } while (isjoin && cmdptr);
+  }
+
+  if (isjoin)
+    end_result(io_data, isjson);
+
+  free(cmdsbuf);
+  if (json_config)
+    json_decref(json_config);
+
+  mutex_unlock(&api_cmd_lock);
+  pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+
+  return !deferred;
+}
+
+#ifdef HAVE_API_EPOLL
+// Lets the API worker finish the jobs queued so far, then ends it
+static void api_worker_end(void)
+{
+  if (!api_worker_started)
+    return;
+
+  api_worker_stop = true;
+  tq_push(api_job_q, NULL);
+  pthread_join(api_worker_pth, NULL);
+  api_worker_started = false;
+}
+#endif
+
 static void tidyup(__maybe_unused void *arg)
 {
   mutex_lock(&quit_restart_lock);
@@ -3182,6 +3723,11 @@ static void tidyup(__maybe_unused void *arg)
     ipaccess = NULL;
   }
 
+#ifdef HAVE_API_EPOLL
+  // Before its io_data goes
+  api_worker_end();
+#endif
+
   io_free();
 
   mutex_unlock(&quit_restart_lock);
@@ -3478,62 +4024,1006 @@ static bool check_connect(struct sockaddr_in *cli, char **connectaddr, char *gro
   return addrok;
 }
 
-static void mcast()
-{
-  struct sockaddr_in listen;
-  struct ip_mreq grp;
-  struct sockaddr_in came_from;
-  time_t bindstart;
-  char *binderror;
-  SOCKETTYPE mcast_sock;
-  SOCKETTYPE reply_sock;
-  socklen_t came_from_siz;
-  char *connectaddr;
-  ssize_t rep;
-  int bound;
-  int count;
-  int reply_port;
-  bool addrok;
-  char group;
+#ifdef HAVE_API_EPOLL
 
-  char expect[] = "sgminer-"; // first 8 bytes constant
-  char *expect_code;
-  size_t expect_code_len;
-  char buf[1024];
-  char replybuf[1024];
+/*
+ * Event server: one thread waits on the listening socket and every client
+ * connection with epoll, so a slow client only holds up itself.  A client
+ * that sends the keepalive command keeps its connection and may send more
+ * requests, each ended by a newline or NUL, without waiting for the replies
+ * in between.  Replies go out in order, each ended by a NUL as before.
+ * Commands marked offload run on the API worker thread while the other
+ * connections are served.  api_cmd_lock keeps to one command at a time, a
+ * request that finds it held is queued for the worker too.
+ *
+ * A connection that sends the subscribe command gets its reply ended by a
+ * newline, and from then on one line of JSON per event it asked for.  The
+ * miner threads format their events with api_push() and queue them for the
+ * API thread, which copies each to the output of the subscribers it matches.
+ */
 
-  memset(&grp, 0, sizeof(grp));
-  grp.imr_multiaddr.s_addr = inet_addr(opt_api_mcast_addr);
-  if (grp.imr_multiaddr.s_addr == INADDR_NONE)
-    quit(1, "Invalid Multicast Address");
-  grp.imr_interface.s_addr = INADDR_ANY;
+#define API_EVENTS 64
+// Connections over this are closed straight away
+#define API_MAX_CONNS 1024
+// Time a client has to send its request, and a keep-alive one to send more
+#define API_REQUEST_SECS 10
+#define API_KEEPALIVE_SECS 120
+// Requests and replies queued on one connection
+#define API_MAX_INPUT (64 * 1024)
+#define API_MAX_OUTPUT (4 * 1024 * 1024)
+// Requests a client may send at once, in seconds of --api-rate
+#define API_RATE_BURST 2
+// Events waiting for the API thread, and for a subscriber to read, past
+// which they are dropped
+#define API_PUSH_QUEUED 4096
+#define API_PUSH_MAX_OUTPUT (256 * 1024)
+// How often hashrates are pushed, and only those that moved this much
+#define API_PUSH_HASHRATE_SECS 5
+#define API_PUSH_HASHRATE_DELTA 0.01
+
+// Requests left to a client address under --api-rate
+struct api_client {
+  in_addr_t ip;
+  double tokens;
+  struct timeval last;
+  UT_hash_handle hh;
+};
 
-  mcast_sock = socket(AF_INET, SOCK_DGRAM, 0);
+struct api_conn {
+  SOCKETTYPE fd;
+  in_addr_t ip;
+  char connectaddr[16];
+  char group;
+  char *in, *out;
+  size_t inlen, insiz, outpos, outlen, outsiz;
+  int requests;
+  int push;       // API_PUSH_ events subscribed to
+  int push_pool, push_gpu;
+  unsigned int push_dropped;  // since the last event that fitted
+  bool keepalive;
+  bool eof;       // the client sends no more
+  bool done;      // close once the replies have been sent
+  bool busy;      // a request is with the API worker
+  bool closed;    // freed once the worker and the current events are done
+  bool writing;   // waiting for the socket to take more
+  time_t last;
+  struct list_head list;
+};
 
-  int optval = 1;
-  if (SOCKETFAIL(setsockopt(mcast_sock, SOL_SOCKET, SO_REUSEADDR, (const char *)(&optval), sizeof(optval)))) {
-    applog(LOG_ERR, "API mcast setsockopt SO_REUSEADDR failed (%s)%s", SOCKERRMSG, MUNAVAILABLE);
-    goto die;
-  }
+// A request for the API worker, and its reply
+struct api_job {
+  struct api_conn *conn;
+  SOCKETTYPE fd;
+  char group;
+  char connectaddr[16];
+  char *req, *reply;
+  int len;
+  size_t replylen;
+  // What the command asked of the connection, as api_conn_result() wants
+  bool keepalive;
+  int subscribe, sub_pool, sub_gpu;
+  struct list_head list;
+};
 
-  memset(&listen, 0, sizeof(listen));
-  listen.sin_family = AF_INET;
-  listen.sin_addr.s_addr = INADDR_ANY;
-  listen.sin_port = htons(opt_api_mcast_port);
+// An event line for the subscribers
+struct api_push {
+  int type;
+  int pool, gpu;  // -1 when it is not about one
+  char *line;
+  size_t len;
+  struct list_head list;
+};
 
-  // try for more than 1 minute ... in case the old one hasn't completely gone yet
-  bound = 0;
-  bindstart = time(NULL);
-  while (bound == 0) {
-    if (SOCKETFAIL(bind(mcast_sock, (struct sockaddr *)(&listen), sizeof(listen)))) {
-      binderror = SOCKERRMSG;
-      if ((time(NULL) - bindstart) > 61)
-        break;
-      else
-        cgsleep_ms(30000);
-    } else
-      bound = 1;
-  }
+static int api_epfd = -1;
+static int api_wake[2] = { -1, -1 };
+// epoll data of the listening socket and of the wake pipe
+static char api_listen_ev, api_wake_ev;
+static LIST_HEAD(api_conn_list);
+static LIST_HEAD(api_conn_dead);
+static struct api_client *api_clients;
+static pthread_mutex_t api_done_lock;
+static LIST_HEAD(api_jobs_done);
+// API_PUSH_ events some connection subscribes to, read by the miner threads
+static int api_push_mask;
+static pthread_mutex_t api_push_lock;
+static LIST_HEAD(api_pushes);
+static int api_pushes_queued;
+static unsigned int api_pushes_lost;
+// Send every hashrate next time, a subscriber has none yet
+static bool api_push_full;
+
+static void api_noblock(int fd)
+{
+  int flags = fcntl(fd, F_GETFL, 0);
+
+  fcntl(fd, F_SETFL, O_NONBLOCK | flags);
+}
+
+static void api_wakeup(void)
+{
+  char c = 0;
+
+  // A full pipe will wake the API thread anyway
+  if (write(api_wake[1], &c, 1) < 0 && errno != EAGAIN)
+    applog(LOG_WARNING, "API: wake failed: %s", strerror(errno));
+}
+
+static void *api_worker(void *userdata)
+{
+  struct io_data *io_data = (struct io_data *)userdata;
+  struct api_job *job;
+
+  RenameThread("APIWorker");
+
+  while (42) {
+    job = (struct api_job *)tq_pop(api_job_q, NULL);
+    if (!job) {
+      if (api_worker_stop)
+        break;
+      continue;
+    }
+
+    api_request(io_data, job->fd, job->req, job->len, job->group, job->connectaddr, false);
+    job->replylen = strlen(io_data->ptr) + 1;
+    job->reply = (char *)malloc(job->replylen);
+    if (unlikely(!job->reply))
+      quithere(1, "OOM API reply");
+    memcpy(job->reply, io_data->ptr, job->replylen);
+    job->keepalive = io_data->keepalive;
+    job->subscribe = io_data->subscribe;
+    job->sub_pool = io_data->sub_pool;
+    job->sub_gpu = io_data->sub_gpu;
+
+    mutex_lock(&api_done_lock);
+    list_add_tail(&job->list, &api_jobs_done);
+    mutex_unlock(&api_done_lock);
+    api_wakeup();
+  }
+
+  return NULL;
+}
+
+static bool api_client_allow(in_addr_t ip)
+{
+  struct api_client *client;
+  double burst = (double)opt_api_rate * API_RATE_BURST;
+  struct timeval now;
+
+  if (!opt_api_rate)
+    return true;
+
+  cgtime(&now);
+  HASH_FIND(hh, api_clients, &ip, sizeof(ip), client);
+  if (!client) {
+    client = (struct api_client *)calloc(1, sizeof(*client));
+    if (unlikely(!client))
+      quithere(1, "OOM API client");
+    client->ip = ip;
+    client->tokens = burst;
+    HASH_ADD(hh, api_clients, ip, sizeof(ip), client);
+  } else {
+    client->tokens += tdiff(&now, &client->last) * opt_api_rate;
+    if (client->tokens > burst)
+      client->tokens = burst;
+  }
+  client->last = now;
+
+  if (client->tokens < 1)
+    return false;
+  client->tokens -= 1;
+  return true;
+}
+
+static void api_conn_watch(struct api_conn *conn)
+{
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = (conn->eof ? 0 : EPOLLIN) | (conn->writing ? EPOLLOUT : 0);
+  ev.data.ptr = conn;
+  if (epoll_ctl(api_epfd, EPOLL_CTL_MOD, conn->fd, &ev))
+    applog(LOG_WARNING, "API: epoll_ctl failed: %s", strerror(errno));
+}
+
+static void api_conn_free(struct api_conn *conn)
+{
+  free(conn->in);
+  free(conn->out);
+  free(conn);
+}
+
+static void api_push_update(void)
+{
+  struct api_conn *conn, *tmp;
+  int mask = 0;
+
+  list_for_each_entry_safe(conn, tmp, &api_conn_list, list)
+    mask |= conn->push;
+  api_push_mask = mask;
+}
+
+/* Later events of this round may still name conn, so it is only freed by
+ * api_conn_reap(), or by api_jobs_finish() when it is busy */
+static void api_conn_close(struct api_conn *conn)
+{
+  epoll_ctl(api_epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+  CLOSESOCKET(conn->fd);
+  api_open--;
+  if (conn->keepalive)
+    api_keepalives--;
+  if (conn->push) {
+    api_subscribers--;
+    conn->push = 0;
+    api_push_update();
+  }
+
+  conn->closed = true;
+  if (conn->busy)
+    list_del(&conn->list);
+  else
+    list_move_tail(&conn->list, &api_conn_dead);
+}
+
+static void api_conn_reap(void)
+{
+  struct api_conn *conn, *tmp;
+
+  list_for_each_entry_safe(conn, tmp, &api_conn_dead, list) {
+    list_del(&conn->list);
+    api_conn_free(conn);
+  }
+}
+
+// Queues len bytes of reply, false if the client is not reading them
+static bool api_conn_reply(struct api_conn *conn, const char *buf, size_t len)
+{
+  if (conn->outpos) {
+    memmove(conn->out, conn->out + conn->outpos, conn->outlen - conn->outpos);
+    conn->outlen -= conn->outpos;
+    conn->outpos = 0;
+  }
+  if (conn->outlen + len > API_MAX_OUTPUT)
+    return false;
+  if (conn->outlen + len > conn->outsiz) {
+    size_t newsiz = conn->outsiz ? conn->outsiz : SOCKBUFALLOCSIZ;
+
+    while (newsiz < conn->outlen + len)
+      newsiz *= 2;
+    conn->out = (char *)realloc(conn->out, newsiz);
+    if (unlikely(!conn->out))
+      quithere(1, "OOM API output");
+    conn->outsiz = newsiz;
+  }
+  memcpy(conn->out + conn->outlen, buf, len);
+  conn->outlen += len;
+  return true;
+}
+
+/* Queues the reply to a request of conn, len bytes without its NUL, and
+ * takes up the keep-alive or subscription the command asked for */
+static bool api_conn_result(struct api_conn *conn, const char *reply, size_t len, bool keepalive,
+                            int subscribe, int sub_pool, int sub_gpu)
+{
+  if (subscribe) {
+    // Newline delimited JSON from the reply on
+    if (!api_conn_reply(conn, reply, len) || !api_conn_reply(conn, "\n", 1))
+      return false;
+    conn->push = subscribe;
+    conn->push_pool = sub_pool;
+    conn->push_gpu = sub_gpu;
+    api_subscribers++;
+    if (conn->push & API_PUSH_HASHRATE)
+      api_push_full = true;
+    api_push_update();
+    return true;
+  }
+
+  if (keepalive && !conn->keepalive) {
+    conn->keepalive = true;
+    api_keepalives++;
+  }
+  if (!api_conn_reply(conn, reply, len + 1))
+    return false;
+  if (!conn->keepalive)
+    conn->done = true;
+  return true;
+}
+
+// Sends what the socket takes, false on error
+static bool api_conn_send(struct api_conn *conn)
+{
+  bool writing;
+  ssize_t n;
+
+  while (conn->outpos < conn->outlen) {
+    n = send(conn->fd, conn->out + conn->outpos, conn->outlen - conn->outpos, 0);
+    if (SOCKETFAIL(n)) {
+      if (sock_blocks())
+        break;
+      applog(LOG_DEBUG, "API: send to %s failed: %s", conn->connectaddr, SOCKERRMSG);
+      return false;
+    }
+    conn->outpos += n;
+    conn->last = time(NULL);
+  }
+  if (conn->outpos == conn->outlen)
+    conn->outpos = conn->outlen = 0;
+
+  writing = conn->outlen > 0;
+  if (writing != conn->writing) {
+    conn->writing = writing;
+    api_conn_watch(conn);
+  }
+  return true;
+}
+
+// Reads what has arrived, false on error or too much unhandled input
+static bool api_conn_read(struct api_conn *conn)
+{
+  ssize_t n;
+
+  if (conn->inlen + 1 >= conn->insiz) {
+    size_t newsiz = conn->insiz ? conn->insiz * 2 : TMPBUFSIZ;
+
+    // Room for the NUL api_request() wants
+    if (newsiz > API_MAX_INPUT + 1) {
+      if (conn->insiz >= API_MAX_INPUT + 1) {
+        applog(LOG_DEBUG, "API: too many requests queued by %s", conn->connectaddr);
+        return false;
+      }
+      newsiz = API_MAX_INPUT + 1;
+    }
+    conn->in = (char *)realloc(conn->in, newsiz);
+    if (unlikely(!conn->in))
+      quithere(1, "OOM API input");
+    conn->insiz = newsiz;
+  }
+
+  n = recv(conn->fd, conn->in + conn->inlen, conn->insiz - conn->inlen - 1, 0);
+  if (SOCKETFAIL(n)) {
+    if (sock_blocks())
+      return true;
+    applog(LOG_DEBUG, "API: recv from %s failed: %s", conn->connectaddr, SOCKERRMSG);
+    return false;
+  }
+  if (n == 0) {
+    // Stop epoll reporting it over and over
+    conn->eof = true;
+    api_conn_watch(conn);
+  } else if (conn->done)
+    return true;
+
+  conn->inlen += n;
+  conn->last = time(NULL);
+  return true;
+}
+
+/* Handles the requests waiting on conn in order, until one goes to the
+ * worker.  req is room for a copy of the longest request. */
+static bool api_conn_requests(struct api_conn *conn, struct io_data *io_data, char *req)
+{
+  struct api_job *job;
+  size_t len, used;
+  bool isjson;
+
+  // A subscriber only listens
+  if (conn->push) {
+    conn->inlen = 0;
+    return true;
+  }
+
+  while (!conn->busy && !conn->done && conn->inlen) {
+    for (len = 0; len < conn->inlen; len++) {
+      if (conn->in[len] == '\n' || conn->in[len] == '\0')
+        break;
+    }
+    if (len < conn->inlen)
+      used = len + 1;
+    // A one-shot request needs no terminator, as it never did
+    else if (!conn->requests || conn->eof)
+      used = len;
+    else
+      break;
+
+    memcpy(req, conn->in, len);
+    while (len && req[len - 1] == '\r')
+      len--;
+    req[len] = '\0';
+
+    if (len) {
+      conn->requests++;
+      api_requests++;
+      applog(LOG_DEBUG, "API: recv command from %s: (%d) '%s'", conn->connectaddr, (int)len, req);
+
+      if (!api_client_allow(conn->ip)) {
+        api_limited++;
+        isjson = (*req == ISJSON);
+        when = time(NULL);
+        io_reinit(io_data);
+        message(io_data, MSG_RATELIMIT, 0, NULL, isjson);
+        end_result(io_data, isjson);
+      } else if (!api_request(io_data, conn->fd, req, len, conn->group, conn->connectaddr, api_worker_started)) {
+        // req was changed, give the worker the original
+        job = (struct api_job *)calloc(1, sizeof(*job));
+        if (unlikely(!job))
+          quithere(1, "OOM API job");
+        job->req = (char *)malloc(len + 1);
+        if (unlikely(!job->req))
+          quithere(1, "OOM API job");
+        memcpy(job->req, conn->in, len);
+        job->req[len] = '\0';
+        job->len = len;
+        job->conn = conn;
+        job->fd = conn->fd;
+        job->group = conn->group;
+        strcpy(job->connectaddr, conn->connectaddr);
+        conn->busy = true;
+        api_offloaded++;
+        tq_push(api_job_q, job);
+      }
+
+      if (!conn->busy) {
+        if (!api_conn_result(conn, io_data->ptr, strlen(io_data->ptr), io_data->keepalive,
+                             io_data->subscribe, io_data->sub_pool, io_data->sub_gpu))
+          return false;
+        if (conn->push) {
+          conn->inlen = 0;
+          return true;
+        }
+      }
+    }
+
+    memmove(conn->in, conn->in + used, conn->inlen - used);
+    conn->inlen -= used;
+    if (bye)
+      conn->done = true;
+  }
+
+  if (conn->done)
+    conn->inlen = 0;
+  else if (conn->eof && !conn->busy)
+    conn->done = true;
+  return true;
+}
+
+// Moves conn along, and closes it when it is finished with or broken
+static void api_conn_process(struct api_conn *conn, struct io_data *io_data, char *req)
+{
+  if (!api_conn_requests(conn, io_data, req) || !api_conn_send(conn) ||
+      (conn->done && !conn->busy && !conn->outlen))
+    api_conn_close(conn);
+}
+
+static void api_jobs_finish(struct io_data *io_data, char *req)
+{
+  struct api_job *job, *tmp;
+  struct api_conn *conn;
+  LIST_HEAD(done);
+
+  mutex_lock(&api_done_lock);
+  list_splice_init(&api_jobs_done, &done);
+  mutex_unlock(&api_done_lock);
+
+  list_for_each_entry_safe(job, tmp, &done, list) {
+    conn = job->conn;
+    conn->busy = false;
+    if (conn->closed)
+      api_conn_free(conn);
+    else if (!api_conn_result(conn, job->reply, job->replylen - 1, job->keepalive,
+                              job->subscribe, job->sub_pool, job->sub_gpu))
+      api_conn_close(conn);
+    else
+      api_conn_process(conn, io_data, req);
+    list_del(&job->list);
+    free(job->req);
+    free(job->reply);
+    free(job);
+  }
+}
+
+static void api_accept(SOCKETTYPE apisock)
+{
+  struct api_conn *conn;
+  struct epoll_event ev;
+  struct sockaddr_in cli;
+  socklen_t clisiz;
+  char *connectaddr;
+  char group;
+  SOCKETTYPE c;
+
+  while (42) {
+    clisiz = sizeof(cli);
+    c = accept(apisock, (struct sockaddr *)(&cli), &clisiz);
+    if (SOCKETFAIL(c)) {
+      if (!sock_blocks() && errno != ECONNABORTED)
+        applog(LOG_WARNING, "API: accept failed (%s)", SOCKERRMSG);
+      return;
+    }
+    api_conns++;
+
+    if (!check_connect(&cli, &connectaddr, &group)) {
+      applog(LOG_DEBUG, "API: connection from %s - Ignored", connectaddr);
+      CLOSESOCKET(c);
+      continue;
+    }
+    if (api_open >= API_MAX_CONNS) {
+      applog(LOG_DEBUG, "API: connection from %s - Refused, %d open", connectaddr, api_open);
+      api_refused++;
+      CLOSESOCKET(c);
+      continue;
+    }
+    applog(LOG_DEBUG, "API: connection from %s - Accepted", connectaddr);
+
+    conn = (struct api_conn *)calloc(1, sizeof(*conn));
+    if (unlikely(!conn))
+      quithere(1, "OOM API connection");
+    api_noblock(c);
+    conn->fd = c;
+    conn->ip = cli.sin_addr.s_addr;
+    snprintf(conn->connectaddr, sizeof(conn->connectaddr), "%s", connectaddr);
+    conn->group = group;
+    conn->last = time(NULL);
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = conn;
+    if (epoll_ctl(api_epfd, EPOLL_CTL_ADD, c, &ev)) {
+      applog(LOG_WARNING, "API: epoll_ctl failed: %s", strerror(errno));
+      CLOSESOCKET(c);
+      api_conn_free(conn);
+      continue;
+    }
+    list_add_tail(&conn->list, &api_conn_list);
+    api_open++;
+  }
+}
+
+// Closes idle connections and forgets clients that have their burst back
+static void api_sweep(void)
+{
+  struct api_client *client, *ctmp;
+  struct api_conn *conn, *tmp;
+  struct timeval now;
+
+  cgtime(&now);
+  list_for_each_entry_safe(conn, tmp, &api_conn_list, list) {
+    if (conn->busy || conn->push)
+      continue;
+    if (now.tv_sec - conn->last >= (conn->keepalive ? API_KEEPALIVE_SECS : API_REQUEST_SECS)) {
+      applog(LOG_DEBUG, "API: connection from %s timed out", conn->connectaddr);
+      api_timeouts++;
+      api_conn_close(conn);
+    }
+  }
+
+  HASH_ITER(hh, api_clients, client, ctmp) {
+    if (tdiff(&now, &client->last) >= API_RATE_BURST) {
+      HASH_DEL(api_clients, client);
+      free(client);
+    }
+  }
+}
+
+/* Queues the line {"event":"<type>","when":<now>,<fmt>} for the subscribers
+ * to type.  Called from any thread. */
+static void api_push(int type, int pool, int gpu, const char *fmt, ...)
+{
+  struct api_push *push;
+  char buf[TMPBUFSIZ];
+  va_list ap;
+  int len, i;
+
+  for (i = 0; push_names[i].mask != type; i++)
+    ;
+  len = snprintf(buf, sizeof(buf), "{\"event\":\"%s\",\"when\":%lu,", push_names[i].name, (unsigned long)time(NULL));
+  va_start(ap, fmt);
+  len += vsnprintf(buf + len, sizeof(buf) - len, fmt, ap);
+  va_end(ap);
+  if (len > (int)sizeof(buf) - 3)
+    return;
+  buf[len++] = '}';
+  buf[len++] = '\n';
+
+  push = (struct api_push *)malloc(sizeof(*push));
+  if (unlikely(!push))
+    quithere(1, "OOM API push");
+  push->line = (char *)malloc(len);
+  if (unlikely(!push->line))
+    quithere(1, "OOM API push");
+  memcpy(push->line, buf, len);
+  push->len = len;
+  push->type = type;
+  push->pool = pool;
+  push->gpu = gpu;
+
+  mutex_lock(&api_push_lock);
+  if (api_pushes_queued >= API_PUSH_QUEUED) {
+    api_pushes_lost++;
+    mutex_unlock(&api_push_lock);
+    free(push->line);
+    free(push);
+    return;
+  }
+  list_add_tail(&push->list, &api_pushes);
+  api_pushes_queued++;
+  mutex_unlock(&api_push_lock);
+  api_wakeup();
+}
+
+static bool api_push_wanted(struct api_conn *conn, struct api_push *push)
+{
+  return (conn->push & push->type) &&
+         (conn->push_pool < 0 || push->pool < 0 || conn->push_pool == push->pool) &&
+         (conn->push_gpu < 0 || push->gpu < 0 || conn->push_gpu == push->gpu);
+}
+
+/* Copies the queued events to the subscribers that want them.  One that
+ * has fallen too far behind misses events, and is told how many with a
+ * dropped event once it catches up. */
+static void api_push_deliver(void)
+{
+  struct api_push *push, *ptmp;
+  struct api_conn *conn, *tmp;
+  char dropped[80];
+  int len;
+  LIST_HEAD(pushes);
+
+  mutex_lock(&api_push_lock);
+  list_splice_init(&api_pushes, &pushes);
+  api_pushes_queued = 0;
+  api_push_dropped += api_pushes_lost;
+  api_pushes_lost = 0;
+  mutex_unlock(&api_push_lock);
+
+  list_for_each_entry_safe(push, ptmp, &pushes, list) {
+    list_for_each_entry_safe(conn, tmp, &api_conn_list, list) {
+      if (!api_push_wanted(conn, push))
+        continue;
+      if (conn->outlen - conn->outpos + push->len + sizeof(dropped) > API_PUSH_MAX_OUTPUT) {
+        conn->push_dropped++;
+        api_push_dropped++;
+        continue;
+      }
+      if (conn->push_dropped) {
+        len = snprintf(dropped, sizeof(dropped), "{\"event\":\"dropped\",\"when\":%lu,\"count\":%u}\n",
+                       (unsigned long)time(NULL), conn->push_dropped);
+        api_conn_reply(conn, dropped, len);
+        conn->push_dropped = 0;
+      }
+      api_conn_reply(conn, push->line, push->len);
+      api_pushed++;
+    }
+    list_del(&push->list);
+    free(push->line);
+    free(push);
+  }
+
+  list_for_each_entry_safe(conn, tmp, &api_conn_list, list) {
+    if (conn->push && conn->outlen && !api_conn_send(conn))
+      api_conn_close(conn);
+  }
+}
+
+/* Pushes the hashrates that have moved by more than API_PUSH_HASHRATE_DELTA
+ * since they were last pushed, and the total */
+static void api_push_hashrate(void)
+{
+  static double *rates, total = -1;
+  static int nrates;
+  struct cgpu_info *cgpu;
+  char buf[TMPBUFSIZ];
+  bool full = api_push_full;
+  size_t len = 0;
+  double rate;
+  int i, n = total_devices;
+
+  api_push_full = false;
+  if (n > nrates) {
+    rates = (double *)realloc(rates, n * sizeof(*rates));
+    if (unlikely(!rates))
+      quithere(1, "OOM API hashrates");
+    for (i = nrates; i < n; i++)
+      rates[i] = -1;
+    nrates = n;
+  }
+
+  buf[0] = '\0';
+  for (i = 0; i < n && len < sizeof(buf) - 64; i++) {
+    cgpu = get_devices(i);
+    if (!cgpu)
+      continue;
+    rate = cgpu->rolling;
+    if (!full && fabs(rate - rates[i]) <= rates[i] * API_PUSH_HASHRATE_DELTA)
+      continue;
+    rates[i] = rate;
+    len += snprintf(buf + len, sizeof(buf) - len, "%s\"%d\":%.4f", len ? "," : "", cgpu->device_id, rate);
+  }
+
+  if (!len && !full && fabs(total_rolling - total) <= total * API_PUSH_HASHRATE_DELTA)
+    return;
+  total = total_rolling;
+  api_push(API_PUSH_HASHRATE, -1, -1, "\"mhs\":%.4f,\"gpus\":{%s}", total, buf);
+}
+
+void api_push_share(const struct work *work, const char *result, const char *reason, double latency)
+{
+  struct cgpu_info *cgpu;
+  double diff = work->work_difficulty;
+  char lat[32] = "", *esc = NULL;
+  int gpu;
+
+  if (!(api_push_mask & API_PUSH_SHARE))
+    return;
+
+  cgpu = get_thr_cgpu(work->thr_id);
+  gpu = cgpu ? cgpu->device_id : -1;
+  if (work->pool->algorithm.type == ALGO_ETHASH)
+    diff /= 1e9;
+  if (latency >= 0)
+    snprintf(lat, sizeof(lat), ",\"latency\":%.1f", latency);
+  if (reason)
+    esc = escape_string((char *)reason, true);
+
+  api_push(API_PUSH_SHARE, work->pool->pool_no, gpu,
+           "\"result\":\"%s\",\"pool\":%d,\"gpu\":%d,\"diff\":%.6g%s%s%s%s",
+           result, work->pool->pool_no, gpu, diff, lat,
+           esc ? ",\"reason\":\"" : "", esc ? esc : "", esc ? "\"" : "");
+
+  if (esc && esc != reason)
+    free(esc);
+}
+
+void api_push_device(struct cgpu_info *cgpu)
+{
+  if (!(api_push_mask & API_PUSH_DEVICE))
+    return;
+
+  api_push(API_PUSH_DEVICE, -1, cgpu->device_id, "\"gpu\":%d,\"status\":\"%s\"",
+           cgpu->device_id, status2str(cgpu->status));
+}
+
+void api_push_pool(struct pool *pool, struct pool *last_pool)
+{
+  char *url;
+
+  if (!(api_push_mask & API_PUSH_POOL))
+    return;
+
+  url = escape_string(pool->rpc_url, true);
+  api_push(API_PUSH_POOL, pool->pool_no, -1, "\"pool\":%d,\"url\":\"%s\",\"from\":%d",
+           pool->pool_no, url, last_pool ? last_pool->pool_no : -1);
+  if (url != pool->rpc_url)
+    free(url);
+}
+
+void api_push_dag(struct cgpu_info *cgpu, unsigned int epoch, double progress)
+{
+  if (!(api_push_mask & API_PUSH_DAG) || !cgpu)
+    return;
+
+  api_push(API_PUSH_DAG, -1, cgpu->device_id, "\"gpu\":%d,\"epoch\":%u,\"progress\":%.1f",
+           cgpu->device_id, epoch, progress);
+}
+
+// False if epoll cannot be used
+static bool api_serve(SOCKETTYPE apisock, struct io_data *io_data)
+{
+  struct epoll_event ev, evs[API_EVENTS];
+  struct api_conn *conn, *tmp;
+  time_t now, swept = 0, hashed = 0;
+  char *req, c;
+  int i, n;
+
+  api_epfd = epoll_create(API_EVENTS);
+  if (api_epfd < 0 || pipe(api_wake)) {
+    applog(LOG_WARNING, "API epoll initialisation failed (%s) - serving one connection at a time", strerror(errno));
+    return false;
+  }
+  api_noblock(apisock);
+  api_noblock(api_wake[0]);
+  api_noblock(api_wake[1]);
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = &api_listen_ev;
+  epoll_ctl(api_epfd, EPOLL_CTL_ADD, apisock, &ev);
+  ev.data.ptr = &api_wake_ev;
+  epoll_ctl(api_epfd, EPOLL_CTL_ADD, api_wake[0], &ev);
+
+  req = (char *)malloc(API_MAX_INPUT + 1);
+  if (unlikely(!req))
+    quithere(1, "OOM API request");
+
+  mutex_init(&api_done_lock);
+  mutex_init(&api_push_lock);
+  api_job_q = tq_new();
+  if (unlikely(!api_job_q))
+    quit(1, "Failed to tq_new in api_serve");
+  if (unlikely(pthread_create(&api_worker_pth, NULL, api_worker, sock_io_new())))
+    quit(1, "API worker thread create failed");
+  api_worker_started = true;
+  api_evented = true;
+
+  while (!bye) {
+    n = epoll_wait(api_epfd, evs, API_EVENTS, 1000);
+    if (n < 0 && errno != EINTR) {
+      applog(LOG_ERR, "API failed (%s)%s", strerror(errno), UNAVAILABLE);
+      break;
+    }
+
+    for (i = 0; i < n && !bye; i++) {
+      if (evs[i].data.ptr == &api_listen_ev)
+        api_accept(apisock);
+      else if (evs[i].data.ptr == &api_wake_ev) {
+        while (read(api_wake[0], &c, 1) > 0)
+          ;
+        api_jobs_finish(io_data, req);
+        api_push_deliver();
+      } else {
+        conn = (struct api_conn *)evs[i].data.ptr;
+        if (conn->closed)
+          continue;
+        // The client has gone, the replies cannot be sent
+        if (evs[i].events & (EPOLLERR | EPOLLHUP))
+          api_conn_close(conn);
+        else if ((evs[i].events & EPOLLIN) && !api_conn_read(conn))
+          api_conn_close(conn);
+        else
+          api_conn_process(conn, io_data, req);
+      }
+    }
+    api_conn_reap();
+
+    now = time(NULL);
+    if (now != swept) {
+      swept = now;
+      api_sweep();
+      if ((api_push_mask & API_PUSH_HASHRATE) &&
+          (api_push_full || now - hashed >= API_PUSH_HASHRATE_SECS)) {
+        hashed = now;
+        api_push_hashrate();
+      }
+      api_conn_reap();
+    }
+  }
+
+  // Last chance for the reply to a quit or restart, the worker may have run it
+  api_worker_end();
+  api_jobs_finish(io_data, req);
+  list_for_each_entry_safe(conn, tmp, &api_conn_list, list) {
+    api_conn_send(conn);
+    api_conn_close(conn);
+  }
+  api_conn_reap();
+  free(req);
+  return true;
+}
+
+#else
+
+// Nothing can subscribe without the event server
+void api_push_share(__maybe_unused const struct work *work, __maybe_unused const char *result,
+                    __maybe_unused const char *reason, __maybe_unused double latency)
+{
+}
+
+void api_push_device(__maybe_unused struct cgpu_info *cgpu)
+{
+}
+
+void api_push_pool(__maybe_unused struct pool *pool, __maybe_unused struct pool *last_pool)
+{
+}
+
+void api_push_dag(__maybe_unused struct cgpu_info *cgpu, __maybe_unused unsigned int epoch,
+                  __maybe_unused double progress)
+{
+}
+
+#endif /* HAVE_API_EPOLL */
+
+/* One connection at a time: accept, read the request, reply and close */
+static void api_accept_loop(SOCKETTYPE apisock, struct io_data *io_data)
+{
+  char buf[TMPBUFSIZ];
+  struct sockaddr_in cli;
+  socklen_t clisiz;
+  char *connectaddr;
+  bool addrok;
+  char group;
+  SOCKETTYPE c;
+  int n;
+
+  while (!bye) {
+    clisiz = sizeof(cli);
+    if (SOCKETFAIL(c = accept(apisock, (struct sockaddr *)(&cli), &clisiz))) {
+      applog(LOG_ERR, "API failed (%s)%s (%d)", SOCKERRMSG, UNAVAILABLE, (int)apisock);
+      return;
+    }
+    api_conns++;
+
+    addrok = check_connect(&cli, &connectaddr, &group);
+    applog(LOG_DEBUG, "API: connection from %s - %s",
+          connectaddr, addrok ? "Accepted" : "Ignored");
+
+    if (addrok) {
+      n = recv(c, &buf[0], TMPBUFSIZ-1, 0);
+      if (SOCKETFAIL(n))
+        buf[0] = '\0';
+      else
+        buf[n] = '\0';
+
+      if (SOCKETFAIL(n))
+        applog(LOG_DEBUG, "API: recv failed: %s", SOCKERRMSG);
+      else
+        applog(LOG_DEBUG, "API: recv command: (%d) '%s'", n, buf);
+
+      if (!SOCKETFAIL(n)) {
+        api_requests++;
+        api_request(io_data, c, buf, n, group, connectaddr, false);
+        send_result(io_data, c);
+      }
+    }
+    CLOSESOCKET(c);
+  }
+}
+
+static void mcast()
+{
+  struct sockaddr_in listen;
+  struct ip_mreq grp;
+  struct sockaddr_in came_from;
+  time_t bindstart;
+  char *binderror;
+  SOCKETTYPE mcast_sock;
+  SOCKETTYPE reply_sock;
+  socklen_t came_from_siz;
+  char *connectaddr;
+  ssize_t rep;
+  int bound;
+  int count;
+  int reply_port;
+  bool addrok;
+  char group;
+
+  char expect[] = "sgminer-"; // first 8 bytes constant
+  char *expect_code;
+  size_t expect_code_len;
+  char buf[1024];
+  char replybuf[1024];
+
+  memset(&grp, 0, sizeof(grp));
+  grp.imr_multiaddr.s_addr = inet_addr(opt_api_mcast_addr);
+  if (grp.imr_multiaddr.s_addr == INADDR_NONE)
+    quit(1, "Invalid Multicast Address");
+  grp.imr_interface.s_addr = INADDR_ANY;
+
+  mcast_sock = socket(AF_INET, SOCK_DGRAM, 0);
+
+  int optval = 1;
+  if (SOCKETFAIL(setsockopt(mcast_sock, SOL_SOCKET, SO_REUSEADDR, (const char *)(&optval), sizeof(optval)))) {
+    applog(LOG_ERR, "API mcast setsockopt SO_REUSEADDR failed (%s)%s", SOCKERRMSG, MUNAVAILABLE);
+    goto die;
+  }
+
+  memset(&listen, 0, sizeof(listen));
+  listen.sin_family = AF_INET;
+  listen.sin_addr.s_addr = INADDR_ANY;
+  listen.sin_port = htons(opt_api_mcast_port);
+
+  // try for more than 1 minute ... in case the old one hasn't completely gone yet
+  bound = 0;
+  bindstart = time(NULL);
+  while (bound == 0) {
+    if (SOCKETFAIL(bind(mcast_sock, (struct sockaddr *)(&listen), sizeof(listen)))) {
+      binderror = SOCKERRMSG;
+      if ((time(NULL) - bindstart) > 61)
+        break;
+      else
+        cgsleep_ms(30000);
+    } else
+      bound = 1;
+  }
 
   if (bound == 0) {
     applog(LOG_ERR, "API mcast bind to port %d failed (%s)%s", opt_api_port, binderror, MUNAVAILABLE);
@@ -3649,28 +5139,11 @@ void api(int api_thr_id)
 {
   struct io_data *io_data;
   struct thr_info bye_thr;
-  char buf[TMPBUFSIZ];
-  char param_buf[TMPBUFSIZ];
-  SOCKETTYPE c;
-  int n, bound;
-  char *connectaddr;
+  int bound;
   char *binderror;
   time_t bindstart;
   short int port = opt_api_port;
   struct sockaddr_in serv;
-  struct sockaddr_in cli;
-  socklen_t clisiz;
-  char cmdbuf[100];
-  char *cmd = NULL, *cmdptr, *cmdsbuf = NULL;
-  char *param;
-  bool addrok;
-  char group;
-  json_error_t json_err;
-  json_t *json_config = NULL;
-  json_t *json_val;
-  bool isjson;
-  bool did, isjoin = false, firstjoin;
-  int i;
 
   SOCKETTYPE *apisock;
 
@@ -3686,6 +5159,8 @@ void api(int api_thr_id)
   io_data = sock_io_new();
 
   mutex_init(&quit_restart_lock);
+  mutex_init(&api_stats_lock);
+  mutex_init(&api_cmd_lock);
 
   pthread_cleanup_push(tidyup, (void *)apisock);
   my_thr_id = api_thr_id;
@@ -3783,176 +5258,11 @@ void api(int api_thr_id)
   if (opt_api_mcast)
     mcast_init();
 
-  while (!bye) {
-    clisiz = sizeof(cli);
-    if (SOCKETFAIL(c = accept(*apisock, (struct sockaddr *)(&cli), &clisiz))) {
-      applog(LOG_ERR, "API failed (%s)%s (%d)", SOCKERRMSG, UNAVAILABLE, (int)*apisock);
-      goto die;
-    }
-
-    addrok = check_connect(&cli, &connectaddr, &group);
-    applog(LOG_DEBUG, "API: connection from %s - %s",
-          connectaddr, addrok ? "Accepted" : "Ignored");
-
-    if (addrok) {
-      n = recv(c, &buf[0], TMPBUFSIZ-1, 0);
-      if (SOCKETFAIL(n))
-        buf[0] = '\0';
-      else
-        buf[n] = '\0';
-
-      if (SOCKETFAIL(n))
-        applog(LOG_DEBUG, "API: recv failed: %s", SOCKERRMSG);
-      else
-        applog(LOG_DEBUG, "API: recv command: (%d) '%s'", n, buf);
-
-      if (!SOCKETFAIL(n)) {
-        // the time of the request in now
-        when = time(NULL);
-        io_reinit(io_data);
-
-        did = false;
-
-        if (*buf != ISJSON) {
-          isjson = false;
-
-          param = strchr(buf, SEPARATOR);
-          if (param != NULL)
-            *(param++) = '\0';
-
-          cmd = buf;
-        }
-        else {
-          isjson = true;
-
-          param = NULL;
-
-#if JANSSON_MAJOR_VERSION > 2 || (JANSSON_MAJOR_VERSION == 2 && JANSSON_MINOR_VERSION > 0)
-          json_config = json_loadb(buf, n, 0, &json_err);
-#elif JANSSON_MAJOR_VERSION > 1
-          json_config = json_loads(buf, 0, &json_err);
-#else
-          json_config = json_loads(buf, &json_err);
+#ifdef HAVE_API_EPOLL
+  if (!api_serve(*apisock, io_data))
 #endif
+    api_accept_loop(*apisock, io_data);
 
-          if (!json_is_object(json_config)) {
-            message(io_data, MSG_INVJSON, 0, NULL, isjson);
-            send_result(io_data, c, isjson);
-            did = true;
-          } else {
-            json_val = json_object_get(json_config, JSON_COMMAND);
-            if (json_val == NULL) {
-              message(io_data, MSG_MISCMD, 0, NULL, isjson);
-              send_result(io_data, c, isjson);
-              did = true;
-            } else {
-              if (!json_is_string(json_val)) {
-                message(io_data, MSG_INVCMD, 0, NULL, isjson);
-                send_result(io_data, c, isjson);
-                did = true;
-              } else {
-                cmd = (char *)json_string_value(json_val);
-                json_val = json_object_get(json_config, JSON_PARAMETER);
-                if (json_is_string(json_val))
-                  param = (char *)json_string_value(json_val);
-                else if (json_is_integer(json_val)) {
-                  sprintf(param_buf, "%d", (int)json_integer_value(json_val));
-                  param = param_buf;
-                } else if (json_is_real(json_val)) {
-                  sprintf(param_buf, "%f", (double)json_real_value(json_val));
-                  param = param_buf;
-                }
-              }
-            }
-          }
-        }
-
-        if (!did) {
-          if (strchr(cmd, CMDJOIN)) {
-            firstjoin = isjoin = true;
-            // cmd + leading '|' + '\0'
-            cmdsbuf = (char *)malloc(strlen(cmd) + 2);
-            if (!cmdsbuf)
-              quithere(1, "OOM cmdsbuf");
-            strcpy(cmdsbuf, "|");
-            param = NULL;
-          } else
-            firstjoin = isjoin = false;
-
-          cmdptr = cmd;
-          do {
-            did = false;
-            if (isjoin) {
-              cmd = strchr(cmdptr, CMDJOIN);
-              if (cmd)
-                *(cmd++) = '\0';
-              if (!*cmdptr)
-                goto inochi;
-            }
-
-            for (i = 0; cmds[i].name != NULL; i++) {
-              if (strcmp(cmdptr, cmds[i].name) == 0) {
-                sprintf(cmdbuf, "|%s|", cmdptr);
-                if (isjoin) {
-                  if (strstr(cmdsbuf, cmdbuf)) {
-                    did = true;
-                    break;
-                  }
-                  strcat(cmdsbuf, cmdptr);
-                  strcat(cmdsbuf, "|");
-                  head_join(io_data, cmdptr, isjson, &firstjoin);
-                  if (!cmds[i].joinable) {
-                    message(io_data, MSG_ACCDENY, 0, cmds[i].name, isjson);
-                    did = true;
-                    tail_join(io_data, isjson);
-                    break;
-                  }
-                }
-                if (ISPRIVGROUP(group) || strstr(COMMANDS(group), cmdbuf))
-                  (cmds[i].func)(io_data, c, param, isjson, group);
-                else {
-                  message(io_data, MSG_ACCDENY, 0, cmds[i].name, isjson);
-                  applog(LOG_DEBUG, "API: access denied to '%s' for '%s' command", connectaddr, cmds[i].name);
-                }
-
-                did = true;
-                if (!isjoin)
-                  send_result(io_data, c, isjson);
-                else
-                  tail_join(io_data, isjson);
-                break;
-              }
-            }
-
-            if (!did) {
-              if (isjoin)
-                head_join(io_data, cmdptr, isjson, &firstjoin);
-              message(io_data, MSG_INVCMD, 0, NULL, isjson);
-              if (isjoin)
-                tail_join(io_data, isjson);
-              else
-                send_result(io_data, c, isjson);
-            }
-inochi:
-            if (isjoin)
-              cmdptr = cmd;
-          } while (isjoin && cmdptr);
-        }
-
-        if (isjoin)
-          send_result(io_data, c, isjson);
-
-        if (isjson && json_is_object(json_config))
-          json_decref(json_config);
-      }
-    }
-    CLOSESOCKET(c);
-  }
-die:
-  /* Blank line fix for older compilers since pthread_cleanup_pop is a
-   * macro that gets confused by a label existing immediately before it
-   */
-  ;
   pthread_cleanup_pop(true);
 
   free(apisock);
@@ -11,6 +11,14 @@
 // Number of requests to queue - normally would be small
 #define QUEUE 100
 
+// Events a connection can subscribe to
+#define API_PUSH_SHARE    1
+#define API_PUSH_DEVICE   2
+#define API_PUSH_POOL     4
+#define API_PUSH_DAG      8
+#define API_PUSH_HASHRATE 16
+#define API_PUSH_ALL      31
+
 #define COMSTR ","
 #define SEPSTR "|"
 
@@ -38,6 +46,8 @@
 #define _MINECOIN "COIN"
 #define _DEBUGSET "DEBUG"
 #define _SETCONFIG  "SETCONFIG"
+#define _KERNELPROFILE  "KERNELPROFILE"
+#define _APISTATS  "APISTATS"
 
 #define JSON0   "{"
 #define JSON1   "\""
@@ -67,6 +77,8 @@
 #define JSON_MINECOIN JSON1 _MINECOIN JSON2
 #define JSON_DEBUGSET JSON1 _DEBUGSET JSON2
 #define JSON_SETCONFIG  JSON1 _SETCONFIG JSON2
+#define JSON_KERNELPROFILE  JSON1 _KERNELPROFILE JSON2
+#define JSON_APISTATS  JSON1 _APISTATS JSON2
 
 #define JSON_END  JSON4 JSON5
 #define JSON_END_TRUNCATED  JSON4_TRUNCATED JSON5
@@ -186,6 +198,17 @@
 #define MSG_INVRAWINT 142
 #define MSG_GPURAWINT 143
 
+#define MSG_KPROFILE 144
+#define MSG_KPROFDIS 145
+
+#define MSG_KEEPALIVE 146
+#define MSG_KEEPDIS 147
+#define MSG_APISTATS 148
+#define MSG_RATELIMIT 149
+#define MSG_SUBSCRIBE 150
+#define MSG_SUBDIS 151
+#define MSG_INVSUB 152
+
 enum code_severity {
   SEVERITY_ERR,
   SEVERITY_WARN,
@@ -245,6 +268,9 @@ struct io_data {
   char *cur;
   bool sock;
   bool close;
+  bool keepalive;   // set by the keepalive command
+  int subscribe;    // API_PUSH_ events asked for by the subscribe command
+  int sub_pool, sub_gpu;  // only events of this pool or GPU, -1 for all
 };
 
 struct io_list {
@@ -0,0 +1,1134 @@
+/*
+ * Copyright 2013-2014 sgminer developers (see AUTHORS.md)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 3 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+/*
+ * CPU hash benchmark (--bench-cpu).  Times the CPU hash (regenhash) of every
+ * registered algorithm on the benchmark block.  Algorithms with vectorised
+ * code have each implementation the running CPU supports timed and checked
+ * against their reference path.  Optionally measures scaling across threads
+ * and saves the results as JSON or compares them against a saved baseline.
+ *
+ * OpenCL kernel benchmark (--bench-kernel), see bench_kernel() below.
+ *
+ * Stratum parser benchmark (--bench-stratum), see bench_stratum() below.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <jansson.h>
+
+#include "miner.h"
+#include "bench.h"
+#include "bench_block.h"
+#include "ocl.h"
+#include "findnonce.h"
+#include "algorithm/scrypt.h"
+#include "algorithm/neoscrypt.h"
+#include "algorithm/yescrypt.h"
+#include "algorithm/lyra2re.h"
+#include "algorithm/lyra2rev2.h"
+#include "sph/sph_aes_ni.h"
+#include "stratum_json.h"
+#include "config_parser.h"
+
+bool opt_bench_cpu;
+int opt_bench_cpu_secs = 2;
+int opt_bench_cpu_threads = 1;
+int opt_bench_cpu_tolerance = 10;
+char *opt_bench_cpu_algos;
+char *opt_bench_cpu_json;
+char *opt_bench_cpu_baseline;
+bool opt_bench_kernel;
+int opt_bench_kernel_secs = 1;
+char *opt_bench_kernel_intensity;
+char *opt_bench_kernel_worksize;
+char *opt_bench_stratum;
+int opt_bench_stratum_secs = 2;
+
+#define BENCH_WORKS 64
+#define BENCH_MAX_ALGOS 128
+
+static json_t *bench_results;   /* array written to --bench-cpu-json */
+static json_t *bench_baseline;  /* results array of --bench-cpu-baseline */
+static bool bench_ok;
+
+struct bench_algo {
+  const char *name;               /* passed to set_algorithm() */
+  const cpu_hash_path_t *paths;   /* reference path first */
+  bool (*selftest)(void);         /* known answer tests, may be NULL */
+};
+
+static bool bench_always(void)
+{
+  return true;
+}
+
+/* Algorithms without a table of their own: whatever regenhash dispatches to */
+static void bench_hash_regenhash(struct work *works, unsigned int n)
+{
+  unsigned int i;
+
+  for (i = 0; i < n; i++)
+    works[i].pool->algorithm.regenhash(&works[i]);
+}
+
+static const cpu_hash_path_t regenhash_paths[] = {
+  { "regenhash", 1, bench_always, bench_hash_regenhash },
+  { NULL, 0, NULL, NULL }
+};
+
+/*
+ * The sph ECHO, SHAvite-3 and Groestl code picks its AES implementation
+ * globally, so the algorithms built on them share one set of paths that
+ * select it and then run the normal regenhash.
+ */
+static void bench_sph_aes_hash(struct work *works, unsigned int n, int impl)
+{
+  sph_aes_ni_set(impl);
+  bench_hash_regenhash(works, n);
+}
+
+static bool bench_have_aesni(void) { return sph_aes_ni_available(SPH_AES_NI); }
+static bool bench_have_vaes(void) { return sph_aes_ni_available(SPH_AES_VAES); }
+static void bench_hash_tables(struct work *works, unsigned int n) { bench_sph_aes_hash(works, n, SPH_AES_TABLES); }
+static void bench_hash_aesni(struct work *works, unsigned int n) { bench_sph_aes_hash(works, n, SPH_AES_NI); }
+static void bench_hash_vaes(struct work *works, unsigned int n) { bench_sph_aes_hash(works, n, SPH_AES_VAES); }
+
+static const cpu_hash_path_t sph_aes_hash_paths[] = {
+  { "tables", 1, bench_always, bench_hash_tables },
+  { "aes-ni", 1, bench_have_aesni, bench_hash_aesni },
+  { "vaes", 1, bench_have_vaes, bench_hash_vaes },
+  { NULL, 0, NULL, NULL }
+};
+
+static bool sph_aes_selftest(void)
+{
+  return sph_aes_ni_selftest() != 0;
+}
+
+static const struct bench_algo bench_algos[] = {
+  { "scrypt", scrypt_hash_paths, NULL },
+  { "neoscrypt", neoscrypt_hash_paths, neoscrypt_selftest },
+  { "yescrypt", yescrypt_hash_paths, NULL },
+  { "lyra2re", lyra2re_hash_paths, NULL },
+  { "lyra2rev2", lyra2rev2_hash_paths, NULL },
+  { "darkcoin-mod", sph_aes_hash_paths, sph_aes_selftest },
+  { "marucoin-mod", sph_aes_hash_paths, sph_aes_selftest },
+  { "fresh", sph_aes_hash_paths, sph_aes_selftest },
+  { "groestlcoin", sph_aes_hash_paths, sph_aes_selftest },
+  { NULL, NULL, NULL }
+};
+
+static const unsigned char bench_block[] = { SGMINER_BENCHMARK_BLOCK };
+
+static void bench_init_works(struct work *works, struct pool *pool)
+{
+  int i;
+
+  for (i = 0; i < BENCH_WORKS; i++) {
+    memset(&works[i], 0, sizeof(struct work));
+    memcpy(works[i].data, bench_block, sizeof(works[i].data));
+    *(uint32_t *)(works[i].data + 76) = htole32(0x1000 * i + i);
+    works[i].pool = pool;
+  }
+}
+
+/* Hashes per second of one path, hashing in groups of its lane count */
+static double bench_path(const cpu_hash_path_t *path, struct work *works)
+{
+  struct timeval tv_start, tv_now;
+  unsigned int group = path->lanes, done = 0, i = 0;
+  double elapsed;
+
+  cgtime(&tv_start);
+  do {
+    path->hash(&works[i], group);
+    done += group;
+    i = (i + group) % (BENCH_WORKS - group + 1);
+    cgtime(&tv_now);
+    elapsed = tdiff(&tv_now, &tv_start);
+  } while (elapsed < opt_bench_cpu_secs);
+
+  return done / elapsed;
+}
+
+/* Pool of regenhash loops for the thread scaling runs */
+struct bench_thread {
+  pthread_t pth;
+  struct work *works;
+  volatile bool *stop;
+  unsigned long done;
+};
+
+static void *bench_thread_main(void *userdata)
+{
+  struct bench_thread *bt = (struct bench_thread *)userdata;
+  unsigned int i = 0;
+
+  while (!*bt->stop) {
+    bt->works[i].pool->algorithm.regenhash(&bt->works[i]);
+    bt->done++;
+    i = (i + 1) % BENCH_WORKS;
+  }
+  return NULL;
+}
+
+/* Total hashes per second of regenhash running on nthreads threads */
+static double bench_threads(struct pool *pool, int nthreads)
+{
+  struct bench_thread *bt;
+  struct timeval tv_start, tv_now;
+  volatile bool stop = false;
+  unsigned long done = 0;
+  int i, started;
+
+  bt = (struct bench_thread *)calloc(nthreads, sizeof(struct bench_thread));
+  if (unlikely(!bt))
+    quit(1, "Failed to calloc in bench_threads");
+
+  cgtime(&tv_start);
+  for (started = 0; started < nthreads; started++) {
+    bt[started].works = (struct work *)calloc(BENCH_WORKS, sizeof(struct work));
+    if (unlikely(!bt[started].works))
+      quit(1, "Failed to calloc in bench_threads");
+    bench_init_works(bt[started].works, pool);
+    bt[started].stop = &stop;
+    if (unlikely(pthread_create(&bt[started].pth, NULL, bench_thread_main, &bt[started]))) {
+      applog(LOG_ERR, "Failed to create benchmark thread %d", started);
+      free(bt[started].works);
+      break;
+    }
+  }
+
+  cgsleep_ms(opt_bench_cpu_secs * 1000);
+  stop = true;
+  for (i = 0; i < started; i++) {
+    pthread_join(bt[i].pth, NULL);
+    done += bt[i].done;
+    free(bt[i].works);
+  }
+  cgtime(&tv_now);
+  free(bt);
+
+  return (started == nthreads) ? done / tdiff(&tv_now, &tv_start) : 0;
+}
+
+static json_t *bench_find_baseline(const char *algo, const char *path, int threads)
+{
+  size_t i;
+
+  if (!bench_baseline)
+    return NULL;
+  for (i = 0; i < json_array_size(bench_baseline); i++) {
+    json_t *res = json_array_get(bench_baseline, i);
+
+    if (!safe_cmp(json_string_value(json_object_get(res, "algorithm")), algo) &&
+        !safe_cmp(json_string_value(json_object_get(res, "path")), path) &&
+        json_integer_value(json_object_get(res, "threads")) == threads)
+      return res;
+  }
+  return NULL;
+}
+
+/*
+ * Store one result for --bench-cpu-json and compare it with the baseline;
+ * returns the text appended to the result line.
+ */
+static const char *bench_record(const char *algo, const char *path, int threads, double rate)
+{
+  static char cmp[64];
+  json_t *res, *base;
+  double base_rate, delta;
+
+  res = json_object();
+  json_object_set_new(res, "algorithm", json_string(algo));
+  json_object_set_new(res, "path", json_string(path));
+  json_object_set_new(res, "threads", json_integer(threads));
+  json_object_set_new(res, "hashes_per_sec", json_real(rate));
+  json_object_set_new(res, "ns_per_hash", json_real(rate > 0 ? 1e9 * threads / rate : 0));
+  json_array_append_new(bench_results, res);
+
+  cmp[0] = '\0';
+  base = bench_find_baseline(algo, path, threads);
+  if (!base)
+    return cmp;
+  base_rate = json_number_value(json_object_get(base, "hashes_per_sec"));
+  if (base_rate <= 0)
+    return cmp;
+
+  delta = 100.0 * (rate - base_rate) / base_rate;
+  if (delta < -opt_bench_cpu_tolerance) {
+    snprintf(cmp, sizeof(cmp), "  %+6.1f%% REGRESSION", delta);
+    bench_ok = false;
+  } else
+    snprintf(cmp, sizeof(cmp), "  %+6.1f%%", delta);
+  return cmp;
+}
+
+static bool bench_verify(const cpu_hash_path_t *path, struct work *works, const struct work *ref)
+{
+  int i;
+
+  for (i = 0; i < BENCH_WORKS; i++)
+    memset(works[i].hash, 0, sizeof(works[i].hash));
+
+  /* Odd sized call so padded lanes are exercised too */
+  path->hash(works, BENCH_WORKS - 1);
+  path->hash(&works[BENCH_WORKS - 1], 1);
+
+  for (i = 0; i < BENCH_WORKS; i++) {
+    if (memcmp(works[i].hash, ref[i].hash, sizeof(works[i].hash)))
+      return false;
+  }
+  return true;
+}
+
+static void bench_algorithm(const struct bench_algo *ba)
+{
+  struct pool *pool;
+  struct work *works, *ref;
+  const cpu_hash_path_t *path;
+  double ref_rate = 0, rate1 = 0;
+  int nthreads;
+
+  pool = (struct pool *)calloc(1, sizeof(struct pool));
+  works = (struct work *)calloc(BENCH_WORKS, sizeof(struct work));
+  ref = (struct work *)calloc(BENCH_WORKS, sizeof(struct work));
+  if (unlikely(!pool || !works || !ref))
+    quit(1, "Failed to calloc in bench_algorithm");
+
+  if (ba->selftest && !ba->selftest()) {
+    applog(LOG_ERR, "%-12s self test FAILED", ba->name);
+    bench_ok = false;
+  }
+
+  set_algorithm(&pool->algorithm, ba->name);
+  bench_init_works(ref, pool);
+  ba->paths[0].hash(ref, BENCH_WORKS);
+  bench_init_works(works, pool);
+
+  for (path = ba->paths; path->name; path++) {
+    double rate;
+
+    if (!path->available()) {
+      applog(LOG_WARNING, "%-12s %-12s not supported by this CPU", ba->name, path->name);
+      continue;
+    }
+    if (!bench_verify(path, works, ref)) {
+      applog(LOG_ERR, "%-12s %-12s MISMATCH against %s", ba->name, path->name, ba->paths[0].name);
+      bench_ok = false;
+      continue;
+    }
+
+    rate = bench_path(path, works);
+    if (path == ba->paths)
+      ref_rate = rate;
+    applog(LOG_WARNING, "%-12s %-12s %10.1f H/s %10.1f ns  %5.2fx%s", ba->name, path->name,
+           rate, rate > 0 ? 1e9 / rate : 0, ref_rate > 0 ? rate / ref_rate : 0,
+           bench_record(ba->name, path->name, 1, rate));
+  }
+
+  /* Scaling of the dispatching regenhash over 1, 2, 4 ... threads */
+  for (nthreads = 1; opt_bench_cpu_threads > 1; nthreads *= 2) {
+    double rate;
+
+    if (nthreads > opt_bench_cpu_threads)
+      nthreads = opt_bench_cpu_threads;
+    rate = bench_threads(pool, nthreads);
+    if (nthreads == 1)
+      rate1 = rate;
+    applog(LOG_WARNING, "%-12s %2d thread(s) %10.1f H/s %10.1f H/s/thread  %5.2fx%s", ba->name,
+           nthreads, rate, rate / nthreads, rate1 > 0 ? rate / rate1 : 0,
+           bench_record(ba->name, "regenhash", nthreads, rate));
+    if (nthreads == opt_bench_cpu_threads)
+      break;
+  }
+
+  free(ref);
+  free(works);
+  free(pool);
+}
+
+/* --bench-cpu-algo: comma separated names or aliases, resolved to their CPU hash */
+static void (*bench_selection[BENCH_MAX_ALGOS])(struct work *);
+static unsigned int bench_nselected;
+
+static void bench_parse_selection(void)
+{
+  char *list, *name;
+
+  list = strdup(opt_bench_cpu_algos);
+  if (unlikely(!list))
+    quit(1, "Failed to strdup in bench_parse_selection");
+  for (name = strtok(list, ","); name && bench_nselected < BENCH_MAX_ALGOS; name = strtok(NULL, ",")) {
+    algorithm_t algo;
+
+    memset(&algo, 0, sizeof(algo));
+    set_algorithm(&algo, name);
+    bench_selection[bench_nselected++] = algo.regenhash;
+  }
+  free(list);
+}
+
+static bool bench_selected(void (*regenhash)(struct work *))
+{
+  unsigned int i;
+
+  if (!opt_bench_cpu_algos)
+    return true;
+  for (i = 0; i < bench_nselected; i++) {
+    if (bench_selection[i] == regenhash)
+      return true;
+  }
+  return false;
+}
+
+static void bench_load_baseline(void)
+{
+  json_error_t err;
+  json_t *root;
+
+#if JANSSON_MAJOR_VERSION > 1
+  root = json_load_file(opt_bench_cpu_baseline, 0, &err);
+#else
+  root = json_load_file(opt_bench_cpu_baseline, &err);
+#endif
+  if (!root || !json_is_array(json_object_get(root, "results"))) {
+    applog(LOG_ERR, "Could not load CPU benchmark baseline %s: %s", opt_bench_cpu_baseline,
+           root ? "no results array" : err.text);
+    json_decref(root);
+    bench_ok = false;
+    return;
+  }
+
+  bench_baseline = json_incref(json_object_get(root, "results"));
+  applog(LOG_WARNING, "Comparing against %s, %d%% tolerance", opt_bench_cpu_baseline, opt_bench_cpu_tolerance);
+  json_decref(root);
+}
+
+static void bench_save_results(void)
+{
+  json_t *root = json_object();
+
+  json_object_set_new(root, "version", json_string(PACKAGE_STRING));
+  json_object_set_new(root, "seconds", json_integer(opt_bench_cpu_secs));
+  json_object_set(root, "results", bench_results);
+  if (json_dump_file(root, opt_bench_cpu_json, JSON_INDENT(2) | JSON_PRESERVE_ORDER)) {
+    applog(LOG_ERR, "Could not write CPU benchmark results to %s", opt_bench_cpu_json);
+    bench_ok = false;
+  } else
+    applog(LOG_WARNING, "CPU benchmark results written to %s", opt_bench_cpu_json);
+  json_decref(root);
+}
+
+bool bench_cpu(void)
+{
+  void (*done[BENCH_MAX_ALGOS])(struct work *);
+  const struct bench_algo *ba;
+  const char *name;
+  unsigned int i, ndone = 0, j;
+
+  bench_ok = true;
+  bench_results = json_array();
+  if (opt_bench_cpu_algos)
+    bench_parse_selection();
+  if (opt_bench_cpu_baseline)
+    bench_load_baseline();
+
+  applog(LOG_WARNING, "CPU hash benchmark, %d second(s) per path, single thread%s", opt_bench_cpu_secs,
+         opt_bench_cpu_threads > 1 ? ", then scaling up to the given threads" : "");
+
+  /* Algorithms with several implementations first, then every other CPU hash once */
+  for (ba = bench_algos; ba->name; ba++) {
+    algorithm_t algo;
+
+    memset(&algo, 0, sizeof(algo));
+    set_algorithm(&algo, ba->name);
+    if (ndone < BENCH_MAX_ALGOS)
+      done[ndone++] = algo.regenhash;
+    if (bench_selected(algo.regenhash))
+      bench_algorithm(ba);
+  }
+  sph_aes_ni_set(SPH_AES_AUTO);
+
+  for (i = 0; (name = get_algorithm_name(i)); i++) {
+    struct bench_algo generic = { name, regenhash_paths, NULL };
+    algorithm_t algo;
+
+    memset(&algo, 0, sizeof(algo));
+    set_algorithm(&algo, name);
+    for (j = 0; j < ndone && done[j] != algo.regenhash; j++)
+      ;
+    if (!algo.regenhash || j < ndone || !bench_selected(algo.regenhash))
+      continue;
+    if (ndone < BENCH_MAX_ALGOS)
+      done[ndone++] = algo.regenhash;
+
+    /* these hash against the DAG cache of a live pool */
+    if (algo.type == ALGO_ETHASH || algo.type == ALGO_NIGHTCAP) {
+      applog(LOG_NOTICE, "%-12s skipped, needs a pool's DAG cache", name);
+      continue;
+    }
+    bench_algorithm(&generic);
+  }
+
+  if (opt_bench_cpu_json)
+    bench_save_results();
+  json_decref(bench_results);
+  json_decref(bench_baseline);
+  bench_results = bench_baseline = NULL;
+
+  return bench_ok;
+}
+
+/*
+ * OpenCL kernel benchmark (--bench-kernel).  Loads the configured
+ * algorithm's kernel on each selected device through initCl() and its
+ * queue_kernel, then sweeps worksize and intensity over a synthetic work.
+ * Every nonce a launch reports is checked with the CPU regenhash, and one
+ * launch per worksize is scanned in full on the CPU to catch missed nonces.
+ */
+
+#define BENCH_KERNEL_CHECK 1024   /* nonces of the full CPU scan per worksize */
+/* Words of the output buffer, with the nonce count of a persistent kernel */
+#define BENCH_KERNEL_WORDS (MAXBUFFERS + 1)
+
+/* Target hit by about hits in every threads hashes; every kernel compares at
+ * least word 7 of the hash, which the CPU check below compares alone */
+static void bench_kernel_target(struct work *work, uint64_t threads, unsigned int hits)
+{
+  double t32 = 4294967296.0 * hits / threads;
+
+  memset(work->target, 0xff, 32);
+  ((uint32_t *)work->target)[7] = htole32(t32 < 4294967295.0 ? (uint32_t)t32 : 0xffffffffU);
+  memcpy(work->device_target, work->target, 32);
+}
+
+static bool bench_kernel_hit(const struct work *work, uint32_t nonce)
+{
+  struct work check;
+
+  memcpy(&check, work, sizeof(struct work));
+  set_work_nonce(&check, nonce);
+  check.pool->algorithm.regenhash(&check);
+  return le32toh(*(uint32_t *)(check.hash + 28)) <= le32toh(((uint32_t *)check.target)[7]);
+}
+
+/* Clears the output buffer, in place when it is mapped */
+static cl_int bench_kernel_clear(_clState *clState, const uint32_t *blank)
+{
+  size_t size = clState->persistent ? PERSISTENT_BUFFERSIZE : BUFFERSIZE;
+
+  if (clState->output_map) {
+    memset(clState->output_map, 0, size);
+    return CL_SUCCESS;
+  }
+  return clEnqueueWriteBuffer(clState->commandQueue, clState->outputBuffer, CL_TRUE, 0,
+    size, blank, 0, NULL, NULL);
+}
+
+/* Runs one launch of threads nonces from work->blk.nonce and leaves the
+ * nonces found in res[0 .. count).  Returns the launch time in seconds or
+ * a negative value on an OpenCL error, or when a persistent kernel did not
+ * scan every nonce. */
+static double bench_kernel_launch(_clState *clState, struct work *work, size_t threads,
+                                  uint32_t *res, unsigned int *count)
+{
+  algorithm_t *algorithm = &work->pool->algorithm;
+  size_t globalThreads[1] = { threads };
+  size_t localThreads[1] = { clState->wsize };
+  size_t offset = work->blk.nonce;
+  size_t size = clState->persistent ? PERSISTENT_BUFFERSIZE : BUFFERSIZE;
+  struct timeval tv_start, tv_end;
+  unsigned int found = algorithm->found_idx, i;
+  cl_int status;
+
+  cgtime(&tv_start);
+  status = algorithm->queue_kernel(clState, &work->blk, threads);
+  if (clState->persistent)
+    status |= queue_persistent_args(clState, globalThreads);
+  status |= clEnqueueNDRangeKernel(clState->commandQueue, clState->kernel, 1, &offset,
+    globalThreads, localThreads, 0, NULL, NULL);
+  for (i = 0; i < clState->n_extra_kernels; i++)
+    status |= clEnqueueNDRangeKernel(clState->commandQueue, clState->extra_kernels[i], 1, &offset,
+      globalThreads, localThreads, 0, NULL, NULL);
+  if (!clState->output_map)
+    status |= clEnqueueReadBuffer(clState->commandQueue, clState->outputBuffer, CL_FALSE, 0,
+      size, res, 0, NULL, NULL);
+  status |= clFinish(clState->commandQueue);
+  if (clState->output_map)
+    memcpy(res, clState->output_map, size);
+  if (unlikely(status != CL_SUCCESS)) {
+    applog(LOG_ERR, "Error %d: kernel launch failed", status);
+    return -1;
+  }
+
+  /* the clear is part of the pass, as in opencl_scanhash(), and a
+   * persistent kernel's count of nonces scanned needs one every pass */
+  *count = res[found];
+  if (*count || clState->persistent) {
+    status = bench_kernel_clear(clState, res + BENCH_KERNEL_WORDS);
+    if (unlikely(status != CL_SUCCESS)) {
+      applog(LOG_ERR, "Error %d: clEnqueueWriteBuffer failed", status);
+      return -1;
+    }
+  }
+  cgtime(&tv_end);
+  /* nothing restarts the benchmark, so every nonce of the pass is scanned */
+  if (clState->persistent && res[PERSISTENT_DONE] != threads) {
+    applog(LOG_ERR, "Persistent kernel scanned %u of %lu nonces", res[PERSISTENT_DONE], (unsigned long)threads);
+    return -1;
+  }
+  /* same sanity check and byte order as postcalc_hash(), a persistent
+   * kernel drops the results beyond the last slot */
+  if (*count & ~found)
+    *count = clState->persistent ? found : found + 1;
+  for (i = 0; i < *count && i < found; i++)
+    if (found == 0x0F)
+      res[i] = swab32(res[i]);
+
+  return tdiff(&tv_end, &tv_start);
+}
+
+/* Launches over BENCH_KERNEL_CHECK nonces with an easy target and compares
+ * what the kernel reports with a CPU scan of the same nonces */
+static bool bench_kernel_check(_clState *clState, struct work *work, uint32_t *res)
+{
+  const char *name = get_algorithm_kernel(&work->pool->algorithm);
+  unsigned int found = work->pool->algorithm.found_idx;
+  size_t threads = (BENCH_KERNEL_CHECK + clState->wsize - 1) / clState->wsize * clState->wsize;
+  unsigned int count, expected = 0, missed = 0, bad = 0, i, j;
+  uint32_t nonce;
+
+  bench_kernel_target(work, threads, (found + 1) / 4);
+  work->blk.nonce = 0x10000000;
+  if (bench_kernel_launch(clState, work, threads, res, &count) < 0)
+    return false;
+  if (count > found) {
+    applog(LOG_ERR, "%-12s ws %4u check: invalid nonce count %u", name, (unsigned)clState->wsize, count);
+    return false;
+  }
+
+  for (i = 0; i < count; i++)
+    if (res[i] - 0x10000000 >= threads || !bench_kernel_hit(work, res[i]))
+      bad++;
+  for (nonce = 0x10000000; nonce < 0x10000000 + threads; nonce++) {
+    if (!bench_kernel_hit(work, nonce))
+      continue;
+    expected++;
+    for (j = 0; j < count && res[j] != nonce; j++)
+      ;
+    if (j == count)
+      missed++;
+  }
+  /* a full output buffer drops the excess nonces */
+  if (count == found)
+    missed = 0;
+
+  applog(missed || bad ? LOG_ERR : LOG_WARNING, "%-12s ws %4u check: %u of %u nonces found, %u missed, %u bad%s",
+         name, (unsigned)clState->wsize, count, expected, missed, bad, missed || bad ? "  MISMATCH" : "");
+  return !missed && !bad;
+}
+
+/* One point of the sweep: launches until --bench-kernel-secs have passed,
+ * the hash rate goes to *rate */
+static bool bench_kernel_point(_clState *clState, struct work *work, int intensity, uint32_t *res,
+                               double *rate)
+{
+  algorithm_t *algorithm = &work->pool->algorithm;
+  size_t wsize = clState->wsize;
+  size_t threads = (size_t)1 << (algorithm->intensity_shift + intensity);
+  struct timeval tv_start, tv_now;
+  double launch, total = 0, best = 0;
+  unsigned int count, launches = 0, nonces = 0, bad = 0, i;
+
+  threads = (threads + wsize - 1) / wsize * wsize;
+  bench_kernel_target(work, threads, 2);
+  work->blk.nonce = 0;
+
+  /* the first launch is not timed, it includes any lazy setup */
+  if (bench_kernel_launch(clState, work, threads, res, &count) < 0)
+    return false;
+
+  cgtime(&tv_start);
+  do {
+    work->blk.nonce += threads;
+    launch = bench_kernel_launch(clState, work, threads, res, &count);
+    if (launch < 0)
+      return false;
+    total += launch;
+    if (!launches++ || launch < best)
+      best = launch;
+    if (count > algorithm->found_idx) {
+      bad++;
+      count = algorithm->found_idx;
+    }
+    for (i = 0; i < count; i++)
+      if (res[i] - work->blk.nonce >= threads || !bench_kernel_hit(work, res[i]))
+        bad++;
+    nonces += count;
+    cgtime(&tv_now);
+  } while (launches < 2 || tdiff(&tv_now, &tv_start) < opt_bench_kernel_secs);
+
+  *rate = threads * launches / total;
+  applog(bad ? LOG_ERR : LOG_WARNING, "%-12s ws %4u I %2d %10lu threads  avg %8.3f ms  min %8.3f ms %12.1f H/s %5u nonces%s",
+         get_algorithm_kernel(algorithm), (unsigned)wsize, intensity, (unsigned long)threads, total * 1000 / launches,
+         best * 1000, *rate, nonces, bad ? "  BAD NONCES" : "");
+  return !bad;
+}
+
+/* Host overhead of a pass with --mapped-buffers: launches of a single
+ * work-group that find nonces nearly every time, so that the time is
+ * mostly the queueing, the result read and the clear.  Measured with the
+ * buffers copied and then mapped. */
+static void bench_kernel_overhead(struct cgpu_info *cgpu, struct work *work, uint32_t *res)
+{
+  const char *name = get_algorithm_kernel(&work->pool->algorithm);
+  unsigned int found = work->pool->algorithm.found_idx;
+  double pass[2];
+  size_t wsize = 0;
+  int mapped;
+
+  for (mapped = 0; mapped < 2; mapped++) {
+    char devname[256] = "";
+    struct timeval tv_start, tv_now;
+    unsigned int count, launches = 0;
+    double launch, total = 0;
+    _clState *clState;
+
+    cgpu->map_buffers = mapped;
+    clState = initCl(cgpu->virtual_gpu, devname, sizeof(devname), &cgpu->algorithm);
+    if (!clState)
+      return;
+    if (mapped && !clState->output_map) {
+      applog(LOG_WARNING, "%-12s GPU %d cannot map its buffers, no overhead comparison", name, cgpu->device_id);
+      releaseCl(clState);
+      return;
+    }
+    wsize = clState->wsize;
+    bench_kernel_target(work, wsize, (found + 1) / 4);
+    work->blk.nonce = 0;
+
+    launch = -1;
+    if (bench_kernel_clear(clState, res + BENCH_KERNEL_WORDS) == CL_SUCCESS &&
+        bench_kernel_launch(clState, work, wsize, res, &count) >= 0) {
+      cgtime(&tv_start);
+      do {
+        work->blk.nonce += wsize;
+        launch = bench_kernel_launch(clState, work, wsize, res, &count);
+        if (launch < 0)
+          break;
+        total += launch;
+        launches++;
+        cgtime(&tv_now);
+      } while (launches < 2 || tdiff(&tv_now, &tv_start) < opt_bench_kernel_secs);
+    }
+    releaseCl(clState);
+    if (launch < 0)
+      return;
+    pass[mapped] = total / launches;
+  }
+
+  applog(LOG_WARNING, "%-12s ws %4u pass overhead  copied %8.1f us  mapped %8.1f us  (%+.1f us)",
+         name, (unsigned)wsize, pass[0] * 1e6, pass[1] * 1e6, (pass[1] - pass[0]) * 1e6);
+}
+
+/* Synthetic work on the benchmark block for cgpu's algorithm */
+static void bench_kernel_work(struct cgpu_info *cgpu, struct pool *pool, struct work *work)
+{
+  pool->algorithm = cgpu->algorithm;
+  memcpy(work->data, bench_block, sizeof(bench_block));
+  work->pool = pool;
+  work->blk.work = work;
+  if (pool->algorithm.precalc_hash)
+    pool->algorithm.precalc_hash(&work->blk, (uint32_t *)work->midstate, (uint32_t *)work->data);
+}
+
+static bool bench_kernel_device(struct cgpu_info *cgpu, int ilow, int ihigh)
+{
+  char name[256], *sizes, *size, *next;
+  struct pool *pool;
+  struct work *work;
+  uint32_t *res;
+  bool ok = true;
+
+  if (cgpu->algorithm.type == ALGO_ETHASH || cgpu->algorithm.type == ALGO_NIGHTCAP) {
+    applog(LOG_ERR, "%s needs a pool's DAG, it cannot be benchmarked offline", cgpu->algorithm.name);
+    return false;
+  }
+
+  pool = (struct pool *)calloc(1, sizeof(struct pool));
+  work = (struct work *)calloc(1, sizeof(struct work));
+  /* output buffer followed by the blank copy that clears it */
+  res = (uint32_t *)calloc(2, PERSISTENT_BUFFERSIZE);
+  sizes = strdup(opt_bench_kernel_worksize ? opt_bench_kernel_worksize : "0");
+  if (unlikely(!pool || !work || !res || !sizes))
+    quit(1, "Failed to calloc in bench_kernel_device");
+
+  /* in order queue: the kernel chain and the read must not overlap */
+  cgpu->algorithm.cq_properties = 0;
+  cgpu->dynamic = false;
+  cgpu->rawintensity = cgpu->xintensity = 0;
+  /* the results are checked on the host */
+  cgpu->payload = false;
+
+  bench_kernel_work(cgpu, pool, work);
+
+  for (size = sizes; size; size = next) {
+    _clState *clState;
+    int intensity, high = ihigh;
+    double rate;
+
+    if ((next = strchr(size, ',')))
+      *next++ = '\0';
+
+    /* buffers are sized for the highest intensity of the sweep */
+    cgpu->work_size = atoi(size);
+    cgpu->intensity = ihigh;
+    strcpy(name, "");
+    clState = initCl(cgpu->virtual_gpu, name, sizeof(name), &cgpu->algorithm);
+    if (!clState) {
+      applog(LOG_ERR, "%-12s ws %4s failed to initialise the kernel on GPU %d",
+             get_algorithm_kernel(&pool->algorithm), size, cgpu->device_id);
+      ok = false;
+      continue;
+    }
+    if (bench_kernel_clear(clState, res + BENCH_KERNEL_WORDS) != CL_SUCCESS) {
+      applog(LOG_ERR, "Error: clEnqueueWriteBuffer failed.");
+      releaseCl(clState);
+      ok = false;
+      continue;
+    }
+    if (cgpu->work_size && clState->wsize != (size_t)cgpu->work_size)
+      applog(LOG_WARNING, "GPU %d does not support worksize %d, using %u", cgpu->device_id,
+             cgpu->work_size, (unsigned)clState->wsize);
+    if (cgpu->intensity < high) {
+      applog(LOG_WARNING, "GPU %d memory limits the sweep to intensity %d", cgpu->device_id, cgpu->intensity);
+      high = cgpu->intensity;
+    }
+
+    ok &= bench_kernel_check(clState, work, res);
+    for (intensity = ilow; intensity <= high; intensity++)
+      if (!bench_kernel_point(clState, work, intensity, res, &rate)) {
+        ok = false;
+        break;
+      }
+
+    releaseCl(clState);
+  }
+
+  if (ok && cgpu->map_buffers) {
+    bench_kernel_overhead(cgpu, work, res);
+    cgpu->map_buffers = true;
+  }
+
+  free(sizes);
+  free(res);
+  free(work);
+  free(pool);
+  return ok;
+}
+
+double bench_kernel_rate(struct cgpu_info *cgpu, int intensity)
+{
+  algorithm_t algorithm = cgpu->algorithm;
+  bool dynamic = cgpu->dynamic, payload = cgpu->payload;
+  int saved_intensity = cgpu->intensity, xintensity = cgpu->xintensity, rawintensity = cgpu->rawintensity;
+  char name[256] = "";
+  _clState *clState;
+  struct pool *pool;
+  struct work *work;
+  uint32_t *res;
+  double rate = 0;
+
+  if (cgpu->algorithm.type == ALGO_ETHASH || cgpu->algorithm.type == ALGO_NIGHTCAP)
+    return 0;
+
+  pool = (struct pool *)calloc(1, sizeof(struct pool));
+  work = (struct work *)calloc(1, sizeof(struct work));
+  res = (uint32_t *)calloc(2, PERSISTENT_BUFFERSIZE);
+  if (unlikely(!pool || !work || !res))
+    quit(1, "Failed to calloc in bench_kernel_rate");
+
+  cgpu->algorithm.cq_properties = 0;
+  cgpu->dynamic = cgpu->payload = false;
+  cgpu->rawintensity = cgpu->xintensity = 0;
+  cgpu->intensity = intensity;
+  bench_kernel_work(cgpu, pool, work);
+
+  clState = initCl(cgpu->virtual_gpu, name, sizeof(name), &cgpu->algorithm);
+  if (clState) {
+    if (bench_kernel_clear(clState, res + BENCH_KERNEL_WORDS) == CL_SUCCESS &&
+        bench_kernel_check(clState, work, res) &&
+        !bench_kernel_point(clState, work, cgpu->intensity, res, &rate))
+      rate = 0;
+    releaseCl(clState);
+  }
+
+  cgpu->algorithm = algorithm;
+  cgpu->dynamic = dynamic;
+  cgpu->payload = payload;
+  cgpu->intensity = saved_intensity;
+  cgpu->xintensity = xintensity;
+  cgpu->rawintensity = rawintensity;
+  free(res);
+  free(work);
+  free(pool);
+  return rate;
+}
+
+bool bench_kernel(void)
+{
+  int ilow = 8, ihigh = 16, i;
+  bool ok = true;
+
+  if (opt_bench_kernel_intensity) {
+    int n = sscanf(opt_bench_kernel_intensity, "%d-%d", &ilow, &ihigh);
+
+    if (n == 1)
+      ihigh = ilow;
+    if (n < 1 || ilow < MIN_INTENSITY || ihigh > MAX_INTENSITY || ilow > ihigh) {
+      applog(LOG_ERR, "Invalid --bench-kernel-intensity %s", opt_bench_kernel_intensity);
+      return false;
+    }
+  }
+  if (!total_devices) {
+    applog(LOG_ERR, "No OpenCL devices to benchmark, try --gpu-device-type");
+    return false;
+  }
+
+  applog(LOG_WARNING, "OpenCL kernel benchmark, intensity %d to %d, %d second(s) per point",
+         ilow, ihigh, opt_bench_kernel_secs);
+
+  for (i = 0; i < total_devices; i++) {
+    struct cgpu_info *cgpu = devices[i];
+
+    if (opt_devs_enabled && !devices_enabled[i])
+      continue;
+    applog(LOG_WARNING, "GPU %d: %s", cgpu->device_id, cgpu->algorithm.name);
+    ok &= bench_kernel_device(cgpu, ilow, ihigh);
+  }
+
+  return ok;
+}
+
+/*
+ * Stratum parser benchmark (--bench-stratum).  Replays stratum messages
+ * recorded from a pool, one JSON message per line or the RECVD lines of a
+ * --protocol-dump log, the way a stratum connection handles them: once off
+ * the tokens of stratum_json.c, jansson only for what they cannot represent,
+ * and once through jansson alone.  The two paths run on pools of their own,
+ * which must end up with the same job.  Allocations counted are those of
+ * jansson and of the pool's job buffers.
+ */
+
+#define BENCH_STRATUM_LINES 100000
+
+static unsigned long bench_json_allocs;
+
+static void *bench_json_malloc(size_t size)
+{
+  bench_json_allocs++;
+  return malloc(size);
+}
+
+/* Methods the benchmark may replay: the others talk back to the pool */
+static bool bench_stratum_replayable(const char *line)
+{
+  json_error_t err;
+  json_t *val = JSON_LOADS(line, &err);
+  const char *method;
+  bool ret;
+
+  if (!val)
+    return false;
+  method = json_string_value(json_object_get(val, "method"));
+  ret = !method || !strncasecmp(method, "mining.notify", 13) ||
+        !strncasecmp(method, "mining.set_difficulty", 21) ||
+        !strncasecmp(method, "mining.set_extranonce", 21);
+  json_decref(val);
+  return ret;
+}
+
+static char **bench_stratum_load(int *nlines)
+{
+  char buf[RBUFSIZE], **lines;
+  FILE *fp;
+  int n = 0;
+
+  fp = fopen(opt_bench_stratum, "r");
+  if (!fp) {
+    applog(LOG_ERR, "Could not open stratum traffic %s", opt_bench_stratum);
+    return NULL;
+  }
+  lines = (char **)calloc(BENCH_STRATUM_LINES, sizeof(char *));
+  if (unlikely(!lines))
+    quit(1, "Failed to calloc in bench_stratum_load");
+
+  while (n < BENCH_STRATUM_LINES && fgets(buf, sizeof(buf), fp)) {
+    char *line = strstr(buf, "RECVD: ");
+
+    line = line ? line + 7 : buf;
+    line[strcspn(line, "\r\n")] = '\0';
+    if (*line != '{' || !bench_stratum_replayable(line))
+      continue;
+    lines[n] = strdup(line);
+    if (unlikely(!lines[n]))
+      quit(1, "Failed to strdup in bench_stratum_load");
+    n++;
+  }
+  fclose(fp);
+
+  *nlines = n;
+  return lines;
+}
+
+static struct pool *bench_stratum_pool(void)
+{
+  struct pool *pool = (struct pool *)calloc(1, sizeof(struct pool));
+
+  if (unlikely(!pool))
+    quit(1, "Failed to calloc in bench_stratum_pool");
+  pool->name = (char *)"stratum bench";
+  pool->algorithm = default_profile.algorithm;
+  if (!pool->algorithm.name[0])
+    set_algorithm(&pool->algorithm, "sha256d");
+  mutex_init(&pool->pool_lock);
+  cglock_init(&pool->data_lock);
+  /* what most pools subscribe with, set_extranonce changes it */
+  pool->nonce1 = strdup("00000000");
+  pool->n1_len = 4;
+  pool->nonce1bin = (unsigned char *)calloc(pool->n1_len, 1);
+  pool->n2size = 4;
+  return pool;
+}
+
+/* A message as stratum_handle_msg() takes it, up to the share accounting
+ * of responses, which is the same whichever way they are parsed. Returns
+ * true for an accepted share. */
+static bool bench_stratum_msg(struct pool *pool, char *s, bool fast)
+{
+  json_t *val, *err_val;
+  json_error_t err;
+  struct sjson js;
+  bool ret = false;
+  int id;
+
+  if (fast && sjson_parse(&js, s)) {
+    if (parse_method_json(pool, s, &js))
+      return false;
+    if (sjson_accepted(&js, &id))
+      return true;
+    /* anything else goes to jansson, see parse_stratum_response() */
+    val = JSON_LOADS(s, &err);
+    json_decref(val);
+    return false;
+  }
+
+  if (parse_method_json(pool, s, NULL))
+    return false;
+  val = JSON_LOADS(s, &err);
+  if (val) {
+    err_val = json_object_get(val, "error");
+    ret = json_is_true(json_object_get(val, "result")) && (!err_val || json_is_null(err_val)) &&
+          json_is_integer(json_object_get(val, "id"));
+    json_decref(val);
+  }
+  return ret;
+}
+
+static bool bench_stratum_same(struct pool *a, struct pool *b)
+{
+  if (!a->swork.job_id || !b->swork.job_id)
+    return a->swork.job_id == b->swork.job_id;
+  return !strcmp(a->swork.job_id, b->swork.job_id) &&
+         a->swork.merkles == b->swork.merkles &&
+         !memcmp(a->swork.merkle_bin, b->swork.merkle_bin, a->swork.merkles * 32) &&
+         a->swork.cb_len == b->swork.cb_len &&
+         !memcmp(a->coinbase, b->coinbase, a->swork.cb_len) &&
+         !memcmp(a->header_bin, b->header_bin, sizeof(a->header_bin)) &&
+         a->swork.diff == b->swork.diff && a->n1_len == b->n1_len;
+}
+
+/* Messages per second over all lines, and allocations per message */
+static double bench_stratum_path(struct pool *pool, char **lines, int nlines, bool fast, double *allocs)
+{
+  struct timeval tv_start, tv_now;
+  unsigned long done = 0, json_allocs;
+  int slot_allocs = pool->swork.slot_allocs, i;
+  double elapsed;
+
+  json_allocs = bench_json_allocs;
+  cgtime(&tv_start);
+  do {
+    for (i = 0; i < nlines; i++)
+      bench_stratum_msg(pool, lines[i], fast);
+    done += nlines;
+    cgtime(&tv_now);
+    elapsed = tdiff(&tv_now, &tv_start);
+  } while (elapsed < opt_bench_stratum_secs);
+
+  *allocs = (double)(bench_json_allocs - json_allocs + pool->swork.slot_allocs - slot_allocs) / done;
+  return done / elapsed;
+}
+
+bool bench_stratum(void)
+{
+  struct pool *fast, *legacy;
+  char **lines;
+  double rate[2], allocs[2];
+  int nlines, i;
+  bool ok = true;
+
+  lines = bench_stratum_load(&nlines);
+  if (!lines)
+    return false;
+  if (!nlines) {
+    applog(LOG_ERR, "No stratum messages to replay in %s", opt_bench_stratum);
+    free(lines);
+    return false;
+  }
+
+  fast = bench_stratum_pool();
+  legacy = bench_stratum_pool();
+  json_set_alloc_funcs(bench_json_malloc, free);
+
+  /* One pass first, checking both paths after every message */
+  for (i = 0; i < nlines; i++) {
+    bool acked = bench_stratum_msg(fast, lines[i], true);
+
+    if (acked != bench_stratum_msg(legacy, lines[i], false) || !bench_stratum_same(fast, legacy)) {
+      applog(LOG_ERR, "Stratum parsers disagree after line %d: %s", i + 1, lines[i]);
+      ok = false;
+      break;
+    }
+  }
+
+  if (ok) {
+    applog(LOG_WARNING, "Stratum parser benchmark, %d message(s), %d second(s) per path",
+           nlines, opt_bench_stratum_secs);
+    rate[0] = bench_stratum_path(legacy, lines, nlines, false, &allocs[0]);
+    applog(LOG_WARNING, "jansson    %10.0f msgs/s %8.2f us/msg %6.2f allocs/msg",
+           rate[0], 1e6 / rate[0], allocs[0]);
+    rate[1] = bench_stratum_path(fast, lines, nlines, true, &allocs[1]);
+    applog(LOG_WARNING, "tokenizer  %10.0f msgs/s %8.2f us/msg %6.2f allocs/msg  %5.2fx",
+           rate[1], 1e6 / rate[1], allocs[1], rate[1] / rate[0]);
+  }
+
+  json_set_alloc_funcs(malloc, free);
+  for (i = 0; i < nlines; i++)
+    free(lines[i]);
+  free(lines);
+  return ok;
+}
@@ -0,0 +1,31 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdbool.h>
+
+extern bool opt_bench_cpu;
+extern int opt_bench_cpu_secs;
+extern int opt_bench_cpu_threads;
+extern int opt_bench_cpu_tolerance;
+extern char *opt_bench_cpu_algos;
+extern char *opt_bench_cpu_json;
+extern char *opt_bench_cpu_baseline;
+extern bool opt_bench_kernel;
+extern int opt_bench_kernel_secs;
+extern char *opt_bench_kernel_intensity;
+extern char *opt_bench_kernel_worksize;
+extern char *opt_bench_stratum;
+extern int opt_bench_stratum_secs;
+
+/* Returns false if a self test, cross-check or baseline comparison failed */
+extern bool bench_cpu(void);
+/* Returns false if a kernel failed to load or disagreed with the CPU hash */
+extern bool bench_kernel(void);
+/* Returns false if the traffic could not be read or the parsers disagree */
+extern bool bench_stratum(void);
+/* Hash rate of cgpu's kernel at intensity on the benchmark block, 0 if it
+ * fails to load or disagrees with the CPU hash; cgpu is left as it was */
+struct cgpu_info;
+extern double bench_kernel_rate(struct cgpu_info *cgpu, int intensity);
+
+#endif /* BENCH_H */
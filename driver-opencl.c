@@ -32,6 +32,7 @@
 #include "driver-opencl.h"
 #include "findnonce.h"
 #include "ocl.h"
+#include "ocl/kernel_profile.h"
 #include "adl.h"
 #include "util.h"
 
@@ -214,6 +215,23 @@ char *set_thread_concurrency(const char *arg)
   return NULL;
 }
 
+/* Lets CPU (e.g. POCL) and accelerator OpenCL devices be used in place of GPUs */
+char *set_gpu_device_type(const char *arg)
+{
+  if (!strcasecmp(arg, "gpu"))
+    opt_cl_device_type = CL_DEVICE_TYPE_GPU;
+  else if (!strcasecmp(arg, "cpu"))
+    opt_cl_device_type = CL_DEVICE_TYPE_CPU;
+  else if (!strcasecmp(arg, "accelerator"))
+    opt_cl_device_type = CL_DEVICE_TYPE_ACCELERATOR;
+  else if (!strcasecmp(arg, "all"))
+    opt_cl_device_type = CL_DEVICE_TYPE_ALL;
+  else
+    return "Invalid value passed to set_gpu_device_type";
+
+  return NULL;
+}
+
 #ifdef HAVE_ADL
 /* This function allows us to map an adl device to an opencl device for when
  * simple enumeration has failed to match them. */
@@ -821,6 +839,19 @@ retry: // TODO: refactor
 #endif
     wlog("Last initialised: %s\n", cgpu->init);
 
+    if (cgpu->kprofile) {
+      struct kernel_stage_stats st[KPROF_STAGES];
+      unsigned int nstages = kernel_profile_stats(cgpu->kprofile, st), k;
+      char kname[16];
+
+      wlog("Kernel time avg/p90 ms and share, last %u passes:", st[0].samples);
+      for (k = 0; k < nstages; k++) {
+        kernel_stage_name(kname, sizeof(kname), k);
+        wlog("%s%s %.3f/%.3f %.0f%%", (k % 4) ? "  " : "\n  ", kname, st[k].avg, st[k].p90, st[k].share);
+      }
+      wlog("\n");
+    }
+
     rd_lock(&mining_thr_lock);
     for (i = 0; i < mining_threads; i++) {
       thr = mining_thr[i];
@@ -1240,6 +1271,9 @@ static void opencl_detect(void)
 #endif
     cgpu->virtual_gpu = i;
     cgpu->algorithm = default_profile.algorithm;
+    cgpu->persistent = opt_persistent_kernel;
+    cgpu->map_buffers = opt_mapped_buffers;
+    cgpu->payload = opt_hash_payload;
     add_cgpu(cgpu);
   }
 
@@ -1343,7 +1377,7 @@ static bool opencl_thread_prepare(struct thr_info *thr)
   int virtual_gpu = cgpu->virtual_gpu;
   int i = thr->id;
   static bool failmessage = false;
-  int buffersize = BUFFERSIZE;
+  int buffersize = PERSISTENT_BUFFERSIZE;   /* fits either output buffer */
 
   if (!blank_res)
     blank_res = (uint32_t *)calloc(buffersize, 1);
@@ -1385,6 +1419,9 @@ static bool opencl_thread_prepare(struct thr_info *thr)
   if (!cgpu->name)
     cgpu->name = strdup(name);
 
+  if (opt_kernel_profile)
+    kernel_profile_reset(&cgpu->kprofile, 1 + clStates[i]->n_extra_kernels);
+
   applog(LOG_INFO, "initCl() finished. Found %s", name);
   cgtime(&now);
   get_datestamp(cgpu->init, sizeof(cgpu->init), &now);
@@ -1401,7 +1438,7 @@ static bool opencl_thread_init(struct thr_info *thr)
   cl_int status = 0;
   thrdata = (struct opencl_thread_data *)calloc(1, sizeof(*thrdata));
   thr->cgpu_data = thrdata;
-  int buffersize = BUFFERSIZE;
+  int buffersize = clState->persistent ? PERSISTENT_BUFFERSIZE : BUFFERSIZE;
 
   if (!thrdata) {
     applog(LOG_ERR, "Failed to calloc in opencl_thread_init");
@@ -1409,7 +1446,8 @@ static bool opencl_thread_init(struct thr_info *thr)
   }
 
   thrdata->queue_kernel_parameters = gpu->algorithm.queue_kernel;
-  thrdata->res = (uint32_t *)calloc(buffersize, 1);
+  /* the hash payload is only read back, never cleared */
+  thrdata->res = (uint32_t *)calloc(clState->payload ? PAYLOAD_BUFFERSIZE : buffersize, 1);
 
   if (!thrdata->res) {
     free(thrdata);
@@ -1417,8 +1455,10 @@ static bool opencl_thread_init(struct thr_info *thr)
     return false;
   }
 
-  status |= clEnqueueWriteBuffer(clState->commandQueue, clState->outputBuffer, CL_TRUE, 0,
-    buffersize, blank_res, 0, NULL, NULL);
+  /* a mapped output buffer was cleared by initCl() */
+  if (!clState->output_map)
+    status |= clEnqueueWriteBuffer(clState->commandQueue, clState->outputBuffer, CL_TRUE, 0,
+      buffersize, blank_res, 0, NULL, NULL);
   if (unlikely(status != CL_SUCCESS)) {
     free(thrdata->res);
     free(thrdata);
@@ -1446,6 +1486,16 @@ static bool opencl_prepare_work(struct thr_info __maybe_unused *thr, struct work
 
 extern int opt_dynamic_interval;
 
+/* Releases the profiling events of the kernels enqueued before a failure,
+ * which kernel_profile_add() would otherwise have released */
+static void release_events(cl_event *events, unsigned int nevents)
+{
+  unsigned int i;
+
+  for (i = 0; i < nevents; i++)
+    clReleaseEvent(events[i]);
+}
+
 static int64_t opencl_scanhash(struct thr_info *thr, struct work *work,
   int64_t __maybe_unused max_nonce)
 {
@@ -1461,8 +1511,12 @@ static int64_t opencl_scanhash(struct thr_info *thr, struct work *work,
   size_t *p_global_work_offset = NULL;
   int64_t hashes;
   int found = gpu->algorithm.found_idx;
-  int buffersize = BUFFERSIZE;
+  int buffersize = clState->persistent ? PERSISTENT_BUFFERSIZE : BUFFERSIZE;
+  /* with --mapped-buffers the results are read where the kernel left them */
+  uint32_t *res = clState->output_map ? clState->output_map : thrdata->res;
   unsigned int i;
+  cl_event events[KPROF_STAGES];
+  bool profile = gpu->kprofile && clState->n_extra_kernels < KPROF_STAGES;
 
   /* Windows' timer resolution is only 15ms so oversample 5x */
   if (gpu->dynamic && (++gpu->intervals * dynamic_us) > 70000) {
@@ -1488,7 +1542,24 @@ static int64_t opencl_scanhash(struct thr_info *thr, struct work *work,
   if (hashes > gpu->max_hashes)
     gpu->max_hashes = hashes;
 
+  /* The pass stays inside the nonce range of the thread, get_nonce_range()
+   * gave what follows to other threads.  A pass grown by the dynamic
+   * intensity is cut to the work-groups left, a shorter tail is given up. */
+  if (gpu->algorithm.type != ALGO_ETHASH && work->blk.nonce + (uint64_t)hashes > work->nonce_end) {
+    uint64_t left = work->nonce_end > work->blk.nonce ? work->nonce_end - work->blk.nonce : 0;
+    size_t step = localThreads[0] * clState->vwidth;
+
+    if (left < step) {
+      work->blk.nonce = work->nonce_end;
+      return 0;
+    }
+    globalThreads[0] = left / step * localThreads[0];
+    hashes = globalThreads[0] * clState->vwidth;
+  }
+
   status = thrdata->queue_kernel_parameters(clState, &work->blk, globalThreads[0]);
+  if (clState->persistent)
+    status |= queue_persistent_args(clState, globalThreads);
   if (unlikely(status != CL_SUCCESS)) {
     applog(LOG_ERR, "Error: clSetKernelArg of all params failed.");
     return -1;
@@ -1500,7 +1571,7 @@ static int64_t opencl_scanhash(struct thr_info *thr, struct work *work,
   //applog(LOG_DEBUG, "Working on nonces from %lu!`", *p_global_work_offset);
 
   status = clEnqueueNDRangeKernel(clState->commandQueue, clState->kernel, 1, p_global_work_offset,
-    globalThreads, localThreads, 0, NULL, NULL);
+    globalThreads, localThreads, 0, NULL, profile ? &events[0] : NULL);
   if (unlikely(status != CL_SUCCESS)) {
     applog(LOG_ERR, "Error %d: Enqueueing kernel onto command queue. (clEnqueueNDRangeKernel)", status);
     return -1;
@@ -1508,24 +1579,33 @@ static int64_t opencl_scanhash(struct thr_info *thr, struct work *work,
 
   for (i = 0; i < clState->n_extra_kernels; i++) {
     status = clEnqueueNDRangeKernel(clState->commandQueue, clState->extra_kernels[i], 1, p_global_work_offset,
-      globalThreads, localThreads, 0, NULL, NULL);
+      globalThreads, localThreads, 0, NULL, profile ? &events[i + 1] : NULL);
     if (unlikely(status != CL_SUCCESS)) {
       applog(LOG_ERR, "Error %d: Enqueueing kernel onto command queue. (clEnqueueNDRangeKernel)", status);
+      if (profile)
+        release_events(events, i + 1);
       return -1;
     }
   }
 
-  status = clEnqueueReadBuffer(clState->commandQueue, clState->outputBuffer, CL_FALSE, 0,
-    buffersize, thrdata->res, 0, NULL, NULL);
-  if (unlikely(status != CL_SUCCESS)) {
-    applog(LOG_ERR, "Error: clEnqueueReadBuffer failed error %d. (clEnqueueReadBuffer)", status);
-    return -1;
+  if (!clState->output_map) {
+    status = clEnqueueReadBuffer(clState->commandQueue, clState->outputBuffer, CL_FALSE, 0,
+      buffersize, thrdata->res, 0, NULL, NULL);
+    if (unlikely(status != CL_SUCCESS)) {
+      applog(LOG_ERR, "Error: clEnqueueReadBuffer failed error %d. (clEnqueueReadBuffer)", status);
+      if (profile)
+        release_events(events, 1 + clState->n_extra_kernels);
+      return -1;
+    }
   }
 
   /* The amount of work scanned can fluctuate when intensity changes
    * and since we do this one cycle behind, we increment the work more
-   * than enough to prevent repeating work */
-  work->blk.nonce += gpu->max_hashes;
+   * than enough to prevent repeating work, up to the end of the range */
+  if (gpu->algorithm.type != ALGO_ETHASH && work->blk.nonce + (uint64_t)gpu->max_hashes > work->nonce_end)
+    work->blk.nonce = work->nonce_end;
+  else
+    work->blk.nonce += gpu->max_hashes;
 
 #ifndef WIN32
   if (gpu->has_nvml) {
@@ -1542,6 +1622,9 @@ static int64_t opencl_scanhash(struct thr_info *thr, struct work *work,
   /* This finish flushes the readbuffer set with CL_FALSE in clEnqueueReadBuffer */
   clFinish(clState->commandQueue);
 
+  if (profile)
+    kernel_profile_add(gpu->kprofile, events, 1 + clState->n_extra_kernels);
+
   if (gpu->kernel_wait_us == -1) {
     // refresh the wait time (req. for nvidia)
     struct timeval tv_now;
@@ -1551,8 +1634,44 @@ static int64_t opencl_scanhash(struct thr_info *thr, struct work *work,
     //else applog(LOG_NOTICE, "adjust kernel wait time to %ld us", (long) gpu->kernel_wait_us);
   }
 
+  /* the kernel drops results beyond the last slot, not a HW error */
+  if ((clState->persistent || clState->payload) && res[found] > (uint32_t)found)
+    res[found] = found;
+
+  if (clState->persistent) {
+    /* nonces scanned before a restart stopped the kernel */
+    hashes = res[PERSISTENT_DONE];
+    if (!res[found]) {
+      if (clState->output_map)
+        res[PERSISTENT_DONE] = 0;
+      else {
+        status = clEnqueueWriteBuffer(clState->commandQueue, clState->outputBuffer, CL_TRUE,
+          PERSISTENT_DONE * sizeof(uint32_t), sizeof(uint32_t), blank_res, 0, NULL, NULL);
+        if (unlikely(status != CL_SUCCESS)) {
+          applog(LOG_ERR, "Error: clEnqueueWriteBuffer failed.");
+          return -1;
+        }
+      }
+    }
+  }
+
   /* found entry is used as a counter to say how many nonces exist */
-  if (thrdata->res[found]) {
+  if (res[found] && clState->output_map) {
+    applog(LOG_DEBUG, "GPU %d found something?", gpu->device_id);
+    /* postcalc_hash_async() takes its own copy, clear the buffer in place */
+    postcalc_hash_async(thr, work, res, clState->payload ? res + PAYLOAD_HASHES : NULL);
+    memset(res, 0, buffersize);
+  }
+  else if (res[found]) {
+    /* only the hashes of the slots used are fetched */
+    if (clState->payload) {
+      status = clEnqueueReadBuffer(clState->commandQueue, clState->outputBuffer, CL_TRUE, PAYLOAD_HASHES * sizeof(uint32_t),
+        8 * sizeof(uint32_t) * res[found], thrdata->res + PAYLOAD_HASHES, 0, NULL, NULL);
+      if (unlikely(status != CL_SUCCESS)) {
+        applog(LOG_ERR, "Error: clEnqueueReadBuffer failed error %d. (clEnqueueReadBuffer)", status);
+        return -1;
+      }
+    }
     /* Clear the buffer again */
     status = clEnqueueWriteBuffer(clState->commandQueue, clState->outputBuffer, CL_FALSE, 0,
       buffersize, blank_res, 0, NULL, NULL);
@@ -1561,7 +1680,7 @@ static int64_t opencl_scanhash(struct thr_info *thr, struct work *work,
       return -1;
     }
     applog(LOG_DEBUG, "GPU %d found something?", gpu->device_id);
-    postcalc_hash_async(thr, work, thrdata->res);
+    postcalc_hash_async(thr, work, thrdata->res, clState->payload ? thrdata->res + PAYLOAD_HASHES : NULL);
 //	postcalc_hash(thr);
 //	submit_tested_work(thr, work);
 //	submit_work_async(work);
@@ -1573,6 +1692,20 @@ static int64_t opencl_scanhash(struct thr_info *thr, struct work *work,
   return hashes;
 }
 
+/* Called from the restart thread: persistent kernels of the device stop
+ * at their next iteration once they see the new generation */
+static void opencl_flush_work(struct cgpu_info *gpu)
+{
+  int i;
+
+  for (i = 0; i < gpu->threads; i++) {
+    _clState *clState = clStates[gpu->thr[i]->id];
+
+    if (clState && clState->restart_gen)
+      (*clState->restart_gen)++;
+  }
+}
+
 // Cleanup OpenCL memory on the GPU
 // Note: This function is not thread-safe (clStates modification not atomic)
 static void opencl_thread_shutdown(struct thr_info *thr)
@@ -1580,31 +1713,9 @@ static void opencl_thread_shutdown(struct thr_info *thr)
   const int thr_id = thr->id;
   _clState *clState = clStates[thr_id];
   clStates[thr_id] = NULL;
-  unsigned int i;
 
-  if (clState) {
-    clFinish(clState->commandQueue);
-    clReleaseMemObject(clState->outputBuffer);
-    if (clState->CLbuffer0)
-      clReleaseMemObject(clState->CLbuffer0);
-    if (clState->buffer1)
-      clReleaseMemObject(clState->buffer1);
-    if (clState->buffer2)
-      clReleaseMemObject(clState->buffer2);
-    if (clState->buffer3)
-      clReleaseMemObject(clState->buffer3);
-    if (clState->padbuffer8)
-      clReleaseMemObject(clState->padbuffer8);
-    clReleaseKernel(clState->kernel);
-    for (i = 0; i < clState->n_extra_kernels; i++)
-      clReleaseKernel(clState->extra_kernels[i]);
-    clReleaseProgram(clState->program);
-    clReleaseCommandQueue(clState->commandQueue);
-    clReleaseContext(clState->context);
-    if (clState->extra_kernels)
-      free(clState->extra_kernels);
-    free(clState);
-  }
+  if (clState)
+    releaseCl(clState);
   free(((struct opencl_thread_data *)thr->cgpu_data)->res);
   free(thr->cgpu_data);
   thr->cgpu_data = NULL;
@@ -1631,7 +1742,7 @@ struct device_drv opencl_drv = {
   /*.scanhash = */    opencl_scanhash,
   /*.scanwork = */    NULL,
   /*.queue_full = */    NULL,
-  /*.flush_work = */    NULL,
+  /*.flush_work = */    opencl_flush_work,
   /*.update_work = */   NULL,
   /*.hw_error = */    NULL,
   /*.thread_shutdown = */   opencl_thread_shutdown,
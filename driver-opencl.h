@@ -7,6 +7,7 @@
 extern void print_ndevs(int *ndevs);
 extern void *reinit_gpu(void *userdata);
 extern char *set_gpu_map(char *arg);
+extern char *set_gpu_device_type(const char *arg);
 extern char *set_gpu_threads(const char *arg);
 extern char *set_gpu_engine(const char *arg);
 extern char *set_gpu_fan(const char *arg);
@@ -28,6 +29,10 @@ void manage_gpu(void);
 extern void pause_dynamic_threads(int gpu);
 
 extern int opt_platform_id;
+extern bool opt_kernel_profile;
+extern bool opt_persistent_kernel;
+extern bool opt_hash_payload;
+extern bool opt_mapped_buffers;
 
 extern struct device_drv opencl_drv;
 
@@ -173,6 +173,8 @@ struct pc_data {
   struct thr_info *thr;
   struct work *work;
   uint32_t res[MAXBUFFERS];
+  uint32_t hashes[8 * MAXBUFFERS];
+  bool has_hashes;
   pthread_t pth;
   int found;
 };
@@ -203,8 +205,12 @@ static void *postcalc_hash(void *userdata)
       nonce = swab32(nonce);
 
     applog(LOG_DEBUG, "[THR%d] OCL NONCE %08x (%lu) found in slot %d (found = %d)", thr->id, nonce, nonce, entry, found);
-    submit_nonce(thr, pcd->work, nonce);
+    pcd->res[entry] = nonce;
   }
+  if (pcd->has_hashes)
+    submit_payload_nonces(thr, pcd->work, pcd->res, pcd->hashes, pcd->res[found]);
+  else
+    submit_nonces(thr, pcd->work, pcd->res, pcd->res[found]);
 
   discard_work(pcd->work);
   free(pcd);
@@ -212,7 +218,7 @@ static void *postcalc_hash(void *userdata)
   return NULL;
 }
 
-void postcalc_hash_async(struct thr_info *thr, struct work *work, uint32_t *res)
+void postcalc_hash_async(struct thr_info *thr, struct work *work, uint32_t *res, const uint32_t *hashes)
 {
   struct pc_data *pcd = (struct pc_data *)malloc(sizeof(struct pc_data));
   int buffersize;
@@ -226,6 +232,11 @@ void postcalc_hash_async(struct thr_info *thr, struct work *work, uint32_t *res)
   pcd->work = copy_work(work);
   buffersize = BUFFERSIZE;
   memcpy(&pcd->res, res, buffersize);
+  pcd->has_hashes = hashes != NULL;
+  if (hashes) {
+    int found = thr->cgpu->algorithm.found_idx;
+    memcpy(pcd->hashes, hashes, 8 * sizeof(uint32_t) * (res[found] & found));
+  }
 
   if (pthread_create(&pcd->pth, NULL, postcalc_hash, (void *)pcd)) {
     applog(LOG_ERR, "Failed to create postcalc_hash thread");
@@ -7,8 +7,16 @@
 #define MAXTHREADS (0xFFFFFFFEULL)
 #define MAXBUFFERS (0x100)
 #define BUFFERSIZE (sizeof(uint32_t) * MAXBUFFERS)
+/* persistent kernels count the nonces they scanned after the results */
+#define PERSISTENT_DONE MAXBUFFERS
+#define PERSISTENT_BUFFERSIZE (sizeof(uint32_t) * (MAXBUFFERS + 1))
+/* --hash-payload kernels put the 8 hash words of each result after those,
+ * see kernel/payload.cl */
+#define PAYLOAD_HASHES (MAXBUFFERS + 1)
+#define PAYLOAD_BUFFERSIZE (sizeof(uint32_t) * (PAYLOAD_HASHES + 8 * MAXBUFFERS))
 
 extern void precalc_hash(dev_blk_ctx *blk, uint32_t *state, uint32_t *data);
-extern void postcalc_hash_async(struct thr_info *thr, struct work *work, uint32_t *res);
+/* hashes: the payload of res, NULL when the kernel wrote only nonces */
+extern void postcalc_hash_async(struct thr_info *thr, struct work *work, uint32_t *res, const uint32_t *hashes);
 
 #endif /*FINDNONCE_H*/
@@ -18,6 +18,8 @@
 #define ROTR(v,n) rotate(v,(uint)(32U-n))
 #define ROTL(v,n) rotate(v, n)
 
+#include "persistent.cl"
+
 #ifdef _AMD_OPENCL
 #define SWAP(v)   rotate(v, 16U)
 #define ROTR8(v)  rotate(v, 24U)
@@ -53,10 +55,11 @@ __kernel void search(
 	const uint MA,
 	const uint MB,
 	const uint MC
+	PERSISTENT_ARGS
 )
 {
 	/* Load the block header and padding */
-	const uint M3 = get_global_id(0);
+	PERSISTENT_BEGIN(M3)
 	const uint MD = 0x80000001UL;
 	const uint ME = 0x00000000UL;
 	const uint MF = 0x000005a0UL;
@@ -154,8 +157,8 @@ __kernel void search(
 	}
 	*/
 
-	if (pre7 ^ V7 ^ VF) return;
-
 	/* Push this share */
-	output[output[0xFF]++] = M3;
+	if (!(pre7 ^ V7 ^ VF))
+		PERSISTENT_FOUND(output, 0xFF, M3);
+	PERSISTENT_END(output)
 }
@@ -32,6 +32,8 @@
 #ifndef GROESTLCOIN_CL
 #define GROESTLCOIN_CL
 
+#include "persistent.cl"
+
 #if __ENDIAN_LITTLE__
 #define SPH_LITTLE_ENDIAN 1
 #else
@@ -129,9 +131,8 @@ typedef long sph_s64;
 #define RD15 (S1(W13) + W8 + S0(W0) + W15)
 
 __attribute__((reqd_work_group_size(WORKSIZE, 1, 1)))
-__kernel void search(__global unsigned char* block, volatile __global uint* output, const ulong target)
+__kernel void search(__global unsigned char* block, volatile __global uint* output, const ulong target PERSISTENT_ARGS)
 {
-  uint gid = get_global_id(0);
   union {
     unsigned char h1[64];
     uint h4[16];
@@ -170,6 +171,7 @@ __kernel void search(__global unsigned char* block, volatile __global uint* outp
 #define T6 T6_C
 #define T7 T7_C
 
+  PERSISTENT_BEGIN(gid)
 
   // groestl
   {
@@ -276,12 +278,15 @@ __kernel void search(__global unsigned char* block, volatile __global uint* outp
     for (unsigned int u = 0; u < 8; u ++)
     hash.h8[u] = H[u + 8];
 
+#ifndef PERSISTENT
   barrier(CLK_GLOBAL_MEM_FENCE);
+#endif
   }
 
   bool result = (hash.h8[3] <= target);
   if (result)
-    output[output[0xFF]++] = SWAP4(gid);
+    PERSISTENT_FOUND(output, 0xFF, SWAP4(gid));
+  PERSISTENT_END(output)
 }
 
 #endif // GROESTLCOIN_CL
@@ -84,11 +84,14 @@ void keccak_block_noabsorb(ARGS_25(uint2* s))
   RND(23);
 }
 
+#include "persistent.cl"
+
 __attribute__((reqd_work_group_size(WORKSIZE, 1, 1)))
-__kernel void search(__global const uint2*restrict in, __global uint*restrict output)
+__kernel void search(__global const uint2*restrict in, __global uint*restrict output PERSISTENT_ARGS)
 {
   uint2 ARGS_25(state);
 
+  PERSISTENT_BEGIN(nonce)
   state0 = in[0];
   state1 = in[1];
   state2 = in[2];
@@ -98,7 +101,7 @@ __kernel void search(__global const uint2*restrict in, __global uint*restrict ou
   state6 = in[6];
   state7 = in[7];
   state8 = in[8];
-  state9 = (uint2)(in[9].x,get_global_id(0));
+  state9 = (uint2)(in[9].x,nonce);
   state10 = (uint2)(1,0);
   state11 = 0;
   state12 = 0;
@@ -118,10 +121,11 @@ __kernel void search(__global const uint2*restrict in, __global uint*restrict ou
   keccak_block_noabsorb(ARGS_25(&state));
 
 #define FOUND (0x0F)
-#define SETFOUND(Xnonce) output[output[FOUND]++] = Xnonce
+#define SETFOUND(Xnonce) PERSISTENT_FOUND(output, FOUND, Xnonce)
 
   if ((state3.y & 0xFFFFFFF0U) == 0)
   {
-    SETFOUND(get_global_id(0));
+    SETFOUND(nonce);
   }
+  PERSISTENT_END(output)
 }
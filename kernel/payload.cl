@@ -0,0 +1,66 @@
+/*
+ * Hash payload results (--hash-payload).
+ *
+ * Built with -D HASH_PAYLOAD the search kernel takes the share target as
+ * one more argument, compares the whole 256-bit hash of a candidate with
+ * it and writes the hash next to the nonce: slot s of the results has its
+ * hash at output[PAYLOAD_HASHES + 8 * s], the words in the order of
+ * work->hash.  The host can then submit a share without hashing it again.
+ *
+ * Without HASH_PAYLOAD, PAYLOAD_FOUND() stores the nonce as before.
+ */
+
+#ifndef PAYLOAD_CL
+#define PAYLOAD_CL
+
+#include "persistent.cl"
+
+#define PAYLOAD_HASHES 0x101
+
+/* big endian word of the hash as it is stored in work->hash */
+#define PAYLOAD_SWAP(x) as_uint(as_uchar4(x).s3210)
+
+#ifdef HASH_PAYLOAD
+
+#define PAYLOAD_ARGS , const uint8 payload_target
+
+/* hash <= target, both little endian 256-bit numbers */
+bool payload_le_target(const uint8 hash, const uint8 target)
+{
+  uint h[8], t[8];
+  int i;
+
+  vstore8(hash, 0, h);
+  vstore8(target, 0, t);
+  for (i = 7; i > 0 && h[i] == t[i]; i--)
+    ;
+  return h[i] <= t[i];
+}
+
+#define PAYLOAD_FOUND(output, found, nonce, hash) \
+  do { \
+    uint8 payload_hash = (hash); \
+    if (payload_le_target(payload_hash, payload_target)) { \
+      uint payload_slot = atomic_inc(&(output)[found]); \
+      if (payload_slot < (found)) { \
+        (output)[payload_slot] = (nonce); \
+        (output)[PAYLOAD_HASHES + 8 * payload_slot + 0] = payload_hash.s0; \
+        (output)[PAYLOAD_HASHES + 8 * payload_slot + 1] = payload_hash.s1; \
+        (output)[PAYLOAD_HASHES + 8 * payload_slot + 2] = payload_hash.s2; \
+        (output)[PAYLOAD_HASHES + 8 * payload_slot + 3] = payload_hash.s3; \
+        (output)[PAYLOAD_HASHES + 8 * payload_slot + 4] = payload_hash.s4; \
+        (output)[PAYLOAD_HASHES + 8 * payload_slot + 5] = payload_hash.s5; \
+        (output)[PAYLOAD_HASHES + 8 * payload_slot + 6] = payload_hash.s6; \
+        (output)[PAYLOAD_HASHES + 8 * payload_slot + 7] = payload_hash.s7; \
+      } \
+    } \
+  } while (0)
+
+#else
+
+#define PAYLOAD_ARGS
+#define PAYLOAD_FOUND(output, found, nonce, hash) PERSISTENT_FOUND(output, found, nonce)
+
+#endif
+
+#endif // PAYLOAD_CL
@@ -0,0 +1,54 @@
+/*
+ * Persistent kernel mode (--persistent-kernel).
+ *
+ * Built with -D PERSISTENT the search kernel takes three more arguments
+ * and every work-item walks the nonces gid, gid + global size, ... for up
+ * to iters iterations instead of hashing one nonce.  The host bumps
+ * *restart when the work goes stale and the loop stops once it sees a
+ * generation newer than the one it was launched with.  The iterations
+ * done by all work-items are summed in output[PERSISTENT_DONE] so the host
+ * knows how many nonces were really scanned.
+ *
+ * Without PERSISTENT the macros give the usual one nonce per work-item.
+ */
+
+#ifndef PERSISTENT_CL
+#define PERSISTENT_CL
+
+#define PERSISTENT_DONE 0x100
+
+#ifdef PERSISTENT
+
+#define PERSISTENT_ARGS , volatile __global const uint * restrict restart, const uint gen, const uint iters
+
+#define PERSISTENT_BEGIN(nonce) \
+  uint persistent_it; \
+  for (persistent_it = 0; persistent_it < iters; persistent_it++) { \
+    if ((int)(*restart - gen) > 0) \
+      break; \
+    { \
+      const uint nonce = (uint)get_global_id(0) + persistent_it * (uint)get_global_size(0);
+
+#define PERSISTENT_END(output) \
+    } \
+  } \
+  atomic_add(&(output)[PERSISTENT_DONE], persistent_it);
+
+/* results of all iterations share the slots, extra ones are dropped */
+#define PERSISTENT_FOUND(output, found, nonce) \
+  do { \
+    uint persistent_slot = atomic_inc(&(output)[found]); \
+    if (persistent_slot < (found)) \
+      (output)[persistent_slot] = (nonce); \
+  } while (0)
+
+#else
+
+#define PERSISTENT_ARGS
+#define PERSISTENT_BEGIN(nonce) { const uint nonce = get_global_id(0);
+#define PERSISTENT_END(output) }
+#define PERSISTENT_FOUND(output, found, nonce) (output)[(output)[found]++] = (nonce)
+
+#endif
+
+#endif // PERSISTENT_CL
@@ -20,6 +20,35 @@ int opt_log_show_date = false;
 /* per default priorities higher than LOG_NOTICE are logged */
 int opt_log_level = LOG_NOTICE;
 
+/* Once log_start() has run, messages are formatted into a ring of
+ * LOG_RING_SIZE slots that any thread can add to without a lock, and the log
+ * writer thread timestamps and writes them out.  A thread that logs never
+ * waits for the console, stderr or syslog.  A message that finds the ring
+ * full is dropped and counted.  Forced messages, sent before quitting, are
+ * written right away after whatever is in the ring. */
+#define LOG_RING_SIZE 1024
+
+struct log_slot {
+  /* pos while free for the message at pos, pos + 1 once it is in */
+  volatile unsigned int seq;
+  int prio;
+  struct timeval tv;
+  char str[LOGBUFSIZ];
+};
+
+static struct log_slot log_ring[LOG_RING_SIZE];
+static volatile unsigned int log_tail;  /* next pos to add at */
+static unsigned int log_head;           /* next pos to write out */
+static pthread_mutex_t log_write_lock;
+static cgsem_t log_sem;
+static volatile unsigned int log_sleeping;
+static bool log_async;
+static pthread_t log_thr;
+
+uint64_t log_dropped;
+
+static void log_write(int prio, const struct timeval *tv, const char *str, bool force);
+
 static void _my_log_curses(int prio, const char *datetime, const char *str)
 {
 	if (opt_quiet && prio != LOG_ERR)
@@ -34,7 +63,110 @@ static void _my_log_curses(int prio, const char *datetime, const char *str)
 		printf("%s%s%s", datetime, str, "                    \n");
 }
 
-void applog(int prio, const char* fmt, ...)
+/* Adds a message to the ring, false if it is not running */
+static bool log_queue(int prio, int size, const char *fmt, va_list args)
+{
+  struct log_slot *slot;
+  unsigned int pos;
+
+  if (!log_async)
+    return false;
+  do {
+    pos = log_tail;
+    slot = &log_ring[pos % LOG_RING_SIZE];
+    /* Still holding the message from one lap before: the ring is full */
+    if ((int)(slot->seq - pos) < 0) {
+      atomic_inc64(&log_dropped);
+      return true;
+    }
+  } while (slot->seq != pos || !atomic_cas(&log_tail, pos, pos + 1));
+
+  slot->prio = prio;
+  cgtime(&slot->tv);
+  vsnprintf(slot->str, size < LOGBUFSIZ ? size : LOGBUFSIZ, fmt, args);
+  mem_barrier();
+  slot->seq = pos + 1;
+
+  if (atomic_cas(&log_sleeping, 1, 0))
+    cgsem_post(&log_sem);
+  return true;
+}
+
+/* Writes out the ring, with log_write_lock held */
+static void __log_drain(void)
+{
+  struct log_slot *slot;
+
+  while (42) {
+    slot = &log_ring[log_head % LOG_RING_SIZE];
+    if (slot->seq != log_head + 1)
+      break;
+    mem_barrier();
+    log_write(slot->prio, &slot->tv, slot->str, false);
+    mem_barrier();
+    slot->seq = log_head + LOG_RING_SIZE;
+    log_head++;
+  }
+}
+
+void log_flush(void)
+{
+  if (!log_async)
+    return;
+  /* The log thread may be quitting from inside log_write() */
+  if (mutex_trylock(&log_write_lock)) {
+    if (pthread_equal(pthread_self(), log_thr))
+      return;
+    mutex_lock(&log_write_lock);
+  }
+  __log_drain();
+  mutex_unlock(&log_write_lock);
+}
+
+static void *log_thread(void __maybe_unused *userdata)
+{
+  uint64_t reported = 0;
+  struct timeval now;
+  char buf[LOGBUFSIZ];
+
+  RenameThread("Log");
+
+  while (42) {
+    mutex_lock(&log_write_lock);
+    __log_drain();
+    if (log_dropped != reported) {
+      snprintf(buf, sizeof(buf), "Log ring full, %llu message(s) dropped", (unsigned long long)(log_dropped - reported));
+      reported = log_dropped;
+      cgtime(&now);
+      log_write(LOG_WARNING, &now, buf, false);
+    }
+    mutex_unlock(&log_write_lock);
+
+    /* Any message added after this is seen by the check or posts */
+    atomic_cas(&log_sleeping, 0, 1);
+    if (log_ring[log_head % LOG_RING_SIZE].seq != log_head + 1)
+      cgsem_mswait(&log_sem, 1000);
+    log_sleeping = 0;
+  }
+  return NULL;
+}
+
+void log_start(void)
+{
+  unsigned int i;
+
+  for (i = 0; i < LOG_RING_SIZE; i++)
+    log_ring[i].seq = i;
+  mutex_init(&log_write_lock);
+  cgsem_init(&log_sem);
+  if (unlikely(pthread_create(&log_thr, NULL, log_thread, NULL)))
+    quit(1, "Failed to create log thread");
+  pthread_detach(log_thr);
+  log_async = true;
+  atexit(log_flush);
+}
+
+void (applog)(int prio, const char* fmt, ...)
 {
   va_list args;
 
@@ -56,10 +188,12 @@ void applogsiz(int prio, int size, const char* fmt, ...)
 void vapplogsiz(int prio, int size, const char* fmt, va_list args)
 {
   if ((opt_debug || prio != LOG_DEBUG)) {
-    char *tmp42 = (char *)calloc(size + 1, 1);
-    vsnprintf(tmp42, size, fmt, args);
+    char tmp42[LOGBUFSIZ];
+
+    if (log_queue(prio, size, fmt, args))
+      return;
+    vsnprintf(tmp42, size < LOGBUFSIZ ? size : LOGBUFSIZ, fmt, args);
     _applog(prio, tmp42, false);
-    free(tmp42);
   }
 #ifdef DEV_DEBUG_MODE
   else if(prio == LOG_DEBUG) {
@@ -75,6 +209,17 @@ void vapplogsiz(int prio, int size, const char* fmt, va_list args)
  * log function
  */
 void _applog(int prio, const char *str, bool force)
+{
+  struct timeval tv;
+
+  /* A forced message comes after everything in the ring */
+  if (force)
+    log_flush();
+  cgtime(&tv);
+  log_write(prio, &tv, str, force);
+}
+
+static void log_write(int prio, const struct timeval *tv, const char *str, bool force)
 {
 #ifdef HAVE_SYSLOG_H
   if (use_syslog) {
@@ -97,12 +242,9 @@ void _applog(int prio, const char *str, bool force)
       return;
 
     char datetime[64];
-    struct timeval tv = {0, 0};
     struct tm *tm;
 
-    cgtime(&tv);
-
-    const time_t tmp_time = tv.tv_sec;
+    const time_t tmp_time = tv->tv_sec;
     tm = localtime(&tmp_time);
 
     /* Day changed. */
@@ -113,7 +255,7 @@ void _applog(int prio, const char *str, bool force)
         tm->tm_year + 1900,
         tm->tm_mon + 1,
         tm->tm_mday);
-      _applog(prio, date_output_str, force);
+      log_write(prio, tv, date_output_str, force);
     }
 
     if (opt_log_show_date) {
@@ -4,6 +4,7 @@
 #include "config.h"
 #include <stdbool.h>
 #include <stdarg.h>
+#include <stdint.h>
 
 #ifdef HAVE_SYSLOG_H
 #include <syslog.h>
@@ -31,12 +32,34 @@ extern int opt_log_show_date;
 
 #define LOGBUFSIZ 512
 
-void applog(int prio, const char* fmt, ...);
+/* Whether messages of prio are logged at all.  applog() checks it before
+ * evaluating its arguments; code that formats something just to log it
+ * should check it too. */
+#ifdef DEV_DEBUG_MODE
+#define applog_enabled(prio) true
+#else
+#define applog_enabled(prio) (opt_debug || (prio) != LOG_DEBUG)
+#endif
+
+#define applog(prio, fmt, ...) do { \
+  if (applog_enabled(prio)) \
+    (applog)(prio, fmt, ##__VA_ARGS__); \
+} while (0)
+
+void (applog)(int prio, const char* fmt, ...);
 void applogsiz(int prio, int size, const char* fmt, ...);
 void vapplogsiz(int prio, int size, const char* fmt, va_list args);
 
 extern void _applog(int prio, const char *str, bool force);
 
+/* Messages dropped because the log ring was full */
+extern uint64_t log_dropped;
+/* Starts the log writer thread, messages are written by the thread logging
+ * them until then */
+extern void log_start(void);
+/* Writes out the messages in the log ring */
+extern void log_flush(void);
+
 void applog_hex(void* data, int len);
 
 #define IN_FMT_FFL " in %s %s():%d"
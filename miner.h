@@ -603,6 +603,28 @@ struct cgpu_info {
   int64_t kernel_wait_us;
   int scan_counter;
 
+  /* seconds between works taken, for the staging depth, and the times
+   * and seconds the device waited for staged work */
+  double work_interval;
+  struct timeval tv_last_getwork;
+  int work_waits;
+  double work_wait_secs;
+
+  /* per-stage kernel times, only with --kernel-profile */
+  struct kernel_profile *kprofile;
+
+  /* build the persistent kernel when there is one, --persistent-kernel */
+  bool persistent;
+  /* map the work and result buffers, --mapped-buffers */
+  bool map_buffers;
+  /* build the kernel with the full target check, --hash-payload */
+  bool payload;
+  /* hash payload results hashed again, taken on trust and found wrong */
+  uint64_t verify_checked;
+  uint64_t verify_skipped;
+  int verify_bad;
+  int verify_acc;   /* --verify-sample accumulator */
+
   bool has_sysfs;
   bool has_nvml;
   bool has_adl;
@@ -906,6 +928,27 @@ extern void api_initlock(void *lock, enum cglock_typ typ, const char *file, cons
 #define cg_ruwlock(_lock) _cg_ruwlock(_lock, __FILE__, __func__, __LINE__)
 #define cg_wunlock(_lock) _cg_wunlock(_lock, __FILE__, __func__, __LINE__)
 
+/* Returns *p and increments or decrements it without a lock.  The cas
+ * versions return true if *p was old and is now new; atomic_inc64 returns
+ * nothing useful.  mem_barrier() orders the memory accesses around it. */
+#ifdef _MSC_VER
+#define atomic_fetch_inc(p) (InterlockedIncrement((volatile LONG *)(p)) - 1)
+#define atomic_fetch_dec(p) (InterlockedDecrement((volatile LONG *)(p)) + 1)
+#define atomic_cas(p, old, new) \
+  (InterlockedCompareExchange((volatile LONG *)(p), (LONG)(new), (LONG)(old)) == (LONG)(old))
+#define mem_barrier() MemoryBarrier()
+#define atomic_inc64(p) InterlockedIncrement64((volatile LONGLONG *)(p))
+#define atomic_cas64(p, old, new) \
+  (InterlockedCompareExchange64((volatile LONGLONG *)(p), (LONGLONG)(new), (LONGLONG)(old)) == (LONGLONG)(old))
+#else
+#define atomic_fetch_inc(p) __sync_fetch_and_add((p), 1)
+#define atomic_fetch_dec(p) __sync_fetch_and_sub((p), 1)
+#define atomic_cas(p, old, new) __sync_bool_compare_and_swap((p), (old), (new))
+#define mem_barrier() __sync_synchronize()
+#define atomic_inc64(p) __sync_add_and_fetch((p), 1)
+#define atomic_cas64(p, old, new) __sync_bool_compare_and_swap((p), (old), (new))
+#endif
+
 static inline void _mutex_lock(pthread_mutex_t *lock, const char *file, const char *func, const int line)
 {
   GETLOCK(lock, file, func, line);
@@ -1136,14 +1179,28 @@ extern int opt_api_mcast_port;
 extern char *opt_api_groups;
 extern char *opt_api_description;
 extern int opt_api_port;
+extern int opt_api_rate;
 extern bool opt_api_listen;
 extern bool opt_api_network;
 extern bool opt_delaynet;
+extern bool opt_tcp_nodelay;
+extern bool opt_stratum_reactor;
+extern int opt_standby_pools;
+extern int opt_stratum_workers;
 extern time_t last_getwork;
 extern bool opt_disable_client_reconnect;
 extern bool opt_restart;
 extern bool opt_worktime;
 extern int swork_id;
+
+/* Stratum shares not answered within SSHARE_TIMEOUT seconds are dropped,
+ * the wheel has a slot per second and must be longer than that */
+#define SSHARE_TIMEOUT 120
+#define SSHARE_WHEEL_SLOTS 128
+
+/* Latency histogram buckets, the last one is for anything slower */
+#define SHARE_LAT_BUCKETS 11
+extern const int share_lat_bounds[SHARE_LAT_BUCKETS - 1];
 extern int opt_tcp_keepalive;
 extern bool opt_incognito;
 
@@ -1217,6 +1274,12 @@ extern int set_memoryclock(int gpu, int iMemoryClock);
 #endif
 
 extern void api(int thr_id);
+/* Events for API subscribers, cheap when there are none.  latency is the
+ * submit to reply time in ms, negative when not known. */
+extern void api_push_share(const struct work *work, const char *result, const char *reason, double latency);
+extern void api_push_device(struct cgpu_info *cgpu);
+extern void api_push_pool(struct pool *pool, struct pool *last_pool);
+extern void api_push_dag(struct cgpu_info *cgpu, unsigned int epoch, double progress);
 
 extern struct pool *current_pool(void);
 extern int enabled_pools;
@@ -1272,6 +1335,14 @@ extern int total_getworks, total_stale, total_discarded;
 extern double total_diff_accepted, total_diff_rejected, total_diff_stale;
 extern unsigned int local_work;
 extern unsigned int total_go, total_ro;
+extern double work_rate;
+extern int staged_target;
+extern int idle_events;
+extern double idle_secs;
+extern int failover_prefetched, failover_used;
+extern int nonce_jobs, nonce_ranges;
+extern uint64_t work_made, work_recycled, work_heap, work_jobs;
+extern int work_slabs_used;
 extern int opt_cutofftemp;
 extern int opt_log_interval;
 extern unsigned long long global_hashrate;
@@ -1327,10 +1398,13 @@ enum pool_state {
   POOL_HIDDEN,
 };
 
+/* Deepest merkle branch of a stratum job, 2^64 transactions */
+#define STRATUM_MAX_MERKLES 64
+
 struct stratum_work {
   char *job_id;
   char *prev_hash;
-  unsigned char **merkle_bin;
+  unsigned char *merkle_bin;  /* merkles * 32 bytes */
   char *bbversion;
   char *nbit;
   char *ntime;
@@ -1340,6 +1414,17 @@ struct stratum_work {
   size_t header_len;
   int merkles;
   double diff;
+
+  /* Job buffers reused from one mining.notify to the next: the strings
+   * above live in text, and pool->coinbase has room for cb_size bytes */
+  char *text;
+  size_t text_size;
+  size_t merkle_size;
+  size_t cb_size;
+  int slot_allocs;  /* times one of them had to grow */
+
+  /* Shared by the works made from this job, see stratum_work_job() */
+  struct work_job *job;
 };
 
 #define RBUFSIZE 8192
@@ -1354,6 +1439,8 @@ struct pool {
   int accepted, rejected;
   int seq_rejects;
   int seq_getfails;
+  /* seconds to generate one work, moving average */
+  double gen_latency;
   int solved;
   double diff1;
   char diff[8];
@@ -1464,12 +1551,31 @@ struct pool {
   bool stratum_active;
   bool stratum_init;
   bool stratum_notify;
+  time_t last_notify;
+  double cnx_latency;  /* seconds to connect and subscribe, last attempt */
+  bool standby;        /* kept connected by --standby-pools */
   struct stratum_work swork;
   pthread_t stratum_sthread;
   pthread_t stratum_rthread;
   pthread_mutex_t stratum_lock;
   struct thread_q *stratum_q;
   int sshares; /* stratum shares submitted waiting on response */
+  struct reactor_src *rsrc;  /* with --stratum-reactor, instead of stratum_rthread */
+  int rstate;
+  time_t rretry;             /* when the reconnect thread tries it again */
+  struct list_head rnode;    /* waiting on the reconnect thread */
+
+  /* Stratum shares waiting on a response, by id and by expiry second */
+  pthread_mutex_t sshare_lock;
+  struct stratum_share *sshare_db;
+  struct list_head sshare_wheel[SSHARE_WHEEL_SLOTS];
+  time_t sshare_tick;
+  int share_timeouts;
+
+  /* Submit to ack latency of stratum shares, see share_lat_bounds */
+  unsigned int share_lat[SHARE_LAT_BUCKETS];
+  unsigned int share_lat_count;
+  double share_lat_total, share_lat_max;  /* milliseconds */
 
   /* GBT variables */
   bool has_gbt;
@@ -1508,6 +1614,19 @@ struct pool {
 #define GETWORK_MODE_STRATUM 'S'
 #define GETWORK_MODE_GBT 'G'
 
+/* The strings a work needs to submit its shares, made once per stratum job
+ * (once per work for GBT) and shared by reference between the works made,
+ * copied and cloned from it.  Never changed once made: a rolled ntime gets
+ * a job of its own.  One allocation holds the struct and the strings. */
+struct work_job {
+  int refs;
+  char *job_id;
+  char *nonce1;
+  char *ntime;
+  char *coinbase;
+  char *txn_data;
+};
+
 struct work {
   unsigned char data[192];
   unsigned char midstate[128];
@@ -1529,6 +1648,7 @@ struct work {
   int   drv_rolllimit; /* How much the driver can roll ntime */
 
   dev_blk_ctx blk;
+  uint64_t  nonce_end;  /* first nonce past the range of the thread */
 
   struct thr_info *thr;
   int   thr_id;
@@ -1546,6 +1666,8 @@ struct work {
   bool    midstate_done;
 
   bool    stratum;
+  /* The strings below point into job, see work_set_job() */
+  struct work_job *job;
   char    *job_id;
   uint64_t  nonce2;
   size_t    nonce2_len;
@@ -1577,6 +1699,11 @@ struct work {
   struct timeval  tv_work_start;
   struct timeval  tv_work_found;
   char    getwork_mode;
+
+  /* Place in the work slabs plus one, 0 for a work calloced on its own,
+   * and the next free work while it is on the free list */
+  unsigned int  slab_id;
+  unsigned int  slab_next;
 };
 
 #define TAILBUFSIZ 64
@@ -1593,9 +1720,12 @@ struct work {
 
 extern void get_datestamp(char *, size_t, struct timeval *);
 extern void inc_hw_errors(struct thr_info *thr);
+extern void set_work_nonce(struct work *work, uint32_t nonce);
 extern bool test_nonce(struct work *work, uint32_t nonce);
 extern bool submit_tested_work(struct thr_info *thr, struct work *work);
 extern bool submit_nonce(struct thr_info *thr, struct work *work, uint32_t nonce);
+extern void submit_nonces(struct thr_info *thr, struct work *work, const uint32_t *nonces, unsigned int count);
+extern void submit_payload_nonces(struct thr_info *thr, struct work *work, const uint32_t *nonces, const uint32_t *hashes, unsigned int count);
 extern struct work *get_work(struct thr_info *thr, const int thr_id);
 extern void _wlog(const char *str);
 extern void _wlogprint(const char *str);
@@ -1629,6 +1759,10 @@ extern void tq_thaw(struct thread_q *tq);
 extern bool successful_connect;
 extern void adl(void);
 extern void app_restart(void);
+extern struct work_job *work_job_new(const char *job_id, const char *nonce1, const char *ntime,
+                                     const char *coinbase, const char *txn_data);
+extern void work_job_put(struct work_job *job);
+extern void work_set_job(struct work *work, struct work_job *job);
 extern void clean_work(struct work *work);
 extern void free_work(struct work *work);
 extern struct work *copy_work_noffset(struct work *base_work, int noffset);
@@ -1639,6 +1773,7 @@ extern struct cgpu_info *get_thr_cgpu(int thr_id);
 extern char *set_int_0_to_9999(const char *arg, int *i);
 extern char *set_int_1_to_65535(const char *arg, int *i);
 extern char *set_int_0_to_10(const char *arg, int *i);
+extern char *set_int_0_to_100(const char *arg, int *i);
 extern char *set_int_1_to_10(const char *arg, int *i);
 
 enum api_data_type {
@@ -34,10 +34,12 @@
 #include "ocl.h"
 #include "ocl/build_kernel.h"
 #include "ocl/binary_kernel.h"
+#include "ocl/autotune.h"
 #include "algorithm/neoscrypt.h"
 #include "algorithm/pluck.h"
 #include "algorithm/yescrypt.h"
 #include "algorithm/lyra2rev2.h"
+#include "bench.h"
 
 #if HAVE_ADL
 #include "adl.h"
@@ -56,6 +58,11 @@ char driver_version[64] = { 0 };
 #include "miner.h"
 
 int opt_platform_id = -1;
+cl_device_type opt_cl_device_type = CL_DEVICE_TYPE_GPU;
+bool opt_kernel_profile;
+bool opt_persistent_kernel;
+bool opt_mapped_buffers;
+bool opt_hash_payload;
 
 bool get_opencl_platform(int preferred_platform_id, cl_platform_id *platform) {
   cl_int status;
@@ -126,7 +133,7 @@ int clDevicesNum(void) {
   status = clGetPlatformInfo(platform, CL_PLATFORM_VERSION, sizeof(pbuff), pbuff, NULL);
   if (status == CL_SUCCESS)
     applog(LOG_INFO, "CL Platform version: %s", pbuff);
-  status = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 0, NULL, &numDevices);
+  status = clGetDeviceIDs(platform, opt_cl_device_type, 0, NULL, &numDevices);
   if (status != CL_SUCCESS) {
     applog(LOG_INFO, "Error %d: Getting Device IDs (num)", status);
     goto out;
@@ -136,7 +143,7 @@ int clDevicesNum(void) {
     unsigned int j;
     cl_device_id *devices = (cl_device_id *)malloc(numDevices*sizeof(cl_device_id));
 
-    clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, numDevices, devices, NULL);
+    clGetDeviceIDs(platform, opt_cl_device_type, numDevices, devices, NULL);
     for (j = 0; j < numDevices; j++) {
       clGetDeviceInfo(devices[j], CL_DEVICE_NAME, sizeof(pbuff), pbuff, NULL);
       applog(LOG_INFO, "\t%i\t%s", j, pbuff);
@@ -149,12 +156,29 @@ out:
   return ret;
 }
 
+bool clDeviceIdent(unsigned int gpu, char *device, size_t devsize, char *driver, size_t drvsize)
+{
+  cl_platform_id platform = NULL;
+  cl_device_id *devices;
+  cl_uint numDevices;
+
+  if (!get_opencl_platform(opt_platform_id, &platform))
+    return false;
+  if (clGetDeviceIDs(platform, opt_cl_device_type, 0, NULL, &numDevices) != CL_SUCCESS || gpu >= numDevices)
+    return false;
+
+  devices = (cl_device_id *)alloca(numDevices * sizeof(cl_device_id));
+  return clGetDeviceIDs(platform, opt_cl_device_type, numDevices, devices, NULL) == CL_SUCCESS &&
+    clGetDeviceInfo(devices[gpu], CL_DEVICE_NAME, devsize, device, NULL) == CL_SUCCESS &&
+    clGetDeviceInfo(devices[gpu], CL_DRIVER_VERSION, drvsize, driver, NULL) == CL_SUCCESS;
+}
+
 static cl_int create_opencl_context(cl_context *context, cl_platform_id *platform)
 {
   cl_context_properties cps[3] = { CL_CONTEXT_PLATFORM, (cl_context_properties)*platform, 0 };
   cl_int status;
 
-  *context = clCreateContextFromType(cps, CL_DEVICE_TYPE_GPU, NULL, NULL, &status);
+  *context = clCreateContextFromType(cps, opt_cl_device_type, NULL, NULL, &status);
   return status;
 }
 
@@ -190,7 +214,8 @@ static cl_int create_opencl_command_queue(cl_command_queue *command_queue, cl_co
   *command_queue = clCreateCommandQueue(*context, *device,
     cq_properties, &status);
   if (status != CL_SUCCESS) /* Try again without OOE enable */
-    *command_queue = clCreateCommandQueue(*context, *device, 0, &status);
+    *command_queue = clCreateCommandQueue(*context, *device,
+      cq_properties & CL_QUEUE_PROFILING_ENABLE, &status);
   return status;
 }
 
@@ -207,6 +232,9 @@ _clState *initCl(unsigned int gpu, char *name, size_t nameSize, algorithm_t *alg
   build_kernel_data *build_data = (build_kernel_data *)alloca(sizeof(struct _build_kernel_data));
   char **pbuff = (char **)alloca(sizeof(char *) * numDevices), filename[256];
 
+  // pick the kernel variant first, tuning it on this device if needed
+  kernel_autotune(cgpu);
+
   // sanity check
   if (!get_opencl_platform(opt_platform_id, &platform)) {
     return NULL;
@@ -224,7 +252,7 @@ _clState *initCl(unsigned int gpu, char *name, size_t nameSize, algorithm_t *alg
 
   /* Now, get the device list data */
 
-  status = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, numDevices, devices, NULL);
+  status = clGetDeviceIDs(platform, opt_cl_device_type, numDevices, devices, NULL);
   if (status != CL_SUCCESS) {
     applog(LOG_ERR, "Error %d: Getting Device IDs (list)", status);
     return NULL;
@@ -270,12 +298,19 @@ _clState *initCl(unsigned int gpu, char *name, size_t nameSize, algorithm_t *alg
     return NULL;
   }
 
-  status = create_opencl_command_queue(&clState->commandQueue, &clState->context, &devices[gpu], cgpu->algorithm.cq_properties);
+  status = create_opencl_command_queue(&clState->commandQueue, &clState->context, &devices[gpu],
+    cgpu->algorithm.cq_properties | (opt_kernel_profile ? CL_QUEUE_PROFILING_ENABLE : 0));
   if (status != CL_SUCCESS) {
     applog(LOG_ERR, "Error %d: Creating Command Queue. (clCreateCommandQueue)", status);
     return NULL;
   }
 
+  // uploads may only be left to complete in the background on an in order
+  // queue, it may have been created without the requested out of order mode
+  cl_command_queue_properties cq_props = CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
+  clGetCommandQueueInfo(clState->commandQueue, CL_QUEUE_PROPERTIES, sizeof(cq_props), &cq_props, NULL);
+  clState->in_order = !(cq_props & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
+
   status = clGetDeviceInfo(devices[gpu], CL_DEVICE_PREFERRED_VECTOR_WIDTH_INT, sizeof(cl_uint), (void *)&preferred_vwidth, NULL);
   if (status != CL_SUCCESS) {
     applog(LOG_ERR, "Error %d: Failed to clGetDeviceInfo when trying to get CL_DEVICE_PREFERRED_VECTOR_WIDTH_INT", status);
@@ -348,7 +383,7 @@ _clState *initCl(unsigned int gpu, char *name, size_t nameSize, algorithm_t *alg
    * name + g + lg + lookup_gap + tc + thread_concurrency + nf + nfactor + w + work_size + l + sizeof(long) + .bin
    */
 
-  sprintf(filename, "%s.cl", (!empty_string(cgpu->algorithm.kernelfile) ? cgpu->algorithm.kernelfile : cgpu->algorithm.name));
+  sprintf(filename, "%s.cl", get_algorithm_kernel(&cgpu->algorithm));
   applog(LOG_DEBUG, "Using source file %s", filename);
 
   /* For some reason 2 vectors is still better even if the card says
@@ -381,12 +416,12 @@ _clState *initCl(unsigned int gpu, char *name, size_t nameSize, algorithm_t *alg
   else
     cgpu->lookup_gap = cgpu->opt_lg;
 
-  if ((strcmp(cgpu->algorithm.name, "zuikkis") == 0) && (cgpu->lookup_gap != 2)) {
+  if ((strcmp(get_algorithm_kernel(&cgpu->algorithm), "zuikkis") == 0) && (cgpu->lookup_gap != 2)) {
     applog(LOG_WARNING, "Kernel zuikkis only supports lookup-gap = 2 (currently %d), forcing.", cgpu->lookup_gap);
     cgpu->lookup_gap = 2;
   }
 
-  if ((strcmp(cgpu->algorithm.name, "bufius") == 0) && ((cgpu->lookup_gap != 2) && (cgpu->lookup_gap != 4) && (cgpu->lookup_gap != 8))) {
+  if ((strcmp(get_algorithm_kernel(&cgpu->algorithm), "bufius") == 0) && ((cgpu->lookup_gap != 2) && (cgpu->lookup_gap != 4) && (cgpu->lookup_gap != 8))) {
     applog(LOG_WARNING, "Kernel bufius only supports lookup-gap of 2, 4 or 8 (currently %d), forcing to 2", cgpu->lookup_gap);
     cgpu->lookup_gap = 2;
   }
@@ -854,11 +889,41 @@ _clState *initCl(unsigned int gpu, char *name, size_t nameSize, algorithm_t *alg
     algorithm->set_compile_options(build_data, cgpu, algorithm);
   }
 
+  // persistent kernels loop over the nonces themselves, see kernel/persistent.cl;
+  // they read the restart generation from a buffer that stays mapped, which
+  // like --mapped-buffers needs AMD's host memory or a shared memory device
+  if (cgpu->persistent) {
+    cl_bool unified = CL_FALSE;
+
+    clGetDeviceInfo(devices[gpu], CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(unified), &unified, NULL);
+    if (!has_persistent_kernel(algorithm))
+      applog(LOG_NOTICE, "GPU %d: %s has no persistent kernel, using the normal one", gpu, filename);
+    else if (!unified && !amd_platform)
+      applog(LOG_NOTICE, "GPU %d: no zero-copy host memory for the restart generation, using the normal kernel", gpu);
+    else {
+      clState->persistent = true;
+      strcat(build_data->compiler_options, " -D PERSISTENT");
+      strcat(build_data->binary_filename, "p");
+    }
+  }
+
+  // the kernel checks the full target and returns the hashes, see kernel/payload.cl
+  if (cgpu->payload) {
+    clState->payload = has_payload_kernel(algorithm);
+    if (clState->payload) {
+      strcat(build_data->compiler_options, " -D HASH_PAYLOAD");
+      strcat(build_data->binary_filename, "h");
+    }
+    else
+      applog(LOG_NOTICE, "GPU %d: %s returns no hash payload, hashing results on the host", gpu, filename);
+  }
+
   strcat(build_data->binary_filename, ".bin");
   applog(LOG_DEBUG, "Using binary file %s", build_data->binary_filename);
 
-  // Load program from file or build it if it doesn't exist
-  if (!(clState->program = load_opencl_binary_kernel(build_data))) {
+  // Load program from file or build it if it doesn't exist; the kernel
+  // benchmark always builds so that edits to the .cl files are measured
+  if (opt_bench_kernel || !(clState->program = load_opencl_binary_kernel(build_data))) {
     applog(LOG_NOTICE, "Building binary %s", build_data->binary_filename);
 
     if (!(clState->program = build_opencl_kernel(build_data, filename))) {
@@ -909,11 +974,41 @@ _clState *initCl(unsigned int gpu, char *name, size_t nameSize, algorithm_t *alg
     }
   }
 
+  if (clState->persistent) {
+    cl_uint nargs = 0;
+
+    // restart, gen and iters come last, after the arguments queue_kernel sets
+    status = clGetKernelInfo(clState->kernel, CL_KERNEL_NUM_ARGS, sizeof(nargs), &nargs, NULL);
+    if (status != CL_SUCCESS || nargs < 3) {
+      applog(LOG_ERR, "Error %d: Getting the persistent kernel arguments. (clGetKernelInfo)", status);
+      return NULL;
+    }
+    clState->persistent_arg = nargs - 3;
+
+    /* The generation stays mapped so that flush_work can bump it while the
+     * kernel runs, the device reads it in place from host memory. */
+    clState->restart = clCreateBuffer(clState->context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, sizeof(cl_uint), NULL, &status);
+    if (status != CL_SUCCESS) {
+      applog(LOG_ERR, "Error %d: clCreateBuffer (restart)", status);
+      return NULL;
+    }
+    clState->restart_gen = (volatile cl_uint *)clEnqueueMapBuffer(clState->commandQueue, clState->restart, CL_TRUE,
+      CL_MAP_WRITE, 0, sizeof(cl_uint), 0, NULL, NULL, &status);
+    if (status != CL_SUCCESS) {
+      applog(LOG_ERR, "Error %d: Mapping the restart buffer. (clEnqueueMapBuffer)", status);
+      return NULL;
+    }
+    *clState->restart_gen = 0;
+    applog(LOG_INFO, "GPU %d: persistent kernel", gpu);
+  }
+
   size_t bufsize=0;
   size_t buf1size=0;
   size_t buf3size=0;
   size_t buf2size=0;
   size_t readbufsize = (algorithm->type == ALGO_CRE) ? 168 : 128;
+  size_t outbufsize = clState->payload ? PAYLOAD_BUFFERSIZE : clState->persistent ? PERSISTENT_BUFFERSIZE : BUFFERSIZE;
+  cl_mem_flags hostmem = 0;
 
   if (algorithm->rw_buffer_size < 0) {
     // calc buffer size for neoscrypt
@@ -1070,8 +1165,21 @@ _clState *initCl(unsigned int gpu, char *name, size_t nameSize, algorithm_t *alg
     readbufsize = 128 + 16; // midstate + endofdata (16)
   }
 
+  // --mapped-buffers keeps CLbuffer0 and outputBuffer mapped while the
+  // kernels use them, which needs a device that works on host memory in
+  // place: AMD's CL_MEM_ALLOC_HOST_PTR buffers or a shared memory device
+  if (cgpu->map_buffers) {
+    cl_bool unified = CL_FALSE;
+
+    clGetDeviceInfo(devices[gpu], CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(unified), &unified, NULL);
+    if (unified || amd_platform)
+      hostmem = CL_MEM_ALLOC_HOST_PTR;
+    else
+      applog(LOG_NOTICE, "GPU %d: no zero-copy host memory, copying the work and result buffers", gpu);
+  }
+
   applog(LOG_DEBUG, "Using read buffer sized %lu", (unsigned long)readbufsize);
-  clState->CLbuffer0 = clCreateBuffer(clState->context, CL_MEM_READ_ONLY, readbufsize, NULL, &status);
+  clState->CLbuffer0 = clCreateBuffer(clState->context, CL_MEM_READ_ONLY | hostmem, readbufsize, NULL, &status);
   if (status != CL_SUCCESS) {
     applog(LOG_ERR, "Error %d: clCreateBuffer (CLbuffer0)", status);
     return NULL;
@@ -1079,13 +1187,130 @@ _clState *initCl(unsigned int gpu, char *name, size_t nameSize, algorithm_t *alg
 
   clState->devid = cgpu->device_id;
 
-  applog(LOG_DEBUG, "Using output buffer sized %lu", BUFFERSIZE);
-  clState->outputBuffer = clCreateBuffer(clState->context, CL_MEM_WRITE_ONLY, BUFFERSIZE, NULL, &status);
+  applog(LOG_DEBUG, "Using output buffer sized %lu", outbufsize);
+  clState->outputBuffer = clCreateBuffer(clState->context, (clState->persistent || clState->payload ? CL_MEM_READ_WRITE : CL_MEM_WRITE_ONLY) | hostmem,
+    outbufsize, NULL, &status);
   if (status != CL_SUCCESS) {
     applog(LOG_ERR, "Error %d: clCreateBuffer (outputBuffer)", status);
     return NULL;
   }
 
+  if (hostmem) {
+    clState->input_map = clEnqueueMapBuffer(clState->commandQueue, clState->CLbuffer0, CL_TRUE,
+      CL_MAP_WRITE, 0, readbufsize, 0, NULL, NULL, &status);
+    if (status != CL_SUCCESS) {
+      applog(LOG_ERR, "Error %d: Mapping CLbuffer0. (clEnqueueMapBuffer)", status);
+      return NULL;
+    }
+    clState->output_map = (uint32_t *)clEnqueueMapBuffer(clState->commandQueue, clState->outputBuffer, CL_TRUE,
+      CL_MAP_READ | CL_MAP_WRITE, 0, outbufsize, 0, NULL, NULL, &status);
+    if (status != CL_SUCCESS) {
+      applog(LOG_ERR, "Error %d: Mapping outputBuffer. (clEnqueueMapBuffer)", status);
+      return NULL;
+    }
+    memset(clState->output_map, 0, outbufsize);
+    applog(LOG_INFO, "GPU %d: work and result buffers mapped", gpu);
+  }
+
   return clState;
 }
 
+
+void releaseCl(_clState *clState)
+{
+  unsigned int i;
+
+  if (clState->restart_gen)
+    clEnqueueUnmapMemObject(clState->commandQueue, clState->restart, (void *)clState->restart_gen, 0, NULL, NULL);
+  if (clState->input_map)
+    clEnqueueUnmapMemObject(clState->commandQueue, clState->CLbuffer0, clState->input_map, 0, NULL, NULL);
+  if (clState->output_map)
+    clEnqueueUnmapMemObject(clState->commandQueue, clState->outputBuffer, clState->output_map, 0, NULL, NULL);
+  clFinish(clState->commandQueue);
+  if (clState->restart)
+    clReleaseMemObject(clState->restart);
+  clReleaseMemObject(clState->outputBuffer);
+  if (clState->CLbuffer0)
+    clReleaseMemObject(clState->CLbuffer0);
+  if (clState->buffer1)
+    clReleaseMemObject(clState->buffer1);
+  if (clState->buffer2)
+    clReleaseMemObject(clState->buffer2);
+  if (clState->buffer3)
+    clReleaseMemObject(clState->buffer3);
+  if (clState->padbuffer8)
+    clReleaseMemObject(clState->padbuffer8);
+  clReleaseKernel(clState->kernel);
+  for (i = 0; i < clState->n_extra_kernels; i++)
+    clReleaseKernel(clState->extra_kernels[i]);
+  clReleaseProgram(clState->program);
+  clReleaseCommandQueue(clState->commandQueue);
+  clReleaseContext(clState->context);
+  if (clState->extra_kernels)
+    free(clState->extra_kernels);
+  free(clState->arg_cache);
+  free(clState);
+}
+
+cl_int set_kernel_arg(_clState *clState, cl_kernel *kernel, cl_uint index, size_t size, const void *value)
+{
+  kernel_arg_t *arg = NULL;
+  size_t k;
+  cl_int status;
+
+  if (kernel == &clState->kernel)
+    k = 0;
+  else if (clState->extra_kernels && kernel >= clState->extra_kernels &&
+           kernel < clState->extra_kernels + clState->n_extra_kernels)
+    k = kernel - clState->extra_kernels + 1;
+  else
+    return clSetKernelArg(*kernel, index, size, value);
+
+  // local memory arguments have no value
+  if (value && size <= KARG_CACHE_BYTES && index < KARG_CACHE_ARGS) {
+    if (!clState->arg_cache)
+      clState->arg_cache = (kernel_arg_t *)calloc((1 + clState->n_extra_kernels) * KARG_CACHE_ARGS, sizeof(kernel_arg_t));
+    if (clState->arg_cache) {
+      arg = &clState->arg_cache[k * KARG_CACHE_ARGS + index];
+      if (arg->size == size && !memcmp(arg->value, value, size))
+        return CL_SUCCESS;
+    }
+  }
+
+  status = clSetKernelArg(*kernel, index, size, value);
+  if (arg) {
+    arg->size = status == CL_SUCCESS ? size : 0;
+    memcpy(arg->value, value, size);
+  }
+  return status;
+}
+
+void forget_kernel_args(_clState *clState)
+{
+  if (clState->arg_cache)
+    memset(clState->arg_cache, 0, (1 + clState->n_extra_kernels) * KARG_CACHE_ARGS * sizeof(kernel_arg_t));
+}
+
+/* Work-items per shader of a persistent kernel pass */
+#define PERSISTENT_WAVES 8
+
+/* A persistent kernel runs the pass of globalThreads nonces with a few waves
+ * per compute unit, each work-item looping over globalThreads / threads of
+ * them, until the generation of the device changes. */
+cl_int queue_persistent_args(_clState *clState, size_t *globalThreads)
+{
+  size_t threads = clState->wsize;
+  cl_uint gen = *clState->restart_gen, iters;
+  cl_int status;
+
+  /* a power of two so that it divides the pass */
+  while (threads * 2 <= clState->compute_shaders * PERSISTENT_WAVES && threads * 2 <= *globalThreads)
+    threads *= 2;
+  iters = *globalThreads / threads;
+  *globalThreads = threads;
+
+  status = set_kernel_arg(clState, &clState->kernel, clState->persistent_arg, sizeof(cl_mem), &clState->restart);
+  status |= set_kernel_arg(clState, &clState->kernel, clState->persistent_arg + 1, sizeof(cl_uint), &gen);
+  status |= set_kernel_arg(clState, &clState->kernel, clState->persistent_arg + 2, sizeof(cl_uint), &iters);
+  return status;
+}
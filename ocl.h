@@ -12,6 +12,16 @@
 
 #include "algorithm.h"
 
+/* Values kept per argument for the first KARG_CACHE_ARGS arguments of the
+ * search kernels; bigger or later arguments are always set */
+#define KARG_CACHE_ARGS 32
+#define KARG_CACHE_BYTES 64
+
+typedef struct {
+  size_t size;    /* 0: not set through the cache yet */
+  unsigned char value[KARG_CACHE_BYTES];
+} kernel_arg_t;
+
 typedef struct __clState {
   cl_context context;
   cl_kernel kernel;
@@ -37,9 +47,44 @@ typedef struct __clState {
   size_t max_work_size;
   size_t wsize;
   size_t compute_shaders;
+  /* --persistent-kernel: restart generation, mapped at restart_gen, and the
+   * index of the first of the restart, gen and iters kernel arguments */
+  bool persistent;
+  cl_mem restart;
+  volatile cl_uint *restart_gen;
+  cl_uint persistent_arg;
+  /* --hash-payload: the kernel takes the target and stores the hash of
+   * every result at PAYLOAD_HASHES */
+  bool payload;
+  /* --mapped-buffers: CLbuffer0 and outputBuffer stay mapped here for the
+   * life of the state, NULL when the buffers are copied */
+  void *input_map;
+  uint32_t *output_map;
+  /* last value of every search kernel argument, (1 + n_extra_kernels) *
+   * KARG_CACHE_ARGS of them, and the work last uploaded to CLbuffer0 */
+  kernel_arg_t *arg_cache;
+  unsigned char cldata_sent[168];
+  size_t cldata_sent_size;
+  bool in_order;
 } _clState;
 
+/* OpenCL device type the GPU driver enumerates, set by --gpu-device-type */
+extern cl_device_type opt_cl_device_type;
+
 extern int clDevicesNum(void);
+/* Name and driver version of OpenCL device gpu */
+extern bool clDeviceIdent(unsigned int gpu, char *device, size_t devsize, char *driver, size_t drvsize);
 extern _clState *initCl(unsigned int gpu, char *name, size_t nameSize, algorithm_t *algorithm);
+/* Frees everything initCl() created */
+extern void releaseCl(_clState *clState);
+/* clSetKernelArg() for kernel, which is clState->kernel or one of its
+ * extra_kernels, skipped when the argument already has this value */
+extern cl_int set_kernel_arg(_clState *clState, cl_kernel *kernel, cl_uint index, size_t size, const void *value);
+/* Sets every argument again on the next set_kernel_arg(), for when a
+ * buffer was recreated and may have the handle of the old one */
+extern void forget_kernel_args(_clState *clState);
+/* Sets the restart, gen and iters arguments of a persistent kernel for a
+ * pass of *globalThreads nonces, and leaves the launch size there */
+extern cl_int queue_persistent_args(_clState *clState, size_t *globalThreads);
 
 #endif /* OCL_H */
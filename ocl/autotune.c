@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "autotune.h"
+#include "miner.h"
+#include "ocl.h"
+#include "bench.h"
+
+bool opt_kernel_autotune;
+char *opt_kernel_autotune_file = "kernel-autotune.txt";
+
+/* used when the device has no fixed intensity */
+#define AUTOTUNE_INTENSITY 16
+
+struct autotune_result {
+  char algorithm[20];
+  char device[256];
+  char driver[64];
+  char variant[20];   /* empty if no variant could be tuned */
+  double rate;        /* H/s, 0 for results that are not saved */
+  struct autotune_result *next;
+};
+
+static struct autotune_result *results;
+static bool results_loaded;
+static pthread_mutex_t autotune_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool is_variant(const char *algorithm, const char *variant)
+{
+  const char *name;
+  unsigned int i;
+
+  for (i = 0; (name = get_algorithm_variant(algorithm, i)); i++)
+    if (!strcmp(name, variant))
+      return true;
+  return false;
+}
+
+static struct autotune_result *add_result(const char *algorithm, const char *device,
+                                          const char *driver, const char *variant, double rate)
+{
+  struct autotune_result *r = (struct autotune_result *)calloc(1, sizeof(struct autotune_result));
+
+  if (unlikely(!r))
+    quit(1, "Failed to calloc in kernel autotune");
+  snprintf(r->algorithm, sizeof(r->algorithm), "%s", algorithm);
+  snprintf(r->device, sizeof(r->device), "%s", device);
+  snprintf(r->driver, sizeof(r->driver), "%s", driver);
+  snprintf(r->variant, sizeof(r->variant), "%s", variant);
+  r->rate = rate;
+  r->next = results;
+  results = r;
+  return r;
+}
+
+static struct autotune_result *find_result(const char *algorithm, const char *device, const char *driver)
+{
+  struct autotune_result *r;
+
+  for (r = results; r; r = r->next)
+    if (!strcmp(r->algorithm, algorithm) && !strcmp(r->device, device) && !strcmp(r->driver, driver))
+      return r;
+  return NULL;
+}
+
+/* One result per line: algorithm|device|driver|variant|H/s */
+static void load_results(void)
+{
+  char line[512], *field[5];
+  int lineno = 0;
+  FILE *f;
+
+  if (!(f = fopen(opt_kernel_autotune_file, "r")))
+    return;
+
+  while (fgets(line, sizeof(line), f)) {
+    char *p = line;
+    int n;
+
+    lineno++;
+    if (*line == '#')
+      continue;
+    line[strcspn(line, "\r\n")] = '\0';
+    for (n = 0; n < 5 && p; n++) {
+      field[n] = p;
+      if ((p = strchr(p, '|')))
+        *p++ = '\0';
+    }
+    if (n < 5 || !is_variant(field[0], field[3])) {
+      applog(LOG_WARNING, "Ignoring invalid line %d of %s", lineno, opt_kernel_autotune_file);
+      continue;
+    }
+    if (!find_result(field[0], field[1], field[2]))
+      add_result(field[0], field[1], field[2], field[3], atof(field[4]));
+  }
+  fclose(f);
+}
+
+static void save_results(void)
+{
+  struct autotune_result *r;
+  FILE *f;
+
+  if (!(f = fopen(opt_kernel_autotune_file, "w"))) {
+    applog(LOG_ERR, "Failed to write kernel autotune results to %s", opt_kernel_autotune_file);
+    return;
+  }
+
+  fprintf(f, "# sgminer kernel autotune: algorithm|device|driver|kernel|H/s\n");
+  for (r = results; r; r = r->next)
+    if (r->rate > 0)
+      fprintf(f, "%s|%s|%s|%s|%.0f\n", r->algorithm, r->device, r->driver, r->variant, r->rate);
+  fclose(f);
+}
+
+static struct autotune_result *tune(struct cgpu_info *cgpu, const char *device, const char *driver)
+{
+  algorithm_t algorithm = cgpu->algorithm;
+  int intensity = AUTOTUNE_INTENSITY;
+  const char *variant, *best = "";
+  double rate, best_rate = 0;
+  unsigned int i;
+
+  if (!cgpu->dynamic && !cgpu->xintensity && !cgpu->rawintensity && cgpu->intensity)
+    intensity = cgpu->intensity;
+
+  applog(LOG_NOTICE, "GPU %d: autotuning %s kernels at intensity %d", cgpu->device_id,
+         algorithm.name, intensity);
+
+  for (i = 0; (variant = get_algorithm_variant(algorithm.name, i)); i++) {
+    set_algorithm_variant(&cgpu->algorithm, variant);
+    rate = bench_kernel_rate(cgpu, intensity);
+    cgpu->algorithm = algorithm;
+
+    if (rate > best_rate) {
+      best_rate = rate;
+      best = variant;
+    }
+  }
+
+  if (best_rate > 0)
+    applog(LOG_NOTICE, "GPU %d: %s is fastest for %s (%.1f H/s)", cgpu->device_id, best,
+           algorithm.name, best_rate);
+  else
+    applog(LOG_WARNING, "GPU %d: no %s kernel could be tuned, using the default", cgpu->device_id,
+           algorithm.name);
+
+  return add_result(algorithm.name, device, driver, best, best_rate);
+}
+
+void kernel_autotune(struct cgpu_info *cgpu)
+{
+  algorithm_t *algorithm = &cgpu->algorithm;
+  char device[256], driver[64];
+  struct autotune_result *r;
+
+  /* the tuning itself runs initCl() with a variant set */
+  if (!opt_kernel_autotune || algorithm->variant || !empty_string(algorithm->kernelfile))
+    return;
+  if (!get_algorithm_variant(algorithm->name, 1))
+    return;
+  if (!clDeviceIdent(cgpu->virtual_gpu, device, sizeof(device), driver, sizeof(driver)))
+    return;
+
+  mutex_lock(&autotune_lock);
+  if (!results_loaded) {
+    load_results();
+    results_loaded = true;
+  }
+  if (!(r = find_result(algorithm->name, device, driver))) {
+    r = tune(cgpu, device, driver);
+    if (r->rate > 0)
+      save_results();
+  }
+  mutex_unlock(&autotune_lock);
+
+  if (*r->variant && set_algorithm_variant(algorithm, r->variant))
+    applog(LOG_INFO, "GPU %d: using kernel %s for %s", cgpu->device_id,
+           get_algorithm_kernel(algorithm), algorithm->name);
+}
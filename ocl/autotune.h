@@ -0,0 +1,26 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <stdbool.h>
+
+/*
+ * Kernel variant autotune (--kernel-autotune). Several algorithms ship
+ * alternative kernels (darkcoin and darkcoin-mod, x14 and x14old, the
+ * scrypt kernels...). The first time an algorithm is loaded on a device,
+ * every variant is benchmarked on the same synthetic work and checked
+ * against the CPU hash. The fastest one is remembered per algorithm,
+ * device name and driver version in --kernel-autotune-file, and initCl()
+ * builds it from then on.
+ */
+
+extern bool opt_kernel_autotune;
+extern char *opt_kernel_autotune_file;
+
+struct cgpu_info;
+
+/* Picks the kernel variant of cgpu->algorithm for its device, tuning it
+ * first if it is not known yet. Does nothing without --kernel-autotune,
+ * with an explicit kernelfile or if a variant is already set. */
+extern void kernel_autotune(struct cgpu_info *cgpu);
+
+#endif /* AUTOTUNE_H */
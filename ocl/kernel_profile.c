@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernel_profile.h"
+#include "miner.h"
+
+void kernel_profile_reset(struct kernel_profile **kp, unsigned int nstages)
+{
+  struct kernel_profile *p = *kp;
+
+  if (nstages > KPROF_STAGES)
+    nstages = KPROF_STAGES;
+
+  if (!p) {
+    p = (struct kernel_profile *)calloc(1, sizeof(struct kernel_profile));
+    if (unlikely(!p))
+      quit(1, "Failed to calloc in kernel_profile_reset");
+    mutex_init(&p->lock);
+    p->nstages = nstages;
+    *kp = p;
+    return;
+  }
+
+  mutex_lock(&p->lock);
+  p->nstages = nstages;
+  p->next = p->count = 0;
+  p->passes = 0;
+  mutex_unlock(&p->lock);
+}
+
+void kernel_profile_add(struct kernel_profile *kp, cl_event *events, unsigned int nevents)
+{
+  float us[KPROF_STAGES];
+  unsigned int i;
+  bool ok = true;
+
+  for (i = 0; i < nevents; i++) {
+    cl_ulong start = 0, end = 0;
+
+    if (clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL) != CL_SUCCESS ||
+        clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL) != CL_SUCCESS)
+      ok = false;
+    else if (i < KPROF_STAGES)
+      us[i] = (end - start) / 1000.0f;
+    clReleaseEvent(events[i]);
+  }
+
+  if (!ok)
+    return;
+
+  mutex_lock(&kp->lock);
+  if (nevents == kp->nstages) {
+    for (i = 0; i < kp->nstages; i++)
+      kp->samples[i][kp->next] = us[i];
+    kp->next = (kp->next + 1) % KPROF_SAMPLES;
+    if (kp->count < KPROF_SAMPLES)
+      kp->count++;
+    kp->passes++;
+  }
+  mutex_unlock(&kp->lock);
+}
+
+static int cmp_float(const void *a, const void *b)
+{
+  float fa = *(const float *)a, fb = *(const float *)b;
+
+  return (fa > fb) - (fa < fb);
+}
+
+/* Nearest rank percentile of n sorted samples */
+static double percentile(const float *sorted, unsigned int n, unsigned int pct)
+{
+  unsigned int rank = (n * pct + 99) / 100;
+
+  return sorted[rank ? rank - 1 : 0];
+}
+
+unsigned int kernel_profile_stats(struct kernel_profile *kp, struct kernel_stage_stats *st)
+{
+  float sorted[KPROF_SAMPLES];
+  unsigned int nstages, n, i, j;
+  double chain = 0;
+
+  mutex_lock(&kp->lock);
+  nstages = kp->nstages;
+  n = kp->count;
+  for (i = 0; i < nstages; i++) {
+    double sum = 0;
+
+    memset(&st[i], 0, sizeof(st[i]));
+    st[i].passes = kp->passes;
+    st[i].samples = n;
+    if (!n)
+      continue;
+    memcpy(sorted, kp->samples[i], n * sizeof(float));
+    qsort(sorted, n, sizeof(float), cmp_float);
+    for (j = 0; j < n; j++)
+      sum += sorted[j];
+    st[i].avg = sum / n / 1000;
+    st[i].p50 = percentile(sorted, n, 50) / 1000;
+    st[i].p90 = percentile(sorted, n, 90) / 1000;
+    st[i].p99 = percentile(sorted, n, 99) / 1000;
+    st[i].max = sorted[n - 1] / 1000;
+    chain += st[i].avg;
+  }
+  mutex_unlock(&kp->lock);
+
+  for (i = 0; i < nstages; i++)
+    st[i].share = chain > 0 ? st[i].avg * 100 / chain : 0;
+
+  return nstages;
+}
+
+void kernel_stage_name(char *buf, size_t bufsiz, unsigned int stage)
+{
+  if (stage)
+    snprintf(buf, bufsiz, "search%u", stage);
+  else
+    snprintf(buf, bufsiz, "search");
+}
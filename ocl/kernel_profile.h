@@ -0,0 +1,49 @@
+#ifndef KERNEL_PROFILE_H
+#define KERNEL_PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#ifdef __APPLE_CC__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+/*
+ * Per-stage timing of the kernel chain of one device (--kernel-profile).
+ * Stage 0 is the "search" kernel, stage N the "searchN" extra kernel.
+ * The device time of every stage is kept for the last KPROF_SAMPLES
+ * passes; averages and percentiles are taken over that window.
+ */
+
+#define KPROF_STAGES 20
+#define KPROF_SAMPLES 256
+
+struct kernel_profile {
+  pthread_mutex_t lock;
+  unsigned int nstages;
+  unsigned int next;      /* ring slot of the next pass */
+  unsigned int count;     /* passes in the ring */
+  uint64_t passes;        /* since the last reset */
+  float samples[KPROF_STAGES][KPROF_SAMPLES];  /* microseconds */
+};
+
+struct kernel_stage_stats {
+  uint64_t passes;
+  unsigned int samples;
+  double avg, p50, p90, p99, max;   /* milliseconds */
+  double share;                     /* percent of the whole chain */
+};
+
+/* Allocates *kp on first use and clears it for a chain of nstages kernels */
+extern void kernel_profile_reset(struct kernel_profile **kp, unsigned int nstages);
+/* Adds one pass from the profiling events of its kernels and releases them */
+extern void kernel_profile_add(struct kernel_profile *kp, cl_event *events, unsigned int nevents);
+/* Fills st[0 .. nstages) and returns nstages */
+extern unsigned int kernel_profile_stats(struct kernel_profile *kp, struct kernel_stage_stats *st);
+/* Kernel name of a stage: "search", "search1" ... */
+extern void kernel_stage_name(char *buf, size_t bufsiz, unsigned int stage);
+
+#endif /* KERNEL_PROFILE_H */
@@ -0,0 +1,245 @@
+/*
+ * Copyright 2013-2014 sgminer developers (see AUTHORS.md)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 3 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "miner.h"
+#include "reactor.h"
+
+#ifdef HAVE_REACTOR
+
+#include <sys/epoll.h>
+
+#define REACTOR_EVENTS 64
+
+static int epfd = -1;
+static pthread_mutex_t reactor_lock;
+static LIST_HEAD(reactor_srcs);
+/* Removed sources, freed by the reactor thread */
+static LIST_HEAD(reactor_gone);
+static struct thread_q *reactor_q;
+
+/* Hands a source that fired to the workers, called with reactor_lock held */
+static void reactor_fire(struct reactor_src *src, int events)
+{
+  src->armed = false;
+  src->due = 0;
+  src->events = events;
+  tq_push(reactor_q, src);
+}
+
+static void *reactor_thread(void __maybe_unused *userdata)
+{
+  struct epoll_event evs[REACTOR_EVENTS];
+
+  pthread_detach(pthread_self());
+  RenameThread("Reactor");
+
+  while (42) {
+    struct reactor_src *src, *tmp;
+    time_t now;
+    int i, n;
+
+    /* Timers have a resolution of a second */
+    n = epoll_wait(epfd, evs, REACTOR_EVENTS, 1000);
+    if (n < 0 && errno != EINTR)
+      quit(1, "epoll_wait failed in reactor_thread");
+
+    mutex_lock(&reactor_lock);
+    for (i = 0; i < n; i++) {
+      src = (struct reactor_src *)evs[i].data.ptr;
+      if (src->armed && src->fd >= 0)
+        reactor_fire(src, REACTOR_READ);
+    }
+    now = time(NULL);
+    list_for_each_entry_safe(src, tmp, &reactor_srcs, node) {
+      if (src->armed && src->due && now >= src->due)
+        reactor_fire(src, REACTOR_TIMEOUT);
+    }
+    /* Unarmed, so the events above skipped them, and the next wait cannot
+     * return them */
+    list_for_each_entry_safe(src, tmp, &reactor_gone, node) {
+      list_del(&src->node);
+      free(src);
+    }
+    mutex_unlock(&reactor_lock);
+  }
+
+  return NULL;
+}
+
+static void *reactor_worker(void __maybe_unused *userdata)
+{
+  pthread_detach(pthread_self());
+  RenameThread("ReactorWork");
+
+  while (42) {
+    struct reactor_src *src = (struct reactor_src *)tq_pop(reactor_q, NULL);
+
+    if (src)
+      src->fn(src->arg, src->events);
+  }
+
+  return NULL;
+}
+
+bool reactor_init(int workers)
+{
+  pthread_t pth;
+  int i;
+
+  epfd = epoll_create(REACTOR_EVENTS);
+  if (epfd < 0) {
+    applog(LOG_ERR, "Failed to create epoll instance: %s", strerror(errno));
+    return false;
+  }
+  mutex_init(&reactor_lock);
+  reactor_q = tq_new();
+  if (unlikely(!reactor_q))
+    quit(1, "Failed to tq_new in reactor_init");
+
+  for (i = 0; i < workers; i++) {
+    if (unlikely(pthread_create(&pth, NULL, reactor_worker, NULL)))
+      quit(1, "Failed to create reactor worker");
+  }
+  if (unlikely(pthread_create(&pth, NULL, reactor_thread, NULL)))
+    quit(1, "Failed to create reactor thread");
+
+  applog(LOG_INFO, "Stratum reactor started with %d workers", workers);
+  return true;
+}
+
+void reactor_src_init(struct reactor_src *src, reactor_fn fn, void *arg)
+{
+  memset(src, 0, sizeof(*src));
+  src->fn = fn;
+  src->arg = arg;
+  src->fd = -1;
+
+  mutex_lock(&reactor_lock);
+  list_add_tail(&src->node, &reactor_srcs);
+  mutex_unlock(&reactor_lock);
+}
+
+/* Stops watching the socket of src, it may have been closed already */
+static void reactor_unwatch(struct reactor_src *src)
+{
+  if (src->fd >= 0)
+    epoll_ctl(epfd, EPOLL_CTL_DEL, src->fd, NULL);
+  src->fd = -1;
+}
+
+void reactor_watch(struct reactor_src *src, SOCKETTYPE fd, int timeout)
+{
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN | EPOLLONESHOT;
+  ev.data.ptr = src;
+
+  mutex_lock(&reactor_lock);
+  if (src->fd != fd)
+    reactor_unwatch(src);
+  src->due = timeout ? time(NULL) + timeout : 0;
+  src->armed = true;
+  /* A closed socket leaves the epoll set by itself, its number may be
+   * reused by the new connection */
+  if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) && epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) {
+    applog(LOG_WARNING, "Failed to add socket %d to epoll: %s", (int)fd, strerror(errno));
+    src->fd = -1;
+    /* Let the callback find out what is wrong with it */
+    reactor_fire(src, REACTOR_TIMEOUT);
+  } else
+    src->fd = fd;
+  mutex_unlock(&reactor_lock);
+}
+
+void reactor_timer(struct reactor_src *src, int secs)
+{
+  mutex_lock(&reactor_lock);
+  reactor_unwatch(src);
+  src->due = time(NULL) + (secs > 0 ? secs : 0);
+  src->armed = true;
+  mutex_unlock(&reactor_lock);
+}
+
+void reactor_idle(struct reactor_src *src)
+{
+  mutex_lock(&reactor_lock);
+  reactor_unwatch(src);
+  src->due = 0;
+  src->armed = false;
+  mutex_unlock(&reactor_lock);
+}
+
+void reactor_kick(struct reactor_src *src)
+{
+  struct reactor_src *cur, *tmp;
+
+  /* src may be gone already, only one still listed is looked at */
+  mutex_lock(&reactor_lock);
+  list_for_each_entry_safe(cur, tmp, &reactor_srcs, node) {
+    if (cur == src) {
+      if (src->armed)
+        reactor_fire(src, REACTOR_TIMEOUT);
+      break;
+    }
+  }
+  mutex_unlock(&reactor_lock);
+}
+
+void reactor_remove(struct reactor_src *src)
+{
+  mutex_lock(&reactor_lock);
+  reactor_unwatch(src);
+  src->armed = false;
+  list_move_tail(&src->node, &reactor_gone);
+  mutex_unlock(&reactor_lock);
+}
+
+#else /* HAVE_REACTOR */
+
+bool reactor_init(int __maybe_unused workers)
+{
+  applog(LOG_WARNING, "The stratum reactor needs epoll, using a thread per pool");
+  return false;
+}
+
+void reactor_src_init(struct reactor_src __maybe_unused *src, reactor_fn __maybe_unused fn, void __maybe_unused *arg)
+{
+}
+
+void reactor_watch(struct reactor_src __maybe_unused *src, SOCKETTYPE __maybe_unused fd, int __maybe_unused timeout)
+{
+}
+
+void reactor_timer(struct reactor_src __maybe_unused *src, int __maybe_unused secs)
+{
+}
+
+void reactor_idle(struct reactor_src __maybe_unused *src)
+{
+}
+
+void reactor_kick(struct reactor_src __maybe_unused *src)
+{
+}
+
+void reactor_remove(struct reactor_src *src)
+{
+  free(src);
+}
+
+#endif /* HAVE_REACTOR */
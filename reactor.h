@@ -0,0 +1,52 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "miner.h"
+
+/*
+ * Event reactor for the stratum pool sockets (--stratum-reactor).
+ *
+ * One thread waits on all watched sockets with epoll and on their timers.
+ * When a socket becomes readable or its timer runs out, the callback of its
+ * source runs on one of a few worker threads.  A source fires once per
+ * reactor_watch()/reactor_timer() and the callback arms it again when it
+ * wants more, so a source is never handled by two workers at a time.
+ *
+ * Only available with epoll (Linux), reactor_init() fails elsewhere.
+ */
+
+#if defined(__linux)
+#define HAVE_REACTOR 1
+#endif
+
+#define REACTOR_READ    1   /* the socket has data */
+#define REACTOR_TIMEOUT 2   /* the timer ran out first */
+
+typedef void (*reactor_fn)(void *arg, int events);
+
+struct reactor_src {
+  reactor_fn fn;
+  void *arg;
+  int fd;           /* socket registered with epoll, -1 for none */
+  time_t due;       /* timer, 0 for none */
+  bool armed;       /* waiting on the reactor */
+  int events;       /* why it fired, passed to fn */
+  struct list_head node;
+};
+
+/* Starts the reactor thread and workers worker threads */
+extern bool reactor_init(int workers);
+extern void reactor_src_init(struct reactor_src *src, reactor_fn fn, void *arg);
+/* Fires src when fd is readable or, with timeout, after timeout seconds */
+extern void reactor_watch(struct reactor_src *src, SOCKETTYPE fd, int timeout);
+/* Fires src after secs seconds, its socket is no longer watched */
+extern void reactor_timer(struct reactor_src *src, int secs);
+/* Leaves src unarmed and forgets its socket, before the socket is closed */
+extern void reactor_idle(struct reactor_src *src);
+/* Fires src now if it is armed and has not been removed */
+extern void reactor_kick(struct reactor_src *src);
+/* Unlinks src, from its own callback or while it is not armed, and frees it
+ * once no event already waited for can name it */
+extern void reactor_remove(struct reactor_src *src);
+
+#endif /* REACTOR_H */
@@ -66,6 +66,11 @@ char *curly = ":D";
 #include "pool.h"
 #include "config_parser.h"
 #include "events.h"
+#include "bench.h"
+#include "reactor.h"
+#include "stratum_json.h"
+#include "sharelog.h"
+#include "ocl/autotune.h"
 
 #if defined(unix) || defined(__APPLE__)
   #include <errno.h>
@@ -112,6 +117,7 @@ int nDevs;
 int opt_dynamic_interval = 7;
 int opt_g_threads = -1;
 bool opt_restart = true;
+int opt_verify_sample = 100;
 
 int opt_vote = 0;
 
@@ -174,6 +180,7 @@ char *opt_api_allow = NULL;
 char *opt_api_groups;
 char *opt_api_description = PACKAGE_STRING;
 int opt_api_port = 4028;
+int opt_api_rate;
 bool opt_api_listen;
 bool opt_api_mcast;
 char *opt_api_mcast_addr = API_MCAST_ADDR;
@@ -182,6 +189,10 @@ char *opt_api_mcast_des = "";
 int opt_api_mcast_port = 4028;
 bool opt_api_network;
 bool opt_delaynet;
+bool opt_tcp_nodelay = true;
+bool opt_stratum_reactor;
+int opt_standby_pools;
+int opt_stratum_workers = 2;
 bool opt_disable_pool;
 bool opt_disable_client_reconnect = false;
 static bool no_work;
@@ -222,7 +233,6 @@ static pthread_mutex_t *stgd_lock;
 pthread_mutex_t console_lock;
 cglock_t ch_lock;
 static pthread_rwlock_t blk_lock;
-static pthread_mutex_t sshare_lock;
 
 pthread_rwlock_t netacc_lock;
 pthread_rwlock_t mining_thr_lock;
@@ -263,6 +273,22 @@ double total_diff1;
 int total_getworks, total_stale, total_discarded;
 double total_diff_accepted, total_diff_rejected, total_diff_stale;
 static int staged_rollable;
+/* Adaptive staging: works per second taken by the devices, the staged
+ * depth the getwork scheduler aims for, and the "Waiting for work" events
+ * with the device time they cost */
+double work_rate;
+int staged_target;
+int idle_events;
+double idle_secs;
+/* Work of a failover pool kept aside while the current pool is unwell */
+static struct work *failover_work;
+int failover_prefetched, failover_used;
+/* The work whose nonce space is being handed out in ranges, see
+ * get_nonce_range(), and the first nonce not handed out yet */
+static struct work *nonce_job;
+static uint64_t nonce_job_next;
+static pthread_mutex_t nonce_lock;
+int nonce_jobs, nonce_ranges;
 unsigned int new_blocks;
 static unsigned int work_block;
 unsigned int found_blocks;
@@ -318,18 +344,24 @@ static struct block *blocks = NULL;
 
 int swork_id;
 
-/* For creating a hash database of stratum shares submitted that have not had
- * a response yet */
+/* For creating a per pool hash database of stratum shares submitted that
+ * have not had a response yet, see sshare_add() */
 struct stratum_share {
   UT_hash_handle hh;
+  struct list_head wheel;
   bool block;
   struct work *work;
   int id;
   time_t sshare_time;
   time_t sshare_sent;
+  time_t expire;
+  struct timeval tv_sent;
+  double latency;   /* ms from sending to the pool's response */
 };
 
-static struct stratum_share *stratum_shares = NULL;
+const int share_lat_bounds[SHARE_LAT_BUCKETS - 1] = {
+  10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000
+};
 
 char *opt_socks_proxy = NULL;
 
@@ -438,9 +470,6 @@ static void applog_and_exit(const char *fmt, ...)
   exit(1);
 }
 
-static pthread_mutex_t sharelog_lock;
-static FILE *sharelog_file = NULL;
-
 struct cgpu_info *get_thr_cgpu(int thr_id)
 {
   struct cgpu_info *cgpu = NULL;
@@ -466,48 +495,6 @@ struct cgpu_info *get_devices(int id)
 
 void enable_device(int i);
 
-static void sharelog(const char*disposition, const struct work*work)
-{
-  char *target, *hash, *data;
-  struct cgpu_info *cgpu;
-  unsigned long int t;
-  struct pool *pool;
-  int thr_id, rv;
-  char s[1024];
-  size_t ret;
-
-  if (!sharelog_file)
-    return;
-
-  thr_id = work->thr_id;
-  cgpu = get_thr_cgpu(thr_id);
-  pool = work->pool;
-  t = (unsigned long int)(work->tv_work_found.tv_sec);
-  target = bin2hex(work->target, sizeof(work->target));
-  hash = bin2hex(work->hash, sizeof(work->hash));
-  data = bin2hex(work->data, sizeof(work->data));
-
-  // timestamp,disposition,target,pool,dev,thr,sharehash,sharedata
-  rv = snprintf(s, sizeof(s), "%lu,%s,%s,%s,%s%u,%u,%s,%s\n", t, disposition, target, pool->rpc_url, cgpu->drv->name, cgpu->device_id, thr_id, hash, data);
-  free(target);
-  free(hash);
-  free(data);
-  if (rv >= (int)(sizeof(s)))
-    s[sizeof(s) - 1] = '\0';
-  else if (rv < 0) {
-    applog(LOG_ERR, "sharelog printf error");
-    return;
-  }
-
-  mutex_lock(&sharelog_lock);
-  ret = fwrite(s, rv, 1, sharelog_file);
-  fflush(sharelog_file);
-  mutex_unlock(&sharelog_lock);
-
-  if (ret != 1)
-    applog(LOG_ERR, "sharelog fwrite error");
-}
-
 static char *getwork_req = "{\"method\": \"getwork\", \"params\": [], \"id\":0}\n";
 
 static char *gbt_req = "{\"id\": 0, \"method\": \"getblocktemplate\", \"params\": [{\"capabilities\": [\"coinbasetxn\", \"coinbasevalue\", \"workid\", \"coinbase/append\"]}]}\n";
@@ -557,6 +544,7 @@ void adjust_quota_gcd(void)
 struct pool *add_pool(void)
 {
   struct pool *pool;
+  int i;
 
   pool = (struct pool *)calloc(sizeof(struct pool), 1);
   if (!pool)
@@ -584,6 +572,10 @@ struct pool *add_pool(void)
   mutex_init(&pool->stratum_lock);
   cglock_init(&pool->gbt_lock);
   INIT_LIST_HEAD(&pool->curlring);
+  mutex_init(&pool->sshare_lock);
+  for (i = 0; i < SSHARE_WHEEL_SLOTS; i++)
+    INIT_LIST_HEAD(&pool->sshare_wheel[i]);
+  pool->sshare_tick = time(NULL);
 
   /* Make sure the pool doesn't think we've been idle since time 0 */
   pool->tv_idle.tv_sec = ~0UL;
@@ -686,6 +678,11 @@ char *set_int_0_to_10(const char *arg, int *i)
   return set_int_range(arg, i, 0, 10);
 }
 
+char *set_int_0_to_100(const char *arg, int *i)
+{
+  return set_int_range(arg, i, 0, 100);
+}
+
 char *set_int_1_to_10(const char *arg, int *i)
 {
   return set_int_range(arg, i, 1, 10);
@@ -1039,6 +1036,14 @@ void remove_pool(struct pool *pool)
   pool->pool_no = total_pools;
   pool->removed = true;
   total_pools--;
+
+  /* Have the reactor, or its reconnect thread, let go of it */
+  if (pool->rsrc) {
+    reactor_kick(pool->rsrc);
+    mutex_lock(&lp_lock);
+    pthread_cond_broadcast(&lp_cond);
+    mutex_unlock(&lp_lock);
+  }
 }
 
 static char *set_pool_state(char *arg)
@@ -1222,23 +1227,17 @@ static char *set_log_file(char *arg)
 
 static char* set_sharelog(char *arg)
 {
-  char *r = "";
-  long int i = strtol(arg, &r, 10);
-
-  if ((!*r) && i >= 0 && i <= INT_MAX) {
-    sharelog_file = fdopen((int)i, "a");
-    if (!sharelog_file)
-      applog(LOG_ERR, "Failed to open fd %u for share log", (unsigned int)i);
-  } else if (!strcmp(arg, "-")) {
-    sharelog_file = stdout;
-    if (!sharelog_file)
-      applog(LOG_ERR, "Standard output missing for share log");
-  } else {
-    sharelog_file = fopen(arg, "a");
-    if (!sharelog_file)
-      applog(LOG_ERR, "Failed to open %s for share log", arg);
-  }
+  return sharelog_open(arg);
+}
 
+static char *set_sharelog_format(char *arg)
+{
+  if (!strcasecmp(arg, "csv"))
+    opt_sharelog_binary = false;
+  else if (!strcasecmp(arg, "binary"))
+    opt_sharelog_binary = true;
+  else
+    return "Invalid value passed to sharelog-format";
   return NULL;
 }
 
@@ -1412,6 +1411,9 @@ struct opt_table opt_config_table[] = {
   OPT_WITH_ARG("--api-port",
 		set_int_1_to_65535, opt_show_intval, &opt_api_port,
 		"Port number of miner API"),
+  OPT_WITH_ARG("--api-rate",
+		set_int_0_to_9999, opt_show_intval, &opt_api_rate,
+		"API requests per second allowed from each client address, 0 for no limit"),
 #ifdef HAVE_ADL
   OPT_WITHOUT_ARG("--auto-fan",
 		opt_set_bool, &opt_autofan,
@@ -1506,6 +1508,9 @@ struct opt_table opt_config_table[] = {
   OPT_WITH_ARG("--gpu-dyninterval",
       set_int_1_to_65535, opt_show_intval, &opt_dynamic_interval,
       "Set the refresh interval in ms for GPUs using dynamic intensity"),
+  OPT_WITH_ARG("--gpu-device-type",
+      set_gpu_device_type, NULL, NULL,
+      "OpenCL device type to use: gpu, cpu (e.g. POCL), accelerator or all. Default: gpu"),
   OPT_WITH_ARG("--gpu-platform",
       set_int_0_to_9999, opt_show_intval, &opt_platform_id,
       "Select OpenCL platform ID to use for GPU mining"),
@@ -1543,6 +1548,9 @@ struct opt_table opt_config_table[] = {
       set_default_gpu_vddc, NULL, NULL,
       "Set the GPU voltage in Volts - one value for all or separate by commas for per card"),
 #endif
+  OPT_WITHOUT_ARG("--hash-payload",
+      opt_set_bool, &opt_hash_payload,
+      "Let blake kernels check the full share target and return the hash with each nonce"),
   OPT_WITH_ARG("--hamsi-expand-big",
       set_int_1_to_10, opt_show_intval, &opt_hamsi_expand_big,
       "Set SPH_HAMSI_EXPAND_BIG for X13 derived algorithms (1 or 4 are common)"),
@@ -1561,6 +1569,9 @@ struct opt_table opt_config_table[] = {
   OPT_WITHOUT_ARG("--luffa-parallel",
       opt_set_bool, &opt_luffa_parallel,
       "Set SPH_LUFFA_PARALLEL for Xn derived algorithms (Can give better hashrate for some GPUs)"),
+  OPT_WITHOUT_ARG("--mapped-buffers",
+      opt_set_bool, &opt_mapped_buffers,
+      "Keep the GPU work and result buffers mapped in host memory instead of copying them every pass"),
 #ifdef HAVE_CURSES
   OPT_WITHOUT_ARG("--incognito",
       opt_set_bool, &opt_incognito,
@@ -1585,6 +1596,15 @@ struct opt_table opt_config_table[] = {
   OPT_WITH_ARG("--kernel-path|-K",
       opt_set_charp, opt_show_charp, &opt_kernel_path,
       "Specify a path to where kernel files are"),
+  OPT_WITHOUT_ARG("--kernel-autotune",
+      opt_set_bool, &opt_kernel_autotune,
+      "Benchmark the kernel variants of the algorithm on each GPU and use the fastest"),
+  OPT_WITH_ARG("--kernel-autotune-file",
+      opt_set_charp, opt_show_charp, &opt_kernel_autotune_file,
+      "File the kernel autotune results are kept in"),
+  OPT_WITHOUT_ARG("--kernel-profile",
+      opt_set_bool, &opt_kernel_profile,
+      "Time every kernel of a GPU pass, see the kernelprofile API command"),
   OPT_WITHOUT_ARG("--load-balance",
       set_loadbalance, &pool_strategy,
       "Change multipool strategy from failover to quota based balance"),
@@ -1643,6 +1663,9 @@ struct opt_table opt_config_table[] = {
   OPT_WITHOUT_ARG("--no-submit-stale",
       opt_set_invbool, &opt_submit_stale,
       "Don't submit shares if they are detected as stale"),
+  OPT_WITHOUT_ARG("--no-tcp-nodelay",
+      opt_set_invbool, &opt_tcp_nodelay,
+      "Let the OS delay small stratum writes (Nagle) instead of sending them at once"),
   OPT_WITHOUT_ARG("--no-extranonce|--pool-no-extranonce",
       set_no_extranonce_subscribe, NULL,
       "Disable 'extranonce' stratum subscribe for pool"),
@@ -1652,6 +1675,9 @@ struct opt_table opt_config_table[] = {
   OPT_WITHOUT_ARG("--per-device-stats",
       opt_set_bool, &want_per_device_stats,
       "Force verbose mode and output per-device statistics"),
+  OPT_WITHOUT_ARG("--persistent-kernel",
+      opt_set_bool, &opt_persistent_kernel,
+      "Let blake, decred, maxcoin and groestlcoin kernels loop over the nonces on the GPU until new work arrives"),
 
   OPT_WITH_ARG("--poolname", /* TODO: Backward compatibility, to be removed. */
       set_poolname_deprecated, NULL, NULL,
@@ -1822,6 +1848,12 @@ struct opt_table opt_config_table[] = {
   OPT_WITH_ARG("--sharelog",
       set_sharelog, NULL, NULL,
       "Append share log to file"),
+  OPT_WITH_ARG("--sharelog-format",
+      set_sharelog_format, NULL, NULL,
+      "Share log format: csv or binary (see tools/sharelog-convert.c). Default: csv"),
+  OPT_WITH_ARG("--sharelog-rotate",
+      set_int_0_to_9999, opt_show_intval, &opt_sharelog_rotate,
+      "Move the share log aside as <file>.<n> once it reaches this many MB, 0 to never. Default: 0"),
   OPT_WITH_ARG("--shares",
       opt_set_intval, NULL, &opt_shares,
       "Quit after mining N shares (default: unlimited)"),
@@ -1831,9 +1863,24 @@ struct opt_table opt_config_table[] = {
   OPT_WITHOUT_ARG("--show-coindiff",
       opt_set_bool, &opt_show_coindiff,
       "Show coin difficulty rather than hash value of a share"),
+  OPT_WITH_ARG("--standby-pools",
+      set_int_0_to_10, opt_show_intval, &opt_standby_pools,
+      "Backup stratum pools kept connected and subscribed for failover"),
   OPT_WITH_ARG("--state|--pool-state",
       set_pool_state, NULL, NULL,
       "Specify pool state at startup (default: enabled)"),
+#ifdef HAVE_REACTOR
+  OPT_WITHOUT_ARG("--stratum-reactor",
+      opt_set_bool, &opt_stratum_reactor,
+      "Serve all stratum pool connections from one epoll thread instead of a thread per pool"),
+#else
+  OPT_WITHOUT_ARG("--stratum-reactor",
+      opt_set_bool, &opt_stratum_reactor,
+      opt_hidden),
+#endif
+  OPT_WITH_ARG("--stratum-workers",
+      set_int_1_to_10, opt_show_intval, &opt_stratum_workers,
+      "Threads handling stratum messages with --stratum-reactor"),
   OPT_WITH_ARG("--switcher-mode",
       set_switcher_mode, NULL, NULL,
       "Algorithm/gpu settings switcher mode."),
@@ -1891,6 +1938,9 @@ struct opt_table opt_config_table[] = {
   OPT_WITHOUT_ARG("--verbose|-v",
       opt_set_bool, &opt_verbose,
       "Log verbose output to stderr as well as status output"),
+  OPT_WITH_ARG("--verify-sample",
+      set_int_0_to_100, opt_show_intval, &opt_verify_sample,
+      "Percentage of --hash-payload results hashed again on the host, block candidates always are"),
   OPT_WITH_ARG("--vote",
       set_int_1_to_65535, opt_show_intval, &opt_vote,
       "Optional vote value for decred blocks"),
@@ -1958,6 +2008,45 @@ static struct opt_table opt_cmdline_table[] = {
   OPT_WITHOUT_ARG("--remote-config-usecache",
       opt_set_bool, &opt_remoteconf_usecache,
       "Use cached copy of the remote config file when download fails. Default: No"),
+  OPT_WITHOUT_ARG("--bench-cpu",
+      opt_set_bool, &opt_bench_cpu,
+      "Benchmark the CPU share verification code paths against the reference and exit"),
+  OPT_WITH_ARG("--bench-cpu-secs",
+      set_int_1_to_65535, opt_show_intval, &opt_bench_cpu_secs,
+      "Seconds to run each code path with --bench-cpu. Default: 2"),
+  OPT_WITH_ARG("--bench-cpu-algo",
+      opt_set_charp, NULL, &opt_bench_cpu_algos,
+      "Comma separated algorithms to run with --bench-cpu. Default: all"),
+  OPT_WITH_ARG("--bench-cpu-threads",
+      set_int_1_to_65535, opt_show_intval, &opt_bench_cpu_threads,
+      "Also measure scaling of each CPU hash up to this many threads with --bench-cpu. Default: 1"),
+  OPT_WITH_ARG("--bench-cpu-json",
+      opt_set_charp, NULL, &opt_bench_cpu_json,
+      "Save --bench-cpu results as JSON to this file"),
+  OPT_WITH_ARG("--bench-cpu-baseline",
+      opt_set_charp, NULL, &opt_bench_cpu_baseline,
+      "Compare --bench-cpu results with a file saved by --bench-cpu-json"),
+  OPT_WITH_ARG("--bench-cpu-tolerance",
+      set_int_0_to_9999, opt_show_intval, &opt_bench_cpu_tolerance,
+      "Percentage a result may fall below --bench-cpu-baseline before it is a regression. Default: 10"),
+  OPT_WITHOUT_ARG("--bench-kernel",
+      opt_set_bool, &opt_bench_kernel,
+      "Benchmark the algorithm's OpenCL kernel on a synthetic work, check it against the CPU hash and exit"),
+  OPT_WITH_ARG("--bench-kernel-secs",
+      set_int_1_to_65535, opt_show_intval, &opt_bench_kernel_secs,
+      "Seconds to run each intensity with --bench-kernel. Default: 1"),
+  OPT_WITH_ARG("--bench-kernel-intensity",
+      opt_set_charp, NULL, &opt_bench_kernel_intensity,
+      "Intensity or range of intensities (e.g. 8-16) to sweep with --bench-kernel. Default: 8-16"),
+  OPT_WITH_ARG("--bench-kernel-worksize",
+      opt_set_charp, NULL, &opt_bench_kernel_worksize,
+      "Comma separated worksizes to sweep with --bench-kernel. Default: the algorithm's"),
+  OPT_WITH_ARG("--bench-stratum",
+      opt_set_charp, NULL, &opt_bench_stratum,
+      "Replay the stratum messages in a file through both stratum parsers, report messages/s and allocations and exit"),
+  OPT_WITH_ARG("--bench-stratum-secs",
+      set_int_1_to_65535, opt_show_intval, &opt_bench_stratum_secs,
+      "Seconds to run each parser with --bench-stratum. Default: 2"),
   OPT_WITHOUT_ARG("--help|-h",
       opt_verusage_and_exit, NULL,
       "Print this message"),
@@ -2011,12 +2100,93 @@ static void calc_midstate(struct work *work)
 }
 
 
+/* Work structs come from slabs that are never freed and go back on a
+ * lock free list when they are retired.  The list head holds the slab_id of
+ * the first free work in its low 32 bits and a count of the pops in the high
+ * ones, so a pop that raced with a pop and push of the same work fails its
+ * compare and swap.  Past WORK_SLABS slabs works are calloced on their own. */
+#define WORK_SLAB_SIZE 256
+#define WORK_SLABS 1024
+
+static struct work *work_slabs[WORK_SLABS];
+int work_slabs_used;
+static pthread_mutex_t work_slab_lock;
+static volatile uint64_t work_free;
+
+uint64_t work_made, work_recycled, work_heap, work_jobs;
+
+static struct work *work_slot(unsigned int slab_id)
+{
+  return &work_slabs[(slab_id - 1) / WORK_SLAB_SIZE][(slab_id - 1) % WORK_SLAB_SIZE];
+}
+
+static struct work *work_pop(void)
+{
+  uint64_t head, next;
+  struct work *w;
+
+  do {
+    head = work_free;
+    if (!(uint32_t)head)
+      return NULL;
+    w = work_slot((uint32_t)head);
+    next = ((head >> 32) + 1) << 32 | w->slab_next;
+  } while (!atomic_cas64(&work_free, head, next));
+  return w;
+}
+
+static void work_push(struct work *w)
+{
+  uint64_t head;
+
+  do {
+    head = work_free;
+    w->slab_next = (uint32_t)head;
+  } while (!atomic_cas64(&work_free, head, (head >> 32) << 32 | w->slab_id));
+}
+
+/* Adds a slab to the free list, false if there are WORK_SLABS already */
+static bool work_grow(void)
+{
+  struct work *slab;
+  int i, n;
+
+  mutex_lock(&work_slab_lock);
+  n = work_slabs_used;
+  if (n == WORK_SLABS) {
+    mutex_unlock(&work_slab_lock);
+    return false;
+  }
+  slab = (struct work *)calloc(WORK_SLAB_SIZE, sizeof(struct work));
+  if (unlikely(!slab))
+    quit(1, "Failed to calloc work slab in work_grow");
+  work_slabs[n] = slab;
+  work_slabs_used = n + 1;
+  mutex_unlock(&work_slab_lock);
+
+  for (i = 0; i < WORK_SLAB_SIZE; i++) {
+    slab[i].slab_id = n * WORK_SLAB_SIZE + i + 1;
+    work_push(&slab[i]);
+  }
+  return true;
+}
+
 static struct work *make_work(void)
 {
-  struct work *w = (struct work *)calloc(1, sizeof(struct work));
+  struct work *w;
 
-  if (unlikely(!w))
-    quit(1, "Failed to calloc work in make_work");
+  atomic_inc64(&work_made);
+  while (!(w = work_pop())) {
+    if (!work_grow()) {
+      w = (struct work *)calloc(1, sizeof(struct work));
+      if (unlikely(!w))
+        quit(1, "Failed to calloc work in make_work");
+      atomic_inc64(&work_heap);
+      break;
+    }
+  }
+  if (w->slab_id)
+    atomic_inc64(&work_recycled);
 
   cg_wlock(&control_lock);
   w->id = total_work++;
@@ -2025,15 +2195,64 @@ static struct work *make_work(void)
   return w;
 }
 
+struct work_job *work_job_new(const char *job_id, const char *nonce1, const char *ntime,
+                              const char *coinbase, const char *txn_data)
+{
+  const char *src[5] = { job_id, nonce1, ntime, coinbase, txn_data };
+  size_t len[5], size = sizeof(struct work_job);
+  struct work_job *job;
+  char *dst[5], *p;
+  int i;
+
+  for (i = 0; i < 5; i++) {
+    len[i] = src[i] ? strlen(src[i]) + 1 : 0;
+    size += len[i];
+  }
+  job = (struct work_job *)malloc(size);
+  if (unlikely(!job))
+    quit(1, "Failed to malloc job in work_job_new");
+  job->refs = 1;
+  p = (char *)(job + 1);
+  for (i = 0; i < 5; i++) {
+    dst[i] = NULL;
+    if (src[i]) {
+      dst[i] = p;
+      memcpy(p, src[i], len[i]);
+      p += len[i];
+    }
+  }
+  job->job_id = dst[0];
+  job->nonce1 = dst[1];
+  job->ntime = dst[2];
+  job->coinbase = dst[3];
+  job->txn_data = dst[4];
+  atomic_inc64(&work_jobs);
+  return job;
+}
+
+void work_job_put(struct work_job *job)
+{
+  if (job && atomic_fetch_dec(&job->refs) == 1)
+    free(job);
+}
+
+/* Makes work use job, taking over the caller's reference */
+void work_set_job(struct work *work, struct work_job *job)
+{
+  work_job_put(work->job);
+  work->job = job;
+  work->job_id = job->job_id;
+  work->nonce1 = job->nonce1;
+  work->ntime = job->ntime;
+  work->coinbase = job->coinbase;
+  work->txn_data = job->txn_data;
+}
+
 /* This is the central place all work that is about to be retired should be
  * cleaned to remove any dynamically allocated arrays within the struct */
 void clean_work(struct work *w)
 {
-  free(w->job_id);
-  free(w->ntime);
-  free(w->coinbase);
-  free(w->txn_data);
-  free(w->nonce1);
+  work_job_put(w->job);
   memset(w, 0, sizeof(struct work));
 }
 
@@ -2041,8 +2260,15 @@ void clean_work(struct work *w)
  * ram from arrays allocated within the work struct */
 void free_work(struct work *w)
 {
+  unsigned int slab_id = w->slab_id;
+
   clean_work(w);
-  free(w);
+  if (!slab_id) {
+    free(w);
+    return;
+  }
+  w->slab_id = slab_id;
+  work_push(w);
 }
 
 static void calc_diff(struct work *work, double known);
@@ -2256,6 +2482,7 @@ static double get_work_blockdiff(const struct work *work)
 static void gen_gbt_work(struct pool *pool, struct work *work)
 {
   unsigned char *merkleroot;
+  char *coinbase;
   struct timeval now;
   uint64_t nonce2le;
 
@@ -2279,14 +2506,13 @@ static void gen_gbt_work(struct pool *pool, struct work *work)
 
   memcpy(work->target, pool->gbt_target, 32);
 
-  work->coinbase = bin2hex(pool->coinbase, pool->coinbase_len);
-  work->txn_data = strdup(pool->txn_data);
+  /* The coinbase changes with every work, so every work has its own job */
+  coinbase = bin2hex(pool->coinbase, pool->coinbase_len);
+  work_set_job(work, work_job_new(pool->gbt_workid, NULL, NULL, coinbase, pool->txn_data));
+  free(coinbase);
 
   /* For encoding the block data on submission */
   work->gbt_txns = pool->gbt_txns + 1;
-
-  if (pool->gbt_workid)
-    work->job_id = strdup(pool->gbt_workid);
   cg_runlock(&pool->gbt_lock);
 
   flip32(work->data + 4 + 32, merkleroot);
@@ -2498,6 +2724,7 @@ static bool gbt_decode(struct pool *pool, json_t *res_val)
   pool->coinbase = (unsigned char *)calloc(cal_len, 1);
   if (unlikely(!pool->coinbase))
     quit(1, "Failed to calloc pool coinbase in gbt_decode");
+  pool->swork.cb_size = cal_len;
   hex2bin(pool->coinbase, pool->coinbasetxn, 42);
   extra_len = (uint8_t *)(pool->coinbase + 41);
   orig_len = *extra_len;
@@ -3203,7 +3430,7 @@ static void restart_threads(void);
  * same time is zero so there is no point adding extra locking */
 static void
 share_result(json_t *val, json_t *res, json_t *err, const struct work *work,
-       char *hashshow, bool resubmit, char *worktime)
+       char *hashshow, bool resubmit, char *worktime, double latency)
 {
   struct pool *pool = work->pool;
   struct cgpu_info *cgpu;
@@ -3245,6 +3472,7 @@ share_result(json_t *val, json_t *res, json_t *err, const struct work *work,
       }
     }
     sharelog("accept", work);
+    api_push_share(work, "accepted", NULL, latency);
     if (opt_shares && total_diff_accepted >= opt_shares) {
       applog(LOG_WARNING, "Successfully mined %d accepted shares as requested and exiting.", opt_shares);
       kill_work();
@@ -3266,6 +3494,10 @@ share_result(json_t *val, json_t *res, json_t *err, const struct work *work,
     if (unlikely(work->block))
       restart_threads();
   } else {
+    char disposition[36] = "reject";
+    char reason[32];
+    const char *why = NULL;
+
     mutex_lock(&stats_lock);
     cgpu->rejected++;
     total_rejected++;
@@ -3277,35 +3509,34 @@ share_result(json_t *val, json_t *res, json_t *err, const struct work *work,
     mutex_unlock(&stats_lock);
 
     applog(LOG_DEBUG, "[THR%d] PROOF OF WORK RESULT: false (booooo)", work->thr_id);
-    if (!QUIET) {
-      char disposition[36] = "reject";
-      char reason[32];
-
-      strcpy(reason, "");
-
-      if (!work->gbt)
-        res = json_object_get(val, "reject-reason");
-      if (res) {
-        const char *reasontmp = json_string_value(res);
-
-        size_t reasonLen = strlen(reasontmp);
-        if (reasonLen > 28)
-          reasonLen = 28;
-        reason[0] = ' '; reason[1] = '(';
-        memcpy(2 + reason, reasontmp, reasonLen);
-        reason[reasonLen + 2] = ')'; reason[reasonLen + 3] = '\0';
-        memcpy(disposition + 7, reasontmp, reasonLen);
-        disposition[6] = ':'; disposition[reasonLen + 7] = '\0';
-      } else if (work->stratum && err && json_is_array(err)) {
-        json_t *reason_val = json_array_get(err, 1);
-        char *reason_str;
-
-        if (reason_val && json_is_string(reason_val)) {
-          reason_str = (char *)json_string_value(reason_val);
-          snprintf(reason, 31, " (%s)", reason_str);
-        }
+    strcpy(reason, "");
+
+    if (!work->gbt)
+      res = json_object_get(val, "reject-reason");
+    if (res) {
+      const char *reasontmp = json_string_value(res);
+
+      size_t reasonLen = strlen(reasontmp);
+      if (reasonLen > 28)
+        reasonLen = 28;
+      reason[0] = ' '; reason[1] = '(';
+      memcpy(2 + reason, reasontmp, reasonLen);
+      reason[reasonLen + 2] = ')'; reason[reasonLen + 3] = '\0';
+      memcpy(disposition + 7, reasontmp, reasonLen);
+      disposition[6] = ':'; disposition[reasonLen + 7] = '\0';
+      why = reasontmp;
+    } else if (work->stratum && err && json_is_array(err)) {
+      json_t *reason_val = json_array_get(err, 1);
+      char *reason_str;
+
+      if (reason_val && json_is_string(reason_val)) {
+        reason_str = (char *)json_string_value(reason_val);
+        snprintf(reason, 31, " (%s)", reason_str);
+        why = reason_str;
       }
+    }
 
+    if (!QUIET) {
       applog(LOG_NOTICE, "Rejected %s %s %d %s%s %s%s",
              hashshow,
              cgpu->drv->name,
@@ -3315,6 +3546,7 @@ share_result(json_t *val, json_t *res, json_t *err, const struct work *work,
              worktime);
       sharelog(disposition, work);
     }
+    api_push_share(work, "rejected", why, latency);
 
     /* Once we have more than a nominal amount of sequential rejects,
      * at least 10 and more than 3 mins at the current utility,
@@ -3572,7 +3804,8 @@ do_rpc_call:
     }
   }
 
-  share_result(val, res, err, work, hashshow, resubmit, worktime);
+  share_result(val, res, err, work, hashshow, resubmit, worktime,
+               tdiff(&tv_submit_reply, &tv_submit) * 1000);
 
   if (cgpu->dev_start_tv.tv_sec == 0)
     dev_runtime = total_secs;
@@ -4166,6 +4399,7 @@ static void *submit_work_thread(void *userdata)
       pool->diff_stale += work->work_difficulty;
       mutex_unlock(&stats_lock);
 
+      api_push_share(work, "stale", NULL, -1);
       free_work(work);
       break;
     }
@@ -4235,7 +4469,7 @@ out_unlock:
  * the future */
 static struct work *clone_work(struct work *work)
 {
-  int mrs = mining_threads + opt_queue - total_staged();
+  int mrs = mining_threads + MAX(opt_queue, staged_target) - total_staged();
   struct work *work_clone;
   bool cloned;
 
@@ -4292,37 +4526,32 @@ static char *offset_ntime(const char *ntime, int noffset)
 static void _copy_work(struct work *work, const struct work *base_work, int noffset)
 {
   int id = work->id;
+  unsigned int slab_id = work->slab_id;
 
   clean_work(work);
   memcpy(work, base_work, sizeof(struct work));
   /* Keep the unique new id assigned during make_work to prevent copied
-   * work from having the same id. */
+   * work from having the same id, and the slab the work came from. */
   work->id = id;
-  if (base_work->job_id)
-    work->job_id = strdup(base_work->job_id);
-  if (base_work->nonce1)
-    work->nonce1 = strdup(base_work->nonce1);
-  if (base_work->ntime) {
+  work->slab_id = slab_id;
+  /* The job is shared, only a rolled ntime needs a new one */
+  if (work->job)
+    atomic_fetch_inc(&work->job->refs);
+  if (noffset) {
     /* If we are passed an noffset the binary work->data ntime and
      * the work->ntime hex string need to be adjusted. */
-    if (noffset) {
-      uint32_t work_ntime = _get_work_time(work);
-      uint32_t ntime = be32toh(work_ntime);
-      ntime += noffset;
-      _set_work_time(work, htobe32(ntime));
-      work->ntime = offset_ntime(base_work->ntime, noffset);
-    } else
-      work->ntime = strdup(base_work->ntime);
-  } else if (noffset) {
     uint32_t work_ntime = _get_work_time(work);
     uint32_t ntime = be32toh(work_ntime);
     ntime += noffset;
     _set_work_time(work, htobe32(ntime));
+    if (base_work->ntime) {
+      char *rolled = offset_ntime(base_work->ntime, noffset);
+
+      work_set_job(work, work_job_new(base_work->job_id, base_work->nonce1, rolled,
+                                      base_work->coinbase, base_work->txn_data));
+      free(rolled);
+    }
   }
-  if (base_work->coinbase)
-    work->coinbase = strdup(base_work->coinbase);
-  if (base_work->txn_data)
-	  work->txn_data = strdup(base_work->txn_data);
 }
 
 /* Generates a copy of an existing work struct, creating fresh heap allocations
@@ -4496,10 +4725,67 @@ static bool pool_unusable(struct pool *pool)
   return false;
 }
 
+/* Keep standby pools whose last job is older than this out of failover */
+#define STANDBY_NOTIFY_AGE 600
+
+/* The --standby-pools stratum pools that follow the first enabled pool by
+ * priority stay connected, subscribed and authorised so that failing over
+ * to them needs no new connection. Returns true if the set changed. */
+static bool update_standby_pools(void)
+{
+  bool primary = false, changed = false;
+  int i, standbys = 0;
+
+  for (i = 0; i < total_pools; i++) {
+    struct pool *pool = priority_pool(i);
+    bool standby = false;
+
+    if (pool->state == POOL_ENABLED) {
+      if (!primary)
+        primary = true;
+      else if (pool->has_stratum && standbys < opt_standby_pools) {
+        standby = true;
+        standbys++;
+      }
+    }
+    if (pool->standby != standby) {
+      pool->standby = standby;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+/* Pool has a live stratum connection and a recent job to mine on */
+static bool pool_warm(struct pool *pool)
+{
+  if (pool_unusable(pool) || !pool->stratum_active || !pool->stratum_notify)
+    return false;
+  return time(NULL) - pool->last_notify < STANDBY_NOTIFY_AGE;
+}
+
+/* The warm standby pool other than cp that connected the fastest */
+static struct pool *standby_pool(struct pool *cp)
+{
+  struct pool *best = NULL;
+  int i;
+
+  for (i = 0; i < total_pools; i++) {
+    struct pool *pool = pools[i];
+
+    if (pool == cp || !pool->standby || !pool_warm(pool))
+      continue;
+    if (!best || pool->cnx_latency < best->cnx_latency)
+      best = pool;
+  }
+  return best;
+}
+
 void __switch_pools(struct pool *selected, bool saveprio)
 {
   struct pool *pool, *last_pool;
   int i, pool_no, next_pool;
+  bool primary_down = false;
 
   cg_wlock(&control_lock);
   last_pool = currentpool;
@@ -4529,11 +4815,20 @@ void __switch_pools(struct pool *selected, bool saveprio)
       for (i = 0; i < total_pools; i++)
       {
         pool = priority_pool(i);
-        if (pool_unusable(pool))
+        if (pool_unusable(pool)) {
+          if (pool->state == POOL_ENABLED)
+            primary_down = true;
           continue;
+        }
         pool_no = pool->pool_no;
         break;
       }
+      /* With the first pool down, the fastest warm standby takes over */
+      if (pool_strategy == POOL_FAILOVER && primary_down && opt_standby_pools) {
+        pool = standby_pool(NULL);
+        if (pool)
+          pool_no = pool->pool_no;
+      }
       break;
     /* Both of these simply increment and cycle */
     case POOL_ROUNDROBIN:
@@ -4583,6 +4878,7 @@ void __switch_pools(struct pool *selected, bool saveprio)
     //if the gpus have been initialized or first pool during startup, it's ok to switch...
     if(gpu_initialized || startup) {
       applog(LOG_WARNING, "Switching to %s", get_pool_name(pool));
+      api_push_pool(pool, last_pool);
       if (pool_localgen(pool) || opt_fail_only) {
         clear_pool_work(last_pool);
       }
@@ -4603,6 +4899,7 @@ void __switch_pools(struct pool *selected, bool saveprio)
     gpu_initialized = true; //gpus initialized
   }
 
+  update_standby_pools();
   mutex_lock(&lp_lock);
   pthread_cond_broadcast(&lp_cond);
   mutex_unlock(&lp_lock);
@@ -4902,12 +5199,18 @@ static bool hash_push(struct work *work)
   return rc;
 }
 
-static void stage_work(struct work *work)
+/* Everything stage_work() does before the work is queued */
+static void prepare_staged_work(struct work *work)
 {
-  applog(LOG_DEBUG, "[THR%d] Pushing work from %s to hash queue", work->thr_id, get_pool_name(work->pool));
   work->work_block = work_block;
   test_work_current(work);
   work->pool->works++;
+}
+
+static void stage_work(struct work *work)
+{
+  applog(LOG_DEBUG, "[THR%d] Pushing work from %s to hash queue", work->thr_id, get_pool_name(work->pool));
+  prepare_staged_work(work);
   hash_push(work);
 }
 
@@ -5619,6 +5922,53 @@ out_unlock:
   }
 }
 
+/* Adds a share about to be sent to the in-flight table of its pool and to the
+ * expiry wheel.  Only the pool's own lock is held, never across the send. */
+static void sshare_add(struct pool *pool, struct stratum_share *sshare)
+{
+  sshare->expire = sshare->sshare_sent + SSHARE_TIMEOUT;
+
+  mutex_lock(&pool->sshare_lock);
+  HASH_ADD_INT(pool->sshare_db, id, sshare);
+  list_add_tail(&sshare->wheel, &pool->sshare_wheel[sshare->expire % SSHARE_WHEEL_SLOTS]);
+  pool->sshares++;
+  mutex_unlock(&pool->sshare_lock);
+}
+
+/* Takes share id out of the table of the pool, recording the submit to ack
+ * latency when it is a response */
+static struct stratum_share *sshare_take(struct pool *pool, int id, bool acked)
+{
+  struct stratum_share *sshare;
+  struct timeval now;
+  double ms;
+  int i;
+
+  mutex_lock(&pool->sshare_lock);
+  HASH_FIND_INT(pool->sshare_db, &id, sshare);
+  if (sshare) {
+    HASH_DEL(pool->sshare_db, sshare);
+    list_del(&sshare->wheel);
+    pool->sshares--;
+
+    if (acked) {
+      cgtime(&now);
+      ms = tdiff(&now, &sshare->tv_sent) * 1000;
+      sshare->latency = ms;
+      for (i = 0; i < SHARE_LAT_BUCKETS - 1 && ms > share_lat_bounds[i]; i++)
+        ;
+      pool->share_lat[i]++;
+      pool->share_lat_count++;
+      pool->share_lat_total += ms;
+      if (ms > pool->share_lat_max)
+        pool->share_lat_max = ms;
+    }
+  }
+  mutex_unlock(&pool->sshare_lock);
+
+  return sshare;
+}
+
 static void stratum_share_result(json_t *val, json_t *res_val, json_t *err_val,
          struct stratum_share *sshare)
 {
@@ -5633,12 +5983,12 @@ static void stratum_share_result(json_t *val, json_t *res_val, json_t *err_val,
            work->pool->pool_no, srdiff);
   }
   show_hash(work, hashshow);
-  share_result(val, res_val, err_val, work, hashshow, false, "");
+  share_result(val, res_val, err_val, work, hashshow, false, "", sshare->latency);
 }
 
 /* Parses stratum json responses and tries to find the id that the request
- * matched to and treat it accordingly. */
-static bool parse_stratum_response(struct pool *pool, char *s)
+ * matched to and treat it accordingly. js is s tokenized, or NULL. */
+static bool parse_stratum_response(struct pool *pool, char *s, const struct sjson *js)
 {
   json_t *val = NULL, *err_val, *res_val, *id_val;
   struct stratum_share *sshare;
@@ -5646,6 +5996,14 @@ static bool parse_stratum_response(struct pool *pool, char *s)
   bool ret = false;
   int id;
 
+  /* Accepted shares, most of what pools answer, need no jansson tree:
+   * the constant true and null stand in for the result and error */
+  if (js && pool->algorithm.type != ALGO_ETHASH && sjson_accepted(js, &id)) {
+    res_val = json_true();
+    err_val = json_null();
+    goto found;
+  }
+
   val = JSON_LOADS(s, &err);
   if (!val) {
     applog(LOG_INFO, "JSON decode failed(%d): %s", err.line, err.text);
@@ -5672,14 +6030,8 @@ static bool parse_stratum_response(struct pool *pool, char *s)
   }
 
   id = json_integer_value(id_val);
-
-  mutex_lock(&sshare_lock);
-  HASH_FIND_INT(stratum_shares, &id, sshare);
-  if (sshare) {
-    HASH_DEL(stratum_shares, sshare);
-    pool->sshares--;
-  }
-  mutex_unlock(&sshare_lock);
+found:
+  sshare = sshare_take(pool, id, true);
 
   if (!sshare) {
     double pool_diff;
@@ -5731,25 +6083,77 @@ void clear_stratum_shares(struct pool *pool)
   double diff_cleared = 0;
   int cleared = 0;
 
-  mutex_lock(&sshare_lock);
-  HASH_ITER(hh, stratum_shares, sshare, tmpshare) {
-    if (sshare->work->pool == pool) {
-      HASH_DEL(stratum_shares, sshare);
-      diff_cleared += sshare->work->work_difficulty;
-      free_work(sshare->work);
-      pool->sshares--;
-      free(sshare);
-      cleared++;
-    }
+  mutex_lock(&pool->sshare_lock);
+  HASH_ITER(hh, pool->sshare_db, sshare, tmpshare) {
+    HASH_DEL(pool->sshare_db, sshare);
+    list_del(&sshare->wheel);
+    diff_cleared += sshare->work->work_difficulty;
+    free_work(sshare->work);
+    pool->sshares--;
+    free(sshare);
+    cleared++;
   }
-  mutex_unlock(&sshare_lock);
+  mutex_unlock(&pool->sshare_lock);
 
   if (cleared) {
     applog(LOG_WARNING, "Lost %d shares due to stratum disconnect on %s", cleared, get_pool_name(pool));
+    mutex_lock(&stats_lock);
     pool->stale_shares += cleared;
     total_stale += cleared;
     pool->diff_stale += diff_cleared;
     total_diff_stale += diff_cleared;
+    mutex_unlock(&stats_lock);
+  }
+}
+
+/* Drops the shares of a pool that got no response within SSHARE_TIMEOUT
+ * seconds, counting them as stale.  Called from the watchdog, the wheel
+ * slots of every second since the last call are checked. */
+static void expire_stratum_shares(struct pool *pool)
+{
+  struct stratum_share *sshare, *tmpshare;
+  struct list_head expired;
+  double diff_expired = 0;
+  int count = 0;
+  time_t now = time(NULL), t;
+
+  INIT_LIST_HEAD(&expired);
+
+  mutex_lock(&pool->sshare_lock);
+  t = pool->sshare_tick;
+  if (now - t > SSHARE_WHEEL_SLOTS)
+    t = now - SSHARE_WHEEL_SLOTS;
+  while (t < now) {
+    struct list_head *slot = &pool->sshare_wheel[++t % SSHARE_WHEEL_SLOTS];
+
+    list_for_each_entry_safe(sshare, tmpshare, slot, wheel) {
+      if (sshare->expire > now)
+        continue;
+      HASH_DEL(pool->sshare_db, sshare);
+      list_move(&sshare->wheel, &expired);
+      pool->sshares--;
+    }
+  }
+  pool->sshare_tick = now;
+  mutex_unlock(&pool->sshare_lock);
+
+  list_for_each_entry_safe(sshare, tmpshare, &expired, wheel) {
+    diff_expired += sshare->work->work_difficulty;
+    free_work(sshare->work);
+    free(sshare);
+    count++;
+  }
+
+  if (count) {
+    applog(LOG_WARNING, "%d shares got no response within %d seconds from %s",
+           count, SSHARE_TIMEOUT, get_pool_name(pool));
+    mutex_lock(&stats_lock);
+    pool->share_timeouts += count;
+    pool->stale_shares += count;
+    total_stale += count;
+    pool->diff_stale += diff_expired;
+    total_diff_stale += diff_expired;
+    mutex_unlock(&stats_lock);
   }
 }
 
@@ -5772,6 +6176,19 @@ void clear_pool_work(struct pool *pool)
     applog(LOG_INFO, "Cleared %d work items due to stratum disconnect on pool %d", cleared, pool->pool_no);
 }
 
+/* Drops the reference a removed pool holds to its last stratum job, works
+ * still using it keep theirs */
+static void release_pool_job(struct pool *pool)
+{
+  struct work_job *job;
+
+  cg_wlock(&pool->data_lock);
+  job = pool->swork.job;
+  pool->swork.job = NULL;
+  cg_wunlock(&pool->data_lock);
+  work_job_put(job);
+}
+
 static int cp_prio(void)
 {
   int prio;
@@ -5813,6 +6230,9 @@ static bool cnx_needed(struct pool *pool)
    * connection open. */
   if (pool->sshares)
     return true;
+  /* Standby pools stay subscribed to fail over to them without delay */
+  if (pool->standby)
+    return true;
   /* If the pool has only just come to life and is higher priority than
    * the current pool keep the connection open so we can fail back to
    * it. */
@@ -5827,6 +6247,7 @@ static bool cnx_needed(struct pool *pool)
 }
 
 static void wait_lpcurrent(struct pool *pool);
+static bool lp_waiting(struct pool *pool);
 static void pool_resus(struct pool *pool);
 static void gen_stratum_work(struct pool *pool, struct work *work);
 static void stratum_resumed(struct pool *pool)
@@ -5854,6 +6275,33 @@ static bool supports_resume(struct pool *pool)
  * checking for new messages and for the integrity of the socket connection. We
  * reset the connection based on the integrity of the receive side only as the
  * send side will eventually expire data it fails to send. */
+/* Handles one message read from a stratum pool */
+static void stratum_handle_msg(struct pool *pool, char *s)
+{
+  struct sjson js, *tok = sjson_parse(&js, s) ? &js : NULL;
+
+  /* Check this pool hasn't died while being a backup pool and
+   * has not had its idle flag cleared */
+  stratum_resumed(pool);
+
+  if (!parse_method_json(pool, s, tok) && !parse_stratum_response(pool, s, tok))
+    applog(LOG_INFO, "Unknown stratum msg: %s", s);
+  else if (pool->swork.clean) {
+    struct work *work = make_work();
+
+    /* Generate a single work item to update the current
+     * block database */
+    pool->swork.clean = false;
+    gen_stratum_work(pool, work);
+    work->longpoll = true;
+    /* Return value doesn't matter. We're just informing
+     * that we may need to restart. */
+    test_work_current(work);
+    free_work(work);
+  }
+  free(s);
+}
+
 static void *stratum_rthread(void *userdata)
 {
   struct pool *pool = (struct pool *)userdata;
@@ -5937,197 +6385,487 @@ static void *stratum_rthread(void *userdata)
       continue;
     }
 
-    /* Check this pool hasn't died while being a backup pool and
-     * has not had its idle flag cleared */
-    stratum_resumed(pool);
-
-    if (!parse_method(pool, s) && !parse_stratum_response(pool, s))
-      applog(LOG_INFO, "Unknown stratum msg: %s", s);
-    else if (pool->swork.clean) {
-      struct work *work = make_work();
-
-      /* Generate a single work item to update the current
-       * block database */
-      pool->swork.clean = false;
-      gen_stratum_work(pool, work);
-      work->longpoll = true;
-      /* Return value doesn't matter. We're just informing
-       * that we may need to restart. */
-      test_work_current(work);
-      free_work(work);
-    }
-    free(s);
+    stratum_handle_msg(pool, s);
   }
 
 out:
+  release_pool_job(pool);
   return NULL;
 }
 
-/* Each pool has one stratum send thread for sending shares to avoid many
- * threads being created for submission since all sends need to be serialised
- * anyway. */
-static void *stratum_sthread(void *userdata)
-{
-  struct pool *pool = (struct pool *)userdata;
-  char threadname[16];
+/* Reactor states of a stratum pool */
+enum stratum_rstate {
+  STRATUM_RCONNECTED,
+  STRATUM_RSUSPENDED,  /* idle backup pool, waits until it is needed */
+  STRATUM_RDEAD        /* retries every 30 seconds */
+};
 
-  pthread_detach(pthread_self());
+/* Pools waiting on stratum_rconnect_thread(), under lp_lock */
+static LIST_HEAD(stratum_rpending);
 
-  snprintf(threadname, sizeof(threadname), "%d/SStratum", pool->pool_no);
-  RenameThread(threadname);
+/* Hands pool to stratum_rconnect_thread(), which connects a suspended one
+ * once it is needed and any other once pool->rretry has come */
+static void stratum_rqueue(struct pool *pool)
+{
+  mutex_lock(&lp_lock);
+  list_add_tail(&pool->rnode, &stratum_rpending);
+  pthread_cond_broadcast(&lp_cond);
+  mutex_unlock(&lp_lock);
+}
 
-  pool->stratum_q = tq_new();
-  if (!pool->stratum_q)
-    quit(1, "Failed to create stratum_q in stratum_sthread");
+/* The reactor is done with a removed pool */
+static void stratum_rrelease(struct pool *pool)
+{
+  struct reactor_src *src = pool->rsrc;
 
-  while (42) {
-    char noncehex[16], nonce2hex[80];
-    char votehex[16] = { 0 };
-    char s[126 + 16 + 2048] = { 0 }; // todo: malloc
-    struct stratum_share *sshare;
-    uint32_t *hash32, *data, nonce;
-    struct work *work;
-    bool submitted = false;
+  pool->rsrc = NULL;
+  reactor_remove(src);
+  release_pool_job(pool);
+}
 
-    if (unlikely(pool->removed)) {
-      break;
-    }
+/* Tries to bring the connection back, watching the socket when it is up */
+static void stratum_reconnect(struct pool *pool)
+{
+  if (restart_stratum(pool)) {
+    if (pool->rstate == STRATUM_RDEAD)
+      stratum_resumed(pool);
+    pool->rstate = STRATUM_RCONNECTED;
+    reactor_watch(pool->rsrc, pool->sock, 90);
+    return;
+  }
+  if (pool->rstate != STRATUM_RDEAD) {
+    pool->rstate = STRATUM_RDEAD;
+    pool_died(pool);
+  }
+  pool_failed(pool);
+  pool->rretry = time(NULL) + 30;
+  stratum_rqueue(pool);
+}
 
-    work = (struct work *)tq_pop(pool->stratum_q, NULL);
-    if (unlikely(!work))
-      quit(1, "Stratum q returned empty work");
+/* Connects pools again for the reactor, so that a dead or slow pool holds up
+ * no reactor worker and the pools it serves */
+static void *stratum_rconnect_thread(void __maybe_unused *userdata)
+{
+  pthread_detach(pthread_self());
+  RenameThread("StratumRecon");
 
-    if (unlikely(work->nonce2_len > 32)) {
-      applog(LOG_ERR, "%s asking for inappropriately long nonce2 length %d", get_pool_name(pool), (int)work->nonce2_len);
-      applog(LOG_ERR, "Not attempting to submit shares");
-      free_work(work);
+  mutex_lock(&lp_lock);
+  while (42) {
+    struct pool *pool = NULL, *cur, *tmp;
+    struct timespec then;
+    time_t now = time(NULL);
+
+    /* Not every change to lp_waiting() is signalled, as for
+     * wait_lpcurrent(), so look again after a while anyway */
+    then.tv_sec = now + 30;
+    then.tv_nsec = 0;
+    list_for_each_entry_safe(cur, tmp, &stratum_rpending, rnode) {
+      if (cur->removed || (cur->rstate == STRATUM_RSUSPENDED ? !lp_waiting(cur) : now >= cur->rretry)) {
+        pool = cur;
+        break;
+      }
+      if (cur->rstate != STRATUM_RSUSPENDED && cur->rretry < then.tv_sec)
+        then.tv_sec = cur->rretry;
+    }
+    if (!pool) {
+      pthread_cond_timedwait(&lp_cond, &lp_lock, &then);
       continue;
     }
+    list_del(&pool->rnode);
+    mutex_unlock(&lp_lock);
 
-    // TODO: check for memory leaks
-    sshare = (struct stratum_share *)calloc(sizeof(struct stratum_share), 1);
-    hash32 = (uint32_t *)work->hash;
-    data  =  (uint32_t *)work->data;
+    if (unlikely(pool->removed))
+      stratum_rrelease(pool);
+    else
+      stratum_reconnect(pool);
+    mutex_lock(&lp_lock);
+  }
 
-    sshare->sshare_time = time(NULL);
-    // This work item is freed in parse_stratum_response
-    sshare->work = work;
-    mutex_lock(&sshare_lock);
-    // Give the stratum share an unique id
-    sshare->id = swork_id++;
-    mutex_unlock(&sshare_lock);
+  return NULL;
+}
 
-    applog(LOG_DEBUG, "stratum_sthread() algorithm = %s", pool->algorithm.name);
+/* Starts the reactor and the thread connecting its pools again, false to
+ * use a thread per pool instead */
+static bool stratum_reactor_init(void)
+{
+  pthread_t pth;
 
-    if (pool->algorithm.type == ALGO_ETHASH)
-    {
-      // special nonce/hash/mix format
-      uint64_t tmp = bswap_64(work->Nonce);
-      char *ASCIIMixHash = bin2hex(work->mixhash, 32);
-      char *ASCIIPoWHash = bin2hex(work->data, 32);
-      char *ASCIINonce = bin2hex((unsigned char*) &tmp, 8);
+  if (!reactor_init(opt_stratum_workers))
+    return false;
+  if (unlikely(pthread_create(&pth, NULL, stratum_rconnect_thread, NULL)))
+    quit(1, "Failed to create stratum reconnect thread");
+  return true;
+}
 
-      snprintf(s, sizeof(s),
-        "{\"method\":\"mining.submit\",\"params\":[\"%s\",\"%s\",\"0x%s\",\"0x%s\",\"0x%s\"],\"id\":%d}",
-        pool->rpc_user, work->job_id, ASCIINonce, ASCIIPoWHash, ASCIIMixHash, sshare->id);
+/* stratum_rthread() as a reactor callback: handles what is readable on the
+ * socket of a pool, or its timer, then arms the reactor again */
+static void stratum_event(void *userdata, int events)
+{
+  struct pool *pool = (struct pool *)userdata;
+  char *s;
 
-      free(ASCIINonce);
-      free(ASCIIMixHash);
-      free(ASCIIPoWHash);
+  if (unlikely(pool->removed)) {
+    stratum_rrelease(pool);
+    return;
+  }
 
-    } else {
+  /* Nothing for 90 seconds, see stratum_rthread() */
+  if ((events & REACTOR_TIMEOUT) && !sock_full(pool))
+    s = NULL;
+  else
+    s = recv_line(pool);
+  if (!s) {
+    applog(LOG_NOTICE, "Stratum connection to %s interrupted", get_pool_name(pool));
+    pool->getfail_occasions++;
+    total_go++;
 
-      nonce = data[19];
-      // Neoscrypt is little endian
-      if (pool->algorithm.type == ALGO_NEOSCRYPT) {
-        nonce = swab32(nonce);
-      }
+    if (!supports_resume(pool) || opt_lowmem)
+      clear_stratum_shares(pool);
+    clear_pool_work(pool);
+    if (pool == current_pool())
+      restart_threads();
 
-      if (pool->algorithm.type == ALGO_DECRED) {
-        uint16_t votebits;
-        memcpy(&votebits, &data[25], 2);
-        votebits = (votebits & 1) | (uint16_t) (opt_vote << 1);
-        nonce = be32dec(work->data + 140); // data[35];
-        __bin2hex(nonce2hex, work->data + 144, pool->n1_len);
-        if (opt_vote) sprintf(votehex, ",\"%04hx\"", votebits);
-      } else {
-        uint64_t nonce2[2] = { 0 };
-        *(nonce2) = htole64(work->nonce2);
-        __bin2hex(nonce2hex, (unsigned char*) nonce2, work->nonce2_len);
-      }
+    /* Straight away, off the reactor */
+    reactor_idle(pool->rsrc);
+    pool->rretry = 0;
+    stratum_rqueue(pool);
+    return;
+  }
+
+  /* Everything already read, before waiting on the socket again */
+  do {
+    stratum_handle_msg(pool, s);
+    s = sock_full(pool) ? recv_line(pool) : NULL;
+  } while (s);
+
+  if (!sock_full(pool) && !cnx_needed(pool)) {
+    applog(LOG_INFO, "Suspending stratum on %s", get_pool_name(pool));
+    reactor_idle(pool->rsrc);
+    suspend_stratum(pool);
+    clear_stratum_shares(pool);
+    clear_pool_work(pool);
+    pool->rstate = STRATUM_RSUSPENDED;
+    stratum_rqueue(pool);
+    return;
+  }
+
+  reactor_watch(pool->rsrc, pool->sock, 90);
+}
+
+/* Shares queued while the send thread was busy go out together, up to
+ * STRATUM_BATCH of them in one send */
+#define STRATUM_BATCH 16
+/* Seconds between attempts to resend shares that failed to go out, and for
+ * how long since they were found */
+#define STRATUM_RETRY_SECS 5
+#define STRATUM_RETRY_MAX 120
+
+/* Preformatted start of the mining.submit requests of one job (user, job_id
+ * and ntime), only the nonces and the id are added per share */
+struct submit_template {
+  char *job_id;
+  char *ntime;
+  char *head;
+  char *mid;
+  size_t head_len, mid_len;
+};
+
+/* The requests of one batch, one line each in buf */
+struct submit_batch {
+  char *buf;
+  size_t size, len;
+  struct stratum_share *shares[STRATUM_BATCH];
+  /* ids of the shares, which may be freed once they are in the table */
+  int ids[STRATUM_BATCH];
+  int count;
+};
+
+static void submit_template_update(struct pool *pool, struct submit_template *tpl, struct work *work)
+{
+  const char *ntime = work->ntime ? work->ntime : "";
+  size_t len;
+
+  if (tpl->job_id && !strcmp(tpl->job_id, work->job_id) && !strcmp(tpl->ntime, ntime))
+    return;
 
-      __bin2hex(noncehex, (const unsigned char *)&nonce, 4);
+  free(tpl->job_id);
+  free(tpl->ntime);
+  free(tpl->head);
+  free(tpl->mid);
+  tpl->job_id = strdup(work->job_id);
+  tpl->ntime = strdup(ntime);
+
+  len = strlen(pool->rpc_user) + strlen(work->job_id) + strlen(ntime) + 64;
+  tpl->head = (char *)malloc(len);
+  tpl->mid = (char *)malloc(len);
+  if (unlikely(!tpl->job_id || !tpl->ntime || !tpl->head || !tpl->mid))
+    quit(1, "Failed to alloc submit template in stratum_sthread");
+
+  if (pool->algorithm.type == ALGO_ETHASH) {
+    // special nonce/hash/mix format, mid goes between the three of them
+    snprintf(tpl->head, len, "{\"method\":\"mining.submit\",\"params\":[\"%s\",\"%s\",\"0x",
+             pool->rpc_user, work->job_id);
+    snprintf(tpl->mid, len, "\",\"0x");
+  } else {
+    snprintf(tpl->head, len, "{\"method\":\"mining.submit\",\"params\":[\"%s\",\"%s\",\"",
+             pool->rpc_user, work->job_id);
+    snprintf(tpl->mid, len, "\",\"%s\",\"", ntime);
+  }
+  tpl->head_len = strlen(tpl->head);
+  tpl->mid_len = strlen(tpl->mid);
+}
+
+/* Appends the mining.submit line of a share to the batch */
+static void submit_batch_add(struct pool *pool, struct submit_template *tpl,
+                             struct submit_batch *batch, struct stratum_share *sshare)
+{
+  struct work *work = sshare->work;
+  uint32_t *data = (uint32_t *)work->data, nonce;
+  char *p;
+
+  submit_template_update(pool, tpl, work);
+
+  /* Room for the template, up to 3 x 32 bytes of hex, the id and the "\n"
+   * __stratum_send() appends */
+  if (batch->size < batch->len + tpl->head_len + 2 * tpl->mid_len + 256) {
+    batch->size = (batch->len + tpl->head_len + 2 * tpl->mid_len + 256) * 2;
+    batch->buf = (char *)realloc(batch->buf, batch->size);
+    if (unlikely(!batch->buf))
+      quit(1, "Failed to realloc submit batch in stratum_sthread");
+  }
+
+  p = batch->buf + batch->len;
+  if (batch->count)
+    *p++ = '\n';
+  memcpy(p, tpl->head, tpl->head_len);
+  p += tpl->head_len;
+
+  if (pool->algorithm.type == ALGO_ETHASH) {
+    uint64_t tmp = bswap_64(work->Nonce);
+
+    __bin2hex(p, (unsigned char *)&tmp, 8);
+    p += 16;
+    memcpy(p, tpl->mid, tpl->mid_len);
+    p += tpl->mid_len;
+    __bin2hex(p, work->data, 32);
+    p += 64;
+    memcpy(p, tpl->mid, tpl->mid_len);
+    p += tpl->mid_len;
+    __bin2hex(p, work->mixhash, 32);
+    p += 64;
+    p += sprintf(p, "\"],\"id\":%d}", sshare->id);
+  } else {
+    char votehex[16] = { 0 };
+
+    nonce = data[19];
+    // Neoscrypt is little endian
+    if (pool->algorithm.type == ALGO_NEOSCRYPT)
+      nonce = swab32(nonce);
+
+    if (pool->algorithm.type == ALGO_DECRED) {
+      uint16_t votebits;
+
+      memcpy(&votebits, &data[25], 2);
+      votebits = (votebits & 1) | (uint16_t) (opt_vote << 1);
+      nonce = be32dec(work->data + 140); // data[35];
+      __bin2hex(p, work->data + 144, pool->n1_len);
+      p += 2 * pool->n1_len;
+      if (opt_vote)
+        sprintf(votehex, ",\"%04hx\"", votebits);
+    } else {
+      uint64_t nonce2[4] = { 0 };
 
-      snprintf(s, sizeof(s),
-        "{\"method\":\"mining.submit\",\"params\":[\"%s\",\"%s\",\"%s\",\"%s\",\"%s\"%s],\"id\":%d}",
-        pool->rpc_user, work->job_id, nonce2hex, work->ntime, noncehex, votehex, sshare->id);
+      *(nonce2) = htole64(work->nonce2);
+      __bin2hex(p, (unsigned char *)nonce2, work->nonce2_len);
+      p += 2 * work->nonce2_len;
     }
 
-    applog(LOG_INFO, "Submitting share %08lx to %s", (long unsigned int)htole32(hash32[6]), get_pool_name(pool));
+    memcpy(p, tpl->mid, tpl->mid_len);
+    p += tpl->mid_len;
+    __bin2hex(p, (const unsigned char *)&nonce, 4);
+    p += 8;
+    p += sprintf(p, "\"%s],\"id\":%d}", votehex, sshare->id);
+  }
+
+  batch->len = p - batch->buf;
+  batch->ids[batch->count] = sshare->id;
+  batch->shares[batch->count++] = sshare;
+}
+
+static void discard_stratum_share(struct pool *pool, struct stratum_share *sshare)
+{
+  applog(LOG_DEBUG, "Failed to submit stratum share, discarding");
+  api_push_share(sshare->work, "stale", NULL, -1);
+  free_work(sshare->work);
+  free(sshare);
+  mutex_lock(&stats_lock);
+  pool->stale_shares++;
+  total_stale++;
+  mutex_unlock(&stats_lock);
+}
+
+/* Whether a share that failed to go out may still be resent: the stratum
+ * pool nonce1 still matches, suggesting we may be able to resume */
+static bool stratum_share_resumable(struct pool *pool, struct stratum_share *sshare)
+{
+  bool sessionid_match;
 
-    /* Try resubmitting for up to 2 minutes if we fail to submit
-     * once and the stratum pool nonce1 still matches suggesting
-     * we may be able to resume. */
-    while (time(NULL) < sshare->sshare_time + 120) {
-      bool sessionid_match;
+  if (opt_lowmem || time(NULL) >= sshare->sshare_time + STRATUM_RETRY_MAX)
+    return false;
 
-      mutex_lock(&sshare_lock);
-      if (likely(stratum_send(pool, s, strlen(s)))) {
-        int ssdiff;
+  cg_rlock(&pool->data_lock);
+  sessionid_match = (pool->nonce1 && !strcmp(sshare->work->nonce1, pool->nonce1));
+  cg_runlock(&pool->data_lock);
 
-        if (pool_tclear(pool, &pool->submit_fail))
-            applog(LOG_WARNING, "%s communication resumed, submitting work", get_pool_name(pool));
+  return sessionid_match;
+}
 
-        sshare->sshare_sent = time(NULL);
-        ssdiff = (int) (sshare->sshare_sent - sshare->sshare_time);
-        if (opt_debug || ssdiff > 0) {
-          applog(LOG_INFO, "Pool %d stratum share submission lag time %d seconds",
-                 pool->pool_no, ssdiff);
-        }
+/* Each pool has one stratum send thread for sending shares to avoid many
+ * threads being created for submission since all sends need to be serialised
+ * anyway.  It sends every share queued when it wakes up in one batch and
+ * keeps the ones that failed to go out aside to retry later, so a failed
+ * send never holds up the shares found after it. */
+static void *stratum_sthread(void *userdata)
+{
+  struct pool *pool = (struct pool *)userdata;
+  struct submit_template tpl;
+  struct submit_batch batch;
+  const struct timespec nowait = {0, 0};
+  struct list_head retries;
+  time_t next_retry = 0;
+  char threadname[16];
+  int i;
 
-        HASH_ADD_INT(stratum_shares, id, sshare);
-        pool->sshares++;
-        mutex_unlock(&sshare_lock);
+  pthread_detach(pthread_self());
 
-        applog(LOG_DEBUG, "Successfully submitted, adding to stratum_shares db");
-        submitted = true;
-        break;
-      }
-      else {
-        mutex_unlock(&sshare_lock);
-      }
-      if (!pool_tset(pool, &pool->submit_fail) && cnx_needed(pool)) {
-        applog(LOG_WARNING, "%s stratum share submission failure", get_pool_name(pool));
-        total_ro++;
-        pool->remotefail_occasions++;
+  snprintf(threadname, sizeof(threadname), "%d/SStratum", pool->pool_no);
+  RenameThread(threadname);
+
+  memset(&tpl, 0, sizeof(tpl));
+  memset(&batch, 0, sizeof(batch));
+  INIT_LIST_HEAD(&retries);
+
+  pool->stratum_q = tq_new();
+  if (!pool->stratum_q)
+    quit(1, "Failed to create stratum_q in stratum_sthread");
+
+  while (42) {
+    struct stratum_share *sshare, *tmpshare;
+    struct timespec abstime = {0, 0};
+    struct work *work;
+    time_t now;
+    int ssdiff = 0;
+
+    if (unlikely(pool->removed)) {
+      break;
+    }
+
+    /* Wait for a share, or until the shares to retry are due */
+    abstime.tv_sec = next_retry;
+    work = (struct work *)tq_pop(pool->stratum_q, list_empty(&retries) ? NULL : &abstime);
+
+    batch.len = 0;
+    batch.count = 0;
+    now = time(NULL);
+
+    if (!list_empty(&retries) && now >= next_retry) {
+      list_for_each_entry_safe(sshare, tmpshare, &retries, wheel) {
+        /* Leave room for the share just popped */
+        if (batch.count == STRATUM_BATCH - 1)
+          break;
+        list_del(&sshare->wheel);
+        if (!stratum_share_resumable(pool, sshare)) {
+          applog(LOG_DEBUG, "No matching session id for resubmitting stratum share");
+          discard_stratum_share(pool, sshare);
+          continue;
+        }
+        submit_batch_add(pool, &tpl, &batch, sshare);
       }
+    }
 
-      if (opt_lowmem) {
-        applog(LOG_DEBUG, "Lowmem option prevents resubmitting stratum share");
-        break;
+    /* The new shares, along with any others already queued */
+    while (work) {
+      if (unlikely(work->nonce2_len > 32)) {
+        applog(LOG_ERR, "%s asking for inappropriately long nonce2 length %d", get_pool_name(pool), (int)work->nonce2_len);
+        applog(LOG_ERR, "Not attempting to submit shares");
+        free_work(work);
+      } else {
+        sshare = (struct stratum_share *)calloc(sizeof(struct stratum_share), 1);
+        if (unlikely(!sshare))
+          quit(1, "Failed to calloc sshare in stratum_sthread");
+        sshare->sshare_time = now;
+        // This work item is freed in parse_stratum_response
+        sshare->work = work;
+        // Give the stratum share an unique id
+        sshare->id = atomic_fetch_inc(&swork_id);
+        submit_batch_add(pool, &tpl, &batch, sshare);
+        applog(LOG_INFO, "Submitting share %08lx to %s",
+               (long unsigned int)htole32(((uint32_t *)work->hash)[6]), get_pool_name(pool));
       }
+      if (batch.count == STRATUM_BATCH)
+        break;
+      work = (struct work *)tq_pop(pool->stratum_q, &nowait);
+    }
 
-      cg_rlock(&pool->data_lock);
-      sessionid_match = (pool->nonce1 && !strcmp(work->nonce1, pool->nonce1));
-      cg_runlock(&pool->data_lock);
+    if (!batch.count)
+      continue;
 
-      if (!sessionid_match) {
-        applog(LOG_DEBUG, "No matching session id for resubmitting stratum share");
-        break;
+    /* The shares go in the table before the send as the responses may be
+     * read before stratum_send() returns */
+    for (i = 0; i < batch.count; i++) {
+      sshare = batch.shares[i];
+      sshare->sshare_sent = now;
+      cgtime(&sshare->tv_sent);
+      if (now - sshare->sshare_time > ssdiff)
+        ssdiff = (int) (now - sshare->sshare_time);
+      sshare_add(pool, sshare);
+    }
+
+    if (likely(stratum_send(pool, batch.buf, batch.len))) {
+      if (pool_tclear(pool, &pool->submit_fail))
+          applog(LOG_WARNING, "%s communication resumed, submitting work", get_pool_name(pool));
+
+      if (opt_debug || ssdiff > 0) {
+        applog(LOG_INFO, "Pool %d stratum share submission lag time %d seconds",
+               pool->pool_no, ssdiff);
       }
-      /* Retry every 5 seconds */
-      sleep(5);
+      applog(LOG_DEBUG, "Successfully submitted %d shares, added to stratum shares db", batch.count);
+      continue;
     }
 
-    if (unlikely(!submitted)) {
-      applog(LOG_DEBUG, "Failed to submit stratum share, discarding");
-      free_work(work);
-      free(sshare);
-      pool->stale_shares++;
-      total_stale++;
+    if (!pool_tset(pool, &pool->submit_fail) && cnx_needed(pool)) {
+      applog(LOG_WARNING, "%s stratum share submission failure", get_pool_name(pool));
+      total_ro++;
+      pool->remotefail_occasions++;
+    }
+
+    /* Not sent: take them back unless a disconnect already cleared and
+     * counted them, and retry the ones that may still be resumed */
+    for (i = 0; i < batch.count; i++) {
+      sshare = sshare_take(pool, batch.ids[i], false);
+      if (!sshare)
+        continue;
+      if (opt_lowmem) {
+        applog(LOG_DEBUG, "Lowmem option prevents resubmitting stratum share");
+        discard_stratum_share(pool, sshare);
+      } else
+        list_add_tail(&sshare->wheel, &retries);
     }
+    next_retry = time(NULL) + STRATUM_RETRY_SECS;
   }
 
+  while (!list_empty(&retries)) {
+    struct stratum_share *sshare = list_entry(retries.next, struct stratum_share *, wheel);
+
+    list_del(&sshare->wheel);
+    discard_stratum_share(pool, sshare);
+  }
+  free(batch.buf);
+  free(tpl.job_id);
+  free(tpl.ntime);
+  free(tpl.head);
+  free(tpl.mid);
+
   /* Freeze the work queue but don't free up its memory in case there is
    * work still trying to be submitted to the removed pool. */
   tq_freeze(pool->stratum_q);
@@ -6141,6 +6879,16 @@ static void init_stratum_threads(struct pool *pool)
 
   if (unlikely(pthread_create(&pool->stratum_sthread, NULL, stratum_sthread, (void *)pool)))
     quit(1, "Failed to create stratum sthread");
+
+  if (opt_stratum_reactor) {
+    pool->rsrc = (struct reactor_src *)calloc(1, sizeof(struct reactor_src));
+    if (unlikely(!pool->rsrc))
+      quit(1, "Failed to calloc rsrc in init_stratum_threads");
+    reactor_src_init(pool->rsrc, stratum_event, pool);
+    pool->rstate = STRATUM_RCONNECTED;
+    reactor_watch(pool->rsrc, pool->sock, 90);
+    return;
+  }
   if (unlikely(pthread_create(&pool->stratum_rthread, NULL, stratum_rthread, (void *)pool)))
     quit(1, "Failed to create stratum rthread");
 }
@@ -6357,16 +7105,32 @@ static void pool_resus(struct pool *pool)
 }
 
 /* If this is called non_blocking, it will return NULL for work so that must
- * be handled. */
-static struct work *hash_pop(bool blocking)
+ * be handled. The seconds a blocking call waited for staged work are
+ * returned in waited when it is not NULL. */
+static struct work *hash_pop(bool blocking, double *waited)
 {
   struct work *work = NULL, *tmp;
   int hc;
 
+  if (waited)
+    *waited = 0;
+
   mutex_lock(stgd_lock);
+  /* Rather than idle, take the work prefetched from the failover pool */
+  if (!HASH_COUNT(staged_work) && blocking && failover_work && !opt_fail_only) {
+    applog(LOG_INFO, "Nothing staged, using the work prefetched from %s", get_pool_name(failover_work->pool));
+    if (work_rollable(failover_work))
+      staged_rollable++;
+    HASH_ADD_INT(staged_work, id, failover_work);
+    failover_work = NULL;
+    failover_used++;
+  }
   if (!HASH_COUNT(staged_work)) {
+    struct timeval tv_start, tv_end;
+
     if (!blocking)
       goto out_unlock;
+    cgtime(&tv_start);
     do {
       struct timespec then;
       struct timeval now;
@@ -6382,10 +7146,15 @@ static struct work *hash_pop(bool blocking)
         * bool separately. */
       if (rc && !no_work) {
         no_work = true;
+        idle_events++;
         applog(LOG_WARNING, "Waiting for work to be available from pools.");
         event_notify("idle");
       }
     } while (!HASH_COUNT(staged_work));
+    cgtime(&tv_end);
+    idle_secs += tdiff(&tv_end, &tv_start);
+    if (waited)
+      *waited = tdiff(&tv_end, &tv_start);
   }
 
   if (no_work) {
@@ -6420,6 +7189,139 @@ out_unlock:
   return work;
 }
 
+/* Most works staged per mining thread beyond --queue */
+#define STAGED_PER_THREAD 4
+/* A pool taking longer than this to generate a work is about to fail */
+#define SLOW_GEN_SECS 2.0
+
+/* Exponential moving average, seeded by the first sample */
+static void ewma_add(double *avg, double sample)
+{
+  *avg = *avg > 0 ? *avg * 0.9 + sample * 0.1 : sample;
+}
+
+/* Records how long pool took to generate one work */
+static void note_gen_latency(struct pool *pool, struct timeval *tv_start)
+{
+  struct timeval now;
+
+  cgtime(&now);
+  ewma_add(&pool->gen_latency, tdiff(&now, tv_start));
+}
+
+/* Staged works the scheduler aims for: twice as many as the devices take
+ * while the current pool generates one, and never fewer than --queue */
+static int staging_depth(struct pool *cp)
+{
+  double rate = 0;
+  int i, depth;
+
+  rd_lock(&devices_lock);
+  for (i = 0; i < total_devices; i++) {
+    struct cgpu_info *cgpu = devices[i];
+
+    if (cgpu->deven != DEV_DISABLED && cgpu->work_interval > 0)
+      rate += 1 / cgpu->work_interval;
+  }
+  rd_unlock(&devices_lock);
+
+  depth = opt_queue + (int)ceil(rate * cp->gen_latency * 2);
+  if (depth > opt_queue + mining_threads * STAGED_PER_THREAD)
+    depth = opt_queue + mining_threads * STAGED_PER_THREAD;
+
+  work_rate = rate;
+  staged_target = depth;
+  return depth;
+}
+
+/* Signs that pool may stop providing work soon */
+static bool pool_unwell(struct pool *pool)
+{
+  if (pool->lagging || pool->idle || pool->seq_getfails)
+    return true;
+  if (pool->has_stratum && !pool->stratum_active)
+    return true;
+  return pool->gen_latency > SLOW_GEN_SECS;
+}
+
+/* The pool we would fail over to from cp that can generate work right
+ * away: the fastest warm standby, else the first by priority */
+static struct pool *failover_pool(struct pool *cp)
+{
+  struct pool *pool;
+  int i;
+
+  if (opt_standby_pools) {
+    pool = standby_pool(cp);
+    if (pool)
+      return pool;
+  }
+
+  for (i = 0; i < total_pools; i++) {
+    pool = priority_pool(i);
+
+    if (pool == cp || pool_unusable(pool))
+      continue;
+    if ((pool->has_stratum && pool->stratum_active && pool->stratum_notify) || pool->has_gbt)
+      return pool;
+  }
+  return NULL;
+}
+
+/* While the current pool is unwell, keep one work of the pool we would
+ * fail over to aside, so that hash_pop() has something to hand out the
+ * moment the current pool runs dry. */
+static void prefetch_failover_work(struct pool *cp)
+{
+  struct work *work;
+  struct pool *pool;
+
+  mutex_lock(stgd_lock);
+  work = failover_work;
+  failover_work = NULL;
+  mutex_unlock(stgd_lock);
+
+  if (work) {
+    if (work->pool == cp) {
+      /* We failed over already, it is ordinary work now */
+      hash_push(work);
+      return;
+    }
+    if (pool_strategy != POOL_FAILOVER || !pool_unwell(cp) || stale_work(work, false)) {
+      discard_work(work);
+      return;
+    }
+    mutex_lock(stgd_lock);
+    if (!failover_work) {
+      failover_work = work;
+      work = NULL;
+    }
+    mutex_unlock(stgd_lock);
+    if (work)
+      discard_work(work);
+    return;
+  }
+
+  if (pool_strategy != POOL_FAILOVER || !pool_unwell(cp))
+    return;
+  pool = failover_pool(cp);
+  if (!pool)
+    return;
+
+  work = make_work();
+  if (pool->has_stratum)
+    gen_stratum_work(pool, work);
+  else
+    gen_gbt_work(pool, work);
+  prepare_staged_work(work);
+  applog(LOG_INFO, "%s unwell, prefetched work from %s", get_pool_name(cp), get_pool_name(pool));
+
+  mutex_lock(stgd_lock);
+  failover_work = work;
+  failover_prefetched++;
+  mutex_unlock(stgd_lock);
+}
+
 void set_target(unsigned char *dest_target, double diff, double diff_multiplier2, const int thr_id)
 {
   unsigned char target[32];
@@ -6520,6 +7422,27 @@ void set_target_neoscrypt(unsigned char *target, double diff, const int thr_id)
  * from the pool. This will keep generating work while a pool is down so we use
  * other means to detect when the pool has died in stratum_thread */
 
+static bool job_str_eq(const char *a, const char *b)
+{
+  return a == b || (a && b && !strcmp(a, b));
+}
+
+/* A reference to the job of the current stratum work of pool, made once per
+ * job_id, nonce1 and ntime.  Must be called with pool->data_lock write
+ * locked. */
+static struct work_job *stratum_work_job(struct pool *pool, const char *nonce1, const char *ntime)
+{
+  struct work_job *job = pool->swork.job;
+
+  if (!job || !job_str_eq(job->job_id, pool->swork.job_id) || !job_str_eq(job->nonce1, nonce1) ||
+      !job_str_eq(job->ntime, ntime)) {
+    work_job_put(job);
+    job = pool->swork.job = work_job_new(pool->swork.job_id, nonce1, ntime, NULL, NULL);
+  }
+  atomic_fetch_inc(&job->refs);
+  return job;
+}
+
 static void gen_stratum_work_eth(struct pool *pool, struct work *work)
 {
   if(pool->algorithm.type != ALGO_ETHASH)
@@ -6527,16 +7450,16 @@ static void gen_stratum_work_eth(struct pool *pool, struct work *work)
 
   applog(LOG_DEBUG, "[THR%d] gen_stratum_work() - algorithm = %s", work->thr_id, pool->algorithm.name);
 
-  cg_rlock(&pool->data_lock);
+  cg_wlock(&pool->data_lock);
   work->EpochNumber = pool->EpochNumber;
-  work->job_id = strdup(pool->swork.job_id);
+  work_set_job(work, stratum_work_job(pool, NULL, NULL));
   memcpy(work->data, pool->EthWork, 32);
   memcpy(work->seedhash, pool->SeedHash, 32);
   memcpy(work->target, pool->Target, 32);
   work->sdiff = pool->swork.diff;
   work->work_difficulty = pool->swork.diff;
   work->network_diff = pool->diff1;
-  cg_runlock(&pool->data_lock);
+  cg_wunlock(&pool->data_lock);
 
   local_work++;
   work->pool = pool;
@@ -6576,6 +7499,9 @@ static void gen_stratum_work(struct pool *pool, struct work *work)
     work->nonce2_len = pool->n2size;
   }
 
+  /* Strings required for share submission */
+  work_set_job(work, stratum_work_job(pool, pool->nonce1, pool->swork.ntime));
+
   /* Downgrade to a read lock to read off the pool variables */
   cg_dwlock(&pool->data_lock);
 
@@ -6583,7 +7509,7 @@ static void gen_stratum_work(struct pool *pool, struct work *work)
   pool->algorithm.gen_hash(pool->coinbase, pool->swork.cb_len, merkle_root);
   memcpy(merkle_sha, merkle_root, 32);
   for (i = 0; i < pool->swork.merkles; i++) {
-    memcpy(merkle_sha + 32, pool->swork.merkle_bin[i], 32);
+    memcpy(merkle_sha + 32, pool->swork.merkle_bin + i * 32, 32);
     gen_hash(merkle_sha, 64, merkle_root);
     memcpy(merkle_sha, merkle_root, 32);
   }
@@ -6651,11 +7577,6 @@ static void gen_stratum_work(struct pool *pool, struct work *work)
   /* Store the stratum work diff to check it still matches the pool's
   * stratum diff when submitting shares */
   work->sdiff = pool->swork.diff;
-
-  /* Copy parameters required for share submission */
-  work->job_id = strdup(pool->swork.job_id);
-  work->nonce1 = strdup(pool->nonce1);
-  work->ntime = strdup(pool->swork.ntime);
   cg_runlock(&pool->data_lock);
 
   if (opt_debug) {
@@ -7374,14 +8295,23 @@ static void get_work_prepare_thread(struct thr_info *mythr, struct work *work)
 
 struct work *get_work(struct thr_info *thr, const int thr_id)
 {
+  struct cgpu_info *cgpu = thr->cgpu;
   struct work *work = NULL;
+  struct timeval now;
   time_t diff_t;
+  double waited;
 
   thread_reportout(thr);
   applog(LOG_DEBUG, "[THR%d] Popping work from get queue to get work", thr_id);
   diff_t = time(NULL);
   while (!work) {
-    work = hash_pop(true);
+    work = hash_pop(true, &waited);
+    if (waited > 0) {
+      mutex_lock(&stats_lock);
+      cgpu->work_waits++;
+      cgpu->work_wait_secs += waited;
+      mutex_unlock(&stats_lock);
+    }
     if (stale_work(work, false)) {
       applog(LOG_DEBUG, "[THR%d] Work is stale, discarding", thr_id);
       discard_work(work);
@@ -7390,6 +8320,14 @@ struct work *get_work(struct thr_info *thr, const int thr_id)
     }
   }
 
+  /* How fast the device takes work, for staging_depth() */
+  cgtime(&now);
+  mutex_lock(&stats_lock);
+  if (cgpu->tv_last_getwork.tv_sec)
+    ewma_add(&cgpu->work_interval, tdiff(&now, &cgpu->tv_last_getwork));
+  cgpu->tv_last_getwork = now;
+  mutex_unlock(&stats_lock);
+
   applog(LOG_DEBUG, "[THR%d] preparing thread...", thr_id);
   get_work_prepare_thread(thr, work);
 
@@ -7435,6 +8373,7 @@ static void submit_work_async(struct work *work)
       pool->diff_stale += work->work_difficulty;
       mutex_unlock(&stats_lock);
 
+      api_push_share(work, "stale", NULL, -1);
       free_work(work);
       return;
     }
@@ -7467,8 +8406,8 @@ void inc_hw_errors(struct thr_info *thr)
   thr->cgpu->drv->hw_error(thr);
 }
 
-/* Fills in the work nonce and builds the output data in work->hash */
-static void rebuild_nonce(struct work *work, uint32_t nonce)
+/* Fills in the work nonce */
+void set_work_nonce(struct work *work, uint32_t nonce)
 {
   uint32_t nonce_pos = 76;
   if (work->pool->algorithm.type == ALGO_CRE) nonce_pos = 140;
@@ -7481,18 +8420,21 @@ static void rebuild_nonce(struct work *work, uint32_t nonce)
     uint32_t *work_nonce = (uint32_t *)(work->data + nonce_pos);
     *work_nonce = htole32(nonce);
   }
+}
 
+/* Fills in the work nonce and builds the output data in work->hash */
+static void rebuild_nonce(struct work *work, uint32_t nonce)
+{
+  set_work_nonce(work, nonce);
   work->pool->algorithm.regenhash(work);
 }
 
-/* For testing a nonce against diff 1 */
-bool test_nonce(struct work *work, uint32_t nonce)
+/* Tests an already regenerated work->hash against diff 1 */
+static bool test_hash_diff1(struct work *work)
 {
   uint32_t *hash_32 = (uint32_t *)(work->hash + 28);
   uint32_t diff1targ;
 
-  rebuild_nonce(work, nonce);
-
   // for Neoscrypt, the diff1targ value is in work->target
   if (work->pool->algorithm.type == ALGO_NEOSCRYPT || work->pool->algorithm.type == ALGO_PLUCK || 
 	  work->pool->algorithm.type == ALGO_YESCRYPT || work->pool->algorithm.type == ALGO_YESCRYPT_MULTI )
@@ -7514,6 +8456,13 @@ bool test_nonce(struct work *work, uint32_t nonce)
   return (le32toh(*hash_32) <= diff1targ);
 }
 
+/* For testing a nonce against diff 1 */
+bool test_nonce(struct work *work, uint32_t nonce)
+{
+  rebuild_nonce(work, nonce);
+  return test_hash_diff1(work);
+}
+
 static void update_work_stats(struct thr_info *thr, struct work *work)
 {
   double test_diff = current_diff;
@@ -7579,6 +8528,96 @@ bool submit_nonce(struct thr_info *thr, struct work *work, uint32_t nonce)
   return false;
 }
 
+#define SUBMIT_BATCH 8
+
+/* Tests and submits several nonces found for the same work. Algorithms with
+ * a batch regenhash verify up to SUBMIT_BATCH nonces per call on shallow
+ * copies of work; submit_tested_work() deep copies whatever it submits. */
+void submit_nonces(struct thr_info *thr, struct work *work, const uint32_t *nonces, unsigned int count)
+{
+  struct work batch[SUBMIT_BATCH];
+  unsigned int i, chunk;
+
+  if (!work->pool->algorithm.regenhash_batch || count < 2) {
+    for (i = 0; i < count; i++)
+      submit_nonce(thr, work, nonces[i]);
+    return;
+  }
+
+  for (; count; count -= chunk, nonces += chunk) {
+    chunk = count < SUBMIT_BATCH ? count : SUBMIT_BATCH;
+    for (i = 0; i < chunk; i++) {
+      memcpy(&batch[i], work, sizeof(struct work));
+      set_work_nonce(&batch[i], nonces[i]);
+    }
+
+    work->pool->algorithm.regenhash_batch(batch, chunk);
+
+    for (i = 0; i < chunk; i++) {
+      if (test_hash_diff1(&batch[i]))
+        submit_tested_work(thr, &batch[i]);
+      else
+        inc_hw_errors(thr);
+    }
+  }
+}
+
+/* Submits nonces that came with their hash from a --hash-payload kernel.
+ * Only opt_verify_sample percent of them, and every block candidate, are
+ * hashed again; a payload that differs from the real hash is a HW error. */
+void submit_payload_nonces(struct thr_info *thr, struct work *work, const uint32_t *nonces, const uint32_t *hashes, unsigned int count)
+{
+  struct cgpu_info *cgpu = thr->cgpu;
+  double block_diff = current_diff * work->pool->algorithm.share_diff_multiplier;
+  struct work check;
+  unsigned int i;
+
+  for (i = 0; i < count; i++, hashes += 8) {
+    bool verify = opt_verify_sample >= 100;
+
+    memcpy(&check, work, sizeof(struct work));
+    set_work_nonce(&check, nonces[i]);
+    memcpy(check.hash, hashes, 32);
+
+    if (!verify) {
+      mutex_lock(&stats_lock);
+      cgpu->verify_acc += opt_verify_sample;
+      if (cgpu->verify_acc >= 100) {
+        cgpu->verify_acc -= 100;
+        verify = true;
+      }
+      mutex_unlock(&stats_lock);
+    }
+    if (!verify && block_diff > 0 && share_diff(&check) >= block_diff)
+      verify = true;
+
+    if (verify) {
+      rebuild_nonce(&check, nonces[i]);
+      if (memcmp(check.hash, hashes, 32)) {
+        applog(LOG_DEBUG, "%s %d: hash payload of nonce %08x is wrong", cgpu->drv->name,
+               cgpu->device_id, nonces[i]);
+        mutex_lock(&stats_lock);
+        cgpu->verify_bad++;
+        mutex_unlock(&stats_lock);
+        inc_hw_errors(thr);
+        continue;
+      }
+    }
+
+    mutex_lock(&stats_lock);
+    if (verify)
+      cgpu->verify_checked++;
+    else
+      cgpu->verify_skipped++;
+    mutex_unlock(&stats_lock);
+
+    if (test_hash_diff1(&check))
+      submit_tested_work(thr, &check);
+    else
+      inc_hw_errors(thr);
+  }
+}
+
 static inline bool abandon_work(struct work *work, struct timeval *wdiff, uint64_t hashes)
 {
 	if (wdiff->tv_sec > opt_scantime) {
@@ -7586,8 +8625,8 @@ static inline bool abandon_work(struct work *work, struct timeval *wdiff, uint64
 		return true;
 	}
 
-	if (work->blk.nonce >= MAXTHREADS - hashes || hashes >= 0xfffffffe) {
-		applog(LOG_WARNING, "Generated too many nonces, giving up.");
+	if ((uint64_t)work->blk.nonce + hashes > work->nonce_end || hashes >= 0xfffffffe) {
+		applog(LOG_DEBUG, "Nonce range used up, getting more.");
 		return true;
 	}
 
@@ -7600,6 +8639,96 @@ static inline bool abandon_work(struct work *work, struct timeval *wdiff, uint64
 	return false;
 }
 
+/* A range covers what the device hashes in half of --scantime so that it
+ * is used up before the work is abandoned for taking too long */
+#define NONCE_RANGE_SCANS 2
+
+/* Size of the next nonce range of a thread, a whole number of passes of
+ * pass nonces.  Without a hashrate yet the thread gets the whole space. */
+static uint64_t nonce_range_size(struct cgpu_info *cgpu, uint64_t pass)
+{
+  double rate = cgpu->rolling * 1000000 / MAX(cgpu->threads, 1);
+  uint64_t size;
+
+  if (rate <= 0 || opt_scantime <= 0)
+    return MAXTHREADS;
+
+  size = rate * opt_scantime / NONCE_RANGE_SCANS;
+  if (pass)
+    size = (size + pass - 1) / pass * pass;
+  if (size < pass)
+    size = pass;
+  if (size > MAXTHREADS)
+    size = MAXTHREADS;
+  return size;
+}
+
+/* Gets the work for the next scan of a thread, with its nonce range set in
+ * work->blk.nonce and work->nonce_end.
+ *
+ * Every staged work has a header of its own (nonce2 or a rolled ntime), so
+ * its nonce space is handed out from a cursor in ranges sized to the
+ * hashrate of the asking device.  Threads keep taking ranges of the open
+ * job and only pop the next work from the queue once its space is used up
+ * or it went stale, so fast devices never skip part of the space and no
+ * two ranges overlap.  Ethash works share one header and get their nonces
+ * from eth_nonce instead, they are scanned whole. */
+static struct work *get_nonce_range(struct thr_info *mythr, uint64_t pass)
+{
+  struct cgpu_info *cgpu = mythr->cgpu;
+  uint64_t size = nonce_range_size(cgpu, pass);
+  struct work *work = NULL;
+  uint64_t start;
+
+  mutex_lock(&nonce_lock);
+  if (nonce_job && (nonce_job_next + MAX(pass, 1) > MAXTHREADS || stale_work(nonce_job, false))) {
+    free_work(nonce_job);
+    nonce_job = NULL;
+  }
+  if (nonce_job) {
+    work = copy_work(nonce_job);
+    start = nonce_job_next;
+    nonce_job_next += size;
+    nonce_ranges++;
+  }
+  mutex_unlock(&nonce_lock);
+
+  if (work) {
+    get_work_prepare_thread(mythr, work);
+    work->clone = true;
+    cgtime(&work->tv_cloned);
+    work->thr_id = mythr->id;
+    work->thr = mythr;
+    work->device_diff = MIN(cgpu->drv->max_diff, work->work_difficulty);
+  } else {
+    work = get_work(mythr, mythr->id);
+    if (work->pool->algorithm.type == ALGO_ETHASH) {
+      work->nonce_end = MAXTHREADS;
+      return work;
+    }
+
+    start = opt_start_nonce;
+    if (opt_rand_nonce)
+      start += ((uint32_t)rand() * 4) / mining_threads;
+    if (start + MAX(pass, 1) > MAXTHREADS)
+      start = 0;
+
+    mutex_lock(&nonce_lock);
+    nonce_jobs++;
+    nonce_ranges++;
+    if (!nonce_job && start + size < MAXTHREADS) {
+      nonce_job = copy_work(work);
+      nonce_job_next = start + size;
+    } else
+      size = MAXTHREADS;
+    mutex_unlock(&nonce_lock);
+  }
+
+  work->blk.nonce = start;
+  work->nonce_end = MIN(start + size, MAXTHREADS);
+  return work;
+}
+
 static void mt_disable(struct thr_info *mythr, const int thr_id,
            struct device_drv *drv)
 {
@@ -7630,6 +8759,7 @@ static void hash_sole_work(struct thr_info *mythr)
   struct timeval diff, sdiff, wdiff = {0, 0};
   uint32_t max_nonce = 0x7fffffff;// drv->can_limit_work(mythr);
   int64_t hashes_done = 0;
+  uint64_t last_pass = 0;
 
   tv_end = &getwork_start;
   cgtime(&getwork_start);
@@ -7637,7 +8767,7 @@ static void hash_sole_work(struct thr_info *mythr)
   cgtime(&tv_lastupdate);
 
   while (likely(!cgpu->shutdown)) {
-    struct work *work = get_work(mythr, thr_id);
+    struct work *work = get_nonce_range(mythr, last_pass);
     int64_t hashes;
 
     mythr->work_restart = false;
@@ -7645,12 +8775,6 @@ static void hash_sole_work(struct thr_info *mythr)
 
     cgtime(&tv_workstart);
 
-	 // We need to fairly spread the nonces around the gpus and threads
-	 work->blk.nonce = opt_start_nonce + ((0xffffffffU / mining_threads) * mythr->id);// opt_start_nonce;
-	 if (opt_rand_nonce)
-	 {
-		 work->blk.nonce += ((rand() * 4) & UINT32_MAX) / mining_threads;
-	 }
 	 work->EpochNumber = work->pool->EpochNumber;
 	 work->HeightNumber = work->pool->HeightNumber;
 
@@ -7807,6 +8931,8 @@ static void hash_sole_work(struct thr_info *mythr)
 
       sdiff.tv_sec = sdiff.tv_usec = 0;
     } while (!abandon_work(work, &wdiff, cgpu->max_hashes));
+    if (cgpu->max_hashes)
+      last_pass = cgpu->max_hashes;
     free_work(work);
   }
   cgpu->deven = DEV_DISABLED;
@@ -7922,11 +9048,16 @@ static struct pool *select_longpoll_pool(struct pool *cp)
 /* This will make the longpoll thread wait till it's the current pool, or it
  * has been flagged as rejecting, before attempting to open any connections.
  */
-static void wait_lpcurrent(struct pool *pool)
+static bool lp_waiting(struct pool *pool)
 {
-  while (!cnx_needed(pool) && (pool->state == POOL_DISABLED ||
+  return !cnx_needed(pool) && (pool->state == POOL_DISABLED ||
          (pool != current_pool() && pool_strategy != POOL_LOADBALANCE &&
-         pool_strategy != POOL_BALANCE))) {
+         pool_strategy != POOL_BALANCE));
+}
+
+static void wait_lpcurrent(struct pool *pool)
+{
+  while (lp_waiting(pool)) {
     mutex_lock(&lp_lock);
     pthread_cond_wait(&lp_cond, &lp_lock);
     mutex_unlock(&lp_lock);
@@ -8132,6 +9263,14 @@ static void *watchpool_thread(void __maybe_unused *userdata)
       sleeptimeout = 5000;
     }
 
+    /* Bring standby connections up or let them go for pools enabled,
+     * disabled or reprioritised since the last pass */
+    if (update_standby_pools()) {
+      mutex_lock(&lp_lock);
+      pthread_cond_broadcast(&lp_cond);
+      mutex_unlock(&lp_lock);
+    }
+
     // check the status of each pool
     for (i = 0; i < total_pools; ++i) {
       struct pool *pool = pools[i];
@@ -8169,7 +9308,8 @@ static void *watchpool_thread(void __maybe_unused *userdata)
       }
 
       // if this pool is alive and the priority is greater (lower) than currently connected pool
-      if (!pool->idle && pool->prio < cp_prio()) {
+      // (standby pools are interchangeable, no failing back among them)
+      if (!pool->idle && pool->prio < cp_prio() && !(pool->standby && current_pool()->standby)) {
         // failover strategy - switch when failover delay is met
         if (pool_strategy == POOL_FAILOVER && (now.tv_sec - pool->tv_idle.tv_sec > opt_fail_switch_delay)) {
           applog(LOG_WARNING, "%s stable for %d seconds", get_pool_name(pool), opt_fail_switch_delay);
@@ -8207,6 +9347,29 @@ static void *watchpool_thread(void __maybe_unused *userdata)
 #define WATCHDOG_SICK_COUNT   (WATCHDOG_SICK_TIME/WATCHDOG_INTERVAL)
 #define WATCHDOG_DEAD_COUNT   (WATCHDOG_DEAD_TIME/WATCHDOG_INTERVAL)
 
+/* Logs the work allocator calls per second every --log interval */
+static void log_work_alloc(void)
+{
+  static uint64_t made, recycled, heap, jobs;
+  static struct timeval tv_last;
+  struct timeval now;
+  double secs;
+
+  cgtime(&now);
+  secs = tdiff(&now, &tv_last);
+  if (secs < opt_log_interval)
+    return;
+  if (tv_last.tv_sec)
+    applog(LOG_DEBUG, "Work allocator: %.1f works/s, %.1f recycled/s, %.1f calloced/s, %.1f jobs/s, %d slabs",
+           (work_made - made) / secs, (work_recycled - recycled) / secs, (work_heap - heap) / secs,
+           (work_jobs - jobs) / secs, work_slabs_used);
+  made = work_made;
+  recycled = work_recycled;
+  heap = work_heap;
+  jobs = work_jobs;
+  copy_time(&tv_last, &now);
+}
+
 static void *watchdog_thread(void __maybe_unused *userdata)
 {
   const unsigned int interval = WATCHDOG_INTERVAL;
@@ -8228,8 +9391,16 @@ static void *watchdog_thread(void __maybe_unused *userdata)
 
     discard_stale();
 
+    for (i = 0; i < total_pools; i++) {
+      if (pools[i]->has_stratum)
+        expire_stratum_shares(pools[i]);
+    }
+
     hashmeter(-1, &zero_tv, 0);
 
+    if (opt_debug)
+      log_work_alloc();
+
     rd_lock(&mining_thr_lock);
 
 #ifdef HAVE_CURSES
@@ -8335,6 +9506,7 @@ static void *watchdog_thread(void __maybe_unused *userdata)
         applog(LOG_ERR, "%s: Recovered, declaring WELL!", dev_str);
         cgpu->status = LIFE_WELL;
         cgpu->device_last_well = time(NULL);
+        api_push_device(cgpu);
       } else if (cgpu->status == LIFE_WELL && (now.tv_sec - thr->last.tv_sec > WATCHDOG_SICK_TIME)) {
         thr->rolling = cgpu->rolling = 0;
         cgpu->status = LIFE_SICK;
@@ -8343,6 +9515,7 @@ static void *watchdog_thread(void __maybe_unused *userdata)
 
         dev_error(cgpu, REASON_DEV_SICK_IDLE_60);
         event_notify("gpu_sick");
+        api_push_device(cgpu);
 
 #ifdef HAVE_ADL
         if (adl_active && cgpu->has_adl && gpu_activity(gpu) > 50) {
@@ -8361,6 +9534,7 @@ static void *watchdog_thread(void __maybe_unused *userdata)
 
         dev_error(cgpu, REASON_DEV_DEAD_IDLE_600);
         event_notify("gpu_dead");
+        api_push_device(cgpu);
       } else if (now.tv_sec - thr->sick.tv_sec > 60 &&
            (cgpu->status == LIFE_SICK || cgpu->status == LIFE_DEAD)) {
         /* Attempt to restart a GPU that's sick or dead once every minute */
@@ -8482,6 +9656,7 @@ void print_summary(void)
 static void clean_up(bool restarting)
 {
   cgtime(&total_tv_end);
+  sharelog_flush();
 #ifdef WIN32
   timeEndPeriod(1);
 #endif
@@ -9149,14 +10324,15 @@ int main(int argc, char *argv[])
   mutex_init(&console_lock);
   cglock_init(&control_lock);
   mutex_init(&stats_lock);
-  mutex_init(&sharelog_lock);
   cglock_init(&ch_lock);
-  mutex_init(&sshare_lock);
   rwlock_init(&blk_lock);
   rwlock_init(&netacc_lock);
   rwlock_init(&mining_thr_lock);
   rwlock_init(&devices_lock);
   mutex_init(&algo_switch_lock);
+  mutex_init(&nonce_lock);
+  mutex_init(&work_slab_lock);
+  log_start();
 
   mutex_init(&lp_lock);
   if (unlikely(pthread_cond_init(&lp_cond, NULL)))
@@ -9251,7 +10427,7 @@ int main(int argc, char *argv[])
   load_default_profile();
 
 #ifdef HAVE_CURSES
-  if (opt_realquiet || opt_display_devs)
+  if (opt_realquiet || opt_display_devs || opt_bench_cpu || opt_bench_kernel || opt_bench_stratum)
     use_curses = false;
 
   if (use_curses)
@@ -9279,6 +10455,20 @@ int main(int argc, char *argv[])
     cnfbuf = NULL;
   }
 
+  if (opt_bench_cpu) {
+    if (!bench_cpu())
+      quit(1, "CPU benchmark failed");
+    quit(0, "CPU benchmark finished");
+  }
+
+  if (opt_bench_stratum) {
+    if (!bench_stratum())
+      quit(1, "Stratum benchmark failed");
+    quit(0, "Stratum benchmark finished");
+  }
+
+  sharelog_start();
+
   if (want_per_device_stats)
     opt_verbose = true;
 
@@ -9311,6 +10501,12 @@ int main(int argc, char *argv[])
   //apply default settings to GPUs
   apply_defaults();
 
+  if (opt_bench_kernel) {
+    if (!bench_kernel())
+      quit(1, "Kernel benchmark failed");
+    quit(0, "Kernel benchmark finished");
+  }
+
   //apply pool-specific config from profiles
   apply_pool_profiles();
 
@@ -9429,6 +10625,9 @@ int main(int argc, char *argv[])
     pool->idle = true;
   }
 
+  if (opt_stratum_reactor && !stratum_reactor_init())
+    opt_stratum_reactor = false;
+
   applog(LOG_NOTICE, "Probing for an alive pool");
   int slept = 0;
   do {
@@ -9534,17 +10733,19 @@ int main(int argc, char *argv[])
 
   /* Once everything is set up, main() becomes the getwork scheduler */
   while (42) {
-    int ts, max_staged = opt_queue;
+    int ts, max_staged;
     struct pool *pool, *cp;
     bool lagging = false;
     struct timespec then;
-    struct timeval now;
+    struct timeval now, tv_gen;
     struct work *work;
 
     if (opt_work_update)
       signal_work_update();
     opt_work_update = false;
     cp = current_pool();
+    prefetch_failover_work(cp);
+    max_staged = staging_depth(cp);
 
     /* If the primary pool is a getwork pool and cannot roll work,
      * try to stage one extra work per mining thread */
@@ -9572,7 +10773,7 @@ int main(int argc, char *argv[])
       /* Keeps slowly generating work even if it's not being
        * used to keep last_getwork incrementing and to see
        * if pools are still alive. */
-      work = hash_pop(false);
+      work = hash_pop(false, NULL);
       if (work) {
         applog(LOG_DEBUG,
          "[THR%d] Staged work: total (%d) > max (%d), discarding",
@@ -9603,7 +10804,9 @@ retry:
           goto retry;
         }
       }
+      cgtime(&tv_gen);
       gen_stratum_work(pool, work);
+      note_gen_latency(pool, &tv_gen);
       applog(LOG_DEBUG, "Generated stratum work");
       stage_work(work);
       continue;
@@ -9622,7 +10825,9 @@ retry:
           goto retry;
         }
       }
+      cgtime(&tv_gen);
       gen_gbt_work(pool, work);
+      note_gen_latency(pool, &tv_gen);
       applog(LOG_DEBUG, "Generated GBT work");
       stage_work(work);
       continue;
@@ -9637,6 +10842,7 @@ retry:
     work->pool = pool;
     ce = pop_curl_entry(pool);
     /* obtain new work from bitcoin via JSON-RPC */
+    cgtime(&tv_gen);
     if (!get_upstream_work(work, ce->curl, ce->curl_err_str)) {
       applog(LOG_DEBUG, "%s json_rpc_call failed on get work, retrying in 5s", get_pool_name(pool));
       /* Make sure the pool just hasn't stopped serving
@@ -9648,6 +10854,7 @@ retry:
       pool = select_pool(!opt_fail_only);
       goto retry;
     }
+    note_gen_latency(pool, &tv_gen);
     if (ts >= max_staged)
       pool_tclear(pool, &pool->lagging);
     if (pool_tclear(pool, &pool->idle))
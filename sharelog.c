@@ -0,0 +1,371 @@
+/*
+ * Copyright 2013-2014 sgminer developers (see AUTHORS.md)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 3 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+#include "miner.h"
+#include "sharelog.h"
+
+#define SHARELOG_FLUSH_SECS 1
+#define SHARELOG_FLUSH_BYTES (64 * 1024)
+/* Shares past this much waiting to be written are dropped */
+#define SHARELOG_MAX_BYTES (16 * 1024 * 1024)
+
+bool opt_sharelog_binary;
+int opt_sharelog_rotate;
+
+/* sharelog_lock guards the buffer the shares are added to; the share log
+ * thread swaps it for sharelog_out and writes that out under
+ * sharelog_write_lock, which also guards the file */
+static pthread_mutex_t sharelog_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t sharelog_write_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sharelog_cond = PTHREAD_COND_INITIALIZER;
+static char *sharelog_buf, *sharelog_out;
+static size_t sharelog_len, sharelog_size, sharelog_out_size;
+static int sharelog_dropped;
+
+static FILE *sharelog_file;
+static char *sharelog_path;     /* NULL when not rotated: stdout or an fd */
+static uint64_t sharelog_written;
+static pthread_t sharelog_thr;
+
+char *sharelog_open(const char *arg)
+{
+  char *r = "";
+  long int i = strtol(arg, &r, 10);
+
+  free(sharelog_path);
+  sharelog_path = NULL;
+
+  if ((!*r) && i >= 0 && i <= INT_MAX) {
+    sharelog_file = fdopen((int)i, "a");
+    if (!sharelog_file)
+      applog(LOG_ERR, "Failed to open fd %u for share log", (unsigned int)i);
+  } else if (!strcmp(arg, "-")) {
+    sharelog_file = stdout;
+    if (!sharelog_file)
+      applog(LOG_ERR, "Standard output missing for share log");
+  } else {
+    sharelog_file = fopen(arg, "a");
+    if (!sharelog_file)
+      applog(LOG_ERR, "Failed to open %s for share log", arg);
+    else
+      sharelog_path = strdup(arg);
+  }
+
+  /* Where rotation counts from, and whether a binary log needs its magic */
+  sharelog_written = 0;
+  if (sharelog_file && !fseek(sharelog_file, 0, SEEK_END)) {
+    long pos = ftell(sharelog_file);
+
+    if (pos > 0)
+      sharelog_written = pos;
+  }
+
+  return NULL;
+}
+
+static void put_le16(unsigned char *p, uint16_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static void put_le32(unsigned char *p, uint32_t v)
+{
+  put_le16(p, v);
+  put_le16(p + 2, v >> 16);
+}
+
+static void put_le64(unsigned char *p, uint64_t v)
+{
+  put_le32(p, v);
+  put_le32(p + 4, v >> 32);
+}
+
+/* Room for size more bytes in sharelog_buf, false if the share must be
+ * dropped.  Called with sharelog_lock held. */
+static bool sharelog_reserve(size_t size)
+{
+  char *buf;
+  size_t want;
+
+  if (sharelog_len + size > SHARELOG_MAX_BYTES)
+    return false;
+  if (sharelog_len + size <= sharelog_size)
+    return true;
+  want = sharelog_size ? sharelog_size : SHARELOG_FLUSH_BYTES;
+  while (want < sharelog_len + size)
+    want *= 2;
+  buf = (char *)realloc(sharelog_buf, want);
+  if (unlikely(!buf))
+    return false;
+  sharelog_buf = buf;
+  sharelog_size = want;
+  return true;
+}
+
+void sharelog(const char *disposition, const struct work *work)
+{
+  struct cgpu_info *cgpu;
+  const char *url, *drv;
+  size_t dlen, nlen, ulen, size;
+  unsigned char *p;
+  int thr_id;
+
+  if (!sharelog_file)
+    return;
+
+  thr_id = work->thr_id;
+  cgpu = get_thr_cgpu(thr_id);
+  url = work->pool->rpc_url;
+  drv = cgpu->drv->name;
+  dlen = MIN(strlen(disposition), 255);
+  nlen = MIN(strlen(drv), 255);
+  ulen = MIN(strlen(url), 4096);
+  if (opt_sharelog_binary)
+    size = SHARELOG_REC_FIXED + 1 + dlen + 1 + nlen + 2 + ulen;
+  else
+    size = dlen + ulen + nlen + 64 + 64 + 384 + 64;  /* and separators and numbers */
+
+  mutex_lock(&sharelog_lock);
+  if (!sharelog_reserve(size)) {
+    sharelog_dropped++;
+    mutex_unlock(&sharelog_lock);
+    return;
+  }
+  p = (unsigned char *)sharelog_buf + sharelog_len;
+
+  if (opt_sharelog_binary) {
+    put_le16(p, size);
+    put_le64(p + 2, work->tv_work_found.tv_sec);
+    put_le32(p + 10, cgpu->device_id);
+    put_le32(p + 14, thr_id);
+    memcpy(p + 18, work->target, 32);
+    memcpy(p + 50, work->hash, 32);
+    memcpy(p + 82, work->data, 192);
+    p += SHARELOG_REC_FIXED;
+    *p++ = dlen;
+    memcpy(p, disposition, dlen);
+    p += dlen;
+    *p++ = nlen;
+    memcpy(p, drv, nlen);
+    p += nlen;
+    put_le16(p, ulen);
+    memcpy(p + 2, url, ulen);
+    p += 2 + ulen;
+  } else {
+    char *s = (char *)p;
+
+    // timestamp,disposition,target,pool,dev,thr,sharehash,sharedata
+    s += sprintf(s, "%lu,%.*s,", (unsigned long int)work->tv_work_found.tv_sec, (int)dlen, disposition);
+    __bin2hex(s, work->target, sizeof(work->target));
+    s += 2 * sizeof(work->target);
+    s += sprintf(s, ",%.*s,%.*s%u,%u,", (int)ulen, url, (int)nlen, drv, cgpu->device_id, thr_id);
+    __bin2hex(s, work->hash, sizeof(work->hash));
+    s += 2 * sizeof(work->hash);
+    *s++ = ',';
+    __bin2hex(s, work->data, sizeof(work->data));
+    s += 2 * sizeof(work->data);
+    *s++ = '\n';
+    p = (unsigned char *)s;
+  }
+
+  sharelog_len = (char *)p - sharelog_buf;
+  if (sharelog_len >= SHARELOG_FLUSH_BYTES)
+    pthread_cond_signal(&sharelog_cond);
+  mutex_unlock(&sharelog_lock);
+}
+
+/* Moves the full log aside as <path>.<n>, the first n not taken, and starts
+ * a new one */
+static void sharelog_rotate(void)
+{
+  size_t len = strlen(sharelog_path) + 16;
+  char *name = (char *)malloc(len);
+  FILE *fp;
+  int n;
+
+  if (unlikely(!name))
+    quit(1, "Failed to malloc in sharelog_rotate");
+  for (n = 1; ; n++) {
+    snprintf(name, len, "%s.%d", sharelog_path, n);
+    fp = fopen(name, "r");
+    if (!fp)
+      break;
+    fclose(fp);
+  }
+
+  fclose(sharelog_file);
+  if (rename(sharelog_path, name))
+    applog(LOG_ERR, "Failed to rotate share log %s to %s", sharelog_path, name);
+  else
+    applog(LOG_NOTICE, "Share log rotated to %s", name);
+  free(name);
+
+  sharelog_written = 0;
+  sharelog_file = fopen(sharelog_path, "a");
+  if (!sharelog_file)
+    applog(LOG_ERR, "Failed to open %s for share log", sharelog_path);
+}
+
+/* Writes len bytes of whole records or lines, with sharelog_write_lock
+ * held */
+static void sharelog_write(const char *buf, size_t len)
+{
+  if (!len || !sharelog_file)
+    return;
+
+  if (opt_sharelog_binary && !sharelog_written) {
+    if (fwrite(SHARELOG_MAGIC, SHARELOG_MAGIC_LEN, 1, sharelog_file) != 1)
+      applog(LOG_ERR, "sharelog fwrite error");
+    sharelog_written += SHARELOG_MAGIC_LEN;
+  }
+  if (fwrite(buf, len, 1, sharelog_file) != 1)
+    applog(LOG_ERR, "sharelog fwrite error");
+  fflush(sharelog_file);
+  sharelog_written += len;
+
+  if (sharelog_path && opt_sharelog_rotate &&
+      sharelog_written >= (uint64_t)opt_sharelog_rotate * 1024 * 1024)
+    sharelog_rotate();
+}
+
+/* Swaps the buffer shares are added to for the one last written out, and
+ * writes it */
+static void sharelog_swap_write(void)
+{
+  size_t len, size;
+  char *buf;
+  int dropped;
+
+  mutex_lock(&sharelog_lock);
+  buf = sharelog_buf;
+  len = sharelog_len;
+  size = sharelog_size;
+  sharelog_buf = sharelog_out;
+  sharelog_size = sharelog_out_size;
+  sharelog_len = 0;
+  dropped = sharelog_dropped;
+  sharelog_dropped = 0;
+  mutex_unlock(&sharelog_lock);
+
+  sharelog_out = buf;
+  sharelog_out_size = size;
+  if (dropped)
+    applog(LOG_ERR, "Share log falling behind, %d share(s) not logged", dropped);
+  sharelog_write(buf, len);
+}
+
+/* A log being appended to must already be in the format being written: a
+ * binary one starts with SHARELOG_MAGIC and a CSV one does not.  One in the
+ * other format is moved aside when it has a name, otherwise shares are not
+ * logged. */
+static void sharelog_check_format(void)
+{
+  const char *format = opt_sharelog_binary ? "binary" : "CSV";
+  char magic[SHARELOG_MAGIC_LEN];
+  bool binary;
+  FILE *fp;
+
+  if (!sharelog_file || !sharelog_written)
+    return;
+
+  if (sharelog_path) {
+    fp = fopen(sharelog_path, "rb");
+    if (!fp) {
+      applog(LOG_WARNING, "Failed to open %s to check the share log format", sharelog_path);
+      return;
+    }
+    binary = fread(magic, sizeof(magic), 1, fp) == 1 && !memcmp(magic, SHARELOG_MAGIC, SHARELOG_MAGIC_LEN);
+    fclose(fp);
+  } else {
+#ifdef WIN32
+    applog(LOG_WARNING, "Cannot read the share log to check it is in %s format", format);
+    return;
+#else
+    ssize_t n = pread(fileno(sharelog_file), magic, sizeof(magic), 0);
+
+    if (n < 0) {
+      applog(LOG_WARNING, "Cannot read the share log to check it is in %s format", format);
+      return;
+    }
+    binary = n == sizeof(magic) && !memcmp(magic, SHARELOG_MAGIC, SHARELOG_MAGIC_LEN);
+#endif
+  }
+
+  if (binary == opt_sharelog_binary)
+    return;
+
+  if (sharelog_path) {
+    applog(LOG_WARNING, "Share log %s is not in %s format, starting a new one", sharelog_path, format);
+    sharelog_rotate();
+  } else {
+    applog(LOG_ERR, "Share log is not in %s format, not logging shares", format);
+    if (sharelog_file != stdout)
+      fclose(sharelog_file);
+    sharelog_file = NULL;
+  }
+}
+
+static void *sharelog_thread(void __maybe_unused *userdata)
+{
+  struct timespec then;
+  struct timeval now;
+
+  pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+  RenameThread("Sharelog");
+
+  while (42) {
+    mutex_lock(&sharelog_lock);
+    if (sharelog_len < SHARELOG_FLUSH_BYTES) {
+      cgtime(&now);
+      then.tv_sec = now.tv_sec + SHARELOG_FLUSH_SECS;
+      then.tv_nsec = now.tv_usec * 1000;
+      pthread_cond_timedwait(&sharelog_cond, &sharelog_lock, &then);
+    }
+    mutex_unlock(&sharelog_lock);
+
+    mutex_lock(&sharelog_write_lock);
+    sharelog_swap_write();
+    mutex_unlock(&sharelog_write_lock);
+  }
+  return NULL;
+}
+
+void sharelog_start(void)
+{
+  /* Only now is --sharelog-format known, whatever the option order */
+  sharelog_check_format();
+  if (!sharelog_file)
+    return;
+  if (unlikely(pthread_create(&sharelog_thr, NULL, sharelog_thread, NULL)))
+    quit(1, "Failed to create sharelog thread");
+  pthread_detach(sharelog_thr);
+}
+
+void sharelog_flush(void)
+{
+  /* The share log thread may be the one quitting */
+  if (mutex_trylock(&sharelog_write_lock)) {
+    if (pthread_equal(pthread_self(), sharelog_thr))
+      return;
+    mutex_lock(&sharelog_write_lock);
+  }
+  sharelog_swap_write();
+  mutex_unlock(&sharelog_write_lock);
+}
@@ -0,0 +1,48 @@
+#ifndef SHARELOG_H
+#define SHARELOG_H
+
+#include <stdbool.h>
+
+/*
+ * Share log (--sharelog).
+ *
+ * Shares are added to a buffer by the threads that find and submit them,
+ * and the share log thread writes the buffer out every SHARELOG_FLUSH_SECS,
+ * or sooner once SHARELOG_FLUSH_BYTES are waiting.  The file is either the
+ * CSV described in README.md, or with --sharelog-format binary the
+ * SHARELOG_MAGIC bytes followed by one record per share, numbers little
+ * endian:
+ *
+ *   offset  size
+ *   0       2    size of the whole record
+ *   2       8    time the share was found, seconds since the epoch
+ *   10      4    device id
+ *   14      4    thread id
+ *   18      32   target
+ *   50      32   share hash
+ *   82      192  share data
+ *   274     1    length of the disposition, then the disposition
+ *   ...     1    length of the driver name, then the name
+ *   ...     2    length of the pool URL, then the URL
+ *
+ * tools/sharelog-convert.c turns a binary share log into CSV or JSON.
+ */
+
+#define SHARELOG_MAGIC "SGSHARE1"
+#define SHARELOG_MAGIC_LEN 8
+#define SHARELOG_REC_FIXED 274
+
+extern bool opt_sharelog_binary;
+extern int opt_sharelog_rotate;
+
+struct work;
+
+/* Opens arg, a file name, a file descriptor or "-" for stdout, NULL or an
+ * error message for the option parser */
+extern char *sharelog_open(const char *arg);
+extern void sharelog_start(void);
+extern void sharelog(const char *disposition, const struct work *work);
+/* Writes out what is waiting, for quitting */
+extern void sharelog_flush(void);
+
+#endif /* SHARELOG_H */
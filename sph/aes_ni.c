@@ -0,0 +1,221 @@
+/**
+ * AES implementation selection for ECHO, SHAvite-3 and Groestl, and the
+ * known answer tests covering every implementation.
+ *
+ * @file     aes_ni.c
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "sph_aes_ni.h"
+#include "sph_echo.h"
+#include "sph_shavite.h"
+#include "sph_groestl.h"
+#include "../algorithm/simd.h"
+
+static int aes_impl = SPH_AES_AUTO;
+
+/* see sph_aes_ni.h */
+int
+sph_aes_ni_available(int impl)
+{
+	switch (impl) {
+	case SPH_AES_TABLES:
+		return 1;
+#ifdef USE_SIMD_X86
+	case SPH_AES_NI:
+		return simd_have(SIMD_AES) && simd_have(SIMD_SSSE3);
+#ifdef USE_SIMD_VAES
+	case SPH_AES_VAES:
+		return simd_have(SIMD_VAES) && simd_have(SIMD_AVX2)
+			&& sph_aes_ni_available(SPH_AES_NI);
+#endif
+#endif
+	default:
+		return 0;
+	}
+}
+
+/* see sph_aes_ni.h */
+int
+sph_aes_ni_set(int impl)
+{
+	if (impl < 0 || impl > SPH_AES_VAES)
+		impl = SPH_AES_VAES;
+	while (!sph_aes_ni_available(impl))
+		impl --;
+	aes_impl = impl;
+	return impl;
+}
+
+/* see sph_aes_ni.h */
+int
+sph_aes_ni_get(void)
+{
+	/*
+	 * Concurrent first calls all store the same value, so the
+	 * detection needs no lock.
+	 */
+	if (aes_impl < 0)
+		return sph_aes_ni_set(SPH_AES_AUTO);
+	return aes_impl;
+}
+
+/* see sph_aes_ni.h */
+const char *
+sph_aes_ni_name(int impl)
+{
+	switch (impl) {
+	case SPH_AES_TABLES:
+		return "tables";
+	case SPH_AES_NI:
+		return "aes-ni";
+	case SPH_AES_VAES:
+		return "vaes";
+	default:
+		return "auto";
+	}
+}
+
+/*
+ * Known answers for the empty message, "abc" and the 200 bytes
+ * 0x00, 0x01, ... 0xC7 (two ECHO-512 blocks, four Groestl-256 blocks),
+ * as produced by the reference T-table code.
+ */
+typedef struct {
+	const char *name;
+	size_t out_len;
+	void (*init)(void *cc);
+	void (*update)(void *cc, const void *data, size_t len);
+	void (*close)(void *cc, void *dst);
+	const char *kat[3];
+} aes_hash_test;
+
+static const aes_hash_test aes_hash_tests[] = {
+	{ "echo256", 32,
+		sph_echo256_init, sph_echo256, sph_echo256_close, {
+		"4496cd09d425999aefa75189ee7fd3c97362aa9e4ca898328002d20a4b519788",
+		"871b1fad479135c37e1aad71ac9a99def41730f3e5b3e0dc3f6b7cf072fa5649",
+		"1ab64b9236e109ca9e41e4baf68703be919bda10809ce3d3477bb6484da6e075"
+	} },
+	{ "echo512", 64,
+		sph_echo512_init, sph_echo512, sph_echo512_close, {
+		"158f58cc79d300a9aa292515049275d051a28ab931726d0ec44bdd9faef4a702"
+		"c36db9e7922fff077402236465833c5cc76af4efc352b4b44c7fa15aa0ef234e",
+		"3bf04ec89d67e0dafd1b8ab26b176abaead6b3cdc706ff7198c3c6045e77d4ea"
+		"f64cd90af9c5a7674919b90ff8c9b4a7554d6cfeffb334406ec233fb0b0dd6bc",
+		"61c10247231339fe1649319067997f656a1a90a0482763a227378c96eaf07eb9"
+		"84018a897d0ed453729ca700d21753432c0cabef97ea9b32fcbd61268d0f7d11"
+	} },
+	{ "shavite256", 32,
+		sph_shavite256_init, sph_shavite256, sph_shavite256_close, {
+		"08c5825af2e9e5947286a8fe208bd5f8c6a7c8e4da598947d7ff8eda0fcd2bd7",
+		"1fa8520307d2c36719d04d4f778f8dea6e06380bca083c2d121208b9363fae2d",
+		"0874a28f9521d26bfafbce3372dceabcefaf2f4155750eb6338bbff7465bc768"
+	} },
+	{ "shavite512", 64,
+		sph_shavite512_init, sph_shavite512, sph_shavite512_close, {
+		"a485c1b2578459d1efc5dddd840bb0b4a650ac82fe68f58c4442ccda747da006"
+		"b2d1dc6b4a4eb7d84ff91e1f466fef429d259acd995dddcad16fa545c7a6e5ba",
+		"0fb0b216b377e6d95db1b6d9b6c8b59f08d4e29814071c8c0f827b32e68c1536"
+		"2f24bcc15ad6b1c925a03f00092997f7628cb47f27c9ad7a22e4c00fbb2c16e3",
+		"c312d285cd9c597d7df9525133155f05aa94f206b31e2def255879b8bb27f25c"
+		"cfaba516238c5de679545e7d0d88a5d0c0c975aae8a2e62369fcdeda4d02da42"
+	} },
+	{ "groestl256", 32,
+		sph_groestl256_init, sph_groestl256, sph_groestl256_close, {
+		"1a52d11d550039be16107f9c58db9ebcc417f16f736adb2502567119f0083467",
+		"f3c1bb19c048801326a7efbcf16e3d7887446249829c379e1840d1a3a1e7d4d2",
+		"5e4874941276bacd43cf9f5078a5d620143b0b105f633f44d65ed13d27f6a849"
+	} },
+	{ "groestl512", 64,
+		sph_groestl512_init, sph_groestl512, sph_groestl512_close, {
+		"6d3ad29d279110eef3adbd66de2a0345a77baede1557f5d099fce0c03d6dc2ba"
+		"8e6d4a6633dfbd66053c20faa87d1a11f39a7fbe4a6c2f009801370308fc4ad8",
+		"70e1c68c60df3b655339d67dc291cc3f1dde4ef343f11b23fdd44957693815a7"
+		"5a8339c682fc28322513fd1f283c18e53cff2b264e06bf83a2f0ac8c1f6fbff6",
+		"ff6dabc4aacd1f3955daba7ee2f36b2e24cca8aef87bdf286ea77b2d86dc4052"
+		"6ca5290c0558e95b4f620d78241a2665ab300216016b66ae87c6dc2e216348bb"
+	} },
+};
+
+#define AES_TEST_MAXLEN   300
+
+static void
+aes_hash_run(const aes_hash_test *t, const unsigned char *msg, size_t len,
+	unsigned char *dst)
+{
+	union {
+		sph_echo512_context echo;
+		sph_shavite512_context shavite;
+		sph_groestl512_context groestl;
+	} cc;
+
+	t->init(&cc);
+	/* split the input so the buffering code gets exercised as well */
+	t->update(&cc, msg, len / 3);
+	t->update(&cc, msg + len / 3, len - len / 3);
+	t->close(&cc, dst);
+}
+
+static int
+aes_hex_equal(const unsigned char *buf, size_t len, const char *hex)
+{
+	static const char digits[] = "0123456789abcdef";
+	size_t u;
+
+	if (strlen(hex) != len * 2)
+		return 0;
+	for (u = 0; u < len; u ++) {
+		if (hex[2 * u] != digits[buf[u] >> 4]
+			|| hex[2 * u + 1] != digits[buf[u] & 0x0F])
+			return 0;
+	}
+	return 1;
+}
+
+/* see sph_aes_ni.h */
+int
+sph_aes_ni_selftest(void)
+{
+	static const size_t kat_len[3] = { 0, 3, 200 };
+	unsigned char msg[AES_TEST_MAXLEN];
+	unsigned char ref[64], out[64];
+	int saved, impl, ok;
+	size_t u, len;
+
+	for (u = 0; u < sizeof msg; u ++)
+		msg[u] = (unsigned char)u;
+	saved = sph_aes_ni_get();
+	ok = 1;
+	for (u = 0; u < sizeof aes_hash_tests / sizeof aes_hash_tests[0]; u ++) {
+		const aes_hash_test *t = &aes_hash_tests[u];
+		int k;
+
+		for (impl = SPH_AES_TABLES; impl <= SPH_AES_VAES; impl ++) {
+			if (!sph_aes_ni_available(impl))
+				continue;
+			sph_aes_ni_set(impl);
+			for (k = 0; k < 3; k ++) {
+				aes_hash_run(t, k == 1
+					? (const unsigned char *)"abc" : msg,
+					kat_len[k], out);
+				ok &= aes_hex_equal(out, t->out_len, t->kat[k]);
+			}
+		}
+		for (len = 0; len <= AES_TEST_MAXLEN; len ++) {
+			sph_aes_ni_set(SPH_AES_TABLES);
+			aes_hash_run(t, msg, len, ref);
+			for (impl = SPH_AES_NI; impl <= SPH_AES_VAES; impl ++) {
+				if (!sph_aes_ni_available(impl))
+					continue;
+				sph_aes_ni_set(impl);
+				aes_hash_run(t, msg, len, out);
+				ok &= !memcmp(out, ref, t->out_len);
+			}
+		}
+	}
+	aes_impl = saved;
+	return ok;
+}
@@ -689,9 +689,16 @@ bmw32_close(sph_bmw_small_context *sc, unsigned ub, unsigned n,
 		h = h1;
 	}
 	memset(buf + ptr, 0, (sizeof sc->buf) - 8 - ptr);
+	/*
+	 * compress_small() reads the buffer as 32-bit words, so the count
+	 * must be written as such too: a 64-bit store there breaks strict
+	 * aliasing and GCC -O2 then hashes a stale count.
+	 */
 #if SPH_64
-	sph_enc64le_aligned(buf + (sizeof sc->buf) - 8,
-		SPH_T64(sc->bit_count + n));
+	sph_enc32le_aligned(buf + (sizeof sc->buf) - 8,
+		SPH_T32((sph_u32)(sc->bit_count + n)));
+	sph_enc32le_aligned(buf + (sizeof sc->buf) - 4,
+		SPH_T32((sph_u32)((sc->bit_count + n) >> 32)));
 #else
 	sph_enc32le_aligned(buf + (sizeof sc->buf) - 8,
 		sc->bit_count_low + n);
@@ -35,6 +35,8 @@
 #include <limits.h>
 
 #include "sph_echo.h"
+#include "sph_aes_ni.h"
+#include "../algorithm/simd.h"
 
 #if SPH_SMALL_FOOTPRINT && !defined SPH_SMALL_FOOTPRINT_ECHO
 #define SPH_SMALL_FOOTPRINT_ECHO   1
@@ -707,11 +709,256 @@ echo_big_init(sph_echo_big_context *sc, unsigned out_len)
 	sc->C0 = sc->C1 = sc->C2 = sc->C3 = 0;
 }
 
+#ifdef USE_SIMD_X86
+
+/*
+ * AES-NI and VAES compression functions. Each ECHO word is an AES state in
+ * the byte order used above, so BIG_SUB_WORDS is two aesenc per word (the
+ * first keyed with the counter, the second with zero), BIG_SHIFT_ROWS is a
+ * renaming of the words and MIX_COLUMN runs on whole words.
+ *
+ * The counter is stepped with a 64-bit vector add, which is exact unless
+ * its low 64 bits wrap inside the compression; echo_aes_impl() leaves that
+ * block (2^64 bits into a message) to the T-table code.
+ */
+
+#define ECHO_XTIME_SSE2(x)   _mm_xor_si128(_mm_add_epi8(x, x), \
+	_mm_and_si128(_mm_cmpgt_epi8(_mm_setzero_si128(), x), \
+	_mm_set1_epi8(0x1B)))
+
+#define ECHO_XTIME_AVX2(x)   _mm256_xor_si256(_mm256_add_epi8(x, x), \
+	_mm256_and_si256(_mm256_cmpgt_epi8(_mm256_setzero_si256(), x), \
+	_mm256_set1_epi8(0x1B)))
+
+#define ECHO_MIX_COLUMN(T, XOR, XTIME, W, ia, ib, ic, id)   do { \
+		T a = W[ia]; \
+		T b = W[ib]; \
+		T c = W[ic]; \
+		T d = W[id]; \
+		T ab = XOR(a, b); \
+		T bc = XOR(b, c); \
+		T cd = XOR(c, d); \
+		T abx = XTIME(ab); \
+		T bcx = XTIME(bc); \
+		T cdx = XTIME(cd); \
+		W[ia] = XOR(XOR(abx, bc), d); \
+		W[ib] = XOR(XOR(bcx, a), cd); \
+		W[ic] = XOR(XOR(cdx, ab), d); \
+		W[id] = XOR(XOR(XOR(abx, bcx), XOR(cdx, ab)), c); \
+	} while (0)
+
+static int
+echo_aes_impl(sph_u32 C0, sph_u32 C1, unsigned words)
+{
+	if (C1 == SPH_C32(0xFFFFFFFF) && C0 > SPH_C32(0xFFFFFFFF) - words)
+		return SPH_AES_TABLES;
+	return sph_aes_ni_get();
+}
+
+SIMD_TARGET("aes")
+static void
+echo_rounds_aesni(__m128i W[16], __m128i K, unsigned rounds)
+{
+	const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+	__m128i t;
+	unsigned r, n;
+
+	for (r = 0; r < rounds; r ++) {
+		for (n = 0; n < 16; n ++) {
+			W[n] = _mm_aesenc_si128(_mm_aesenc_si128(W[n], K),
+				_mm_setzero_si128());
+			K = _mm_add_epi64(K, one);
+		}
+		t = W[1];
+		W[1] = W[5];
+		W[5] = W[9];
+		W[9] = W[13];
+		W[13] = t;
+		t = W[2];
+		W[2] = W[10];
+		W[10] = t;
+		t = W[6];
+		W[6] = W[14];
+		W[14] = t;
+		t = W[15];
+		W[15] = W[11];
+		W[11] = W[7];
+		W[7] = W[3];
+		W[3] = t;
+		ECHO_MIX_COLUMN(__m128i, _mm_xor_si128, ECHO_XTIME_SSE2,
+			W, 0, 1, 2, 3);
+		ECHO_MIX_COLUMN(__m128i, _mm_xor_si128, ECHO_XTIME_SSE2,
+			W, 4, 5, 6, 7);
+		ECHO_MIX_COLUMN(__m128i, _mm_xor_si128, ECHO_XTIME_SSE2,
+			W, 8, 9, 10, 11);
+		ECHO_MIX_COLUMN(__m128i, _mm_xor_si128, ECHO_XTIME_SSE2,
+			W, 12, 13, 14, 15);
+	}
+}
+
+SIMD_TARGET("aes")
+static void
+echo_small_compress_aesni(sph_echo_small_context *sc)
+{
+	__m128i W[16];
+	__m128i *V = (__m128i *)sc->u.Vs;
+	const __m128i *M = (const __m128i *)sc->buf;
+	unsigned u;
+
+	for (u = 0; u < 4; u ++)
+		W[u] = _mm_loadu_si128(V + u);
+	for (u = 0; u < 12; u ++)
+		W[u + 4] = _mm_loadu_si128(M + u);
+	echo_rounds_aesni(W, _mm_set_epi32(sc->C3, sc->C2, sc->C1, sc->C0), 8);
+	for (u = 0; u < 4; u ++) {
+		__m128i x = _mm_xor_si128(_mm_loadu_si128(M + u),
+			_mm_loadu_si128(M + u + 4));
+
+		x = _mm_xor_si128(x, _mm_loadu_si128(M + u + 8));
+		x = _mm_xor_si128(x, _mm_xor_si128(W[u], W[u + 4]));
+		x = _mm_xor_si128(x, _mm_xor_si128(W[u + 8], W[u + 12]));
+		_mm_storeu_si128(V + u, _mm_xor_si128(_mm_loadu_si128(V + u), x));
+	}
+}
+
+SIMD_TARGET("aes")
+static void
+echo_big_compress_aesni(sph_echo_big_context *sc)
+{
+	__m128i W[16];
+	__m128i *V = (__m128i *)sc->u.Vs;
+	const __m128i *M = (const __m128i *)sc->buf;
+	unsigned u;
+
+	for (u = 0; u < 8; u ++) {
+		W[u] = _mm_loadu_si128(V + u);
+		W[u + 8] = _mm_loadu_si128(M + u);
+	}
+	echo_rounds_aesni(W, _mm_set_epi32(sc->C3, sc->C2, sc->C1, sc->C0), 10);
+	for (u = 0; u < 8; u ++) {
+		__m128i x = _mm_xor_si128(_mm_loadu_si128(M + u),
+			_mm_xor_si128(W[u], W[u + 8]));
+
+		_mm_storeu_si128(V + u, _mm_xor_si128(_mm_loadu_si128(V + u), x));
+	}
+}
+
+#ifdef USE_SIMD_VAES
+
+/*
+ * VAES: Y[n] holds words n and n + 8, i.e. columns c and c + 2 of the
+ * same row, so the two halves take counter values 8 apart and the row
+ * shifts become whole-register moves and half swaps.
+ */
+
+#define ECHO_SWAP_AVX2(x)   _mm256_permute4x64_epi64(x, 0x4E)
+
+#define ECHO_PAIR_AVX2(lo, hi) \
+	_mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1)
+
+SIMD_TARGET("vaes,avx2")
+static void
+echo_rounds_vaes(__m256i Y[8], __m128i K, unsigned rounds)
+{
+	const __m256i one = _mm256_set_epi32(0, 0, 0, 1, 0, 0, 0, 1);
+	const __m256i eight = _mm256_set_epi32(0, 0, 0, 8, 0, 0, 0, 8);
+	__m256i KK, t;
+	unsigned r, n;
+
+	KK = ECHO_PAIR_AVX2(K, _mm_add_epi64(K, _mm_set_epi32(0, 0, 0, 8)));
+	for (r = 0; r < rounds; r ++) {
+		for (n = 0; n < 8; n ++) {
+			Y[n] = _mm256_aesenc_epi128(_mm256_aesenc_epi128(Y[n], KK),
+				_mm256_setzero_si256());
+			KK = _mm256_add_epi64(KK, one);
+		}
+		KK = _mm256_add_epi64(KK, eight);
+		t = Y[1];
+		Y[1] = Y[5];
+		Y[5] = ECHO_SWAP_AVX2(t);
+		Y[2] = ECHO_SWAP_AVX2(Y[2]);
+		Y[6] = ECHO_SWAP_AVX2(Y[6]);
+		t = Y[3];
+		Y[3] = ECHO_SWAP_AVX2(Y[7]);
+		Y[7] = t;
+		ECHO_MIX_COLUMN(__m256i, _mm256_xor_si256, ECHO_XTIME_AVX2,
+			Y, 0, 1, 2, 3);
+		ECHO_MIX_COLUMN(__m256i, _mm256_xor_si256, ECHO_XTIME_AVX2,
+			Y, 4, 5, 6, 7);
+	}
+}
+
+SIMD_TARGET("vaes,avx2")
+static void
+echo_small_compress_vaes(sph_echo_small_context *sc)
+{
+	__m256i Y[8];
+	__m128i *V = (__m128i *)sc->u.Vs;
+	const __m128i *M = (const __m128i *)sc->buf;
+	unsigned u;
+
+	for (u = 0; u < 4; u ++) {
+		Y[u] = ECHO_PAIR_AVX2(_mm_loadu_si128(V + u),
+			_mm_loadu_si128(M + u + 4));
+		Y[u + 4] = ECHO_PAIR_AVX2(_mm_loadu_si128(M + u),
+			_mm_loadu_si128(M + u + 8));
+	}
+	echo_rounds_vaes(Y, _mm_set_epi32(sc->C3, sc->C2, sc->C1, sc->C0), 8);
+	for (u = 0; u < 4; u ++) {
+		__m256i y = _mm256_xor_si256(Y[u], Y[u + 4]);
+		__m128i x = _mm_xor_si128(_mm256_castsi256_si128(y),
+			_mm256_extracti128_si256(y, 1));
+
+		x = _mm_xor_si128(x, _mm_xor_si128(_mm_loadu_si128(M + u),
+			_mm_loadu_si128(M + u + 4)));
+		x = _mm_xor_si128(x, _mm_loadu_si128(M + u + 8));
+		_mm_storeu_si128(V + u, _mm_xor_si128(_mm_loadu_si128(V + u), x));
+	}
+}
+
+SIMD_TARGET("vaes,avx2")
+static void
+echo_big_compress_vaes(sph_echo_big_context *sc)
+{
+	__m256i Y[8];
+	__m128i *V = (__m128i *)sc->u.Vs;
+	const __m128i *M = (const __m128i *)sc->buf;
+	unsigned u;
+
+	for (u = 0; u < 8; u ++)
+		Y[u] = ECHO_PAIR_AVX2(_mm_loadu_si128(V + u),
+			_mm_loadu_si128(M + u));
+	echo_rounds_vaes(Y, _mm_set_epi32(sc->C3, sc->C2, sc->C1, sc->C0), 10);
+	for (u = 0; u < 8; u ++) {
+		__m128i x = _mm_xor_si128(_mm256_castsi256_si128(Y[u]),
+			_mm256_extracti128_si256(Y[u], 1));
+
+		x = _mm_xor_si128(x, _mm_loadu_si128(M + u));
+		_mm_storeu_si128(V + u, _mm_xor_si128(_mm_loadu_si128(V + u), x));
+	}
+}
+
+#endif
+
+#endif
+
 static void
 echo_small_compress(sph_echo_small_context *sc)
 {
 	DECL_STATE_SMALL
 
+#ifdef USE_SIMD_X86
+	switch (echo_aes_impl(sc->C0, sc->C1, 8 * 16)) {
+#ifdef USE_SIMD_VAES
+	case SPH_AES_VAES:
+		echo_small_compress_vaes(sc);
+		return;
+#endif
+	case SPH_AES_NI:
+		echo_small_compress_aesni(sc);
+		return;
+	}
+#endif
 	COMPRESS_SMALL(sc);
 }
 
@@ -720,6 +967,18 @@ echo_big_compress(sph_echo_big_context *sc)
 {
 	DECL_STATE_BIG
 
+#ifdef USE_SIMD_X86
+	switch (echo_aes_impl(sc->C0, sc->C1, 10 * 16)) {
+#ifdef USE_SIMD_VAES
+	case SPH_AES_VAES:
+		echo_big_compress_vaes(sc);
+		return;
+#endif
+	case SPH_AES_NI:
+		echo_big_compress_aesni(sc);
+		return;
+	}
+#endif
 	COMPRESS_BIG(sc);
 }
 
@@ -34,6 +34,8 @@
 #include <string.h>
 
 #include "sph_groestl.h"
+#include "sph_aes_ni.h"
+#include "../algorithm/simd.h"
 
 #if SPH_SMALL_FOOTPRINT && !defined SPH_SMALL_FOOTPRINT_GROESTL
 #define SPH_SMALL_FOOTPRINT_GROESTL   1
@@ -2730,6 +2732,442 @@ static const sph_u32 T3dn[] = {
 
 #endif
 
+#if defined USE_SIMD_X86 && SPH_GROESTL_64 && USE_LE
+#define SPH_GROESTL_AES   1
+
+/*
+ * AES-NI and VAES compression functions. They work on the state transposed
+ * to one row per register (bytes in column order), so MixBytes is plain
+ * vector arithmetic on whole rows and AddRoundConstant touches only row 0
+ * (P) or all rows (Q). SubBytes and ShiftBytes are one pshufb followed by
+ * aesenclast with a zero key: the pshufb applies ShiftBytes and undoes the
+ * AES ShiftRows that aesenclast performs before its S-box.
+ *
+ * Groestl-224/256 keeps row i of P in the low and row i of Q in the high
+ * half of one register, so both permutations run together. Groestl-384/512
+ * runs P and Q one after the other with AES-NI, or side by side in the two
+ * halves of a 256-bit register with VAES.
+ */
+
+/* pshufb masks, row i: ShiftBytes by the row's shift, then AES InvShiftRows */
+static const unsigned char groestl_shift_small[8][16] = {
+	{  0, 14, 11,  7,  4,  1, 15, 12,  9,  5,  2,  8, 13, 10,  6,  3 },
+	{  1,  8, 13,  0,  5,  2,  9, 14, 11,  6,  3, 10, 15, 12,  7,  4 },
+	{  2, 10, 15,  1,  6,  3, 11,  8, 13,  7,  4, 12,  9, 14,  0,  5 },
+	{  3, 12,  9,  2,  7,  4, 13, 10, 15,  0,  5, 14, 11,  8,  1,  6 },
+	{  4, 13, 10,  3,  0,  5, 14, 11,  8,  1,  6, 15, 12,  9,  2,  7 },
+	{  5, 15, 12,  4,  1,  6,  8, 13, 10,  2,  7,  9, 14, 11,  3,  0 },
+	{  6,  9, 14,  5,  2,  7, 10, 15, 12,  3,  0, 11,  8, 13,  4,  1 },
+	{  7, 11,  8,  6,  3,  0, 12,  9, 14,  4,  1, 13, 10, 15,  5,  2 },
+};
+
+static const unsigned char groestl_shift_big_p[8][16] = {
+	{  0, 13, 10,  7,  4,  1, 14, 11,  8,  5,  2, 15, 12,  9,  6,  3 },
+	{  1, 14, 11,  8,  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4 },
+	{  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4,  1, 14, 11,  8,  5 },
+	{  3,  0, 13, 10,  7,  4,  1, 14, 11,  8,  5,  2, 15, 12,  9,  6 },
+	{  4,  1, 14, 11,  8,  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7 },
+	{  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4,  1, 14, 11,  8 },
+	{  6,  3,  0, 13, 10,  7,  4,  1, 14, 11,  8,  5,  2, 15, 12,  9 },
+	{ 11,  8,  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4,  1, 14 },
+};
+
+static const unsigned char groestl_shift_big_q[8][16] = {
+	{  1, 14, 11,  8,  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4 },
+	{  3,  0, 13, 10,  7,  4,  1, 14, 11,  8,  5,  2, 15, 12,  9,  6 },
+	{  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4,  1, 14, 11,  8 },
+	{ 11,  8,  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4,  1, 14 },
+	{  0, 13, 10,  7,  4,  1, 14, 11,  8,  5,  2, 15, 12,  9,  6,  3 },
+	{  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4,  1, 14, 11,  8,  5 },
+	{  4,  1, 14, 11,  8,  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7 },
+	{  6,  3,  0, 13, 10,  7,  4,  1, 14, 11,  8,  5,  2, 15, 12,  9 },
+};
+
+#define GROESTL_XTIME_SSE2(x)   _mm_xor_si128(_mm_add_epi8(x, x), \
+	_mm_and_si128(_mm_cmpgt_epi8(_mm_setzero_si128(), x), \
+	_mm_set1_epi8(0x1B)))
+
+#define GROESTL_XTIME_AVX2(x)   _mm256_xor_si256(_mm256_add_epi8(x, x), \
+	_mm256_and_si256(_mm256_cmpgt_epi8(_mm256_setzero_si256(), x), \
+	_mm256_set1_epi8(0x1B)))
+
+/*
+ * MixBytes with x[i] = a[i] + a[i+1], y[i] = x[i] + x[i+3] and
+ * z[i] = x[i] + x[i+2] + a[i+6]: row i becomes
+ * 2 * (2 * y[i+3] + z[i+7]) + z[i+4], which needs two doublings per row.
+ */
+#define GROESTL_MIX_BYTES(T, XOR, XTIME, a)   do { \
+		T x[8], y[8], z[8]; \
+		x[0] = XOR(a[0], a[1]); \
+		x[1] = XOR(a[1], a[2]); \
+		x[2] = XOR(a[2], a[3]); \
+		x[3] = XOR(a[3], a[4]); \
+		x[4] = XOR(a[4], a[5]); \
+		x[5] = XOR(a[5], a[6]); \
+		x[6] = XOR(a[6], a[7]); \
+		x[7] = XOR(a[7], a[0]); \
+		y[0] = XOR(x[0], x[3]); \
+		y[1] = XOR(x[1], x[4]); \
+		y[2] = XOR(x[2], x[5]); \
+		y[3] = XOR(x[3], x[6]); \
+		y[4] = XOR(x[4], x[7]); \
+		y[5] = XOR(x[5], x[0]); \
+		y[6] = XOR(x[6], x[1]); \
+		y[7] = XOR(x[7], x[2]); \
+		z[0] = XOR(XOR(x[0], x[2]), a[6]); \
+		z[1] = XOR(XOR(x[1], x[3]), a[7]); \
+		z[2] = XOR(XOR(x[2], x[4]), a[0]); \
+		z[3] = XOR(XOR(x[3], x[5]), a[1]); \
+		z[4] = XOR(XOR(x[4], x[6]), a[2]); \
+		z[5] = XOR(XOR(x[5], x[7]), a[3]); \
+		z[6] = XOR(XOR(x[6], x[0]), a[4]); \
+		z[7] = XOR(XOR(x[7], x[1]), a[5]); \
+		a[0] = XOR(XTIME(XOR(XTIME(y[3]), z[7])), z[4]); \
+		a[1] = XOR(XTIME(XOR(XTIME(y[4]), z[0])), z[5]); \
+		a[2] = XOR(XTIME(XOR(XTIME(y[5]), z[1])), z[6]); \
+		a[3] = XOR(XTIME(XOR(XTIME(y[6]), z[2])), z[7]); \
+		a[4] = XOR(XTIME(XOR(XTIME(y[7]), z[3])), z[0]); \
+		a[5] = XOR(XTIME(XOR(XTIME(y[0]), z[4])), z[1]); \
+		a[6] = XOR(XTIME(XOR(XTIME(y[1]), z[5])), z[2]); \
+		a[7] = XOR(XTIME(XOR(XTIME(y[2]), z[6])), z[3]); \
+	} while (0)
+
+/* SubBytes and ShiftBytes of all rows, m[j] being the pshufb mask of row j */
+#define GROESTL_SUB_SHIFT(SUB_SHIFT, a, m)   do { \
+		a[0] = SUB_SHIFT(a[0], m[0]); \
+		a[1] = SUB_SHIFT(a[1], m[1]); \
+		a[2] = SUB_SHIFT(a[2], m[2]); \
+		a[3] = SUB_SHIFT(a[3], m[3]); \
+		a[4] = SUB_SHIFT(a[4], m[4]); \
+		a[5] = SUB_SHIFT(a[5], m[5]); \
+		a[6] = SUB_SHIFT(a[6], m[6]); \
+		a[7] = SUB_SHIFT(a[7], m[7]); \
+	} while (0)
+
+#define GROESTL_SUB_SHIFT_SSE2(x, m) \
+	_mm_aesenclast_si128(_mm_shuffle_epi8(x, m), _mm_setzero_si128())
+
+#define GROESTL_SUB_SHIFT_AVX2(x, m) \
+	_mm256_aesenclast_epi128(_mm256_shuffle_epi8(x, m), _mm256_setzero_si256())
+
+/*
+ * Columns to rows: x[k] holds columns 2k and 2k+1 (8 bytes each) and
+ * becomes row k, 16 bytes in column order. Interleaving the two columns
+ * of each register makes this an 8x8 transpose of 16-bit elements, which
+ * is its own inverse. These are macros so that the VAES code gets them
+ * VEX encoded.
+ */
+#define GROESTL_TRANSPOSE_8X8_16(x)   do { \
+		__m128i t_[8], u_[8]; \
+		int k_; \
+		for (k_ = 0; k_ < 4; k_ ++) { \
+			t_[k_] = _mm_unpacklo_epi16(x[2 * k_], x[2 * k_ + 1]); \
+			t_[k_ + 4] = _mm_unpackhi_epi16(x[2 * k_], x[2 * k_ + 1]); \
+		} \
+		for (k_ = 0; k_ < 8; k_ += 4) { \
+			u_[k_] = _mm_unpacklo_epi32(t_[k_], t_[k_ + 1]); \
+			u_[k_ + 1] = _mm_unpackhi_epi32(t_[k_], t_[k_ + 1]); \
+			u_[k_ + 2] = _mm_unpacklo_epi32(t_[k_ + 2], t_[k_ + 3]); \
+			u_[k_ + 3] = _mm_unpackhi_epi32(t_[k_ + 2], t_[k_ + 3]); \
+		} \
+		for (k_ = 0; k_ < 8; k_ += 4) { \
+			x[k_] = _mm_unpacklo_epi64(u_[k_], u_[k_ + 2]); \
+			x[k_ + 1] = _mm_unpackhi_epi64(u_[k_], u_[k_ + 2]); \
+			x[k_ + 2] = _mm_unpacklo_epi64(u_[k_ + 1], u_[k_ + 3]); \
+			x[k_ + 3] = _mm_unpackhi_epi64(u_[k_ + 1], u_[k_ + 3]); \
+		} \
+	} while (0)
+
+#define GROESTL_TO_ROWS(x)   do { \
+		const __m128i m_ = _mm_set_epi8(15, 7, 14, 6, 13, 5, 12, 4, \
+			11, 3, 10, 2, 9, 1, 8, 0); \
+		int j_; \
+		for (j_ = 0; j_ < 8; j_ ++) \
+			x[j_] = _mm_shuffle_epi8(x[j_], m_); \
+		GROESTL_TRANSPOSE_8X8_16(x); \
+	} while (0)
+
+#define GROESTL_TO_COLUMNS(x)   do { \
+		const __m128i m_ = _mm_set_epi8(15, 13, 11, 9, 7, 5, 3, 1, \
+			14, 12, 10, 8, 6, 4, 2, 0); \
+		int j_; \
+		GROESTL_TRANSPOSE_8X8_16(x); \
+		for (j_ = 0; j_ < 8; j_ ++) \
+			x[j_] = _mm_shuffle_epi8(x[j_], m_); \
+	} while (0)
+
+#define GROESTL_LOAD_MASKS_SSE2(m, shift)   do { \
+		int j; \
+		for (j = 0; j < 8; j ++) \
+			m[j] = _mm_loadu_si128((const __m128i *)shift[j]); \
+	} while (0)
+
+/* P in the low and Q in the high half of each row */
+SIMD_TARGET("aes,ssse3")
+static void
+groestl_perm_small_aesni(__m128i a[8])
+{
+	const __m128i qc = _mm_set_epi32(-1, -1, 0, 0);
+	const __m128i rc0 = _mm_set_epi32(-1, -1, 0x70605040, 0x30201000);
+	const __m128i rc7 = _mm_set_epi32(0x8F9FAFBF, 0xCFDFEFFF, 0, 0);
+	__m128i m[8];
+	int r;
+
+	GROESTL_LOAD_MASKS_SSE2(m, groestl_shift_small);
+	for (r = 0; r < 10; r ++) {
+		__m128i rr = _mm_set1_epi32(r * 0x01010101);
+
+		a[0] = _mm_xor_si128(a[0],
+			_mm_xor_si128(rc0, _mm_andnot_si128(qc, rr)));
+		a[1] = _mm_xor_si128(a[1], qc);
+		a[2] = _mm_xor_si128(a[2], qc);
+		a[3] = _mm_xor_si128(a[3], qc);
+		a[4] = _mm_xor_si128(a[4], qc);
+		a[5] = _mm_xor_si128(a[5], qc);
+		a[6] = _mm_xor_si128(a[6], qc);
+		a[7] = _mm_xor_si128(a[7],
+			_mm_xor_si128(rc7, _mm_and_si128(qc, rr)));
+		GROESTL_SUB_SHIFT(GROESTL_SUB_SHIFT_SSE2, a, m);
+		GROESTL_MIX_BYTES(__m128i, _mm_xor_si128, GROESTL_XTIME_SSE2, a);
+	}
+}
+
+SIMD_TARGET("aes,ssse3")
+static void
+groestl_perm_big_p_aesni(__m128i a[8])
+{
+	const __m128i rc0 = _mm_set_epi32(0xF0E0D0C0, 0xB0A09080,
+		0x70605040, 0x30201000);
+	__m128i m[8];
+	int r;
+
+	GROESTL_LOAD_MASKS_SSE2(m, groestl_shift_big_p);
+	for (r = 0; r < 14; r ++) {
+		a[0] = _mm_xor_si128(a[0],
+			_mm_xor_si128(rc0, _mm_set1_epi32(r * 0x01010101)));
+		GROESTL_SUB_SHIFT(GROESTL_SUB_SHIFT_SSE2, a, m);
+		GROESTL_MIX_BYTES(__m128i, _mm_xor_si128, GROESTL_XTIME_SSE2, a);
+	}
+}
+
+SIMD_TARGET("aes,ssse3")
+static void
+groestl_perm_big_q_aesni(__m128i a[8])
+{
+	const __m128i ones = _mm_set1_epi32(-1);
+	const __m128i rc7 = _mm_set_epi32(0x0F1F2F3F, 0x4F5F6F7F,
+		0x8F9FAFBF, 0xCFDFEFFF);
+	__m128i m[8];
+	int r;
+
+	GROESTL_LOAD_MASKS_SSE2(m, groestl_shift_big_q);
+	for (r = 0; r < 14; r ++) {
+		a[0] = _mm_xor_si128(a[0], ones);
+		a[1] = _mm_xor_si128(a[1], ones);
+		a[2] = _mm_xor_si128(a[2], ones);
+		a[3] = _mm_xor_si128(a[3], ones);
+		a[4] = _mm_xor_si128(a[4], ones);
+		a[5] = _mm_xor_si128(a[5], ones);
+		a[6] = _mm_xor_si128(a[6], ones);
+		a[7] = _mm_xor_si128(a[7],
+			_mm_xor_si128(rc7, _mm_set1_epi32(r * 0x01010101)));
+		GROESTL_SUB_SHIFT(GROESTL_SUB_SHIFT_SSE2, a, m);
+		GROESTL_MIX_BYTES(__m128i, _mm_xor_si128, GROESTL_XTIME_SSE2, a);
+	}
+}
+
+SIMD_TARGET("aes,ssse3")
+static void
+groestl_small_compress_aesni(sph_u64 *H, const unsigned char *buf)
+{
+	__m128i x[8], h[4];
+	int k;
+
+	for (k = 0; k < 4; k ++) {
+		h[k] = _mm_loadu_si128((const __m128i *)H + k);
+		x[k + 4] = _mm_loadu_si128((const __m128i *)buf + k);
+		x[k] = _mm_xor_si128(h[k], x[k + 4]);
+	}
+	GROESTL_TO_ROWS(x);
+	groestl_perm_small_aesni(x);
+	GROESTL_TO_COLUMNS(x);
+	for (k = 0; k < 4; k ++)
+		_mm_storeu_si128((__m128i *)H + k, _mm_xor_si128(h[k],
+			_mm_xor_si128(x[k], x[k + 4])));
+}
+
+SIMD_TARGET("aes,ssse3")
+static void
+groestl_small_final_aesni(sph_u64 *H)
+{
+	__m128i x[8], h[4];
+	int k;
+
+	for (k = 0; k < 4; k ++)
+		x[k] = x[k + 4] = h[k] = _mm_loadu_si128((const __m128i *)H + k);
+	GROESTL_TO_ROWS(x);
+	groestl_perm_small_aesni(x);
+	GROESTL_TO_COLUMNS(x);
+	for (k = 0; k < 4; k ++)
+		_mm_storeu_si128((__m128i *)H + k, _mm_xor_si128(h[k], x[k]));
+}
+
+SIMD_TARGET("aes,ssse3")
+static void
+groestl_big_compress_aesni(sph_u64 *H, const unsigned char *buf)
+{
+	__m128i p[8], q[8], h[8];
+	int k;
+
+	for (k = 0; k < 8; k ++) {
+		h[k] = _mm_loadu_si128((const __m128i *)H + k);
+		q[k] = _mm_loadu_si128((const __m128i *)buf + k);
+		p[k] = _mm_xor_si128(h[k], q[k]);
+	}
+	GROESTL_TO_ROWS(p);
+	GROESTL_TO_ROWS(q);
+	groestl_perm_big_p_aesni(p);
+	groestl_perm_big_q_aesni(q);
+	for (k = 0; k < 8; k ++)
+		p[k] = _mm_xor_si128(p[k], q[k]);
+	GROESTL_TO_COLUMNS(p);
+	for (k = 0; k < 8; k ++)
+		_mm_storeu_si128((__m128i *)H + k, _mm_xor_si128(h[k], p[k]));
+}
+
+SIMD_TARGET("aes,ssse3")
+static void
+groestl_big_final_aesni(sph_u64 *H)
+{
+	__m128i p[8], h[8];
+	int k;
+
+	for (k = 0; k < 8; k ++)
+		p[k] = h[k] = _mm_loadu_si128((const __m128i *)H + k);
+	GROESTL_TO_ROWS(p);
+	groestl_perm_big_p_aesni(p);
+	GROESTL_TO_COLUMNS(p);
+	for (k = 0; k < 8; k ++)
+		_mm_storeu_si128((__m128i *)H + k, _mm_xor_si128(h[k], p[k]));
+}
+
+#ifdef USE_SIMD_VAES
+
+/* P in the low and Q in the high 128 bits of each row */
+SIMD_TARGET("aes,vaes,avx2")
+static void
+groestl_perm_big_vaes(__m256i a[8])
+{
+	const __m256i qc = _mm256_set_epi32(-1, -1, -1, -1, 0, 0, 0, 0);
+	const __m256i rc0 = _mm256_set_epi32(-1, -1, -1, -1,
+		0xF0E0D0C0, 0xB0A09080, 0x70605040, 0x30201000);
+	const __m256i rc7 = _mm256_set_epi32(0x0F1F2F3F, 0x4F5F6F7F,
+		0x8F9FAFBF, 0xCFDFEFFF, 0, 0, 0, 0);
+	__m256i m[8];
+	int r;
+
+	for (r = 0; r < 8; r ++) {
+		m[r] = _mm256_inserti128_si256(_mm256_castsi128_si256(
+			_mm_loadu_si128((const __m128i *)groestl_shift_big_p[r])),
+			_mm_loadu_si128((const __m128i *)groestl_shift_big_q[r]), 1);
+	}
+	for (r = 0; r < 14; r ++) {
+		__m256i rr = _mm256_set1_epi32(r * 0x01010101);
+
+		a[0] = _mm256_xor_si256(a[0],
+			_mm256_xor_si256(rc0, _mm256_andnot_si256(qc, rr)));
+		a[1] = _mm256_xor_si256(a[1], qc);
+		a[2] = _mm256_xor_si256(a[2], qc);
+		a[3] = _mm256_xor_si256(a[3], qc);
+		a[4] = _mm256_xor_si256(a[4], qc);
+		a[5] = _mm256_xor_si256(a[5], qc);
+		a[6] = _mm256_xor_si256(a[6], qc);
+		a[7] = _mm256_xor_si256(a[7],
+			_mm256_xor_si256(rc7, _mm256_and_si256(qc, rr)));
+		GROESTL_SUB_SHIFT(GROESTL_SUB_SHIFT_AVX2, a, m);
+		GROESTL_MIX_BYTES(__m256i, _mm256_xor_si256, GROESTL_XTIME_AVX2, a);
+	}
+}
+
+SIMD_TARGET("aes,vaes,avx2")
+static void
+groestl_big_compress_vaes(sph_u64 *H, const unsigned char *buf)
+{
+	__m128i p[8], q[8], h[8];
+	__m256i a[8];
+	int k;
+
+	for (k = 0; k < 8; k ++) {
+		h[k] = _mm_loadu_si128((const __m128i *)H + k);
+		q[k] = _mm_loadu_si128((const __m128i *)buf + k);
+		p[k] = _mm_xor_si128(h[k], q[k]);
+	}
+	GROESTL_TO_ROWS(p);
+	GROESTL_TO_ROWS(q);
+	for (k = 0; k < 8; k ++)
+		a[k] = _mm256_inserti128_si256(_mm256_castsi128_si256(p[k]),
+			q[k], 1);
+	groestl_perm_big_vaes(a);
+	for (k = 0; k < 8; k ++)
+		p[k] = _mm_xor_si128(_mm256_castsi256_si128(a[k]),
+			_mm256_extracti128_si256(a[k], 1));
+	GROESTL_TO_COLUMNS(p);
+	for (k = 0; k < 8; k ++)
+		_mm_storeu_si128((__m128i *)H + k, _mm_xor_si128(h[k], p[k]));
+}
+
+#endif
+
+/*
+ * These return 0 when the T-table code is selected. Groestl-224/256 and
+ * the output transforms use AES-NI also when VAES is selected.
+ */
+static int
+groestl_small_compress_aes(sph_u64 *H, const unsigned char *buf)
+{
+	if (sph_aes_ni_get() == SPH_AES_TABLES)
+		return 0;
+	groestl_small_compress_aesni(H, buf);
+	return 1;
+}
+
+static int
+groestl_small_final_aes(sph_u64 *H)
+{
+	if (sph_aes_ni_get() == SPH_AES_TABLES)
+		return 0;
+	groestl_small_final_aesni(H);
+	return 1;
+}
+
+static int
+groestl_big_compress_aes(sph_u64 *H, const unsigned char *buf)
+{
+	switch (sph_aes_ni_get()) {
+#ifdef USE_SIMD_VAES
+	case SPH_AES_VAES:
+		groestl_big_compress_vaes(H, buf);
+		return 1;
+#endif
+	case SPH_AES_NI:
+		groestl_big_compress_aesni(H, buf);
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static int
+groestl_big_final_aes(sph_u64 *H)
+{
+	if (sph_aes_ni_get() == SPH_AES_TABLES)
+		return 0;
+	groestl_big_final_aesni(H);
+	return 1;
+}
+
+#endif
+
 static void
 groestl_small_init(sph_groestl_small_context *sc, unsigned out_size)
 {
@@ -2791,6 +3229,9 @@ groestl_small_core(sph_groestl_small_context *sc, const void *data, size_t len)
 		data = (const unsigned char *)data + clen;
 		len -= clen;
 		if (ptr == sizeof sc->buf) {
+#if SPH_GROESTL_AES
+			if (!groestl_small_compress_aes(H, buf))
+#endif
 			COMPRESS_SMALL;
 #if SPH_64
 			sc->count ++;
@@ -2852,6 +3293,9 @@ groestl_small_close(sph_groestl_small_context *sc,
 #endif
 	groestl_small_core(sc, pad, pad_len);
 	READ_STATE_SMALL(sc);
+#if SPH_GROESTL_AES
+	if (!groestl_small_final_aes(H))
+#endif
 	FINAL_SMALL;
 #if SPH_GROESTL_64
 	for (u = 0; u < 4; u ++)
@@ -2925,6 +3369,9 @@ groestl_big_core(sph_groestl_big_context *sc, const void *data, size_t len)
 		data = (const unsigned char *)data + clen;
 		len -= clen;
 		if (ptr == sizeof sc->buf) {
+#if SPH_GROESTL_AES
+			if (!groestl_big_compress_aes(H, buf))
+#endif
 			COMPRESS_BIG;
 #if SPH_64
 			sc->count ++;
@@ -2986,6 +3433,9 @@ groestl_big_close(sph_groestl_big_context *sc,
 #endif
 	groestl_big_core(sc, pad, pad_len);
 	READ_STATE_BIG(sc);
+#if SPH_GROESTL_AES
+	if (!groestl_big_final_aes(H))
+#endif
 	FINAL_BIG;
 #if SPH_GROESTL_64
 	for (u = 0; u < 8; u ++)
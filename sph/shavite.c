@@ -34,6 +34,8 @@
 #include <string.h>
 
 #include "sph_shavite.h"
+#include "sph_aes_ni.h"
+#include "../algorithm/simd.h"
 
 #if SPH_SMALL_FOOTPRINT && !defined SPH_SMALL_FOOTPRINT_SHAVITE
 #define SPH_SMALL_FOOTPRINT_SHAVITE   1
@@ -1471,6 +1473,160 @@ c512(sph_shavite_big_context *sc, const void *msg)
 
 #endif
 
+#ifdef USE_SIMD_X86
+
+/*
+ * AES-NI compression functions. The state and round keys are AES states
+ * in the byte order used above, so AES_ROUND_NOKEY followed by a round key
+ * XOR is one aesenc, and the rotation in the key expansion is a pshufd.
+ * The round keys are expanded in full before the rounds, as in the small
+ * footprint code.
+ *
+ * There is no VAES version: every round depends on the previous one, so
+ * the rounds are latency bound and wider registers would not help.
+ */
+
+#define SHAVITE_AES4(x, k0, k1, k2, k3)   _mm_aesenc_si128(_mm_aesenc_si128( \
+	_mm_aesenc_si128(_mm_aesenc_si128(_mm_xor_si128(x, k0), k1), k2), \
+	k3), _mm_setzero_si128())
+
+SIMD_TARGET("aes,ssse3")
+static void
+c256_aesni(sph_shavite_small_context *sc, const void *msg)
+{
+	__m128i rk[36];
+	__m128i *h = (__m128i *)sc->h;
+	__m128i p0, p1, x;
+	const __m128i zero = _mm_setzero_si128();
+	sph_u32 c0 = sc->count0, c1 = sc->count1;
+	int b, r;
+
+	for (b = 0; b < 4; b ++)
+		rk[b] = _mm_loadu_si128((const __m128i *)msg + b);
+	for (b = 4; b < 36; ) {
+		for (r = 0; r < 4; r ++, b ++) {
+			x = _mm_shuffle_epi32(rk[b - 4], 0x39);
+			rk[b] = _mm_aesenc_si128(x, rk[b - 1]);
+			if (b == 4) {
+				rk[b] = _mm_xor_si128(rk[b],
+					_mm_set_epi32(0, 0, ~c1, c0));
+			} else if (b == 14) {
+				rk[b] = _mm_xor_si128(rk[b],
+					_mm_set_epi32(0, ~c0, c1, 0));
+			} else if (b == 21) {
+				rk[b] = _mm_xor_si128(rk[b],
+					_mm_set_epi32(~c0, c1, 0, 0));
+			} else if (b == 31) {
+				rk[b] = _mm_xor_si128(rk[b],
+					_mm_set_epi32(~c1, 0, 0, c0));
+			}
+		}
+		for (r = 0; r < 4; r ++, b ++) {
+			x = _mm_xor_si128(rk[b - 4], _mm_srli_si128(rk[b - 1], 4));
+			rk[b] = _mm_xor_si128(x, _mm_slli_si128(x, 12));
+		}
+	}
+
+	p0 = _mm_loadu_si128(h);
+	p1 = _mm_loadu_si128(h + 1);
+	for (b = 0; b < 36; b += 6) {
+		x = _mm_aesenc_si128(_mm_aesenc_si128(_mm_aesenc_si128(
+			_mm_xor_si128(p1, rk[b]), rk[b + 1]), rk[b + 2]), zero);
+		p0 = _mm_xor_si128(p0, x);
+		x = _mm_aesenc_si128(_mm_aesenc_si128(_mm_aesenc_si128(
+			_mm_xor_si128(p0, rk[b + 3]), rk[b + 4]), rk[b + 5]), zero);
+		p1 = _mm_xor_si128(p1, x);
+	}
+	_mm_storeu_si128(h, _mm_xor_si128(_mm_loadu_si128(h), p0));
+	_mm_storeu_si128(h + 1, _mm_xor_si128(_mm_loadu_si128(h + 1), p1));
+}
+
+SIMD_TARGET("aes,ssse3")
+static void
+c512_aesni(sph_shavite_big_context *sc, const void *msg)
+{
+	__m128i rk[112];
+	__m128i *h = (__m128i *)sc->h;
+	__m128i p0, p1, p2, p3, x;
+	sph_u32 c0 = sc->count0, c1 = sc->count1;
+	sph_u32 c2 = sc->count2, c3 = sc->count3;
+	int b, r;
+
+	for (b = 0; b < 8; b ++)
+		rk[b] = _mm_loadu_si128((const __m128i *)msg + b);
+	for (b = 8; ; ) {
+		for (r = 0; r < 8; r ++, b ++) {
+			x = _mm_shuffle_epi32(rk[b - 8], 0x39);
+			rk[b] = _mm_aesenc_si128(x, rk[b - 1]);
+			if (b == 8) {
+				rk[b] = _mm_xor_si128(rk[b],
+					_mm_set_epi32(~c3, c2, c1, c0));
+			} else if (b == 41) {
+				rk[b] = _mm_xor_si128(rk[b],
+					_mm_set_epi32(~c0, c1, c2, c3));
+			} else if (b == 79) {
+				rk[b] = _mm_xor_si128(rk[b],
+					_mm_set_epi32(~c1, c0, c3, c2));
+			} else if (b == 110) {
+				rk[b] = _mm_xor_si128(rk[b],
+					_mm_set_epi32(~c2, c3, c0, c1));
+			}
+		}
+		if (b == 112)
+			break;
+		for (r = 0; r < 8; r ++, b ++) {
+			rk[b] = _mm_xor_si128(rk[b - 8],
+				_mm_alignr_epi8(rk[b - 1], rk[b - 2], 4));
+		}
+	}
+
+	p0 = _mm_loadu_si128(h);
+	p1 = _mm_loadu_si128(h + 1);
+	p2 = _mm_loadu_si128(h + 2);
+	p3 = _mm_loadu_si128(h + 3);
+	for (b = 0; b < 112; b += 8) {
+		p0 = _mm_xor_si128(p0, SHAVITE_AES4(p1,
+			rk[b], rk[b + 1], rk[b + 2], rk[b + 3]));
+		p2 = _mm_xor_si128(p2, SHAVITE_AES4(p3,
+			rk[b + 4], rk[b + 5], rk[b + 6], rk[b + 7]));
+		x = p3;
+		p3 = p2;
+		p2 = p1;
+		p1 = p0;
+		p0 = x;
+	}
+	_mm_storeu_si128(h, _mm_xor_si128(_mm_loadu_si128(h), p0));
+	_mm_storeu_si128(h + 1, _mm_xor_si128(_mm_loadu_si128(h + 1), p1));
+	_mm_storeu_si128(h + 2, _mm_xor_si128(_mm_loadu_si128(h + 2), p2));
+	_mm_storeu_si128(h + 3, _mm_xor_si128(_mm_loadu_si128(h + 3), p3));
+}
+
+#endif
+
+static void
+shavite_small_compress(sph_shavite_small_context *sc, const void *msg)
+{
+#ifdef USE_SIMD_X86
+	if (sph_aes_ni_get() != SPH_AES_TABLES) {
+		c256_aesni(sc, msg);
+		return;
+	}
+#endif
+	c256(sc, msg);
+}
+
+static void
+shavite_big_compress(sph_shavite_big_context *sc, const void *msg)
+{
+#ifdef USE_SIMD_X86
+	if (sph_aes_ni_get() != SPH_AES_TABLES) {
+		c512_aesni(sc, msg);
+		return;
+	}
+#endif
+	c512(sc, msg);
+}
+
 static void
 shavite_small_init(sph_shavite_small_context *sc, const sph_u32 *iv)
 {
@@ -1501,7 +1657,7 @@ shavite_small_core(sph_shavite_small_context *sc, const void *data, size_t len)
 		if (ptr == sizeof sc->buf) {
 			if ((sc->count0 = SPH_T32(sc->count0 + 512)) == 0)
 				sc->count1 = SPH_T32(sc->count1 + 1);
-			c256(sc, buf);
+			shavite_small_compress(sc, buf);
 			ptr = 0;
 		}
 	}
@@ -1533,7 +1689,7 @@ shavite_small_close(sph_shavite_small_context *sc,
 	} else {
 		buf[ptr ++] = z;
 		memset(buf + ptr, 0, 64 - ptr);
-		c256(sc, buf);
+		shavite_small_compress(sc, buf);
 		memset(buf, 0, 54);
 		sc->count0 = sc->count1 = 0;
 	}
@@ -1541,7 +1697,7 @@ shavite_small_close(sph_shavite_small_context *sc,
 	sph_enc32le(buf + 58, count1);
 	buf[62] = out_size_w32 << 5;
 	buf[63] = out_size_w32 >> 3;
-	c256(sc, buf);
+	shavite_small_compress(sc, buf);
 	for (u = 0; u < out_size_w32; u ++)
 		sph_enc32le((unsigned char *)dst + (u << 2), sc->h[u]);
 }
@@ -1586,7 +1742,7 @@ shavite_big_core(sph_shavite_big_context *sc, const void *data, size_t len)
 					}
 				}
 			}
-			c512(sc, buf);
+			shavite_big_compress(sc, buf);
 			ptr = 0;
 		}
 	}
@@ -1620,7 +1776,7 @@ shavite_big_close(sph_shavite_big_context *sc,
 	} else {
 		buf[ptr ++] = z;
 		memset(buf + ptr, 0, 128 - ptr);
-		c512(sc, buf);
+		shavite_big_compress(sc, buf);
 		memset(buf, 0, 110);
 		sc->count0 = sc->count1 = sc->count2 = sc->count3 = 0;
 	}
@@ -1630,7 +1786,7 @@ shavite_big_close(sph_shavite_big_context *sc,
 	sph_enc32le(buf + 122, count3);
 	buf[126] = out_size_w32 << 5;
 	buf[127] = out_size_w32 >> 3;
-	c512(sc, buf);
+	shavite_big_compress(sc, buf);
 	for (u = 0; u < out_size_w32; u ++)
 		sph_enc32le((unsigned char *)dst + (u << 2), sc->h[u]);
 }
@@ -0,0 +1,79 @@
+/**
+ * Selection of the AES round implementation used by ECHO, SHAvite-3 and
+ * Groestl.
+ *
+ * Next to the portable T-table code, echo.c, shavite.c and groestl.c carry
+ * AES-NI (and, for ECHO and Groestl-384/512, VAES) versions of their
+ * compression functions. The fastest implementation supported by the CPU
+ * is detected with cpuid on first use; sph_aes_ni_set() can force another
+ * one, e.g. to benchmark or cross-check them. All three functions keep
+ * their context layout, so the choice can change between two messages.
+ *
+ * @file     sph_aes_ni.h
+ */
+
+#ifndef SPH_AES_NI_H__
+#define SPH_AES_NI_H__
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/** Pick the fastest implementation the CPU supports. */
+#define SPH_AES_AUTO     -1
+/** Portable T-table code (aes_helper.c). */
+#define SPH_AES_TABLES    0
+/** 128-bit AES-NI instructions. */
+#define SPH_AES_NI        1
+/** 256-bit VAES instructions, AES-NI where they do not fit. */
+#define SPH_AES_VAES      2
+
+/**
+ * Get the implementation currently in use; the first call runs the
+ * cpuid detection.
+ *
+ * @return  one of SPH_AES_TABLES, SPH_AES_NI or SPH_AES_VAES
+ */
+int sph_aes_ni_get(void);
+
+/**
+ * Force an implementation. Asking for one that this CPU (or compiler)
+ * does not support selects the best supported one below it. This is not
+ * synchronized with running hashes and is meant to be called before
+ * worker threads start.
+ *
+ * @param impl   SPH_AES_AUTO or one of the implementation constants
+ * @return  the implementation actually selected
+ */
+int sph_aes_ni_set(int impl);
+
+/**
+ * Test whether an implementation can run here.
+ *
+ * @param impl   one of the implementation constants
+ * @return  non-zero if supported
+ */
+int sph_aes_ni_available(int impl);
+
+/**
+ * Get a short name for an implementation ("tables", "aes-ni", "vaes").
+ *
+ * @param impl   one of the implementation constants
+ * @return  the name
+ */
+const char *sph_aes_ni_name(int impl);
+
+/**
+ * Run the ECHO, SHAvite-3 and Groestl known answer tests with every
+ * supported implementation, and compare each against the T-table code
+ * over a range of message lengths. The previous selection is restored.
+ *
+ * @return  non-zero if all tests pass
+ */
+int sph_aes_ni_selftest(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
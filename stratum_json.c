@@ -0,0 +1,231 @@
+/*
+ * Copyright 2013-2014 sgminer developers (see AUTHORS.md)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 3 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "stratum_json.h"
+
+/* What the tokenizer expects next */
+enum sjson_state {
+  SJ_VALUE,
+  SJ_VALUE_OR_CLOSE,  /* just after [ */
+  SJ_KEY,
+  SJ_KEY_OR_CLOSE,    /* just after { */
+  SJ_COLON,
+  SJ_NEXT             /* , or the end of the container */
+};
+
+static int sjson_add(struct sjson *js, const int *stack, int depth, int type, int start)
+{
+  struct sjson_tok *tok;
+
+  if (js->ntok == SJSON_TOKENS)
+    return -1;
+  tok = &js->tok[js->ntok];
+  tok->type = type;
+  tok->escaped = false;
+  tok->size = 0;
+  tok->end = js->ntok + 1;
+  tok->start = start;
+  tok->len = 0;
+  if (depth)
+    js->tok[stack[depth - 1]].size++;
+  return js->ntok++;
+}
+
+static bool sjson_primitive_char(char c)
+{
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         c == '+' || c == '-' || c == '.';
+}
+
+bool sjson_parse(struct sjson *js, const char *s)
+{
+  int stack[SJSON_DEPTH], depth = 0, state = SJ_VALUE, t;
+  const char *p;
+
+  js->s = s;
+  js->ntok = 0;
+  for (p = s; ; p++) {
+    char c = *p;
+
+    if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+      continue;
+    if (!c)
+      return state == SJ_NEXT && !depth;
+
+    if (state == SJ_COLON) {
+      if (c != ':')
+        return false;
+      state = SJ_VALUE;
+      continue;
+    }
+
+    if (c == '}' || c == ']') {
+      if (state != SJ_NEXT && state != SJ_KEY_OR_CLOSE && state != SJ_VALUE_OR_CLOSE)
+        return false;
+      if (!depth)
+        return false;
+      t = stack[--depth];
+      if (js->tok[t].type != (c == '}' ? SJSON_OBJECT : SJSON_ARRAY))
+        return false;
+      js->tok[t].end = js->ntok;
+      js->tok[t].len = p + 1 - s - js->tok[t].start;
+      state = SJ_NEXT;
+      continue;
+    }
+
+    if (state == SJ_NEXT) {
+      /* Nothing may follow the message itself */
+      if (c != ',' || !depth)
+        return false;
+      state = js->tok[stack[depth - 1]].type == SJSON_OBJECT ? SJ_KEY : SJ_VALUE;
+      continue;
+    }
+
+    if (c == '"') {
+      bool key = state == SJ_KEY || state == SJ_KEY_OR_CLOSE;
+
+      t = sjson_add(js, stack, depth, SJSON_STRING, p + 1 - s);
+      if (t < 0)
+        return false;
+      for (p++; *p != '"'; p++) {
+        if ((unsigned char)*p < 0x20)
+          return false;
+        if (*p == '\\') {
+          js->tok[t].escaped = true;
+          if (!*++p)
+            return false;
+        }
+      }
+      js->tok[t].len = p - s - js->tok[t].start;
+      state = key ? SJ_COLON : SJ_NEXT;
+      continue;
+    }
+
+    /* Object keys are strings */
+    if (state == SJ_KEY || state == SJ_KEY_OR_CLOSE)
+      return false;
+
+    if (c == '{' || c == '[') {
+      if (depth == SJSON_DEPTH)
+        return false;
+      t = sjson_add(js, stack, depth, c == '{' ? SJSON_OBJECT : SJSON_ARRAY, p - s);
+      if (t < 0)
+        return false;
+      stack[depth++] = t;
+      state = c == '{' ? SJ_KEY_OR_CLOSE : SJ_VALUE_OR_CLOSE;
+      continue;
+    }
+
+    if (!sjson_primitive_char(c))
+      return false;
+    t = sjson_add(js, stack, depth, SJSON_PRIMITIVE, p - s);
+    if (t < 0)
+      return false;
+    while (sjson_primitive_char(p[1]))
+      p++;
+    js->tok[t].len = p + 1 - s - js->tok[t].start;
+    if (!(c == '-' || (c >= '0' && c <= '9')) && !sjson_literal(js, t, "true") &&
+        !sjson_literal(js, t, "false") && !sjson_literal(js, t, "null"))
+      return false;
+    state = SJ_NEXT;
+  }
+}
+
+int sjson_get(const struct sjson *js, int obj, const char *key)
+{
+  int len = strlen(key), i, t;
+
+  if (obj < 0 || js->tok[obj].type != SJSON_OBJECT)
+    return -1;
+  for (i = 0, t = obj + 1; i + 1 < js->tok[obj].size; i += 2) {
+    const struct sjson_tok *k = &js->tok[t];
+
+    if (!k->escaped && k->len == len && !memcmp(js->s + k->start, key, len))
+      return t + 1;
+    t = js->tok[t + 1].end;
+  }
+  return -1;
+}
+
+int sjson_index(const struct sjson *js, int arr, int i)
+{
+  int t;
+
+  if (arr < 0 || js->tok[arr].type != SJSON_ARRAY || i < 0 || i >= js->tok[arr].size)
+    return -1;
+  for (t = arr + 1; i; i--)
+    t = js->tok[t].end;
+  return t;
+}
+
+bool sjson_string(const struct sjson *js, int t, struct sjson_str *str)
+{
+  if (t < 0 || js->tok[t].type != SJSON_STRING || js->tok[t].escaped)
+    return false;
+  str->s = js->s + js->tok[t].start;
+  str->len = js->tok[t].len;
+  return true;
+}
+
+bool sjson_literal(const struct sjson *js, int t, const char *lit)
+{
+  int len = strlen(lit);
+
+  if (t < 0 || js->tok[t].type != SJSON_PRIMITIVE || js->tok[t].len != len)
+    return false;
+  return !memcmp(js->s + js->tok[t].start, lit, len);
+}
+
+bool sjson_number(const struct sjson *js, int t, double *d)
+{
+  const char *start;
+  char *end;
+
+  if (t < 0 || js->tok[t].type != SJSON_PRIMITIVE)
+    return false;
+  start = js->s + js->tok[t].start;
+  if (*start != '-' && (*start < '0' || *start > '9'))
+    return false;
+  /* A number is always followed by a delimiter strtod() stops at */
+  *d = strtod(start, &end);
+  return end == start + js->tok[t].len;
+}
+
+bool sjson_integer(const struct sjson *js, int t, int *i)
+{
+  const char *start;
+  char *end;
+
+  if (t < 0 || js->tok[t].type != SJSON_PRIMITIVE)
+    return false;
+  start = js->s + js->tok[t].start;
+  if (*start != '-' && (*start < '0' || *start > '9'))
+    return false;
+  *i = (int)strtol(start, &end, 10);
+  return end == start + js->tok[t].len;
+}
+
+bool sjson_accepted(const struct sjson *js, int *id)
+{
+  int err;
+
+  if (!js->ntok || js->tok[0].type != SJSON_OBJECT)
+    return false;
+  if (!sjson_literal(js, sjson_get(js, 0, "result"), "true"))
+    return false;
+  err = sjson_get(js, 0, "error");
+  if (err >= 0 && !sjson_literal(js, err, "null"))
+    return false;
+  return sjson_integer(js, sjson_get(js, 0, "id"), id);
+}
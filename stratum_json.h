@@ -0,0 +1,64 @@
+#ifndef STRATUM_JSON_H
+#define STRATUM_JSON_H
+
+#include <stdbool.h>
+
+/*
+ * Tokenizer for stratum messages.
+ *
+ * sjson_parse() checks a whole line of JSON and records where each value
+ * is, without copying or decoding anything and without allocating.  The
+ * common stratum messages are then read straight off the line; anything
+ * the accessors below cannot represent (escaped strings, deep nesting,
+ * more than SJSON_TOKENS values) makes the caller fall back to jansson.
+ */
+
+#define SJSON_TOKENS 160
+#define SJSON_DEPTH 16
+
+enum sjson_type {
+  SJSON_OBJECT = 1,
+  SJSON_ARRAY,
+  SJSON_STRING,
+  SJSON_PRIMITIVE   /* number, true, false or null */
+};
+
+struct sjson_tok {
+  unsigned char type;
+  bool escaped;          /* string with backslash escapes, left undecoded */
+  unsigned short size;   /* direct children, keys and values for objects */
+  unsigned short end;    /* index of the token after this one and its children */
+  int start, len;        /* string without its quotes, or the primitive */
+};
+
+struct sjson {
+  const char *s;
+  int ntok;
+  struct sjson_tok tok[SJSON_TOKENS];
+};
+
+/* A string value inside the line, not NUL terminated */
+struct sjson_str {
+  const char *s;
+  int len;
+};
+
+/* Tokenizes s, false if it is not valid JSON or too big for struct sjson */
+extern bool sjson_parse(struct sjson *js, const char *s);
+/* Token of the value of key in object obj, -1 if there is none */
+extern int sjson_get(const struct sjson *js, int obj, const char *key);
+/* Token of element i of array arr, -1 if there is none */
+extern int sjson_index(const struct sjson *js, int arr, int i);
+/* Token t as a string, false if it is not one or has escapes */
+extern bool sjson_string(const struct sjson *js, int t, struct sjson_str *str);
+/* Token t is the primitive true, false or null */
+extern bool sjson_literal(const struct sjson *js, int t, const char *lit);
+/* Token t as a number, false if it is not one */
+extern bool sjson_number(const struct sjson *js, int t, double *d);
+/* Token t as an integer, false if it is not one */
+extern bool sjson_integer(const struct sjson *js, int t, int *i);
+/* Response to a request of ours that the pool accepted: an integer id with
+ * a true result and no error */
+extern bool sjson_accepted(const struct sjson *js, int *id);
+
+#endif /* STRATUM_JSON_H */
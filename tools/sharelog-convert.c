@@ -0,0 +1,171 @@
+/*
+ * Copyright 2013-2014 sgminer developers (see AUTHORS.md)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 3 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+/*
+ * Converts share logs written with --sharelog-format binary to the CSV
+ * --sharelog writes by default, or to JSON with one object per line.
+ *
+ *   sharelog-convert [--json] <file>...
+ *
+ * The record format is described in sharelog.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "sharelog.h"
+
+static uint32_t get_le16(const unsigned char *p)
+{
+  return p[0] | (uint32_t)p[1] << 8;
+}
+
+static uint32_t get_le32(const unsigned char *p)
+{
+  return get_le16(p) | get_le16(p + 2) << 16;
+}
+
+static uint64_t get_le64(const unsigned char *p)
+{
+  return get_le32(p) | (uint64_t)get_le32(p + 4) << 32;
+}
+
+static void put_hex(const unsigned char *p, size_t len)
+{
+  static const char hex[] = "0123456789abcdef";
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    putchar(hex[p[i] >> 4]);
+    putchar(hex[p[i] & 0xF]);
+  }
+}
+
+static void put_json_str(const unsigned char *p, size_t len)
+{
+  size_t i;
+
+  putchar('"');
+  for (i = 0; i < len; i++) {
+    if (p[i] == '"' || p[i] == '\\')
+      printf("\\%c", p[i]);
+    else if (p[i] < 0x20)
+      printf("\\u%04x", p[i]);
+    else
+      putchar(p[i]);
+  }
+  putchar('"');
+}
+
+/* One record of size bytes, false if its lengths do not add up */
+static bool convert_record(const unsigned char *rec, size_t size, bool json)
+{
+  const unsigned char *disp, *drv, *url;
+  size_t dlen, nlen, ulen, off = SHARELOG_REC_FIXED;
+
+  if (off + 1 > size)
+    return false;
+  dlen = rec[off];
+  disp = rec + off + 1;
+  off += 1 + dlen;
+  if (off + 1 > size)
+    return false;
+  nlen = rec[off];
+  drv = rec + off + 1;
+  off += 1 + nlen;
+  if (off + 2 > size)
+    return false;
+  ulen = get_le16(rec + off);
+  url = rec + off + 2;
+  if (off + 2 + ulen > size)
+    return false;
+
+  if (json) {
+    printf("{\"time\":%llu,\"disposition\":", (unsigned long long)get_le64(rec + 2));
+    put_json_str(disp, dlen);
+    printf(",\"target\":\"");
+    put_hex(rec + 18, 32);
+    printf("\",\"pool\":");
+    put_json_str(url, ulen);
+    printf(",\"device\":");
+    put_json_str(drv, nlen);
+    printf(",\"device_id\":%u,\"thread\":%u,\"hash\":\"", get_le32(rec + 10), get_le32(rec + 14));
+    put_hex(rec + 50, 32);
+    printf("\",\"data\":\"");
+    put_hex(rec + 82, 192);
+    printf("\"}\n");
+  } else {
+    // timestamp,disposition,target,pool,dev,thr,sharehash,sharedata
+    printf("%llu,%.*s,", (unsigned long long)get_le64(rec + 2), (int)dlen, disp);
+    put_hex(rec + 18, 32);
+    printf(",%.*s,%.*s%u,%u,", (int)ulen, url, (int)nlen, drv, get_le32(rec + 10), get_le32(rec + 14));
+    put_hex(rec + 50, 32);
+    putchar(',');
+    put_hex(rec + 82, 192);
+    putchar('\n');
+  }
+  return true;
+}
+
+static bool convert_file(const char *name, bool json)
+{
+  unsigned char magic[SHARELOG_MAGIC_LEN], rec[65536];
+  size_t size;
+  long records = 0;
+  bool ret = false;
+  FILE *fp;
+
+  fp = fopen(name, "rb");
+  if (!fp) {
+    fprintf(stderr, "%s: cannot open\n", name);
+    return false;
+  }
+  if (fread(magic, sizeof(magic), 1, fp) != 1 || memcmp(magic, SHARELOG_MAGIC, SHARELOG_MAGIC_LEN)) {
+    fprintf(stderr, "%s: not a binary share log\n", name);
+    goto out;
+  }
+
+  while (fread(rec, 2, 1, fp) == 1) {
+    size = get_le16(rec);
+    if (size < SHARELOG_REC_FIXED || fread(rec + 2, size - 2, 1, fp) != 1) {
+      fprintf(stderr, "%s: truncated after %ld record(s)\n", name, records);
+      goto out;
+    }
+    if (!convert_record(rec, size, json)) {
+      fprintf(stderr, "%s: bad record %ld\n", name, records + 1);
+      goto out;
+    }
+    records++;
+  }
+  ret = !ferror(fp);
+out:
+  fclose(fp);
+  return ret;
+}
+
+int main(int argc, char *argv[])
+{
+  bool json = false, ok = true;
+  int i = 1;
+
+  if (i < argc && !strcmp(argv[i], "--json")) {
+    json = true;
+    i++;
+  }
+  if (i == argc) {
+    fprintf(stderr, "Usage: %s [--json] <file>...\n"
+            "Writes binary share logs (--sharelog-format binary) as CSV, or as JSON lines\n", argv[0]);
+    return 1;
+  }
+  for (; i < argc; i++)
+    ok &= convert_file(argv[i], json);
+  return ok ? 0 : 1;
+}
@@ -45,6 +45,7 @@
 #include "compat.h"
 #include "util.h"
 #include "pool.h"
+#include "stratum_json.h"
 
 #define DEFAULT_SOCKWAIT 60
 extern double opt_diff_mult;
@@ -69,7 +70,7 @@ static void keep_sockalive(SOCKETTYPE fd)
 #endif
 
   setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, (const char *)&tcp_one, sizeof(tcp_one));
-  if (!opt_delaynet)
+  if (!opt_delaynet && opt_tcp_nodelay)
 #ifndef __linux
     setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char *)&tcp_one, sizeof(tcp_one));
 #else /* __linux */
@@ -1558,94 +1559,103 @@ static uint32_t getblocheight(uint8_t* coinbase)
 
 static char *blank_merkel = "0000000000000000000000000000000000000000000000000000000000000000";
 
-static bool parse_notify(struct pool *pool, json_t *val)
+/* Fields of a mining.notify, pointing into the message */
+struct stratum_notify {
+  struct sjson_str job_id, prev_hash, coinbase1, coinbase2, bbversion, nbit, ntime;
+  struct sjson_str merkle[STRATUM_MAX_MERKLES];
+  int merkles;
+  bool clean;
+};
+
+/* Like hex2bin() for a string that need not be NUL terminated but has at
+ * least 2 * len digits; the bytes after an invalid digit are zeroed. */
+static bool hex2bin_n(unsigned char *p, const char *hexstr, size_t len)
 {
-  char *job_id, *prev_hash, *coinbase1, *coinbase2, *bbversion, *nbit,
-       *ntime, *header;
-  size_t cb1_len, cb2_len, alloc_len;
-  unsigned char *cb1, *cb2;
-  bool clean, ret = false;
-  int merkles, i;
-  json_t *arr;
+  while (len) {
+    int nibble1 = hex2bin_tbl[(unsigned char)hexstr[0]];
+    int nibble2 = hex2bin_tbl[(unsigned char)hexstr[1]];
 
-  arr = json_array_get(val, 4);
-  if (!arr || !json_is_array(arr))
-    goto out;
+    if (unlikely((nibble1 < 0) || (nibble2 < 0))) {
+      applog(LOG_ERR, "hex2bin scan failed");
+      memset(p, 0, len);
+      return false;
+    }
+    *p++ = (((unsigned char)nibble1) << 4) | ((unsigned char)nibble2);
+    hexstr += 2;
+    --len;
+  }
+  return true;
+}
 
-  merkles = json_array_size(arr);
+/* Returns buf if it holds len bytes, else a bigger one in its place. The
+ * job buffers of a pool only grow, so a new job rarely allocates. */
+static void *stratum_slot(struct pool *pool, void *buf, size_t *size, size_t len)
+{
+  if (likely(len <= *size))
+    return buf;
+  free(buf);
+  *size = (len + 255) & ~(size_t)255;
+  buf = malloc(*size);
+  if (unlikely(!buf))
+    quithere(1, "Failed to malloc stratum job buffer");
+  pool->swork.slot_allocs++;
+  return buf;
+}
 
-  job_id = json_array_string(val, 0);
-  prev_hash = json_array_string(val, 1);
-  coinbase1 = json_array_string(val, 2);
-  coinbase2 = json_array_string(val, 3);
-  bbversion = json_array_string(val, 5);
-  nbit = json_array_string(val, 6);
-  ntime = json_array_string(val, 7);
-  clean = json_is_true(json_array_get(val, 8));
-
-  if (!job_id || !prev_hash || !coinbase1 || !coinbase2 || !bbversion || !nbit || !ntime) {
-    /* Annoying but we must not leak memory */
-    if (job_id)
-      free(job_id);
-    if (prev_hash)
-      free(prev_hash);
-    if (coinbase1)
-      free(coinbase1);
-    if (coinbase2)
-      free(coinbase2);
-    if (bbversion)
-      free(bbversion);
-    if (nbit)
-      free(nbit);
-    if (ntime)
-      free(ntime);
-    goto out;
-  }
+/* Copies str to *text as a C string and moves *text past it */
+static char *stratum_text(char **text, const struct sjson_str *str)
+{
+  char *ret = *text;
+
+  memcpy(ret, str->s, str->len);
+  ret[str->len] = '\0';
+  *text += str->len + 1;
+  return ret;
+}
+
+/* Makes the job in n the current one of pool, decoding it into the job
+ * buffers of the pool */
+static bool stratum_set_job(struct pool *pool, const struct stratum_notify *n)
+{
+  size_t cb1_len = n->coinbase1.len / 2, cb2_len = n->coinbase2.len / 2, alloc_len;
+  char *text, *header;
+  int i;
 
   cg_wlock(&pool->data_lock);
-  free(pool->swork.job_id);
-  free(pool->swork.prev_hash);
-  free(pool->swork.bbversion);
-  free(pool->swork.nbit);
-  free(pool->swork.ntime);
-  pool->swork.job_id = job_id;
-  pool->swork.prev_hash = prev_hash;
-  cb1_len = strlen(coinbase1) / 2;
-  cb2_len = strlen(coinbase2) / 2;
-  pool->swork.bbversion = bbversion;
-  pool->swork.nbit = nbit;
-  pool->swork.ntime = ntime;
-  pool->swork.clean = clean;
+  pool->swork.text = (char *)stratum_slot(pool, pool->swork.text, &pool->swork.text_size,
+      n->job_id.len + n->prev_hash.len + n->bbversion.len + n->nbit.len + n->ntime.len + 5);
+  text = pool->swork.text;
+  pool->swork.job_id = stratum_text(&text, &n->job_id);
+  pool->swork.prev_hash = stratum_text(&text, &n->prev_hash);
+  pool->swork.bbversion = stratum_text(&text, &n->bbversion);
+  pool->swork.nbit = stratum_text(&text, &n->nbit);
+  pool->swork.ntime = stratum_text(&text, &n->ntime);
+  pool->swork.clean = n->clean;
   if (pool->next_diff > 0) {
     pool->swork.diff = pool->next_diff;
   }
   alloc_len = pool->swork.cb_len = cb1_len + pool->n1_len + pool->n2size + cb2_len;
   pool->nonce2_offset = cb1_len + pool->n1_len;
 
-  for (i = 0; i < pool->swork.merkles; i++)
-    free(pool->swork.merkle_bin[i]);
-  if (merkles) {
-    pool->swork.merkle_bin = (unsigned char **)realloc(pool->swork.merkle_bin,
-             sizeof(char *) * merkles + 1);
-    for (i = 0; i < merkles; i++) {
-      char *merkle = json_array_string(arr, i);
-
-      pool->swork.merkle_bin[i] = (unsigned char *)malloc(32);
-      if (unlikely(!pool->swork.merkle_bin[i]))
-        quit(1, "Failed to malloc pool swork merkle_bin");
-      hex2bin(pool->swork.merkle_bin[i], merkle, 32);
-      free(merkle);
-    }
+  pool->swork.merkle_bin = (unsigned char *)stratum_slot(pool, pool->swork.merkle_bin,
+      &pool->swork.merkle_size, n->merkles * 32);
+  for (i = 0; i < n->merkles; i++) {
+    unsigned char *merkle = pool->swork.merkle_bin + i * 32;
+    size_t len = n->merkle[i].len / 2;
+
+    if (len > 32)
+      len = 32;
+    memset(merkle + len, 0, 32 - len);
+    hex2bin_n(merkle, n->merkle[i].s, len);
   }
-  pool->swork.merkles = merkles;
-  if (clean)
+  pool->swork.merkles = n->merkles;
+  if (n->clean)
     pool->nonce2 = 0;
-  pool->merkle_offset = strlen(pool->swork.bbversion) +
-            strlen(pool->swork.prev_hash);
+  pool->merkle_offset = n->bbversion.len + n->prev_hash.len;
   pool->swork.header_len = pool->merkle_offset +
   /* merkle_hash */  32 +
-         strlen(pool->swork.ntime) +
-         strlen(pool->swork.nbit) +
+         n->ntime.len +
+         n->nbit.len +
   /* nonce */    8 +
   /* workpadding */  96;
   pool->merkle_offset /= 2;
@@ -1662,32 +1672,20 @@ static bool parse_notify(struct pool *pool, json_t *val)
     "00000000", /* nonce */
     workpadding);
   if (unlikely(!hex2bin(pool->header_bin, header, 128))) {
+    cg_wunlock(&pool->data_lock);
     applog(LOG_WARNING, "%s: Failed to convert header to header_bin, got %s", __func__, header);
     pool_failed(pool);
-    // TODO: memory leaks? goto out, clean up there?
     return false;
   }
 
-  cb1 = (unsigned char *)calloc(cb1_len, 1);
-  if (unlikely(!cb1))
-    quithere(1, "Failed to calloc cb1 in parse_notify");
-  hex2bin(cb1, coinbase1, cb1_len);
-
-  cb2 = (unsigned char *)calloc(cb2_len, 1);
-  if (unlikely(!cb2))
-    quithere(1, "Failed to calloc cb2 in parse_notify");
-  hex2bin(cb2, coinbase2, cb2_len);
-
-  free(pool->coinbase);
   align_len(&alloc_len);
-  pool->coinbase = (unsigned char *)calloc(alloc_len, 1);
-  if (unlikely(!pool->coinbase))
-    quit(1, "Failed to calloc pool coinbase in parse_notify");
-  memcpy(pool->coinbase, cb1, cb1_len);
+  pool->coinbase = (unsigned char *)stratum_slot(pool, pool->coinbase, &pool->swork.cb_size, alloc_len);
+  hex2bin_n(pool->coinbase, n->coinbase1.s, cb1_len);
   memcpy(pool->coinbase + cb1_len, pool->nonce1bin, pool->n1_len);
   // NOTE: gap for nonce2, filled at work generation time
-  memcpy(pool->coinbase + cb1_len + pool->n1_len + pool->n2size, cb2, cb2_len);
-
+  memset(pool->coinbase + pool->nonce2_offset, 0, pool->n2size);
+  hex2bin_n(pool->coinbase + pool->nonce2_offset + pool->n2size, n->coinbase2.s, cb2_len);
+  memset(pool->coinbase + pool->swork.cb_len, 0, alloc_len - pool->swork.cb_len);
 
   // Grab height & epoc
   pool->HeightNumber = getblocheight(pool->coinbase);
@@ -1699,28 +1697,94 @@ static bool parse_notify(struct pool *pool, json_t *val)
   cg_wunlock(&pool->data_lock);
 
   if (opt_protocol) {
-    applog(LOG_DEBUG, "job_id: %s", job_id);
-    applog(LOG_DEBUG, "prev_hash: %s", prev_hash);
-    applog(LOG_DEBUG, "coinbase1: %s", coinbase1);
-    applog(LOG_DEBUG, "coinbase2: %s", coinbase2);
-    applog(LOG_DEBUG, "bbversion: %s", bbversion);
-    applog(LOG_DEBUG, "nbit: %s", nbit);
-    applog(LOG_DEBUG, "ntime: %s", ntime);
-    applog(LOG_DEBUG, "clean: %s", clean ? "yes" : "no");
-  }
-  free(coinbase1);
-  free(coinbase2);
-  free(cb1);
-  free(cb2);
+    applog(LOG_DEBUG, "job_id: %.*s", n->job_id.len, n->job_id.s);
+    applog(LOG_DEBUG, "prev_hash: %.*s", n->prev_hash.len, n->prev_hash.s);
+    applog(LOG_DEBUG, "coinbase1: %.*s", n->coinbase1.len, n->coinbase1.s);
+    applog(LOG_DEBUG, "coinbase2: %.*s", n->coinbase2.len, n->coinbase2.s);
+    applog(LOG_DEBUG, "bbversion: %.*s", n->bbversion.len, n->bbversion.s);
+    applog(LOG_DEBUG, "nbit: %.*s", n->nbit.len, n->nbit.s);
+    applog(LOG_DEBUG, "ntime: %.*s", n->ntime.len, n->ntime.s);
+    applog(LOG_DEBUG, "clean: %s", n->clean ? "yes" : "no");
+  }
 
   /* A notify message is the closest stratum gets to a getwork */
   pool->getwork_requested++;
   total_getworks++;
-  ret = true;
   if (pool == current_pool())
     opt_work_update = true;
-out:
-  return ret;
+  return true;
+}
+
+static bool json_str(json_t *val, struct sjson_str *str)
+{
+  str->s = json_string_value(val);
+  if (!str->s)
+    return false;
+  str->len = strlen(str->s);
+  return true;
+}
+
+static bool parse_notify(struct pool *pool, json_t *val)
+{
+  struct stratum_notify n;
+  json_t *arr;
+  int i;
+
+  arr = json_array_get(val, 4);
+  if (!arr || !json_is_array(arr))
+    return false;
+
+  n.merkles = json_array_size(arr);
+  if (n.merkles > STRATUM_MAX_MERKLES)
+    return false;
+  for (i = 0; i < n.merkles; i++) {
+    if (!json_str(json_array_get(arr, i), &n.merkle[i]))
+      return false;
+  }
+
+  if (!json_str(json_array_get(val, 0), &n.job_id) ||
+      !json_str(json_array_get(val, 1), &n.prev_hash) ||
+      !json_str(json_array_get(val, 2), &n.coinbase1) ||
+      !json_str(json_array_get(val, 3), &n.coinbase2) ||
+      !json_str(json_array_get(val, 5), &n.bbversion) ||
+      !json_str(json_array_get(val, 6), &n.nbit) ||
+      !json_str(json_array_get(val, 7), &n.ntime))
+    return false;
+  n.clean = json_is_true(json_array_get(val, 8));
+
+  return stratum_set_job(pool, &n);
+}
+
+/* parse_notify() straight off the tokenized message, -1 if it has
+ * anything the tokens cannot represent */
+static int parse_notify_fast(struct pool *pool, const struct sjson *js, int params)
+{
+  struct stratum_notify n;
+  int arr, i;
+
+  arr = sjson_index(js, params, 4);
+  if (arr < 0 || js->tok[arr].type != SJSON_ARRAY)
+    return -1;
+
+  n.merkles = js->tok[arr].size;
+  if (n.merkles > STRATUM_MAX_MERKLES)
+    return -1;
+  for (i = 0; i < n.merkles; i++) {
+    if (!sjson_string(js, sjson_index(js, arr, i), &n.merkle[i]))
+      return -1;
+  }
+
+  if (!sjson_string(js, sjson_index(js, params, 0), &n.job_id) ||
+      !sjson_string(js, sjson_index(js, params, 1), &n.prev_hash) ||
+      !sjson_string(js, sjson_index(js, params, 2), &n.coinbase1) ||
+      !sjson_string(js, sjson_index(js, params, 3), &n.coinbase2) ||
+      !sjson_string(js, sjson_index(js, params, 5), &n.bbversion) ||
+      !sjson_string(js, sjson_index(js, params, 6), &n.nbit) ||
+      !sjson_string(js, sjson_index(js, params, 7), &n.ntime))
+    return -1;
+  n.clean = sjson_literal(js, sjson_index(js, params, 8), "true");
+
+  return stratum_set_job(pool, &n);
 }
 
 
@@ -1755,6 +1819,8 @@ static bool parse_notify_ethash(struct pool *pool, json_t *val)
   bool clean;
   uint8_t EthWork[32], SeedHash[32], Target[32], NetDiff[32] = { 0 };
   char *EthWorkStr, *SeedHashStr, *TgtStr, *BlockHeightStr, *NetDiffStr = NULL;
+  struct sjson_str id;
+  char *text;
   char* target = (char*) Target;
   char* netdiff = (char*) NetDiff;
   int ret = true;
@@ -1789,9 +1855,11 @@ static bool parse_notify_ethash(struct pool *pool, json_t *val)
 
   cg_wlock(&pool->data_lock);
 
-  if (pool->swork.job_id != NULL)
-    free(pool->swork.job_id);
-  pool->swork.job_id = strdup(job_id);
+  id.s = job_id;
+  id.len = strlen(job_id);
+  pool->swork.text = (char *)stratum_slot(pool, pool->swork.text, &pool->swork.text_size, id.len + 1);
+  text = pool->swork.text;
+  pool->swork.job_id = stratum_text(&text, &id);
   pool->swork.clean = clean;
 
   if (memcmp(pool->SeedHash, SeedHash, 32)) {
@@ -1843,14 +1911,14 @@ out:
   return ret;
 }
 
-static bool parse_diff(struct pool *pool, json_t *val)
+static bool stratum_set_diff(struct pool *pool, double value)
 {
   double old_diff, diff;
 
   if (opt_diff_mult == 0.0)
-    diff = json_number_value(json_array_get(val, 0)) * pool->algorithm.diff_multiplier1;
+    diff = value * pool->algorithm.diff_multiplier1;
   else
-    diff = json_number_value(json_array_get(val, 0)) * opt_diff_mult;
+    diff = value * opt_diff_mult;
 
   if (diff == 0)
     return false;
@@ -1882,25 +1950,28 @@ static bool parse_diff(struct pool *pool, json_t *val)
   return true;
 }
 
-static bool parse_extranonce(struct pool *pool, json_t *val)
+static bool parse_diff(struct pool *pool, json_t *val)
+{
+  return stratum_set_diff(pool, json_number_value(json_array_get(val, 0)));
+}
+
+static bool stratum_set_extranonce(struct pool *pool, const struct sjson_str *str, int n2size)
 {
   char *nonce1;
-  int n2size;
 
-  nonce1 = json_array_string(val, 0);
-  if (!nonce1) {
-    return false;
-  }
-  n2size = json_integer_value(json_array_get(val, 1));
   if (!n2size) {
-    free(nonce1);
     return false;
   }
+  nonce1 = (char *)malloc(str->len + 1);
+  if (unlikely(!nonce1))
+    quithere(1, "Failed to malloc nonce1");
+  memcpy(nonce1, str->s, str->len);
+  nonce1[str->len] = '\0';
 
   cg_wlock(&pool->data_lock);
   free(pool->nonce1);
   pool->nonce1 = nonce1;
-  pool->n1_len = strlen(nonce1) / 2;
+  pool->n1_len = str->len / 2;
   free(pool->nonce1bin);
   pool->nonce1bin = (unsigned char *)calloc(pool->n1_len, 1);
   if (unlikely(!pool->nonce1bin))
@@ -1914,6 +1985,16 @@ static bool parse_extranonce(struct pool *pool, json_t *val)
   return true;
 }
 
+static bool parse_extranonce(struct pool *pool, json_t *val)
+{
+  struct sjson_str nonce1;
+
+  if (!json_str(json_array_get(val, 0), &nonce1)) {
+    return false;
+  }
+  return stratum_set_extranonce(pool, &nonce1, json_integer_value(json_array_get(val, 1)));
+}
+
 static void __suspend_stratum(struct pool *pool)
 {
   clear_sockbuf(pool);
@@ -2127,7 +2208,70 @@ static bool show_message(struct pool *pool, json_t *val)
   return true;
 }
 
+static bool method_is(const struct sjson_str *method, const char *name)
+{
+  int len = strlen(name);
+
+  return method->len >= len && !strncasecmp(method->s, name, len);
+}
+
+/* The methods pools send all the time, handled off the tokens without
+ * building a jansson tree. Returns -1 for anything else. */
+static int parse_method_fast(struct pool *pool, const struct sjson *js)
+{
+  struct sjson_str method, nonce1;
+  int m, err, params, ret, n2size;
+  double d;
+
+  if (js->tok[0].type != SJSON_OBJECT)
+    return -1;
+  m = sjson_get(js, 0, "method");
+  if (m < 0)
+    return 0;
+  err = sjson_get(js, 0, "error");
+  if (err >= 0 && !sjson_literal(js, err, "null"))
+    return -1;
+  if (!sjson_string(js, m, &method))
+    return -1;
+  params = sjson_get(js, 0, "params");
+
+  if (method_is(&method, "mining.notify")) {
+    if (pool->algorithm.type == ALGO_ETHASH)
+      return -1;
+    ret = parse_notify_fast(pool, js, params);
+    if (ret < 0)
+      return -1;
+    pool->stratum_notify = ret;
+    if (ret)
+      pool->last_notify = time(NULL);
+    return ret;
+  }
+
+  if (method_is(&method, "mining.set_difficulty")) {
+    if (!sjson_number(js, sjson_index(js, params, 0), &d) || !stratum_set_diff(pool, d))
+      return -1;
+    return 1;
+  }
+
+  if (method_is(&method, "mining.set_extranonce")) {
+    if (!sjson_string(js, sjson_index(js, params, 0), &nonce1) ||
+        !sjson_integer(js, sjson_index(js, params, 1), &n2size) ||
+        !stratum_set_extranonce(pool, &nonce1, n2size))
+      return -1;
+    return 1;
+  }
+
+  return -1;
+}
+
 bool parse_method(struct pool *pool, char *s)
+{
+  struct sjson js;
+
+  return parse_method_json(pool, s, s && sjson_parse(&js, s) ? &js : NULL);
+}
+
+bool parse_method_json(struct pool *pool, char *s, const struct sjson *js)
 {
   json_t *val = NULL, *method, *err_val = NULL, *params;
   json_t *id;
@@ -2139,6 +2283,13 @@ bool parse_method(struct pool *pool, char *s)
     return ret;
   }
 
+  if (js) {
+    int fast = parse_method_fast(pool, js);
+
+    if (fast >= 0)
+      return fast;
+  }
+
   if (!(val = JSON_LOADS(s, &err))) {
     applog(LOG_INFO, "JSON decode failed(%d): %s", err.line, err.text);
     return ret;
@@ -2180,6 +2331,8 @@ bool parse_method(struct pool *pool, char *s)
       ret = parse_notify(pool, params);
 
     pool->stratum_notify = ret;
+    if (ret)
+      pool->last_notify = time(NULL);
     goto done;
   }
 
@@ -2225,7 +2378,7 @@ bool subscribe_extranonce(struct pool *pool)
   json_error_t err;
   bool ret = false;
 
-  sprintf(s, "{\"id\": %d, \"method\": \"mining.extranonce.subscribe\", \"params\": []}", swork_id++);
+  sprintf(s, "{\"id\": %d, \"method\": \"mining.extranonce.subscribe\", \"params\": []}", atomic_fetch_inc(&swork_id));
 
   if (!stratum_send(pool, s, strlen(s))) {
     return ret;
@@ -2300,7 +2453,7 @@ bool auth_stratum(struct pool *pool)
   bool ret = false;
 
   sprintf(s, "{\"id\": %d, \"method\": \"mining.authorize\", \"params\": [\"%s\", \"%s\"]}",
-    swork_id++, pool->rpc_user, pool->rpc_pass);
+    atomic_fetch_inc(&swork_id), pool->rpc_user, pool->rpc_pass);
 
   if (!stratum_send(pool, s, strlen(s))) {
     return ret;
@@ -2784,9 +2937,11 @@ bool initiate_stratum(struct pool *pool)
   char s[RBUFSIZE], *sret = NULL, *nonce1, *sessionid;
   json_t *val = NULL, *res_val, *err_val;
   json_error_t err;
+  struct timeval tv_start, tv_reply;
   int n2size;
 
 resend:
+  cgtime(&tv_start);
   if (!setup_stratum_socket(pool)) {
     /* FIXME: change to LOG_DEBUG when issue #88 resolved */
     applog(LOG_INFO, "setup_stratum_socket() on %s failed", get_pool_name(pool));
@@ -2799,12 +2954,12 @@ resend:
   if (recvd) {
     /* Get rid of any crap lying around if we're resending */
     clear_sock(pool);
-    sprintf(s, "{\"id\": %d, \"method\": \"mining.subscribe\", \"params\": []}", swork_id++);
+    sprintf(s, "{\"id\": %d, \"method\": \"mining.subscribe\", \"params\": []}", atomic_fetch_inc(&swork_id));
   } else {
     if (pool->sessionid)
-      sprintf(s, "{\"id\": %d, \"method\": \"mining.subscribe\", \"params\": [\"" PACKAGE "/" CGMINER_VERSION "\", \"%s\"]}", swork_id++, pool->sessionid);
+      sprintf(s, "{\"id\": %d, \"method\": \"mining.subscribe\", \"params\": [\"" PACKAGE "/" CGMINER_VERSION "\", \"%s\"]}", atomic_fetch_inc(&swork_id), pool->sessionid);
     else
-      sprintf(s, "{\"id\": %d, \"method\": \"mining.subscribe\", \"params\": [\"" PACKAGE "/" CGMINER_VERSION "\"]}", swork_id++);
+      sprintf(s, "{\"id\": %d, \"method\": \"mining.subscribe\", \"params\": [\"" PACKAGE "/" CGMINER_VERSION "\"]}", atomic_fetch_inc(&swork_id));
   }
 
   if (__stratum_send(pool, s, strlen(s)) != SEND_OK) {
@@ -2822,6 +2977,9 @@ resend:
     goto out;
 
   recvd = true;
+  /* Connect plus one round trip, what a failover to this pool costs */
+  cgtime(&tv_reply);
+  pool->cnx_latency = tdiff(&tv_reply, &tv_start);
 
   val = JSON_LOADS(sret, &err);
   //free(sret);
@@ -135,6 +135,10 @@ bool stratum_send(struct pool *pool, char *s, ssize_t len);
 bool sock_full(struct pool *pool);
 char *recv_line(struct pool *pool);
 bool parse_method(struct pool *pool, char *s);
+/* parse_method() of s already tokenized into js, or with a NULL js of s as
+ * jansson parses it */
+struct sjson;
+bool parse_method_json(struct pool *pool, char *s, const struct sjson *js);
 bool extract_sockaddr(char *url, char **sockaddr_url, char **sockaddr_port);
 bool auth_stratum(struct pool *pool);
 bool subscribe_extranonce(struct pool *pool);